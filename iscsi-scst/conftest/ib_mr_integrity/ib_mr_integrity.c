@@ -0,0 +1,15 @@
+#include <linux/module.h>
+#include <rdma/ib_verbs.h>
+
+static int __init modinit(void)
+{
+	struct ib_reg_wr wr = { .wr.opcode = IB_WR_REG_MR_INTEGRITY };
+	struct ib_mr *mr = ib_alloc_mr_integrity(NULL, 1, 1);
+
+	return IS_ERR(mr) + ib_map_mr_sg_pi(wr.mr, NULL, 0, NULL, NULL, 0,
+					    NULL, PAGE_SIZE);
+}
+
+module_init(modinit);
+
+MODULE_LICENSE("GPL");
@@ -0,0 +1,13 @@
+#include <linux/module.h>
+#include <rdma/ib_verbs.h>
+
+static int __init modinit(void)
+{
+	struct ib_device_attr attr = { };
+
+	return !!(attr.kernel_cap_flags & IBK_INTEGRITY_HANDOVER);
+}
+
+module_init(modinit);
+
+MODULE_LICENSE("GPL");
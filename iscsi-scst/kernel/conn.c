@@ -208,6 +208,53 @@ static ssize_t iscsi_conn_state_show(struct kobject *kobj,
 static struct kobj_attribute iscsi_conn_state_attr =
 	__ATTR(state, S_IRUGO, iscsi_conn_state_show, NULL);
 
+static ssize_t iscsi_conn_rx_stats_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	int pos;
+	struct iscsi_conn *conn;
+
+	TRACE_ENTRY();
+
+	conn = container_of(kobj, struct iscsi_conn, conn_kobj);
+
+	pos = sprintf(buf, "pdus %llu\nrecvmsg_calls %llu\nbusy_polls %llu\n"
+		"early_cmds %llu\nearly_bufs %llu\n",
+		(unsigned long long)READ_ONCE(conn->rx_pdus),
+		(unsigned long long)READ_ONCE(conn->rx_recvmsg_calls),
+		(unsigned long long)READ_ONCE(conn->rx_busy_polls),
+		(unsigned long long)READ_ONCE(conn->rx_early_cmds),
+		(unsigned long long)READ_ONCE(conn->rx_early_bufs));
+
+	TRACE_EXIT_RES(pos);
+	return pos;
+}
+
+static struct kobj_attribute iscsi_conn_rx_stats_attr =
+	__ATTR(rx_stats, S_IRUGO, iscsi_conn_rx_stats_show, NULL);
+
+static ssize_t iscsi_conn_tx_stats_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	int pos;
+	struct iscsi_conn *conn;
+
+	TRACE_ENTRY();
+
+	conn = container_of(kobj, struct iscsi_conn, conn_kobj);
+
+	pos = sprintf(buf, "pdus %llu\nsend_calls %llu\nbatches %llu\n",
+		(unsigned long long)READ_ONCE(conn->tx_pdus),
+		(unsigned long long)READ_ONCE(conn->tx_send_calls),
+		(unsigned long long)READ_ONCE(conn->tx_batches));
+
+	TRACE_EXIT_RES(pos);
+	return pos;
+}
+
+static struct kobj_attribute iscsi_conn_tx_stats_attr =
+	__ATTR(tx_stats, S_IRUGO, iscsi_conn_tx_stats_show, NULL);
+
 static void conn_sysfs_del(struct iscsi_conn *conn)
 {
 	DECLARE_COMPLETION_ONSTACK(c);
@@ -274,6 +321,22 @@ restart:
 		goto out_err;
 	}
 
+	res = sysfs_create_file(&conn->conn_kobj,
+			&iscsi_conn_rx_stats_attr.attr);
+	if (res != 0) {
+		PRINT_ERROR("Unable create sysfs attribute %s for conn %s",
+			iscsi_conn_rx_stats_attr.attr.name, addr);
+		goto out_err;
+	}
+
+	res = sysfs_create_file(&conn->conn_kobj,
+			&iscsi_conn_tx_stats_attr.attr);
+	if (res != 0) {
+		PRINT_ERROR("Unable create sysfs attribute %s for conn %s",
+			iscsi_conn_tx_stats_attr.attr.name, addr);
+		goto out_err;
+	}
+
 	res = sysfs_create_file(&conn->conn_kobj,
 			&iscsi_conn_cid_attr.attr);
 	if (res != 0) {
@@ -768,6 +831,13 @@ static int conn_setup_sock(struct iscsi_conn *conn)
 				    KERNEL_SOCKPTR(&opt), sizeof(opt));
 	set_fs(oldfs);
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	/* Same as SO_BUSY_POLL, see do_recv() */
+	if (conn->target->rx_busy_poll_us != 0)
+		WRITE_ONCE(conn->sock->sk->sk_ll_usec,
+			   conn->target->rx_busy_poll_us);
+#endif
+
 out:
 	return res;
 }
@@ -779,6 +849,9 @@ void iscsi_tcp_conn_free(struct iscsi_conn *conn)
 	conn->sock = NULL;
 
 	free_page((unsigned long)conn->read_iov);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)
+	kfree(conn->rx_buf);
+#endif
 
 	kmem_cache_free(iscsi_conn_cache, conn);
 }
@@ -915,6 +988,14 @@ int iscsi_conn_alloc(struct iscsi_session *session,
 		goto out_err_free_conn;
 	}
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)
+	conn->rx_buf = kmalloc(ISCSI_RX_BUF_SIZE, GFP_KERNEL);
+	if (conn->rx_buf == NULL) {
+		res = -ENOMEM;
+		goto out_free_iov;
+	}
+#endif
+
 	res = iscsi_init_conn(session, info, conn);
 	if (res != 0)
 		goto out_free_iov;
@@ -940,6 +1021,9 @@ out_fput:
 	fput(conn->file);
 
 out_free_iov:
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)
+	kfree(conn->rx_buf);
+#endif
 	free_page((unsigned long)conn->read_iov);
 
 out_err_free_conn:
@@ -969,10 +1053,18 @@ int __add_conn(struct iscsi_session *session, struct iscsi_kern_conn_info *info)
 		goto out;
 	}
 
-	if (session->sess_params.rdma_extensions)
+	if (session->sess_params.rdma_extensions) {
 		t = iscsit_get_transport(ISCSI_RDMA);
-	else
+	} else if (unlikely(session->target->t10_pi)) {
+		PRINT_ERROR("Target %s has T10-PI enabled, which requires iSER, "
+			"rejecting TCP connection from %s",
+			session->target->name,
+			session->scst_sess->initiator_name);
+		err = -EOPNOTSUPP;
+		goto out;
+	} else {
 		t = iscsit_get_transport(ISCSI_TCP);
+	}
 	if (!t) {
 		err = -ENOENT;
 		goto out;
@@ -56,12 +56,15 @@ struct kmem_cache *iscsi_sess_cache;
 static struct page *dummy_page;
 static struct scatterlist dummy_sg[1];
 
+static struct sgv_pool *iscsi_early_sgv_pool;
+
 static void cmnd_remove_data_wait_hash(struct iscsi_cmnd *cmnd);
 static void iscsi_send_task_mgmt_resp(struct iscsi_cmnd *req, int status,
 	bool dropped);
 static void iscsi_check_send_delayed_tm_resp(struct iscsi_session *sess);
 static void req_cmnd_release(struct iscsi_cmnd *req);
 static int cmnd_insert_data_wait_hash(struct iscsi_cmnd *cmnd);
+static void iscsi_early_buf_free(struct iscsi_cmnd *req);
 static void iscsi_cmnd_init_write(struct iscsi_cmnd *rsp, int flags);
 static void iscsi_set_resid_no_scst_cmd(struct iscsi_cmnd *rsp);
 
@@ -152,7 +155,8 @@ static inline int cmnd_read_size(struct iscsi_cmnd *cmnd)
 	return 0;
 }
 
-void iscsi_restart_cmnd(struct iscsi_cmnd *cmnd)
+static void __iscsi_restart_cmnd(struct iscsi_cmnd *cmnd,
+	enum scst_exec_context context)
 {
 	int status;
 
@@ -225,13 +229,18 @@ unlock_cont:
 
 	cmnd->scst_state = ISCSI_CMD_STATE_RESTARTED;
 
-	scst_restart_cmd(cmnd->scst_cmd, status, SCST_CONTEXT_THREAD);
+	scst_restart_cmd(cmnd->scst_cmd, status, context);
 
 out:
 	TRACE_EXIT();
 	return;
 }
 
+void iscsi_restart_cmnd(struct iscsi_cmnd *cmnd)
+{
+	__iscsi_restart_cmnd(cmnd, SCST_CONTEXT_THREAD);
+}
+
 static struct iscsi_cmnd *iscsi_create_tm_clone(struct iscsi_cmnd *cmnd)
 {
 	struct iscsi_cmnd *tm_clone;
@@ -445,6 +454,13 @@ void cmnd_done(struct iscsi_cmnd *cmnd)
 
 		/* Order between above and below code is important! */
 
+		/* The device can go away after scst_tgt_cmd_done() */
+		if (cmnd->early_mem_lim != NULL) {
+			scst_mem_lim_uncharge(cmnd->early_mem_lim,
+				cmnd->early_sg_cnt);
+			cmnd->early_mem_lim = NULL;
+		}
+
 		if ((cmnd->scst_cmd != NULL) || (cmnd->scst_aen != NULL)) {
 			/*
 			 * Tell Coverity when cmnd->scst_cmd or scst_aen is set.
@@ -508,6 +524,9 @@ void cmnd_done(struct iscsi_cmnd *cmnd)
 #endif
 		}
 
+		if (cmnd->early_sgv != NULL)
+			iscsi_early_buf_free(cmnd);
+
 		if (unlikely(cmnd->dec_active_cmds))
 			iscsi_dec_active_cmds(cmnd);
 
@@ -1027,7 +1046,7 @@ static void iscsi_tcp_set_sense_data(struct iscsi_cmnd *rsp,
 	sg_set_buf(&sg[1], (u8 *)sense_buf, sense_len);
 }
 
-static void iscsi_init_status_rsp(struct iscsi_cmnd *rsp,
+void iscsi_init_status_rsp(struct iscsi_cmnd *rsp,
 	int status, const u8 *sense_buf, int sense_len)
 {
 	struct iscsi_cmnd *req = rsp->parent_req;
@@ -1060,6 +1079,7 @@ static void iscsi_init_status_rsp(struct iscsi_cmnd *rsp,
 	TRACE_EXIT();
 	return;
 }
+EXPORT_SYMBOL(iscsi_init_status_rsp);
 
 struct iscsi_cmnd *create_status_rsp(struct iscsi_cmnd *req,
 	int status, const u8 *sense_buf, int sense_len)
@@ -1940,6 +1960,7 @@ int cmnd_rx_continue(struct iscsi_cmnd *req)
 	struct iscsi_scsi_cmd_hdr *req_hdr = cmnd_hdr(req);
 	struct scst_cmd *scst_cmd = req->scst_cmd;
 	scst_data_direction dir;
+	bool early_rx = req->early_rx;
 	int res = 0;
 
 	TRACE_ENTRY();
@@ -1950,6 +1971,9 @@ int cmnd_rx_continue(struct iscsi_cmnd *req)
 
 	dir = scst_cmd_get_data_direction(scst_cmd);
 
+	/* If set, the immediate data have already been received */
+	req->early_rx = 0;
+
 	/*
 	 * Check for preliminary completion here to save R2Ts. For TASK QUEUE
 	 * FULL statuses that might be a big performance win.
@@ -1960,7 +1984,7 @@ int cmnd_rx_continue(struct iscsi_cmnd *req)
 		 * If necessary, ISCSI_CMD_ABORTED will be set by
 		 * iscsi_xmit_response().
 		 */
-		res = iscsi_preliminary_complete(req, req, true);
+		res = iscsi_preliminary_complete(req, req, !early_rx);
 		goto trace;
 	}
 
@@ -1978,9 +2002,13 @@ int cmnd_rx_continue(struct iscsi_cmnd *req)
 			goto out_close;
 		}
 
+		if (req->early_sgv != NULL)
+			iscsi_early_buf_settle(req, early_rx);
+
 		if (req->pdu.datasize) {
-			res = cmnd_prepare_recv_pdu(conn, req, 0,
-						    req->pdu.datasize);
+			if (!early_rx)
+				res = cmnd_prepare_recv_pdu(conn, req, 0,
+							    req->pdu.datasize);
 			/* For performance better to send R2Ts ASAP */
 			if (likely(res == 0) && (req->r2t_len_to_send != 0))
 				send_r2t(req);
@@ -2014,6 +2042,139 @@ out_close:
 	goto out;
 }
 
+/*
+ * For WRITEs carrying all their data as immediate data allocates the data
+ * buffer already now, on the command PDU receive. If SCST preprocessing of
+ * the command goes to another thread, it allows to receive the data without
+ * stalling the connection until preprocessing finished. Then the buffer is
+ * offered to SCST via tgt_alloc_data_buf(), so in the common case the data
+ * are received in a single copy directly into the command's buffer.
+ */
+static void iscsi_early_buf_alloc(struct iscsi_cmnd *req)
+{
+	struct iscsi_conn *conn = req->conn;
+	struct iscsi_session *session = conn->session;
+	struct iscsi_scsi_cmd_hdr *req_hdr = cmnd_hdr(req);
+	unsigned int size = req->pdu.datasize;
+	int cnt;
+
+	TRACE_ENTRY();
+
+	if ((size == 0) ||
+	    (size > READ_ONCE(conn->target->early_write_buf_size)) ||
+	    (size != be32_to_cpu(req_hdr->data_length)) ||
+	    !(req_hdr->flags & ISCSI_CMD_FINAL))
+		goto out;
+
+	/*
+	 * Negotiated parameters violations are left for
+	 * iscsi_cmnd_set_write_buf(). Data digest of the early received data
+	 * can't be checked before SCST set the command's status, so data
+	 * digests aren't supported.
+	 */
+	if ((conn->transport->transport_type != ISCSI_TCP) ||
+	    !session->sess_params.immediate_data ||
+	    (size > session->sess_params.first_burst_length) ||
+	    ((conn->ddigest_type & DIGEST_NONE) == 0))
+		goto out;
+
+	/*
+	 * The device isn't known yet, so only the global limit is checked
+	 * here. The device's limit is charged, when SCST takes the buffer in
+	 * iscsi_alloc_data_buf().
+	 */
+	req->early_sg = sgv_pool_alloc(iscsi_early_sgv_pool, size, GFP_KERNEL,
+		0, &cnt, &req->early_sgv, NULL, NULL);
+	if (unlikely(req->early_sg == NULL)) {
+		TRACE(TRACE_OUT_OF_MEM, "Unable to allocate early buffer "
+			"(size %d, req %p)", size, req);
+		goto out;
+	}
+
+	req->early_sg_cnt = cnt;
+	req->early_bufflen = size;
+	scst_cmd_set_tgt_need_alloc_data_buf(req->scst_cmd);
+
+	TRACE_DBG("Allocated early buffer for req %p (size %d, sg_cnt %d)",
+		req, size, cnt);
+
+out:
+	TRACE_EXIT();
+	return;
+}
+
+static void iscsi_early_buf_free(struct iscsi_cmnd *req)
+{
+	TRACE_DBG("Freeing early buffer of req %p", req);
+
+	sgv_pool_free(req->early_sgv, NULL);
+	req->early_sgv = NULL;
+	req->early_sg = NULL;
+	req->early_sg_cnt = 0;
+	req->early_bufflen = 0;
+}
+
+/* Copies the early received immediate data into req's SCST buffer */
+static void iscsi_early_buf_copy(struct iscsi_cmnd *req)
+{
+	struct scatterlist *dst = req->sg, *src = req->early_sg;
+	unsigned int dst_off = 0, src_off = 0, d, s, n;
+	unsigned int len = min(req->bufflen, req->pdu.datasize);
+	void *daddr, *saddr;
+
+	while (len > 0) {
+		/* Pages can be in highmem, so copy page by page */
+		d = dst->offset + dst_off;
+		s = src->offset + src_off;
+		n = min3(dst->length - dst_off, src->length - src_off, len);
+		n = min3(n, (unsigned int)(PAGE_SIZE - offset_in_page(d)),
+			 (unsigned int)(PAGE_SIZE - offset_in_page(s)));
+
+		daddr = kmap_local_page(sg_page(dst) + (d >> PAGE_SHIFT));
+		saddr = kmap_local_page(sg_page(src) + (s >> PAGE_SHIFT));
+		memcpy(daddr + offset_in_page(d), saddr + offset_in_page(s), n);
+		kunmap_local(saddr);
+		kunmap_local(daddr);
+
+		len -= n;
+		dst_off += n;
+		src_off += n;
+		if (dst_off == dst->length) {
+			dst = sg_next(dst);
+			dst_off = 0;
+		}
+		if (src_off == src->length) {
+			src = sg_next(src);
+			src_off = 0;
+		}
+	}
+}
+
+/*
+ * Called after the SCST write buffer was set up in req->sg. If SCST didn't
+ * take the early buffer, the early received data, if any, are copied and
+ * the early buffer freed.
+ */
+static void iscsi_early_buf_settle(struct iscsi_cmnd *req, bool received)
+{
+	if (likely(req->sg == req->early_sg)) {
+		req->conn->rx_early_bufs++;
+		goto out;
+	}
+
+	TRACE_MEM("SCST didn't take early buffer of req %p (bufflen %d, "
+		"early_bufflen %d, received %d)", req, req->bufflen,
+		req->early_bufflen, received);
+
+	if (received)
+		iscsi_early_buf_copy(req);
+
+	iscsi_early_buf_free(req);
+
+out:
+	return;
+}
+
 static int scsi_cmnd_start(struct iscsi_cmnd *req)
 {
 	struct iscsi_conn *conn = req->conn;
@@ -2074,6 +2235,7 @@ static int scsi_cmnd_start(struct iscsi_cmnd *req)
 		dir = SCST_DATA_WRITE;
 		scst_cmd_set_expected(scst_cmd, dir,
 			be32_to_cpu(req_hdr->data_length));
+		iscsi_early_buf_alloc(req);
 	} else {
 		dir = SCST_DATA_NONE;
 		scst_cmd_set_expected(scst_cmd, dir, 0);
@@ -2140,7 +2302,21 @@ static int scsi_cmnd_start(struct iscsi_cmnd *req)
 
 	if (req->scst_state != ISCSI_CMD_STATE_RX_CMD)
 		res = req->conn->transport->iscsit_receive_cmnd_data(req);
-	else {
+	else if (req->early_sgv != NULL) {
+		/*
+		 * Don't stall the connection until preprocessing finished,
+		 * receive the data in the early buffer. The rest is done by
+		 * cmnd_rx_continue() on RX_END.
+		 */
+		TRACE_DBG("Early receiving req %p data (size %d)", req,
+			req->pdu.datasize);
+		req->early_rx = 1;
+		req->sg = req->early_sg;
+		req->sg_cnt = req->early_sg_cnt;
+		req->bufflen = req->early_bufflen;
+		conn->rx_early_cmds++;
+		res = cmnd_prepare_recv_pdu(conn, req, 0, req->pdu.datasize);
+	} else {
 		TRACE_DBG("Delaying req %p post processing (scst_state %d)",
 			req, req->scst_state);
 		res = 1;
@@ -2840,8 +3016,14 @@ static void iscsi_cmnd_exec(struct iscsi_cmnd *cmnd)
 	iscsi_extracheck_is_rd_thread(cmnd->conn);
 
 	if (cmnd_opcode(cmnd) == ISCSI_OP_SCSI_CMD) {
+		/*
+		 * Small WRITEs in the early buffer are executed directly in
+		 * this thread, so, together with iscsi_try_local_processing(),
+		 * they are completed without any context switch.
+		 */
 		if (cmnd->r2t_len_to_receive == 0)
-			iscsi_restart_cmnd(cmnd);
+			__iscsi_restart_cmnd(cmnd, (cmnd->early_sgv != NULL) ?
+				SCST_CONTEXT_DIRECT : SCST_CONTEXT_THREAD);
 		else if (cmnd->r2t_len_to_send != 0)
 			send_r2t(cmnd);
 		goto out;
@@ -2897,7 +3079,11 @@ void cmnd_tx_start(struct iscsi_cmnd *cmnd)
 
 	iscsi_extracheck_is_wr_thread(conn);
 
-	set_cork(conn->sock, 1);
+	/* Uncorked by iscsi_tx_flush() after the last PDU of the batch */
+	if (!conn->tx_corked) {
+		set_cork(conn->sock, 1);
+		conn->tx_corked = 1;
+	}
 
 	conn->write_iop = conn->write_iov;
 	conn->write_iop->iov_base = &cmnd->pdu.bhs;
@@ -3005,7 +3191,15 @@ void cmnd_tx_end(struct iscsi_cmnd *cmnd)
 		}
 	}
 
-	set_cork(cmnd->conn->sock, 0);
+	return;
+}
+
+void iscsi_tx_uncork(struct iscsi_conn *conn)
+{
+	iscsi_extracheck_is_wr_thread(conn);
+
+	set_cork(conn->sock, 0);
+	conn->tx_corked = 0;
 	return;
 }
 
@@ -3290,6 +3484,32 @@ static ssize_t iscsi_tcp_get_initiator_ip(struct iscsi_conn *conn,
 
 static int iscsi_alloc_data_buf(struct scst_cmd *cmd)
 {
+	struct iscsi_cmnd *req = scst_cmd_get_tgt_priv(cmd);
+
+	if (scst_cmd_get_data_direction(cmd) == SCST_DATA_WRITE) {
+		/*
+		 * WRITEs get here for the early buffer, see
+		 * iscsi_early_buf_alloc(). If it doesn't fit, let SCST allocate
+		 * the buffer, the already received data will be copied in
+		 * cmnd_rx_continue().
+		 */
+		if ((req->early_sgv == NULL) ||
+		    (scst_cmd_get_bufflen(cmd) != req->early_bufflen) ||
+		    scst_cmd_get_dh_data_buff_alloced(cmd) ||
+		    (cmd->dev->dev_dif_mode != SCST_DIF_MODE_NONE))
+			return 1;
+		/*
+		 * Account the buffer as if SCST allocated it. The early SGV
+		 * pool doesn't cluster, so there is one page per SG entry.
+		 */
+		if (!scst_mem_lim_charge(&cmd->dev->dev_mem_lim,
+					 req->early_sg_cnt))
+			return 1;
+		req->early_mem_lim = &cmd->dev->dev_mem_lim;
+		scst_cmd_set_tgt_sg(cmd, req->early_sg, req->early_sg_cnt);
+		return 0;
+	}
+
 	/*
 	 * sock->ops->sendpage() is async zero copy operation,
 	 * so we must be sure not to free and reuse
@@ -3376,6 +3596,7 @@ static void iscsi_try_local_processing(struct iscsi_cmnd *req)
 			if (rc <= 0)
 				break;
 		} while (req->not_processed_rsp_cnt != 0);
+		iscsi_tx_flush(conn);
 
 		spin_lock_bh(&p->wr_lock);
 #ifdef CONFIG_SCST_EXTRACHECKS
@@ -4333,6 +4554,13 @@ static int __init iscsi_init(void)
 
 	iscsi_conn_ktype.sysfs_ops = scst_sysfs_get_sysfs_ops();
 
+	iscsi_early_sgv_pool = sgv_pool_create("iscsi-early", sgv_no_clustering,
+		0, false, 0);
+	if (iscsi_early_sgv_pool == NULL) {
+		err = -ENOMEM;
+		goto out_unreg_tgt;
+	}
+
 	err = iscsi_threads_pool_get(false, NULL, &iscsi_main_thread_pool);
 	if (err != 0)
 		goto out_thr;
@@ -4341,7 +4569,9 @@ out:
 	return err;
 
 out_thr:
+	sgv_pool_del(iscsi_early_sgv_pool);
 
+out_unreg_tgt:
 	scst_unregister_target_template(&iscsi_template);
 
 out_kmem:
@@ -4387,6 +4617,8 @@ static void __exit iscsi_exit(void)
 
 	scst_unregister_target_template(&iscsi_template);
 
+	sgv_pool_del(iscsi_early_sgv_pool);
+
 	iscsit_unreg_transport(&iscsi_tcp_transport);
 
 	mempool_destroy(iscsi_cmnd_abort_mempool);
@@ -123,12 +123,38 @@ struct iscsi_target {
 
 	unsigned int tgt_enabled:1;
 
+	/*
+	 * Set if T10-PI is offloaded to the transport. Protected by
+	 * target_mutex, can be changed only without sessions. While set,
+	 * the SCST sg_tablesize of the target is ISCSI_T10_PI_MAX_PAGES.
+	 */
+	unsigned int t10_pi:1;
+
+	/*
+	 * SO_BUSY_POLL value in us for new connections, 0 - disabled.
+	 * Protected by target_mutex.
+	 */
+	unsigned int rx_busy_poll_us;
+
+	/*
+	 * Max size of WRITEs with all data immediate, for which the data
+	 * buffer is allocated already on the command PDU receive, 0 -
+	 * disabled. Protected by target_mutex.
+	 */
+	unsigned int early_write_buf_size;
+
 	/* Protected by target_mutex */
 	struct list_head attrs_list;
 
 	char name[ISCSI_NAME_LEN];
 };
 
+/*
+ * Max number of data pages of a T10-PI command. The transport maps each
+ * such command into a single signature MR, which has a limited page list.
+ */
+#define ISCSI_T10_PI_MAX_PAGES	256
+
 #define ISCSI_HASH_ORDER	8
 #define	cmnd_hashfn(itt)	hash_32(itt, ISCSI_HASH_ORDER)
 
@@ -182,6 +208,20 @@ struct iscsi_session {
 
 #define ISCSI_CONN_IOV_MAX			(PAGE_SIZE/sizeof(struct kvec))
 
+/* Size of the per connection receive buffer */
+#define ISCSI_RX_BUF_SIZE			(16*1024)
+/* Reads of at least this size bypass the receive buffer */
+#define ISCSI_RX_DIRECT_SIZE			(ISCSI_RX_BUF_SIZE/2)
+/* Max PDUs parsed from the receive buffer in a row */
+#define ISCSI_RX_MAX_BATCH			16
+
+/* Limits of PDUs sent in one corked batch, see iscsi_send_batch() */
+#define ISCSI_TX_MAX_BATCH			32
+#define ISCSI_TX_MAX_BATCH_SIZE			(256*1024)
+
+/* Max value of the early_write_buf_size target attribute */
+#define ISCSI_EARLY_WRITE_BUF_MAX_SIZE		(256*1024)
+
 #define ISCSI_CONN_RD_STATE_IDLE		0
 #define ISCSI_CONN_RD_STATE_IN_LIST		1
 #define ISCSI_CONN_RD_STATE_PROCESSING		2
@@ -246,6 +286,17 @@ struct iscsi_conn {
 	u32 write_offset;
 	int write_state;
 
+	/* Set, if TCP_CORK is set on the socket */
+	unsigned int tx_corked:1;
+	/* Size of the current batch, see iscsi_send_batch() */
+	int tx_batch_pdus;
+	int tx_batch_bytes;
+
+	/* Transmit statistics */
+	u64 tx_pdus;
+	u64 tx_send_calls;
+	u64 tx_batches;
+
 	/* Both don't need any protection */
 	struct file *file;
 	struct socket *sock;
@@ -297,6 +348,25 @@ struct iscsi_conn {
 	struct task_struct *rx_task;
 	uint32_t rpadding;
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)
+	/*
+	 * Receive buffer. Reads smaller than ISCSI_RX_DIRECT_SIZE, like BHS,
+	 * digests and small data, are served from it, so a single
+	 * sock_recvmsg() can bring in several PDUs. Unprotected, since
+	 * accessed only from a single read thread.
+	 */
+	u8 *rx_buf;
+	unsigned int rx_buf_off;
+	unsigned int rx_buf_len;
+#endif
+
+	/* Receive statistics, updated only from a single read thread */
+	u64 rx_pdus;
+	u64 rx_recvmsg_calls;
+	u64 rx_busy_polls;
+	u64 rx_early_cmds;
+	u64 rx_early_bufs;
+
 	struct iscsi_target *target;
 
 	struct list_head conn_list_entry; /* list entry in session conn_list */
@@ -384,6 +454,8 @@ struct iscsi_cmnd {
 	unsigned int force_cleanup_done:1;
 	unsigned int dec_active_cmds:1;
 	unsigned int ddigest_checked:1;
+	/* Immediate data received before preprocessing finished */
+	unsigned int early_rx:1;
 	/*
 	 * Used to prevent release of original req while its related DATA OUT
 	 * cmd is receiving data, i.e. stays between data_out_start() and
@@ -474,6 +546,14 @@ struct iscsi_cmnd {
 
 			struct iscsi_cmnd *main_rsp;
 
+			/* See iscsi_early_buf_alloc() */
+			struct sgv_pool_obj *early_sgv;
+			struct scatterlist *early_sg;
+			int early_sg_cnt;
+			unsigned int early_bufflen;
+			/* Charged by early_sg_cnt pages, if SCST took it */
+			struct scst_mem_lim *early_mem_lim;
+
 			/*
 			 * Protected on modify by conn->write_list_lock, hence
 			 * modified independently to the above field, hence the
@@ -537,6 +617,7 @@ extern int cmnd_rx_continue(struct iscsi_cmnd *req);
 extern void cmnd_rx_end(struct iscsi_cmnd *cmnd);
 extern void cmnd_tx_start(struct iscsi_cmnd *cmnd);
 extern void cmnd_tx_end(struct iscsi_cmnd *cmnd);
+extern void iscsi_tx_uncork(struct iscsi_conn *conn);
 extern void req_cmnd_release_force(struct iscsi_cmnd *req);
 extern void rsp_cmnd_release(struct iscsi_cmnd *cmnd);
 extern void iscsi_drop_delayed_tm_rsp(struct iscsi_cmnd *tm_rsp);
@@ -574,6 +655,8 @@ extern void __iscsi_write_space_ready(struct iscsi_conn *conn);
 
 /* nthread.c */
 extern int iscsi_send(struct iscsi_conn *conn);
+extern int iscsi_send_batch(struct iscsi_conn *conn);
+extern void iscsi_tx_flush(struct iscsi_conn *conn);
 extern int istrd(void *arg);
 extern int istwr(void *arg);
 extern void iscsi_task_mgmt_affected_cmds_done(struct scst_mgmt_cmd *scst_mcmd);
@@ -841,5 +924,7 @@ extern int iscsi_init_conn(struct iscsi_session *session,
 extern void req_cmnd_pre_release(struct iscsi_cmnd *req);
 extern struct iscsi_cmnd *create_status_rsp(struct iscsi_cmnd *req,
 	int status, const u8 *sense_buf, int sense_len);
+extern void iscsi_init_status_rsp(struct iscsi_cmnd *rsp,
+	int status, const u8 *sense_buf, int sense_len);
 extern int iscsi_cmnd_set_write_buf(struct iscsi_cmnd *req);
 #endif	/* __ISCSI_H__ */
@@ -87,6 +87,8 @@ enum isert_wr_op {
 	ISER_WR_SEND,
 	ISER_WR_RDMA_WRITE,
 	ISER_WR_RDMA_READ,
+	ISER_WR_LOCAL_INV,
+	ISER_WR_REG_MR,
 };
 
 struct isert_device;
@@ -108,15 +110,46 @@ struct isert_wr {
 		struct ib_send_wr send_wr;
 #else
 		struct ib_rdma_wr send_wr;
+#endif
+#ifdef HAVE_IB_MAP_MR_SG
+		struct ib_reg_wr fr_wr;
 #endif
 	};
 } ____cacheline_aligned;
 
+/*
+ * Fast registration descriptor. Lets an arbitrarily fragmented data buffer
+ * be transferred by a single RDMA READ or RDMA WRITE work request. Signature
+ * descriptors additionally make the HCA insert, check or strip T10-PI on
+ * the fly.
+ */
+struct isert_fr_desc {
+	/* in isert_conn->fr_pool or, for signature MRs, in ->sig_pool */
+	struct list_head	fr_node;
+	struct ib_mr		*mr;
+	struct ib_sge		sge;
+	struct isert_wr		inv_wr;
+	struct isert_wr		reg_wr;
+	/* Head of the registration WR chain, either inv_wr or reg_wr */
+	struct isert_wr		*first_wr;
+	/* DMA mapped PI buffer of the current transfer, if any */
+	struct scatterlist	*pi_sg;
+	int			pi_sg_cnt;
+	enum dma_data_direction	pi_dma_dir;
+	/* Set if the MR key has not been used since it was last updated */
+	unsigned int		key_valid:1;
+	/* Set for integrity (T10-PI signature) MRs */
+	unsigned int		sig:1;
+};
+
 #define ISER_SQ_SIZE		128
 #define ISER_MAX_WCE		2048
 
 #define ISER_MIN_SQ_SIZE	16
 
+/* Max number of pages a fast registration MR can map (1 MB with 4K pages) */
+#define ISER_FR_MAX_PAGES	256
+
 struct isert_cmnd {
 	struct iscsi_cmnd	iscsi ____cacheline_aligned;
 
@@ -126,6 +159,13 @@ struct isert_cmnd {
 	struct ib_sge		*sg_pool;
 	int			n_wr;
 	int			n_sge;
+	/* Fast registration descriptor used by the current RDMA, if any */
+	struct isert_fr_desc	*fr_desc;
+	/*
+	 * Response of a T10-PI READ, sent only after the HCA has verified
+	 * the data it transferred.
+	 */
+	struct isert_cmnd	*pi_rsp;
 
 	struct isert_hdr	*isert_hdr ____cacheline_aligned;
 	struct iscsi_hdr	*bhs;
@@ -188,6 +228,19 @@ struct isert_conn {
 	struct list_head	tx_free_list;
 	struct list_head	tx_busy_list;
 
+	spinlock_t		fr_pool_lock;
+
+	/* Following protected by fr_pool_lock */
+	struct list_head	fr_pool;
+	int			fr_pool_size;
+	unsigned long		fr_reg_cnt;
+	unsigned long		fr_pool_empty_cnt;
+	unsigned long		fr_map_fail_cnt;
+	struct list_head	sig_pool;
+	int			sig_pool_size;
+	unsigned long		sig_reg_cnt;
+	unsigned long		sig_err_cnt;
+
 	struct rdma_cm_id	*cm_id;
 	struct isert_device	*isert_dev;
 	struct ib_qp		*qp;
@@ -245,6 +298,10 @@ struct isert_device {
 	struct ib_mr		*mr;
 #endif
 	u32			lkey;
+	/* Max pages per fast registration MR, 0 if not supported */
+	u32			fr_max_pages;
+	/* Set if the HCA can offload T10-PI through signature MRs */
+	unsigned int		pi_capable:1;
 
 	struct list_head	devs_node;
 	/* conn_list and refcnt protected by dev_list_mutex */
@@ -378,6 +435,8 @@ int isert_pdu_post_rdma_write(struct isert_conn *isert_conn,
 int isert_pdu_post_rdma_read(struct isert_conn *isert_conn,
 			     struct isert_cmnd *isert_cmd,
 			     int wr_cnt);
+void isert_rdma_release_fr_desc(struct isert_cmnd *isert_pdu);
+int isert_rdma_check_pi_status(struct isert_cmnd *isert_pdu);
 
 void isert_pdu_free(struct isert_cmnd *pdu);
 int isert_rx_pdu_done(struct isert_cmnd *pdu);
@@ -291,6 +291,43 @@ int isert_task_abort(struct iscsi_cmnd *cmnd)
 	return 0;
 }
 
+static ssize_t isert_conn_fast_reg_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	struct iscsi_conn *iscsi_conn = container_of(kobj, struct iscsi_conn,
+						     conn_kobj);
+	struct isert_conn *isert_conn = container_of(iscsi_conn,
+						struct isert_conn, iscsi);
+	int pos;
+
+	spin_lock(&isert_conn->fr_pool_lock);
+	pos = scnprintf(buf, SCST_SYSFS_BLOCK_SIZE,
+			"pool_size %d\nregistrations %lu\npool_empty %lu\nmap_failures %lu\n"
+			"sig_pool_size %d\nsig_registrations %lu\npi_errors %lu\n",
+			isert_conn->fr_pool_size, isert_conn->fr_reg_cnt,
+			isert_conn->fr_pool_empty_cnt,
+			isert_conn->fr_map_fail_cnt,
+			isert_conn->sig_pool_size, isert_conn->sig_reg_cnt,
+			isert_conn->sig_err_cnt);
+	spin_unlock(&isert_conn->fr_pool_lock);
+
+	return pos;
+}
+
+static struct kobj_attribute isert_conn_fast_reg_attr =
+	__ATTR(fast_reg, S_IRUGO, isert_conn_fast_reg_show, NULL);
+
+void isert_conn_sysfs_add(struct iscsi_conn *iscsi_conn)
+{
+	int res;
+
+	res = sysfs_create_file(&iscsi_conn->conn_kobj,
+				&isert_conn_fast_reg_attr.attr);
+	if (unlikely(res))
+		PRINT_ERROR("Unable create sysfs attribute %s for conn %p",
+			    isert_conn_fast_reg_attr.attr.name, iscsi_conn);
+}
+
 void *isert_get_priv(struct iscsi_conn *iscsi_conn)
 {
 	struct isert_conn *isert_conn = container_of(iscsi_conn,
@@ -233,6 +233,634 @@ static inline void isert_link_send_pdu_wrs(struct isert_cmnd *from_pdu,
 #endif
 }
 
+#ifdef HAVE_IB_MAP_MR_SG
+static void isert_fr_list_destroy(struct list_head *pool)
+{
+	struct isert_fr_desc *fr_desc, *tmp;
+
+	list_for_each_entry_safe(fr_desc, tmp, pool, fr_node) {
+		list_del(&fr_desc->fr_node);
+		ib_dereg_mr(fr_desc->mr);
+		kfree(fr_desc);
+	}
+}
+
+static void isert_fr_pool_destroy(struct isert_conn *isert_conn)
+{
+	isert_fr_list_destroy(&isert_conn->fr_pool);
+	isert_conn->fr_pool_size = 0;
+	isert_fr_list_destroy(&isert_conn->sig_pool);
+	isert_conn->sig_pool_size = 0;
+}
+
+static void isert_fr_desc_init(struct isert_fr_desc *fr_desc,
+			       struct isert_conn *isert_conn)
+{
+	isert_wr_set_fields(&fr_desc->inv_wr, isert_conn, NULL);
+	fr_desc->inv_wr.wr_op = ISER_WR_LOCAL_INV;
+	isert_wr_set_fields(&fr_desc->reg_wr, isert_conn, NULL);
+	fr_desc->reg_wr.wr_op = ISER_WR_REG_MR;
+	fr_desc->key_valid = 1;
+}
+
+/*
+ * Allocates up to @size fast registration descriptors. Running short of MRs
+ * is not fatal, commands then simply fall back to per-SGE RDMA WRs.
+ */
+static void isert_fr_pool_create(struct isert_conn *isert_conn, int size)
+{
+	struct isert_device *isert_dev = isert_conn->isert_dev;
+	struct isert_fr_desc *fr_desc;
+	int i, err = 0;
+
+	TRACE_ENTRY();
+
+	if (!isert_dev->fr_max_pages)
+		goto out;
+
+	for (i = 0; i < size; ++i) {
+		fr_desc = kzalloc(sizeof(*fr_desc), GFP_KERNEL);
+		if (unlikely(!fr_desc)) {
+			err = -ENOMEM;
+			break;
+		}
+
+		fr_desc->mr = ib_alloc_mr(isert_dev->pd, IB_MR_TYPE_MEM_REG,
+					  isert_dev->fr_max_pages);
+		if (IS_ERR(fr_desc->mr)) {
+			err = PTR_ERR(fr_desc->mr);
+			kfree(fr_desc);
+			break;
+		}
+
+		isert_fr_desc_init(fr_desc, isert_conn);
+
+		list_add_tail(&fr_desc->fr_node, &isert_conn->fr_pool);
+		isert_conn->fr_pool_size++;
+	}
+
+	if (unlikely(err))
+		PRINT_WARNING("conn:%p allocated %d of %d fast reg MRs, err:%d",
+			      isert_conn, isert_conn->fr_pool_size, size, err);
+
+out:
+	TRACE_EXIT();
+}
+
+#ifdef HAVE_IB_MR_INTEGRITY
+/*
+ * Allocates @size integrity MRs, one per command the initiator may have
+ * outstanding. Unlike with plain fast registration there is no software
+ * fallback for T10-PI commands, so any failure here fails the login.
+ */
+static int isert_sig_pool_create(struct isert_conn *isert_conn, int size)
+{
+	struct isert_device *isert_dev = isert_conn->isert_dev;
+	struct isert_fr_desc *sig_desc;
+	int i, err = 0;
+
+	TRACE_ENTRY();
+
+	if (!isert_dev->pi_capable) {
+		PRINT_ERROR("Target %s requires T10-PI offload, which device %s does not support",
+			    isert_conn->iscsi.target->name,
+			    dev_name(&isert_dev->ib_dev->dev));
+		err = -EOPNOTSUPP;
+		goto out;
+	}
+
+	for (i = 0; i < size; ++i) {
+		sig_desc = kzalloc(sizeof(*sig_desc), GFP_KERNEL);
+		if (unlikely(!sig_desc)) {
+			err = -ENOMEM;
+			goto out_err;
+		}
+
+		sig_desc->mr = ib_alloc_mr_integrity(isert_dev->pd,
+						     isert_dev->fr_max_pages,
+						     isert_dev->fr_max_pages);
+		if (IS_ERR(sig_desc->mr)) {
+			err = PTR_ERR(sig_desc->mr);
+			kfree(sig_desc);
+			goto out_err;
+		}
+
+		isert_fr_desc_init(sig_desc, isert_conn);
+		sig_desc->sig = 1;
+
+		list_add_tail(&sig_desc->fr_node, &isert_conn->sig_pool);
+		isert_conn->sig_pool_size++;
+	}
+
+out:
+	TRACE_EXIT_RES(err);
+	return err;
+
+out_err:
+	PRINT_ERROR("conn:%p failed to allocate signature MR %d of %d, err:%d",
+		    isert_conn, i + 1, size, err);
+	goto out;
+}
+#endif
+
+static struct isert_fr_desc *isert_fr_desc_get(struct isert_conn *isert_conn,
+					       bool sig)
+{
+	struct list_head *pool = sig ? &isert_conn->sig_pool :
+				       &isert_conn->fr_pool;
+	struct isert_fr_desc *fr_desc = NULL;
+
+	spin_lock(&isert_conn->fr_pool_lock);
+	if (likely(!list_empty(pool))) {
+		fr_desc = list_first_entry(pool, struct isert_fr_desc,
+					   fr_node);
+		list_del(&fr_desc->fr_node);
+		if (sig)
+			isert_conn->sig_reg_cnt++;
+		else
+			isert_conn->fr_reg_cnt++;
+	} else if (!sig) {
+		isert_conn->fr_pool_empty_cnt++;
+	}
+	spin_unlock(&isert_conn->fr_pool_lock);
+
+	return fr_desc;
+}
+
+static void isert_fr_desc_put(struct isert_conn *isert_conn,
+			      struct isert_fr_desc *fr_desc, bool map_failed)
+{
+	spin_lock(&isert_conn->fr_pool_lock);
+	if (fr_desc->sig) {
+		list_add(&fr_desc->fr_node, &isert_conn->sig_pool);
+	} else {
+		list_add(&fr_desc->fr_node, &isert_conn->fr_pool);
+		if (unlikely(map_failed)) {
+			isert_conn->fr_reg_cnt--;
+			isert_conn->fr_map_fail_cnt++;
+		}
+	}
+	spin_unlock(&isert_conn->fr_pool_lock);
+}
+
+static void isert_fr_desc_unmap_pi(struct isert_fr_desc *fr_desc)
+{
+	if (!fr_desc->pi_sg_cnt)
+		return;
+
+	ib_dma_unmap_sg(fr_desc->reg_wr.isert_dev->ib_dev, fr_desc->pi_sg,
+			fr_desc->pi_sg_cnt, fr_desc->pi_dma_dir);
+	fr_desc->pi_sg_cnt = 0;
+}
+
+void isert_rdma_release_fr_desc(struct isert_cmnd *isert_pdu)
+{
+	struct isert_fr_desc *fr_desc = isert_pdu->fr_desc;
+
+	if (likely(!fr_desc))
+		return;
+
+	isert_pdu->fr_desc = NULL;
+	isert_fr_desc_unmap_pi(fr_desc);
+	isert_fr_desc_put(fr_desc->reg_wr.conn, fr_desc, false);
+}
+
+/*
+ * Builds the [LOCAL_INV ->] REG_MR chain in front of the single RDMA WR of
+ * isert_pdu and makes fr_desc own the current transfer.
+ */
+static void isert_fr_desc_link_reg(struct isert_cmnd *isert_pdu,
+				   struct isert_fr_desc *fr_desc,
+				   enum ib_wr_opcode reg_opcode)
+{
+	struct isert_wr *wr = &isert_pdu->wr[0];
+	struct ib_mr *mr = fr_desc->mr;
+	struct ib_send_wr *inv_wr;
+	struct ib_reg_wr *reg_wr;
+
+	/*
+	 * ib_reg_wr and ib_rdma_wr both start with struct ib_send_wr, hence
+	 * isert_post_send() can be handed fr_desc->first_wr directly.
+	 */
+	reg_wr = &fr_desc->reg_wr.fr_wr;
+	memset(reg_wr, 0, sizeof(*reg_wr));
+	reg_wr->wr.wr_id = _ptr_to_u64(&fr_desc->reg_wr);
+	reg_wr->wr.opcode = reg_opcode;
+	reg_wr->wr.next = &wr->send_wr.wr;
+	reg_wr->mr = mr;
+	reg_wr->access = IB_ACCESS_LOCAL_WRITE;
+	fr_desc->reg_wr.pdu = isert_pdu;
+	fr_desc->first_wr = &fr_desc->reg_wr;
+
+	if (!fr_desc->key_valid) {
+		inv_wr = &fr_desc->inv_wr.send_wr.wr;
+		memset(inv_wr, 0, sizeof(*inv_wr));
+		inv_wr->wr_id = _ptr_to_u64(&fr_desc->inv_wr);
+		inv_wr->opcode = IB_WR_LOCAL_INV;
+		inv_wr->ex.invalidate_rkey = mr->rkey;
+		inv_wr->next = &reg_wr->wr;
+		fr_desc->inv_wr.pdu = isert_pdu;
+		fr_desc->first_wr = &fr_desc->inv_wr;
+
+		ib_update_fast_reg_key(mr, ib_inc_rkey(mr->rkey));
+	}
+	reg_wr->key = mr->rkey;
+	/* The RDMA WR has to carry the key just bumped above */
+	fr_desc->sge.lkey = mr->lkey;
+	fr_desc->key_valid = 0;
+
+	isert_pdu->fr_desc = fr_desc;
+}
+
+/*
+ * Points the single RDMA WR of isert_pdu at the registered MR of fr_desc.
+ */
+static int isert_fr_desc_init_rdma_wr(struct isert_cmnd *isert_pdu,
+				      struct isert_conn *isert_conn,
+				      struct isert_fr_desc *fr_desc,
+				      enum isert_wr_op op)
+{
+	struct isert_wr *wr = &isert_pdu->wr[0];
+	struct ib_mr *mr = fr_desc->mr;
+	int err;
+
+	err = isert_wr_init(wr, op, &isert_pdu->rdma_buf, isert_conn,
+			    isert_pdu, isert_pdu->sg_pool, 0, 1, 0);
+	if (unlikely(err < 0))
+		return err;
+
+	fr_desc->sge.addr = mr->iova;
+	fr_desc->sge.length = mr->length;
+	wr->sge_list = &fr_desc->sge;
+	wr->send_wr.wr.sg_list = &fr_desc->sge;
+	wr->send_wr.wr.next = NULL;
+	if (op == ISER_WR_RDMA_READ)
+		wr->send_wr.wr.send_flags = IB_SEND_SIGNALED;
+
+	return 0;
+}
+
+/*
+ * Registers the whole DMA mapped rdma_buf through a fast registration MR so
+ * that it can be transferred by a single RDMA WR, whatever its SG layout.
+ * The resulting chain is [LOCAL_INV ->] REG_MR -> RDMA, so it is still
+ * posted with one doorbell together with the response, if any.
+ *
+ * Returns the number of RDMA WRs in isert_pdu->wr (1) on success, -EAGAIN
+ * if the caller should fall back to per-SGE WRs or another negative error
+ * code.
+ */
+static int isert_fast_reg_rdma(struct isert_cmnd *isert_pdu,
+			       struct isert_conn *isert_conn,
+			       enum isert_wr_op op, int dma_nents)
+{
+	struct isert_buf *isert_buf = &isert_pdu->rdma_buf;
+	struct isert_fr_desc *fr_desc;
+	int n, err;
+
+	TRACE_ENTRY();
+
+	fr_desc = isert_fr_desc_get(isert_conn, false);
+	if (unlikely(!fr_desc)) {
+		err = -EAGAIN;
+		goto out;
+	}
+
+	n = ib_map_mr_sg(fr_desc->mr, isert_buf->sg, dma_nents, NULL,
+			 PAGE_SIZE);
+	if (unlikely(n != dma_nents)) {
+		TRACE_DBG("conn:%p failed to map %d sg entries to fast reg MR (%d)",
+			  isert_conn, dma_nents, n);
+		isert_fr_desc_put(isert_conn, fr_desc, true);
+		err = -EAGAIN;
+		goto out;
+	}
+
+	err = isert_fr_desc_init_rdma_wr(isert_pdu, isert_conn, fr_desc, op);
+	if (unlikely(err < 0)) {
+		isert_fr_desc_put(isert_conn, fr_desc, false);
+		goto out;
+	}
+
+	isert_fr_desc_link_reg(isert_pdu, fr_desc, IB_WR_REG_MR);
+	err = 1;
+
+out:
+	TRACE_EXIT_RES(err);
+	return err;
+}
+
+#ifdef HAVE_IB_MR_INTEGRITY
+static void isert_set_dif_domain(struct scst_cmd *scst_cmd,
+				 struct ib_sig_domain *domain)
+{
+	struct ib_t10_dif_domain *dif = &domain->sig.dif;
+	enum scst_dif_actions checks;
+
+	checks = scst_get_dif_checks(scst_cmd->cmd_dif_actions);
+
+	domain->sig_type = IB_SIG_TYPE_T10_DIF;
+	dif->bg_type = IB_T10DIF_CRC;
+	dif->pi_interval = scst_cmd_get_block_size(scst_cmd);
+	dif->app_escape = true;
+
+	if (scst_cmd_get_dif_prot_type(scst_cmd) == 3) {
+		dif->ref_escape = true;
+		if (checks & SCST_DIF_CHECK_REF_TAG)
+			dif->ref_tag = be32_to_cpu(
+				scst_cmd_get_dif_app_ref_tag(scst_cmd));
+	} else {
+		dif->ref_tag = scst_cmd_get_lba(scst_cmd) & 0xFFFFFFFF;
+		dif->ref_remap = true;
+	}
+
+	if (checks & SCST_DIF_CHECK_APP_TAG) {
+		dif->app_tag = be16_to_cpu(scst_cmd_get_dif_app_tag(scst_cmd,
+						scst_cmd_get_lba(scst_cmd)));
+		dif->apptag_check_mask = 0xffff;
+	}
+}
+
+static u8 isert_dif_check_mask(enum scst_dif_actions dif_actions)
+{
+	enum scst_dif_actions checks = scst_get_dif_checks(dif_actions);
+	u8 check_mask = 0;
+
+	switch (scst_get_dif_action(dif_actions)) {
+	case SCST_DIF_ACTION_STRIP:
+	case SCST_DIF_ACTION_PASS_CHECK:
+		break;
+	default:
+		return 0;
+	}
+
+	if (checks & SCST_DIF_CHECK_GUARD_TAG)
+		check_mask |= IB_SIG_CHECK_GUARD;
+	if (checks & SCST_DIF_CHECK_APP_TAG)
+		check_mask |= IB_SIG_CHECK_APPTAG;
+	if (checks & SCST_DIF_CHECK_REF_TAG)
+		check_mask |= IB_SIG_CHECK_REFTAG;
+
+	return check_mask;
+}
+
+/*
+ * Transfers the data of a T10-PI command through a signature MR, so that the
+ * HCA inserts, verifies and/or strips the protection information as SCST
+ * asked the target driver to do in @dif_actions. The wire side of the
+ * transfer, i.e. the initiator buffer, carries PI interleaved with the data,
+ * the memory side keeps it in the separate SCST DIF SG vector.
+ *
+ * Returns the number of RDMA WRs in isert_pdu->wr (1) on success, -EAGAIN
+ * if all signature MRs are busy or another negative error code.
+ */
+static int isert_sig_rdma(struct isert_cmnd *isert_pdu,
+			  struct isert_conn *isert_conn, enum isert_wr_op op,
+			  int dma_nents, enum scst_dif_actions dif_actions)
+{
+	struct scst_cmd *scst_cmd = isert_pdu->iscsi.scst_cmd;
+	struct isert_buf *isert_buf = &isert_pdu->rdma_buf;
+	struct ib_device *ib_dev = isert_conn->isert_dev->ib_dev;
+	struct isert_fr_desc *sig_desc;
+	struct ib_sig_attrs *sig_attrs;
+	struct scatterlist *pi_sg = NULL;
+	int pi_sg_cnt = 0, pi_nents = 0;
+	bool mem_pi, wire_pi;
+	int err;
+
+	TRACE_ENTRY();
+
+	/* RDMA WRITE moves data from memory to the wire, RDMA READ back */
+	switch (scst_get_dif_action(dif_actions)) {
+	case SCST_DIF_ACTION_STRIP:
+		mem_pi = op == ISER_WR_RDMA_WRITE;
+		wire_pi = op == ISER_WR_RDMA_READ;
+		break;
+	case SCST_DIF_ACTION_INSERT:
+		mem_pi = op == ISER_WR_RDMA_READ;
+		wire_pi = op == ISER_WR_RDMA_WRITE;
+		break;
+	default:
+		mem_pi = true;
+		wire_pi = true;
+		break;
+	}
+
+	if (mem_pi) {
+		pi_sg = scst_cmd_get_dif_sg(scst_cmd);
+		pi_sg_cnt = scst_cmd_get_dif_sg_cnt(scst_cmd);
+		if (unlikely(!pi_sg)) {
+			PRINT_ERROR("No DIF buffer for T10-PI cmd %p (op %s)",
+				    scst_cmd, scst_get_opcode_name(scst_cmd));
+			err = -EINVAL;
+			goto out;
+		}
+
+		pi_nents = ib_dma_map_sg(ib_dev, pi_sg, pi_sg_cnt,
+					 isert_buf->dma_dir);
+		if (unlikely(!pi_nents)) {
+			PRINT_ERROR("Failed to DMA map DIF sg:%p len:%d",
+				    pi_sg, pi_sg_cnt);
+			err = -EFAULT;
+			goto out;
+		}
+	}
+
+	sig_desc = isert_fr_desc_get(isert_conn, true);
+	if (unlikely(!sig_desc)) {
+		PRINT_ERROR("conn:%p out of signature MRs", isert_conn);
+		err = -EAGAIN;
+		goto out_unmap;
+	}
+
+	err = ib_map_mr_sg_pi(sig_desc->mr, isert_buf->sg, dma_nents, NULL,
+			      pi_sg, pi_nents, NULL, PAGE_SIZE);
+	if (unlikely(err)) {
+		PRINT_ERROR("conn:%p failed to map T10-PI cmd %p to signature MR, err:%d",
+			    isert_conn, scst_cmd, err);
+		goto out_put;
+	}
+
+	sig_attrs = sig_desc->mr->sig_attrs;
+	memset(sig_attrs, 0, sizeof(*sig_attrs));
+	if (mem_pi)
+		isert_set_dif_domain(scst_cmd, &sig_attrs->mem);
+	else
+		sig_attrs->mem.sig_type = IB_SIG_TYPE_NONE;
+	if (wire_pi)
+		isert_set_dif_domain(scst_cmd, &sig_attrs->wire);
+	else
+		sig_attrs->wire.sig_type = IB_SIG_TYPE_NONE;
+	sig_attrs->check_mask = isert_dif_check_mask(dif_actions);
+
+	err = isert_fr_desc_init_rdma_wr(isert_pdu, isert_conn, sig_desc, op);
+	if (unlikely(err < 0))
+		goto out_put;
+
+	/* Only the wire side length counts for the RDMA itself */
+	sig_desc->sge.length = isert_buf->size;
+	if (wire_pi)
+		sig_desc->sge.length += (isert_buf->size >>
+			scst_cmd->dev->block_shift) << SCST_DIF_TAG_SHIFT;
+
+	/* Sig status must be checked as soon as the transfer completes */
+	isert_pdu->wr[0].send_wr.wr.send_flags = IB_SEND_SIGNALED;
+
+	sig_desc->pi_sg = pi_sg;
+	sig_desc->pi_sg_cnt = mem_pi ? pi_sg_cnt : 0;
+	sig_desc->pi_dma_dir = isert_buf->dma_dir;
+
+	isert_fr_desc_link_reg(isert_pdu, sig_desc, IB_WR_REG_MR_INTEGRITY);
+	err = 1;
+
+out:
+	TRACE_EXIT_RES(err);
+	return err;
+
+out_put:
+	isert_fr_desc_put(isert_conn, sig_desc, false);
+out_unmap:
+	if (mem_pi)
+		ib_dma_unmap_sg(ib_dev, pi_sg, pi_sg_cnt, isert_buf->dma_dir);
+	goto out;
+}
+
+/*
+ * Returns the T10-PI actions the HCA has to perform for the RDMA @op of
+ * isert_pdu, SCST_DIF_ACTION_NONE if none.
+ */
+static enum scst_dif_actions isert_rdma_dif_actions(struct isert_cmnd *isert_pdu,
+						    enum isert_wr_op op)
+{
+	struct scst_cmd *scst_cmd = isert_pdu->iscsi.scst_cmd;
+
+	if (!scst_cmd)
+		return SCST_DIF_ACTION_NONE;
+
+	if (op == ISER_WR_RDMA_WRITE)
+		return scst_get_read_dif_tgt_actions(scst_cmd);
+	else
+		return scst_get_write_dif_tgt_actions(scst_cmd);
+}
+
+/*
+ * Checks whether the HCA detected a T10-PI error in the transfer through the
+ * signature MR of isert_pdu. If so, accounts the error and sets the
+ * corresponding sense in the SCST command.
+ *
+ * Returns 0 if the data is fine, a negative error code otherwise.
+ */
+int isert_rdma_check_pi_status(struct isert_cmnd *isert_pdu)
+{
+	struct isert_fr_desc *sig_desc = isert_pdu->fr_desc;
+	struct scst_cmd *scst_cmd = isert_pdu->iscsi.scst_cmd;
+	struct isert_conn *isert_conn;
+	struct ib_mr_status mr_status;
+	int err;
+
+	if (likely(!sig_desc || !sig_desc->sig))
+		return 0;
+
+	isert_conn = sig_desc->reg_wr.conn;
+
+	err = ib_check_mr_status(sig_desc->mr, IB_MR_CHECK_SIG_STATUS,
+				 &mr_status);
+	if (unlikely(err)) {
+		PRINT_ERROR("conn:%p failed to check signature status of cmd %p, err:%d",
+			    isert_conn, scst_cmd, err);
+		scst_set_cmd_error(scst_cmd,
+				   SCST_LOAD_SENSE(scst_sense_hardw_error));
+		goto out;
+	}
+
+	if (likely(!(mr_status.fail_status & IB_MR_CHECK_SIG_STATUS)))
+		goto out;
+
+	spin_lock(&isert_conn->fr_pool_lock);
+	isert_conn->sig_err_cnt++;
+	spin_unlock(&isert_conn->fr_pool_lock);
+
+	PRINT_WARNING("T10-PI error %d at offset %llu (expected 0x%x, actual 0x%x) for cmd %p (op %s, lba %lld)",
+		      mr_status.sig_err.err_type,
+		      (unsigned long long)mr_status.sig_err.sig_err_offset,
+		      mr_status.sig_err.expected, mr_status.sig_err.actual,
+		      scst_cmd, scst_get_opcode_name(scst_cmd),
+		      (long long)scst_cmd_get_lba(scst_cmd));
+
+	switch (mr_status.sig_err.err_type) {
+	case IB_SIG_BAD_GUARD:
+		scst_dif_acc_guard_check_failed_tgt(scst_cmd);
+		scst_set_cmd_error(scst_cmd,
+			SCST_LOAD_SENSE(scst_logical_block_guard_check_failed));
+		break;
+	case IB_SIG_BAD_REFTAG:
+		scst_dif_acc_ref_check_failed_tgt(scst_cmd);
+		scst_set_cmd_error(scst_cmd,
+			SCST_LOAD_SENSE(scst_logical_block_ref_tag_check_failed));
+		break;
+	case IB_SIG_BAD_APPTAG:
+		scst_dif_acc_app_check_failed_tgt(scst_cmd);
+		scst_set_cmd_error(scst_cmd,
+			SCST_LOAD_SENSE(scst_logical_block_app_tag_check_failed));
+		break;
+	}
+	err = -EILSEQ;
+
+out:
+	return err;
+}
+#endif
+#else
+static inline void isert_fr_pool_destroy(struct isert_conn *isert_conn)
+{
+}
+
+static inline void isert_fr_pool_create(struct isert_conn *isert_conn,
+					int size)
+{
+}
+
+void isert_rdma_release_fr_desc(struct isert_cmnd *isert_pdu)
+{
+}
+#endif
+
+#if !defined(HAVE_IB_MAP_MR_SG) || !defined(HAVE_IB_MR_INTEGRITY)
+static inline int isert_sig_pool_create(struct isert_conn *isert_conn,
+					int size)
+{
+	PRINT_ERROR("Target %s requires T10-PI offload, which this kernel does not support",
+		    isert_conn->iscsi.target->name);
+	return -EOPNOTSUPP;
+}
+
+static inline int isert_sig_rdma(struct isert_cmnd *isert_pdu,
+				 struct isert_conn *isert_conn,
+				 enum isert_wr_op op, int dma_nents,
+				 enum scst_dif_actions dif_actions)
+{
+	return -EOPNOTSUPP;
+}
+
+static inline enum scst_dif_actions isert_rdma_dif_actions(
+	struct isert_cmnd *isert_pdu, enum isert_wr_op op)
+{
+	return SCST_DIF_ACTION_NONE;
+}
+
+int isert_rdma_check_pi_status(struct isert_cmnd *isert_pdu)
+{
+	return 0;
+}
+#endif
+
+static inline struct isert_wr *isert_rdma_first_wr(struct isert_cmnd *pdu)
+{
+	if (pdu->fr_desc)
+		return pdu->fr_desc->first_wr;
+	return &pdu->wr[0];
+}
+
 int isert_prepare_rdma(struct isert_cmnd *isert_pdu,
 		       struct isert_conn *isert_conn,
 		       enum isert_wr_op op)
@@ -270,6 +898,28 @@ int isert_prepare_rdma(struct isert_cmnd *isert_pdu,
 		goto out;
 	}
 
+	if (unlikely(isert_conn->sig_pool_size)) {
+		enum scst_dif_actions dif_actions;
+
+		dif_actions = isert_rdma_dif_actions(isert_pdu, op);
+		if (scst_get_dif_action(dif_actions) != SCST_DIF_ACTION_NONE) {
+			wr_cnt = isert_sig_rdma(isert_pdu, isert_conn, op, err,
+						dif_actions);
+			if (unlikely(wr_cnt < 0))
+				goto out_unmap;
+			goto out;
+		}
+	}
+
+#ifdef HAVE_IB_MAP_MR_SG
+	if (isert_buf->sg_cnt > isert_conn->max_sge &&
+	    isert_conn->fr_pool_size) {
+		wr_cnt = isert_fast_reg_rdma(isert_pdu, isert_conn, op, err);
+		if (wr_cnt != -EAGAIN)
+			goto out;
+	}
+#endif
+
 	buff_offset = 0;
 	sg_cnt = 0;
 	for (wr_cnt = 0, sg_offset = 0; sg_offset < isert_buf->sg_cnt;
@@ -304,12 +954,19 @@ int isert_prepare_rdma(struct isert_cmnd *isert_pdu,
 out:
 	TRACE_EXIT_RES(wr_cnt);
 	return wr_cnt;
+
+out_unmap:
+	/* Nothing else unmaps it, since no WR will complete */
+	ib_dma_unmap_sg(ib_dev, isert_buf->sg, isert_buf->sg_cnt,
+			isert_buf->dma_dir);
+	goto out;
 }
 
 void isert_pdu_free(struct isert_cmnd *pdu)
 {
 	int i;
 
+	isert_rdma_release_fr_desc(pdu);
 	list_del(&pdu->pool_node);
 	for (i = 0; i < pdu->n_wr; ++i)
 		isert_wr_release(&pdu->wr[i]);
@@ -479,6 +1136,15 @@ int isert_alloc_conn_resources(struct isert_conn *isert_conn)
 		}
 	}
 
+	isert_fr_pool_create(isert_conn, isert_conn->queue_depth);
+
+	if (isert_conn->iscsi.target->t10_pi) {
+		err = isert_sig_pool_create(isert_conn,
+					    isert_conn->queue_depth);
+		if (unlikely(err))
+			goto clean_pdus;
+	}
+
 	err = isert_post_recv(isert_conn, &first_pdu->wr[0], to_alloc);
 	if (unlikely(err)) {
 		PRINT_ERROR("Failed to post recv err:%d", err);
@@ -574,6 +1240,8 @@ void isert_free_conn_resources(struct isert_conn *isert_conn)
 	}
 	spin_unlock(&isert_conn->tx_lock);
 
+	isert_fr_pool_destroy(isert_conn);
+
 	TRACE_EXIT();
 }
 
@@ -616,6 +1284,22 @@ int isert_pdu_post_rdma_write(struct isert_conn *isert_conn,
 
 	TRACE_ENTRY();
 
+	if (unlikely(isert_cmd->fr_desc && isert_cmd->fr_desc->sig)) {
+		/*
+		 * The HCA reports T10-PI errors only once the RDMA WRITE has
+		 * completed, so the response is sent from its completion.
+		 */
+		isert_cmd->pi_rsp = isert_rsp;
+		err = isert_post_send(isert_conn,
+				      isert_rdma_first_wr(isert_cmd), wr_cnt);
+		if (unlikely(err)) {
+			isert_cmd->pi_rsp = NULL;
+			PRINT_ERROR("Failed to send pdu conn:%p pdu:%p err:%d",
+				    isert_conn, isert_cmd, err);
+		}
+		goto out;
+	}
+
 #ifdef USE_PRE_440_WR_STRUCTURE
 	isert_rsp->wr[0].send_wr.num_sge = isert_pdu_prepare_send(isert_conn,
 								  isert_rsp);
@@ -624,12 +1308,14 @@ int isert_pdu_post_rdma_write(struct isert_conn *isert_conn,
 								     isert_rsp);
 #endif
 	isert_link_send_pdu_wrs(isert_cmd, isert_rsp, wr_cnt);
-	err = isert_post_send(isert_conn, &isert_cmd->wr[0], wr_cnt + 1);
+	err = isert_post_send(isert_conn, isert_rdma_first_wr(isert_cmd),
+			      wr_cnt + 1);
 	if (unlikely(err)) {
 		PRINT_ERROR("Failed to send pdu conn:%p pdu:%p err:%d",
 			    isert_conn, isert_cmd, err);
 	}
 
+out:
 	TRACE_EXIT_RES(err);
 	return err;
 }
@@ -641,7 +1327,8 @@ int isert_pdu_post_rdma_read(struct isert_conn *isert_conn,
 
 	TRACE_ENTRY();
 
-	err = isert_post_send(isert_conn, &isert_cmd->wr[0], wr_cnt);
+	err = isert_post_send(isert_conn, isert_rdma_first_wr(isert_cmd),
+			      wr_cnt);
 	if (unlikely(err)) {
 		PRINT_ERROR("Failed to send pdu conn:%p pdu:%p err:%d",
 			    isert_conn, isert_cmd, err);
@@ -35,6 +35,7 @@
  */
 
 #include <linux/kernel.h>
+#include <linux/module.h>
 #include <linux/vmalloc.h>
 #include <linux/in.h>
 #include <linux/in6.h>
@@ -53,6 +54,20 @@
 
 static DEFINE_MUTEX(dev_list_mutex);
 
+#ifdef HAVE_IB_MAP_MR_SG
+static bool isert_use_fast_reg = true;
+module_param(isert_use_fast_reg, bool, S_IRUGO);
+MODULE_PARM_DESC(isert_use_fast_reg,
+		 "Use fast registration MRs for fragmented data buffers if the HCA supports them (default true).");
+#endif
+
+#ifdef HAVE_IB_MR_INTEGRITY
+static bool isert_pi_offload = true;
+module_param(isert_pi_offload, bool, S_IRUGO);
+MODULE_PARM_DESC(isert_pi_offload,
+		 "Let the HCA insert, check and strip T10-PI if it supports signature MRs (default true).");
+#endif
+
 static void isert_portal_free(struct isert_portal *portal);
 static struct rdma_cm_id *
 isert_setup_id(struct isert_portal *portal);
@@ -138,9 +153,12 @@ int isert_post_send(struct isert_conn *isert_conn,
 	if (unlikely(err)) {
 		num_posted = isert_num_send_posted_on_err(first_ib_wr, bad_wr);
 
-		PRINT_ERROR("conn:%p send posted:%d/%d bad wr_id:0x%llx sz:%d num_sge: %d err:%d",
+		/* LOCAL_INV and REG_MR WRs have no sg_list */
+		PRINT_ERROR("conn:%p send posted:%d/%d bad wr_id:0x%llx opcode:%d sz:%d num_sge: %d err:%d",
 			    isert_conn, num_posted, num_wr, bad_wr->wr_id,
-			    bad_wr->sg_list->length, bad_wr->num_sge, err);
+			    bad_wr->opcode,
+			    bad_wr->num_sge ? bad_wr->sg_list->length : 0,
+			    bad_wr->num_sge, err);
 	}
 
 	TRACE_EXIT_RES(err);
@@ -433,8 +451,10 @@ static void isert_send_completion_handler(struct isert_wr *wr)
 	TRACE_ENTRY();
 
 	if (iscsi_req_pdu && iscsi_req_pdu->bufflen &&
-	    isert_req_pdu->is_rstag_valid)
+	    isert_req_pdu->is_rstag_valid) {
+		isert_rdma_release_fr_desc(isert_req_pdu);
 		isert_data_in_sent(iscsi_req_pdu);
+	}
 
 	isert_pdu_sent(iscsi_pdu);
 
@@ -447,11 +467,19 @@ static void isert_rdma_rd_completion_handler(struct isert_wr *wr)
 	struct isert_device *isert_dev = wr->isert_dev;
 	struct ib_device *ib_dev = isert_dev->ib_dev;
 
+	int err;
+
 	ib_dma_unmap_sg(ib_dev, isert_buf->sg, isert_buf->sg_cnt,
 			isert_buf->dma_dir);
 	isert_buf->sg_cnt = 0;
 
-	isert_data_out_ready(&wr->pdu->iscsi);
+	err = isert_rdma_check_pi_status(wr->pdu);
+	isert_rdma_release_fr_desc(wr->pdu);
+
+	if (unlikely(err))
+		isert_data_out_failed(&wr->pdu->iscsi);
+	else
+		isert_data_out_ready(&wr->pdu->iscsi);
 }
 
 static void isert_rdma_wr_completion_handler(struct isert_wr *wr)
@@ -460,10 +488,27 @@ static void isert_rdma_wr_completion_handler(struct isert_wr *wr)
 	struct isert_device *isert_dev = wr->isert_dev;
 	struct ib_device *ib_dev = isert_dev->ib_dev;
 
+	struct isert_cmnd *isert_rsp = wr->pdu->pi_rsp;
+	int err;
+
 	ib_dma_unmap_sg(ib_dev, isert_buf->sg, isert_buf->sg_cnt,
 			isert_buf->dma_dir);
 	isert_buf->sg_cnt = 0;
 
+	if (unlikely(isert_rsp)) {
+		/* T10-PI READ, its response has been held back until now */
+		wr->pdu->pi_rsp = NULL;
+		err = isert_rdma_check_pi_status(wr->pdu);
+		isert_rdma_release_fr_desc(wr->pdu);
+		if (unlikely(err))
+			isert_data_in_failed(&wr->pdu->iscsi,
+					     &isert_rsp->iscsi);
+		isert_pdu_tx(&isert_rsp->iscsi);
+		return;
+	}
+
+	isert_rdma_release_fr_desc(wr->pdu);
+
 	isert_data_in_sent(&wr->pdu->iscsi);
 }
 
@@ -682,6 +727,7 @@ static void isert_handle_wc_error(struct ib_wc *wc)
 					isert_buf->sg_cnt, isert_buf->dma_dir);
 			isert_buf->sg_cnt = 0;
 		}
+		isert_rdma_release_fr_desc(isert_pdu);
 		if (!isert_pdu->is_fake_rx)
 			isert_pdu_err(&isert_pdu->iscsi);
 		break;
@@ -700,10 +746,26 @@ static void isert_handle_wc_error(struct ib_wc *wc)
 					isert_buf->sg_cnt, isert_buf->dma_dir);
 			isert_buf->sg_cnt = 0;
 		}
+		isert_rdma_release_fr_desc(isert_pdu);
 		/*
 		 * RDMA-WR and SEND response of a READ task
 		 * are sent together, so when receiving RDMA-WR error,
 		 * wait until SEND error arrives to complete the task.
+		 * T10-PI READs are the exception, their response has not
+		 * been posted yet.
+		 */
+		if (unlikely(isert_pdu->pi_rsp)) {
+			struct isert_cmnd *isert_rsp = isert_pdu->pi_rsp;
+
+			isert_pdu->pi_rsp = NULL;
+			isert_pdu_err(&isert_rsp->iscsi);
+		}
+		break;
+	case ISER_WR_LOCAL_INV:
+	case ISER_WR_REG_MR:
+		/*
+		 * Unsignaled registration WRs only complete when flushed.
+		 * The RDMA WR chained after them completes the task.
 		 */
 		break;
 	default:
@@ -1036,13 +1098,34 @@ static struct isert_device *isert_device_create(struct ib_device *ib_dev)
 	isert_dev->lkey = pd->local_dma_lkey;
 #endif
 
+#ifdef HAVE_IB_MAP_MR_SG
+	if (isert_use_fast_reg &&
+	    (isert_dev->device_attr.device_cap_flags &
+	     IB_DEVICE_MEM_MGT_EXTENSIONS))
+		isert_dev->fr_max_pages =
+			min_t(u32, ISER_FR_MAX_PAGES,
+			      isert_dev->device_attr.max_fast_reg_page_list_len);
+#endif
+#ifdef HAVE_IB_MR_INTEGRITY
+	if (isert_pi_offload &&
+	    isert_dev->fr_max_pages >= ISCSI_T10_PI_MAX_PAGES &&
+#ifdef HAVE_IBK_INTEGRITY_HANDOVER
+	    (isert_dev->device_attr.kernel_cap_flags & IBK_INTEGRITY_HANDOVER))
+#else
+	    (isert_dev->device_attr.device_cap_flags &
+	     IB_DEVICE_INTEGRITY_HANDOVER))
+#endif
+		isert_dev->pi_capable = 1;
+#endif
+
 	INIT_LIST_HEAD(&isert_dev->conn_list);
 
 	lockdep_assert_held(&dev_list_mutex);
 
 	isert_dev_list_add(isert_dev);
 
-	PRINT_INFO("iser created device:%p", isert_dev);
+	PRINT_INFO("iser created device:%p fast_reg_pages:%u pi_offload:%d",
+		   isert_dev, isert_dev->fr_max_pages, isert_dev->pi_capable);
 	return isert_dev;
 
 fail_cq:
@@ -1149,6 +1232,10 @@ static int isert_conn_qp_create(struct isert_conn *isert_conn)
 	qp_attr.cap.max_recv_sge = 3;
 	qp_attr.sq_sig_type = IB_SIGNAL_REQ_WR;
 	qp_attr.qp_type = IB_QPT_RC;
+#ifdef HAVE_IB_MR_INTEGRITY
+	if (isert_dev->pi_capable)
+		qp_attr.create_flags |= IB_QP_CREATE_INTEGRITY_EN;
+#endif
 
 	do {
 		if (max_wr < ISER_MIN_SQ_SIZE) {
@@ -1190,7 +1277,10 @@ isert_init_conn(struct isert_conn *isert_conn)
 	INIT_LIST_HEAD(&isert_conn->rx_buf_list);
 	INIT_LIST_HEAD(&isert_conn->tx_free_list);
 	INIT_LIST_HEAD(&isert_conn->tx_busy_list);
+	INIT_LIST_HEAD(&isert_conn->fr_pool);
+	INIT_LIST_HEAD(&isert_conn->sig_pool);
 	spin_lock_init(&isert_conn->tx_lock);
+	spin_lock_init(&isert_conn->fr_pool_lock);
 	spin_lock_init(&isert_conn->post_recv_lock);
 	init_waitqueue_head(&isert_conn->rem_wait);
 	kref_init(&isert_conn->kref);
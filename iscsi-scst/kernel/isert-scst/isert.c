@@ -360,11 +360,41 @@ int isert_data_out_ready(struct iscsi_cmnd *cmnd)
 	return res;
 }
 
+/*
+ * Called instead of isert_data_out_ready() if the HCA found the received
+ * data corrupted. The sense is already set in cmnd->scst_cmd.
+ */
+int isert_data_out_failed(struct iscsi_cmnd *cmnd)
+{
+	set_bit(ISCSI_CMD_PRELIM_COMPLETED, &cmnd->prelim_compl_flags);
+	return isert_data_out_ready(cmnd);
+}
+
 int isert_data_in_sent(struct iscsi_cmnd *din)
 {
 	return 0;
 }
 
+/*
+ * Turns the not yet sent good status response rsp of req into CHECK
+ * CONDITION with the sense the HCA T10-PI verification failure set in
+ * req->scst_cmd.
+ */
+void isert_data_in_failed(struct iscsi_cmnd *req, struct iscsi_cmnd *rsp)
+{
+	struct scst_cmd *scst_cmd = req->scst_cmd;
+
+	TRACE_ENTRY();
+
+	iscsi_init_status_rsp(rsp, SAM_STAT_CHECK_CONDITION,
+			      scst_cmd_get_sense_buffer(scst_cmd),
+			      scst_cmd_get_sense_buffer_len(scst_cmd));
+	iscsi_set_resid(rsp);
+	iscsi_cmnd_set_length(&rsp->pdu);
+
+	TRACE_EXIT();
+}
+
 void isert_pdu_err(struct iscsi_cmnd *pdu)
 {
 	struct iscsi_conn *conn = pdu->conn;
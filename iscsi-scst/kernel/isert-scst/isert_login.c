@@ -251,6 +251,8 @@ int isert_conn_alloc(struct iscsi_session *session,
 	if (unlikely(res))
 		goto cleanup_iscsi_conn;
 
+	isert_conn_sysfs_add(conn);
+
 	list_add_tail(&conn->conn_list_entry, &session->conn_list);
 
 	goto out;
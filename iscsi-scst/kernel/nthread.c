@@ -20,6 +20,7 @@
 #include <linux/kthread.h>
 #include <linux/delay.h>
 #include <net/tcp_states.h>
+#include <net/busy_poll.h>
 #ifdef INSIDE_KERNEL_TREE
 #include <scst/iscsit_transport.h>
 #else
@@ -526,13 +527,103 @@ out:
 }
 EXPORT_SYMBOL(iscsi_get_send_cmnd);
 
+static int iscsi_sock_recvmsg(struct iscsi_conn *conn, struct msghdr *msg,
+	int size)
+{
+	mm_segment_t oldfs;
+	int res;
+
+	conn->rx_recvmsg_calls++;
+
+	oldfs = get_fs();
+	set_fs(KERNEL_DS);
+	res = sock_recvmsg(conn->sock, msg,
+#if SOCK_RECVMSG_HAS_FOUR_ARGS
+			   size,
+#endif
+			   MSG_DONTWAIT | MSG_NOSIGNAL);
+	set_fs(oldfs);
+
+	return res;
+}
+
+/*
+ * If SO_BUSY_POLL is set on the socket, busy polls the device queue until
+ * data arrive or the busy poll time expires. Returns true, if data arrived.
+ */
+static bool iscsi_rx_busy_poll(struct iscsi_conn *conn)
+{
+#if defined(CONFIG_NET_RX_BUSY_POLL) && \
+    LINUX_VERSION_CODE >= KERNEL_VERSION(4, 12, 0)
+	struct sock *sk = conn->sock->sk;
+
+	if (!sk_can_busy_loop(sk))
+		return false;
+
+	conn->rx_busy_polls++;
+	sk_busy_loop(sk, 0);
+
+	return !skb_queue_empty(&sk->sk_receive_queue);
+#else
+	return false;
+#endif
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)
+static inline bool iscsi_rx_buffered(const struct iscsi_conn *conn)
+{
+	return conn->rx_buf_len != 0;
+}
+
+/* Copies as much as possible from the receive buffer to read_msg */
+static void iscsi_rx_buf_copy(struct iscsi_conn *conn)
+{
+	size_t n = min_t(size_t, conn->rx_buf_len,
+			 conn->read_msg.msg_iter.count);
+
+	n = copy_to_iter(conn->rx_buf + conn->rx_buf_off, n,
+			 &conn->read_msg.msg_iter);
+	conn->rx_buf_off += n;
+	conn->rx_buf_len -= n;
+	if (conn->rx_buf_len == 0)
+		conn->rx_buf_off = 0;
+}
+
+/* Receives as much as available into the empty receive buffer */
+static int iscsi_rx_buf_fill(struct iscsi_conn *conn)
+{
+	struct msghdr msg = {};
+	struct kvec iov = {
+		.iov_base = conn->rx_buf,
+		.iov_len = ISCSI_RX_BUF_SIZE,
+	};
+	int res;
+
+	EXTRACHECKS_BUG_ON(conn->rx_buf_len != 0);
+
+	iov_iter_kvec(&msg.msg_iter, READ, &iov, 1, ISCSI_RX_BUF_SIZE);
+	res = iscsi_sock_recvmsg(conn, &msg, ISCSI_RX_BUF_SIZE);
+	if (res > 0) {
+		conn->rx_buf_off = 0;
+		conn->rx_buf_len = res;
+	}
+
+	return res;
+}
+#else
+static inline bool iscsi_rx_buffered(const struct iscsi_conn *conn)
+{
+	return false;
+}
+#endif
+
 /* Returns number of bytes left to receive or <0 for error */
 static int do_recv(struct iscsi_conn *conn)
 {
 	int res;
-	mm_segment_t oldfs;
 	struct msghdr *msg;
 	int read_size;
+	bool busy_polled = false;
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3, 19, 0)
 	struct iovec *first_iov;
 	int first_len;
@@ -554,21 +645,37 @@ static int do_recv(struct iscsi_conn *conn)
 restart:
 	msg = &conn->read_msg;
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)
+	if (conn->rx_buf_len != 0) {
+		iscsi_rx_buf_copy(conn);
+		if (msg->msg_iter.count == 0) {
+			res = 0;
+			goto out;
+		}
+	}
+
 	read_size = msg->msg_iter.count;
+
+	/*
+	 * Small reads go through the receive buffer, big ones, i.e. data,
+	 * directly to their pages to not copy them.
+	 */
+	if (read_size < ISCSI_RX_DIRECT_SIZE) {
+		res = iscsi_rx_buf_fill(conn);
+		TRACE_DBG("rx_buf fill: read_size %d, res %d", read_size, res);
+		if (res > 0) {
+			iscsi_rx_buf_copy(conn);
+			res = msg->msg_iter.count;
+			goto out;
+		}
+		goto out_err;
+	}
 #else
 	read_size = conn->read_size;
 	first_iov = msg->msg_iov;
 	first_len = first_iov->iov_len;
 #endif
 
-	oldfs = get_fs();
-	set_fs(KERNEL_DS);
-	res = sock_recvmsg(conn->sock, msg,
-#if SOCK_RECVMSG_HAS_FOUR_ARGS
-			   read_size,
-#endif
-			   MSG_DONTWAIT | MSG_NOSIGNAL);
-	set_fs(oldfs);
+	res = iscsi_sock_recvmsg(conn, msg, read_size);
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)
 	TRACE_DBG("nr_segs %ld, bytes_left %zd, res %d",
@@ -592,25 +699,33 @@ restart:
 		conn->read_size -= res;
 		res = conn->read_size;
 #endif
-	} else {
-		switch (res) {
-		case -EAGAIN:
-			TRACE_DBG("EAGAIN received for conn %p", conn);
-			res = read_size;
-			break;
-		case -ERESTARTSYS:
-			TRACE_DBG("ERESTARTSYS received for conn %p", conn);
+		goto out;
+	}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)
+out_err:
+#endif
+	switch (res) {
+	case -EAGAIN:
+		TRACE_DBG("EAGAIN received for conn %p", conn);
+		if (!busy_polled && iscsi_rx_busy_poll(conn)) {
+			busy_polled = true;
 			goto restart;
-		default:
-			if (!conn->closing) {
-				PRINT_ERROR("sock_recvmsg() failed: %d (conn %p)",
-					res, conn);
-				mark_conn_closed(conn);
-			}
-			if (res == 0)
-				res = -EIO;
-			break;
 		}
+		res = read_size;
+		break;
+	case -ERESTARTSYS:
+		TRACE_DBG("ERESTARTSYS received for conn %p", conn);
+		goto restart;
+	default:
+		if (!conn->closing) {
+			PRINT_ERROR("sock_recvmsg() failed: %d (conn %p)",
+				res, conn);
+			mark_conn_closed(conn);
+		}
+		if (res == 0)
+			res = -EIO;
+		break;
 	}
 
 out:
@@ -688,7 +803,7 @@ static int iscsi_rx_check_ddigest(struct iscsi_conn *conn)
 static int process_read_io(struct iscsi_conn *conn, int *closed)
 {
 	struct iscsi_cmnd *cmnd = conn->read_cmnd;
-	int bytes_left, res;
+	int bytes_left, res, batch = 0;
 
 	TRACE_ENTRY();
 
@@ -796,6 +911,25 @@ static int process_read_io(struct iscsi_conn *conn, int *closed)
 						 bytes_left);
 				sBUG();
 			}
+
+			/*
+			 * Immediate data were received in the early buffer
+			 * before preprocessing finished, see scsi_cmnd_start().
+			 */
+			if (cmnd->early_rx) {
+				if (cmnd->scst_state == ISCSI_CMD_STATE_RX_CMD) {
+					TRACE_DBG("cmnd %p is still in RX_CMD state",
+						cmnd);
+					res = 1;
+					break;
+				}
+				res = cmnd_rx_continue(cmnd);
+				if (unlikely(res != 0)) {
+					sBUG_ON(!conn->closing);
+					break;
+				}
+			}
+
 			conn->read_cmnd = NULL;
 			conn->read_state = RX_INIT_BHS;
 
@@ -807,12 +941,22 @@ static int process_read_io(struct iscsi_conn *conn, int *closed)
 			EXTRACHECKS_BUG_ON(conn->read_size != 0);
 #endif
 
+			conn->rx_pdus++;
+
 			/*
-			 * To maintain fairness. Res must be 0 here anyway, the
-			 * assignment is only to remove compiler warning about
-			 * uninitialized variable.
+			 * Res must be 0 here anyway, the assignment is only
+			 * to remove compiler warning about uninitialized
+			 * variable.
 			 */
 			res = 0;
+
+			/*
+			 * Go on with PDUs already in the receive buffer, but
+			 * to maintain fairness not with too many of them.
+			 */
+			if (iscsi_rx_buffered(conn) &&
+			    (++batch < ISCSI_RX_MAX_BATCH))
+				break;
 			goto out;
 
 		case RX_INIT_HDIGEST:
@@ -1138,6 +1282,7 @@ static int write_data(struct iscsi_conn *conn)
 
 			sBUG_ON(count > ARRAY_SIZE(conn->write_iov));
 retry:
+			conn->tx_send_calls++;
 			res = scst_writev(file, iop, count, &off);
 			TRACE_WRITE("sid %#Lx, cid %u, res %d, iov_len %zd",
 				    (unsigned long long)conn->session->sid,
@@ -1231,6 +1376,7 @@ retry:
 		sendsize = min(size, length);
 		if (size <= sendsize) {
 retry2:
+			conn->tx_send_calls++;
 			res = sendpage(sock, page, offset, size, flags);
 			TRACE_WRITE("Final %s sid %#Lx, cid %u, res %d (page index %lu, offset %u, size %u, cmd %p, page %p)",
 				(sendpage != sock_no_sendpage) ?
@@ -1257,6 +1403,7 @@ retry2:
 		}
 
 retry1:
+		conn->tx_send_calls++;
 		res = sendpage(sock, page, offset, sendsize, flags | MSG_MORE);
 		TRACE_WRITE("%s sid %#Lx, cid %u, res %d (page index %lu, offset %u, sendsize %u, size %u, cmd %p, page %p)",
 			(sendpage != sock_no_sendpage) ? "sendpage" :
@@ -1372,6 +1519,7 @@ static int tx_ddigest(struct iscsi_cmnd *cmnd, int state)
 	iov.iov_base = (char *)(&cmnd->ddigest) + (sizeof(u32) - rest);
 	iov.iov_len = rest;
 
+	cmnd->conn->tx_send_calls++;
 	res = kernel_sendmsg(cmnd->conn->sock, &msg, &iov, 1, rest);
 	if (res > 0) {
 		cmnd->conn->write_size -= res;
@@ -1419,6 +1567,7 @@ static int tx_padding(struct iscsi_cmnd *cmnd, int state)
 	iov.iov_base = (char *)&padding;
 	iov.iov_len = rest;
 
+	cmnd->conn->tx_send_calls++;
 	res = kernel_sendmsg(cmnd->conn->sock, &msg, &iov, 1, rest);
 	if (res > 0) {
 		cmnd->conn->write_size -= res;
@@ -1473,6 +1622,7 @@ int iscsi_send(struct iscsi_conn *conn)
 		if (!cmnd)
 			goto out;
 		cmnd_tx_start(cmnd);
+		conn->tx_batch_bytes += conn->write_size;
 		if (!(conn->hdigest_type & DIGEST_NONE))
 			init_tx_hdigest(cmnd);
 		conn->write_state = TX_BHS_DATA;
@@ -1525,12 +1675,67 @@ int iscsi_send(struct iscsi_conn *conn)
 
 	conn->write_cmnd = NULL;
 	conn->write_state = TX_INIT;
+	conn->tx_batch_pdus++;
+	conn->tx_pdus++;
 
 out:
 	TRACE_EXIT_RES(res);
 	return res;
 }
 
+/*
+ * Pushes out the PDUs sent since the last flush by uncorking the socket,
+ * unless a PDU is partially sent. No locks, conn is wr processing.
+ */
+void iscsi_tx_flush(struct iscsi_conn *conn)
+{
+	iscsi_extracheck_is_wr_thread(conn);
+
+	if (!conn->tx_corked || (conn->write_state != TX_INIT))
+		return;
+
+	iscsi_tx_uncork(conn);
+
+	if (conn->tx_batch_pdus != 0)
+		conn->tx_batches++;
+	conn->tx_batch_pdus = 0;
+	conn->tx_batch_bytes = 0;
+	return;
+}
+
+/*
+ * Sends the queued PDUs of conn in one corked batch, so that TCP
+ * coalesces them into as few segments as possible, then flushes it. The
+ * batch is limited to maintain fairness between connections.
+ *
+ * The same as for iscsi_send(), conn must be protected by an additional
+ * conn_get().
+ */
+int iscsi_send_batch(struct iscsi_conn *conn)
+{
+	int res;
+
+	TRACE_ENTRY();
+
+	while (1) {
+		res = iscsi_send(conn);
+		if (res <= 0)
+			break;
+		/* Finish the PDU being sent, e.g. its padding and digest */
+		if (conn->write_state != TX_INIT)
+			continue;
+		if ((conn->tx_batch_pdus >= ISCSI_TX_MAX_BATCH) ||
+		    (conn->tx_batch_bytes >= ISCSI_TX_MAX_BATCH_SIZE) ||
+		    list_empty(&conn->write_list))
+			break;
+	}
+
+	iscsi_tx_flush(conn);
+
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
 /*
  * Called under wr_lock and BHs disabled, but will drop it inside,
  * then reacquire.
@@ -1567,7 +1772,7 @@ static void scst_do_job_wr(struct iscsi_thread_pool *p)
 
 		conn_get(conn);
 
-		rc = iscsi_send(conn);
+		rc = iscsi_send_batch(conn);
 
 		spin_lock_bh(&p->wr_lock);
 #ifdef CONFIG_SCST_EXTRACHECKS
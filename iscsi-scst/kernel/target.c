@@ -421,8 +421,258 @@ out:
 static struct kobj_attribute iscsi_tgt_attr_tid =
 	__ATTR(tid, S_IRUGO, iscsi_tgt_tid_show, NULL);
 
+/* Block sizes of T10-PI devices signature MR capable HCAs can handle */
+static const int iscsi_t10_pi_block_sizes[] = { 512, 4096, 0 };
+
+static ssize_t iscsi_tgt_t10_pi_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	int res = -E_TGT_PRIV_NOT_YET_SET;
+	struct scst_tgt *scst_tgt;
+	struct iscsi_target *tgt;
+
+	TRACE_ENTRY();
+
+	scst_tgt = container_of(kobj, struct scst_tgt, tgt_kobj);
+	tgt = scst_tgt_get_tgt_priv(scst_tgt);
+	if (!tgt)
+		goto out;
+
+	res = sprintf(buf, "%d\n%s", tgt->t10_pi,
+		tgt->t10_pi ? SCST_SYSFS_KEY_MARK "\n" : "");
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+/*
+ * T10-PI is only available over iSER through the HCA, so the target then
+ * accepts only iSER connections of PI capable HCAs.
+ */
+static ssize_t iscsi_tgt_t10_pi_store(struct kobject *kobj,
+	struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	int res;
+	struct scst_tgt *scst_tgt;
+	struct iscsi_target *tgt;
+	unsigned long val;
+
+	TRACE_ENTRY();
+
+	scst_tgt = container_of(kobj, struct scst_tgt, tgt_kobj);
+	tgt = scst_tgt_get_tgt_priv(scst_tgt);
+	if (!tgt) {
+		res = -E_TGT_PRIV_NOT_YET_SET;
+		goto out;
+	}
+
+	res = kstrtoul(buf, 0, &val);
+	if (res != 0) {
+		PRINT_ERROR("kstrtoul() for %s failed: %d ", buf, res);
+		goto out;
+	}
+
+	mutex_lock(&tgt->target_mutex);
+
+	if (!list_empty(&tgt->session_list)) {
+		PRINT_ERROR("Can't change t10_pi of target %s with active "
+			"sessions", tgt->name);
+		res = -EBUSY;
+		goto out_unlock;
+	}
+
+	tgt->t10_pi = (val != 0);
+	scst_tgt_set_dif_supported(scst_tgt, tgt->t10_pi);
+	scst_tgt_set_hw_dif_type1_supported(scst_tgt, tgt->t10_pi);
+	scst_tgt_set_hw_dif_type3_supported(scst_tgt, tgt->t10_pi);
+	scst_tgt_set_supported_dif_block_sizes(scst_tgt,
+		tgt->t10_pi ? iscsi_t10_pi_block_sizes : NULL);
+	/*
+	 * Iscsi_template has no_clustering set, so each SG entry is a page.
+	 * Capping sg_tablesize makes SCST advertise the matching maximum
+	 * transfer length and reject larger commands.
+	 */
+	scst_tgt_set_sg_tablesize(scst_tgt, tgt->t10_pi ?
+		ISCSI_T10_PI_MAX_PAGES : iscsi_template.sg_tablesize);
+
+	PRINT_INFO("T10-PI offload %s for target %s",
+		tgt->t10_pi ? "enabled" : "disabled", tgt->name);
+
+	res = count;
+
+out_unlock:
+	mutex_unlock(&tgt->target_mutex);
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+static struct kobj_attribute iscsi_tgt_attr_t10_pi =
+	__ATTR(t10_pi, S_IRUGO | S_IWUSR, iscsi_tgt_t10_pi_show,
+		iscsi_tgt_t10_pi_store);
+
+static ssize_t iscsi_tgt_rx_busy_poll_us_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	int res = -E_TGT_PRIV_NOT_YET_SET;
+	struct scst_tgt *scst_tgt;
+	struct iscsi_target *tgt;
+
+	TRACE_ENTRY();
+
+	scst_tgt = container_of(kobj, struct scst_tgt, tgt_kobj);
+	tgt = scst_tgt_get_tgt_priv(scst_tgt);
+	if (!tgt)
+		goto out;
+
+	res = sprintf(buf, "%u\n%s", tgt->rx_busy_poll_us,
+		tgt->rx_busy_poll_us ? SCST_SYSFS_KEY_MARK "\n" : "");
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+/*
+ * Busy polling makes the read threads spin on the NIC queue instead of
+ * waiting for the interrupt, which at low queue depth saves the wake up
+ * latency at the cost of CPU. Applies to new connections.
+ */
+static ssize_t iscsi_tgt_rx_busy_poll_us_store(struct kobject *kobj,
+	struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	int res;
+	struct scst_tgt *scst_tgt;
+	struct iscsi_target *tgt;
+	unsigned int val;
+
+	TRACE_ENTRY();
+
+	scst_tgt = container_of(kobj, struct scst_tgt, tgt_kobj);
+	tgt = scst_tgt_get_tgt_priv(scst_tgt);
+	if (!tgt) {
+		res = -E_TGT_PRIV_NOT_YET_SET;
+		goto out;
+	}
+
+	res = kstrtouint(buf, 0, &val);
+	if (res != 0) {
+		PRINT_ERROR("kstrtouint() for %s failed: %d ", buf, res);
+		goto out;
+	}
+
+#ifndef CONFIG_NET_RX_BUSY_POLL
+	if (val != 0) {
+		PRINT_ERROR("Busy polling requires CONFIG_NET_RX_BUSY_POLL "
+			"(target %s)", tgt->name);
+		res = -EOPNOTSUPP;
+		goto out;
+	}
+#endif
+
+	mutex_lock(&tgt->target_mutex);
+	tgt->rx_busy_poll_us = val;
+	mutex_unlock(&tgt->target_mutex);
+
+	PRINT_INFO("Receive busy polling for new connections of target %s "
+		"set to %u us", tgt->name, val);
+
+	res = count;
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+static struct kobj_attribute iscsi_tgt_attr_rx_busy_poll_us =
+	__ATTR(rx_busy_poll_us, S_IRUGO | S_IWUSR,
+		iscsi_tgt_rx_busy_poll_us_show,
+		iscsi_tgt_rx_busy_poll_us_store);
+
+static ssize_t iscsi_tgt_early_write_buf_size_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	int res = -E_TGT_PRIV_NOT_YET_SET;
+	struct scst_tgt *scst_tgt;
+	struct iscsi_target *tgt;
+
+	TRACE_ENTRY();
+
+	scst_tgt = container_of(kobj, struct scst_tgt, tgt_kobj);
+	tgt = scst_tgt_get_tgt_priv(scst_tgt);
+	if (!tgt)
+		goto out;
+
+	res = sprintf(buf, "%u\n%s", tgt->early_write_buf_size,
+		tgt->early_write_buf_size ? SCST_SYSFS_KEY_MARK "\n" : "");
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+/*
+ * WRITEs not larger than this, which carry all data as immediate data, get
+ * their data buffer allocated on the command PDU receive and are executed
+ * directly in the read thread. Useful for small writes at low queue depth.
+ */
+static ssize_t iscsi_tgt_early_write_buf_size_store(struct kobject *kobj,
+	struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	int res;
+	struct scst_tgt *scst_tgt;
+	struct iscsi_target *tgt;
+	unsigned int val;
+
+	TRACE_ENTRY();
+
+	scst_tgt = container_of(kobj, struct scst_tgt, tgt_kobj);
+	tgt = scst_tgt_get_tgt_priv(scst_tgt);
+	if (!tgt) {
+		res = -E_TGT_PRIV_NOT_YET_SET;
+		goto out;
+	}
+
+	res = kstrtouint(buf, 0, &val);
+	if (res != 0) {
+		PRINT_ERROR("kstrtouint() for %s failed: %d ", buf, res);
+		goto out;
+	}
+
+	if (val > ISCSI_EARLY_WRITE_BUF_MAX_SIZE) {
+		PRINT_ERROR("Too large early write buffer size %u (max %u, "
+			"target %s)", val, ISCSI_EARLY_WRITE_BUF_MAX_SIZE,
+			tgt->name);
+		res = -EINVAL;
+		goto out;
+	}
+
+	mutex_lock(&tgt->target_mutex);
+	WRITE_ONCE(tgt->early_write_buf_size, val);
+	mutex_unlock(&tgt->target_mutex);
+
+	PRINT_INFO("Early write buffer size of target %s set to %u",
+		tgt->name, val);
+
+	res = count;
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+static struct kobj_attribute iscsi_tgt_attr_early_write_buf_size =
+	__ATTR(early_write_buf_size, S_IRUGO | S_IWUSR,
+		iscsi_tgt_early_write_buf_size_show,
+		iscsi_tgt_early_write_buf_size_store);
+
 const struct attribute *iscsi_tgt_attrs[] = {
 	&iscsi_tgt_attr_tid.attr,
+	&iscsi_tgt_attr_t10_pi.attr,
+	&iscsi_tgt_attr_rx_busy_poll_us.attr,
+	&iscsi_tgt_attr_early_write_buf_size.attr,
 	NULL,
 };
 
@@ -58,6 +58,7 @@ void conn_free(struct connection *conn)
 	free(conn->user);
 	if (conn->auth_method == AUTH_CHAP)
 		free(conn->auth.chap.challenge);
+	tls_conn_free(conn);
 	free(conn);
 	return;
 }
@@ -62,6 +62,13 @@ static struct option const long_options[] = {
 	{"gid", required_argument, 0, 'g'},
 	{"address", required_argument, 0, 'a'},
 	{"port", required_argument, 0, 'p'},
+#ifdef CONFIG_ISCSI_TLS
+	{"tls-cert", required_argument, 0, 'C'},
+	{"tls-key", required_argument, 0, 'K'},
+	{"tls-ca", required_argument, 0, 'A'},
+	{"tls-priority", required_argument, 0, 'P'},
+	{"tls-required", no_argument, 0, 'T'},
+#endif
 	{"version", no_argument, 0, 'v'},
 	{"help", no_argument, 0, 'h'},
 	{0, 0, 0, 0},
@@ -87,6 +94,17 @@ iSCSI target daemon.\n\
   -p, --port=port            listen on specified port instead of 3260\n\
   -h, --help                 display this help and exit\n\
 ");
+#ifdef CONFIG_ISCSI_TLS
+		printf("\
+  -C, --tls-cert=path        PEM certificate to accept TLS connections with\n\
+  -K, --tls-key=path         PEM private key of the TLS certificate\n\
+  -A, --tls-ca=path          PEM CA bundle to require and verify initiator\n\
+                             certificates with\n\
+  -P, --tls-priority=string  GnuTLS priority string, must only allow\n\
+                             ciphers supported by kTLS\n\
+  -T, --tls-required         refuse plain text (non-TLS) connections\n\
+");
+#endif
 	}
 	exit(1);
 }
@@ -505,6 +523,8 @@ static void accept_connection(int listen)
 	conn->getsockname = getsockname;
 	conn->is_discovery = tcp_is_discovery;
 	conn_read_pdu(conn);
+	if (tls_active())
+		conn->iostate = IOSTATE_TLS_PROBE;
 
 	incoming_cnt++;
 
@@ -538,6 +558,19 @@ static void event_conn(struct connection *conn, struct pollfd *pollfd)
 
 again:
 	switch (conn->iostate) {
+	case IOSTATE_TLS_PROBE:
+	case IOSTATE_TLS_HANDSHAKE:
+		res = tls_conn_event(conn, pollfd);
+		if (res == -EAGAIN)
+			break;
+		else if (res != 0) {
+			conn->state = STATE_DROP;
+			goto out;
+		}
+		conn_read_pdu(conn);
+		pollfd->events = POLLIN;
+		break;
+
 	case IOSTATE_READ_BHS:
 	case IOSTATE_READ_AHS_DATA:
 	      read_again:
@@ -883,7 +916,7 @@ int main(int argc, char **argv)
 	int rc = sigaction(SIGPIPE, &act, NULL);
 	assert(rc == 0);
 
-	while ((ch = getopt_long(argc, argv, "c:fd:s:u:g:a:p:vh", long_options, &longindex)) >= 0) {
+	while ((ch = getopt_long(argc, argv, "c:fd:s:u:g:a:p:C:K:A:P:Tvh", long_options, &longindex)) >= 0) {
 		switch (ch) {
 		case 'c':
 			config = optarg;
@@ -925,6 +958,23 @@ int main(int argc, char **argv)
 		case 'p':
 			server_port = (uint16_t)strtoul(optarg, NULL, 0);
 			break;
+#ifdef CONFIG_ISCSI_TLS
+		case 'C':
+			tls_cert_file = optarg;
+			break;
+		case 'K':
+			tls_key_file = optarg;
+			break;
+		case 'A':
+			tls_ca_file = optarg;
+			break;
+		case 'P':
+			tls_priority = optarg;
+			break;
+		case 'T':
+			tls_required = 1;
+			break;
+#endif
 		case 'v':
 			printf("%s version %s\n", program_name, ISCSI_VERSION_STRING);
 			exit(0);
@@ -968,6 +1018,12 @@ int main(int argc, char **argv)
 	}
 
 	log_init();
+
+#ifdef CONFIG_ISCSI_TLS
+	if (tls_init() != 0)
+		exit(-1);
+#endif
+
 	if (log_daemon) {
 		char buf[64];
 		pid_t pid;
@@ -17,6 +17,7 @@
 #ifndef ISCSID_H
 #define ISCSID_H
 
+#include <errno.h>
 #include <search.h>
 #include <sys/types.h>
 #include <poll.h>
@@ -131,6 +132,9 @@ struct connection {
 
 	bool is_iser;
 
+	/* gnutls_session_t while the TLS handshake is in progress */
+	void *tls_session;
+
 	int (*cork_transmit)(int fd);
 	int (*uncork_transmit)(int fd);
 	int (*getsockname)(int fd, struct sockaddr *name, socklen_t *namelen);
@@ -143,6 +147,8 @@ struct connection {
 #define IOSTATE_WRITE_BHS	3
 #define IOSTATE_WRITE_AHS	4
 #define IOSTATE_WRITE_DATA	5
+#define IOSTATE_TLS_PROBE	6
+#define IOSTATE_TLS_HANDSHAKE	7
 
 #define STATE_FREE		0
 #define STATE_SECURITY		1
@@ -388,6 +394,25 @@ extern void iscsi_attr_destroy(struct iscsi_attr *attr);
 extern int iscsi_attr_replace(struct __qelem *attrs_list, const char *sysfs_name,
 	char *raw_value);
 
+/* tls.c */
+#ifdef CONFIG_ISCSI_TLS
+extern char *tls_cert_file;
+extern char *tls_key_file;
+extern char *tls_ca_file;
+extern char *tls_priority;
+extern int tls_required;
+
+extern int tls_init(void);
+extern bool tls_active(void);
+extern int tls_conn_event(struct connection *conn, struct pollfd *pollfd);
+extern void tls_conn_free(struct connection *conn);
+#else
+static inline bool tls_active(void) { return false; }
+static inline int tls_conn_event(struct connection *conn,
+	struct pollfd *pollfd) { return -EOPNOTSUPP; }
+static inline void tls_conn_free(struct connection *conn) {}
+#endif
+
 /* isns.c */
 extern char *isns_server;
 extern int isns_access_control;
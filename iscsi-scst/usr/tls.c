@@ -0,0 +1,412 @@
+/*
+ *  tls.c - TLS transport support for iSCSI-SCST.
+ *
+ *  The TLS handshake is performed here with GnuTLS, after which the
+ *  negotiated keys are installed into the kernel TLS (kTLS) layer of the
+ *  connection socket. From that point on both iscsi-scstd (during login)
+ *  and the iscsi-scst kernel module (in full feature phase) use the socket
+ *  as a plain TCP socket, while the kernel, or the NIC if it supports TLS
+ *  offload, does the record encryption and decryption.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation, version 2
+ *  of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+
+#include <gnutls/gnutls.h>
+
+#include "iscsid.h"
+
+#ifndef SOL_TLS
+#define SOL_TLS			282
+#endif
+
+#ifndef TCP_ULP
+#define TCP_ULP			31
+#endif
+
+/* First byte of a TLS handshake record (ContentType handshake) */
+#define TLS_RECORD_HANDSHAKE	0x16
+
+/*
+ * Only ciphers, which kTLS can take over, may be negotiated, otherwise
+ * the connection couldn't be passed to the kernel after login.
+ */
+#define TLS_DEFAULT_PRIORITY	"SECURE128:-VERS-ALL:+VERS-TLS1.3:+VERS-TLS1.2:" \
+				"-CIPHER-ALL:+AES-128-GCM:+AES-256-GCM"
+
+char *tls_cert_file;
+char *tls_key_file;
+char *tls_ca_file;
+char *tls_priority;
+int tls_required;
+
+static bool tls_enabled;
+static gnutls_certificate_credentials_t tls_creds;
+static gnutls_priority_t tls_prio;
+
+int tls_init(void)
+{
+	int res;
+	const char *err_pos;
+
+	if (tls_cert_file == NULL && tls_key_file == NULL) {
+		if (tls_required) {
+			log_error("TLS is required, but no TLS certificate "
+				"and key configured");
+			res = -EINVAL;
+			goto out;
+		}
+		res = 0;
+		goto out;
+	}
+
+	if (tls_cert_file == NULL || tls_key_file == NULL) {
+		log_error("Both TLS certificate and key must be specified");
+		res = -EINVAL;
+		goto out;
+	}
+
+	res = gnutls_global_init();
+	if (res < 0) {
+		log_error("gnutls_global_init() failed: %s",
+			gnutls_strerror(res));
+		res = -EINVAL;
+		goto out;
+	}
+
+	res = gnutls_certificate_allocate_credentials(&tls_creds);
+	if (res < 0) {
+		log_error("Unable to allocate TLS credentials: %s",
+			gnutls_strerror(res));
+		goto out_deinit;
+	}
+
+	res = gnutls_certificate_set_x509_key_file(tls_creds, tls_cert_file,
+			tls_key_file, GNUTLS_X509_FMT_PEM);
+	if (res < 0) {
+		log_error("Unable to load TLS certificate %s or key %s: %s",
+			tls_cert_file, tls_key_file, gnutls_strerror(res));
+		goto out_free_creds;
+	}
+
+	if (tls_ca_file != NULL) {
+		res = gnutls_certificate_set_x509_trust_file(tls_creds,
+				tls_ca_file, GNUTLS_X509_FMT_PEM);
+		if (res < 0) {
+			log_error("Unable to load TLS CA file %s: %s",
+				tls_ca_file, gnutls_strerror(res));
+			goto out_free_creds;
+		}
+	}
+
+	res = gnutls_priority_init(&tls_prio,
+			tls_priority ? tls_priority : TLS_DEFAULT_PRIORITY,
+			&err_pos);
+	if (res < 0) {
+		log_error("Invalid TLS priority string near \"%s\": %s",
+			err_pos ? err_pos : "", gnutls_strerror(res));
+		goto out_free_creds;
+	}
+
+	tls_enabled = true;
+
+	log_info("TLS enabled (certificate %s%s)", tls_cert_file,
+		tls_required ? ", required" : "");
+
+	res = 0;
+
+out:
+	return res;
+
+out_free_creds:
+	gnutls_certificate_free_credentials(tls_creds);
+
+out_deinit:
+	gnutls_global_deinit();
+	res = -EINVAL;
+	goto out;
+}
+
+bool tls_active(void)
+{
+	return tls_enabled;
+}
+
+void tls_conn_free(struct connection *conn)
+{
+	if (conn->tls_session != NULL) {
+		gnutls_deinit(conn->tls_session);
+		conn->tls_session = NULL;
+	}
+	return;
+}
+
+static int tls_fill_crypto_info(gnutls_session_t session, int read,
+	void *crypto_info, socklen_t *len)
+{
+	gnutls_datum_t mac_key, iv, cipher_key;
+	unsigned char seq[8];
+	bool tls13 = gnutls_protocol_get_version(session) == GNUTLS_TLS1_3;
+	int res;
+
+	res = gnutls_record_get_state(session, read, &mac_key, &iv,
+			&cipher_key, seq);
+	if (res < 0) {
+		log_error("gnutls_record_get_state() failed: %s",
+			gnutls_strerror(res));
+		res = -EINVAL;
+		goto out;
+	}
+
+	/*
+	 * For TLS 1.2 GnuTLS returns only the 4 bytes implicit part of the
+	 * nonce and the explicit part is the record sequence number, while
+	 * for TLS 1.3 the whole 12 bytes static IV is returned.
+	 */
+	switch (gnutls_cipher_get(session)) {
+	case GNUTLS_CIPHER_AES_128_GCM:
+	{
+		struct tls12_crypto_info_aes_gcm_128 *ci = crypto_info;
+
+		memset(ci, 0, sizeof(*ci));
+		ci->info.version = tls13 ? TLS_1_3_VERSION : TLS_1_2_VERSION;
+		ci->info.cipher_type = TLS_CIPHER_AES_GCM_128;
+		memcpy(ci->salt, iv.data, TLS_CIPHER_AES_GCM_128_SALT_SIZE);
+		memcpy(ci->iv, tls13 ? iv.data + TLS_CIPHER_AES_GCM_128_SALT_SIZE : seq,
+			TLS_CIPHER_AES_GCM_128_IV_SIZE);
+		memcpy(ci->rec_seq, seq, TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+		memcpy(ci->key, cipher_key.data, TLS_CIPHER_AES_GCM_128_KEY_SIZE);
+		*len = sizeof(*ci);
+		break;
+	}
+	case GNUTLS_CIPHER_AES_256_GCM:
+	{
+		struct tls12_crypto_info_aes_gcm_256 *ci = crypto_info;
+
+		memset(ci, 0, sizeof(*ci));
+		ci->info.version = tls13 ? TLS_1_3_VERSION : TLS_1_2_VERSION;
+		ci->info.cipher_type = TLS_CIPHER_AES_GCM_256;
+		memcpy(ci->salt, iv.data, TLS_CIPHER_AES_GCM_256_SALT_SIZE);
+		memcpy(ci->iv, tls13 ? iv.data + TLS_CIPHER_AES_GCM_256_SALT_SIZE : seq,
+			TLS_CIPHER_AES_GCM_256_IV_SIZE);
+		memcpy(ci->rec_seq, seq, TLS_CIPHER_AES_GCM_256_REC_SEQ_SIZE);
+		memcpy(ci->key, cipher_key.data, TLS_CIPHER_AES_GCM_256_KEY_SIZE);
+		*len = sizeof(*ci);
+		break;
+	}
+	default:
+		log_error("Negotiated TLS cipher %s is not supported by kTLS",
+			gnutls_cipher_get_name(gnutls_cipher_get(session)));
+		res = -EINVAL;
+		goto out;
+	}
+
+	res = 0;
+
+out:
+	return res;
+}
+
+/*
+ * Hands the record layer of the established TLS session over to the kernel.
+ * The kernel transparently uses the NIC TLS offload (TLS_HW), if the
+ * egress/ingress device supports it, otherwise falls back to the software
+ * kTLS implementation.
+ */
+static int tls_enable_ktls(struct connection *conn, int fd)
+{
+	gnutls_session_t session = conn->tls_session;
+	union {
+		struct tls12_crypto_info_aes_gcm_128 aes128;
+		struct tls12_crypto_info_aes_gcm_256 aes256;
+	} crypto_info;
+	socklen_t len;
+	int res;
+
+	/*
+	 * Records, which GnuTLS has already read from the socket, would be
+	 * lost for the kernel.
+	 */
+	if (gnutls_record_check_pending(session) != 0) {
+		log_error("Initiator sent data before TLS handshake "
+			"completed (fd %d)", fd);
+		res = -EPROTO;
+		goto out;
+	}
+
+	res = setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls"));
+	if (res != 0) {
+		res = -errno;
+		log_error("Unable to set TLS ULP (is tls module loaded?): %s",
+			strerror(-res));
+		goto out;
+	}
+
+	res = tls_fill_crypto_info(session, 0, &crypto_info, &len);
+	if (res != 0)
+		goto out;
+
+	res = setsockopt(fd, SOL_TLS, TLS_TX, &crypto_info, len);
+	if (res != 0) {
+		res = -errno;
+		log_error("Unable to set TLS_TX: %s", strerror(-res));
+		goto out_clear;
+	}
+
+	res = tls_fill_crypto_info(session, 1, &crypto_info, &len);
+	if (res != 0)
+		goto out_clear;
+
+	res = setsockopt(fd, SOL_TLS, TLS_RX, &crypto_info, len);
+	if (res != 0) {
+		res = -errno;
+		log_error("Unable to set TLS_RX: %s", strerror(-res));
+		goto out_clear;
+	}
+
+out_clear:
+	memset(&crypto_info, 0, sizeof(crypto_info));
+
+out:
+	return res;
+}
+
+static int tls_conn_start(struct connection *conn, int fd)
+{
+	gnutls_session_t session;
+	int res;
+
+	res = gnutls_init(&session, GNUTLS_SERVER | GNUTLS_NONBLOCK |
+				    GNUTLS_NO_TICKETS);
+	if (res < 0) {
+		log_error("gnutls_init() failed: %s", gnutls_strerror(res));
+		goto out_err;
+	}
+	conn->tls_session = session;
+
+	res = gnutls_priority_set(session, tls_prio);
+	if (res < 0) {
+		log_error("gnutls_priority_set() failed: %s",
+			gnutls_strerror(res));
+		goto out_err;
+	}
+
+	res = gnutls_credentials_set(session, GNUTLS_CRD_CERTIFICATE,
+			tls_creds);
+	if (res < 0) {
+		log_error("gnutls_credentials_set() failed: %s",
+			gnutls_strerror(res));
+		goto out_err;
+	}
+
+	if (tls_ca_file != NULL)
+		gnutls_certificate_server_set_request(session,
+			GNUTLS_CERT_REQUIRE);
+
+	gnutls_transport_set_int(session, fd);
+
+	res = 0;
+
+out:
+	return res;
+
+out_err:
+	res = -EINVAL;
+	goto out;
+}
+
+/*
+ * Called from the event loop for connections in IOSTATE_TLS_PROBE and
+ * IOSTATE_TLS_HANDSHAKE iostates. Returns 0, if the connection should
+ * continue with the login, -EAGAIN, if more events must be waited for
+ * (pollfd->events updated accordingly), or other negative error code, if
+ * the connection must be dropped.
+ */
+int tls_conn_event(struct connection *conn, struct pollfd *pollfd)
+{
+	unsigned char b;
+	char *desc;
+	int res;
+
+	if (conn->iostate == IOSTATE_TLS_PROBE) {
+		/*
+		 * Both plain and TLS connections are accepted on the same
+		 * port. They are told apart by the first received byte: a
+		 * login request BHS never starts with 0x16.
+		 */
+		res = recv(pollfd->fd, &b, 1, MSG_PEEK);
+		if (res <= 0) {
+			if (res < 0 && (errno == EINTR || errno == EAGAIN)) {
+				res = -EAGAIN;
+				goto out;
+			}
+			res = -ECONNRESET;
+			goto out;
+		}
+
+		if (b != TLS_RECORD_HANDSHAKE) {
+			if (tls_required) {
+				log_warning("Plain text connection (fd %d) "
+					"refused, because TLS is required",
+					pollfd->fd);
+				res = -EPROTO;
+				goto out;
+			}
+			res = 0;
+			goto out;
+		}
+
+		res = tls_conn_start(conn, pollfd->fd);
+		if (res != 0)
+			goto out;
+
+		conn->iostate = IOSTATE_TLS_HANDSHAKE;
+	}
+
+	res = gnutls_handshake(conn->tls_session);
+	if (res == GNUTLS_E_AGAIN || res == GNUTLS_E_INTERRUPTED) {
+		pollfd->events = gnutls_record_get_direction(conn->tls_session) ?
+					POLLOUT : POLLIN;
+		res = -EAGAIN;
+		goto out;
+	} else if (res < 0) {
+		log_warning("TLS handshake on fd %d failed: %s", pollfd->fd,
+			gnutls_strerror(res));
+		res = -EPROTO;
+		goto out;
+	}
+
+	res = tls_enable_ktls(conn, pollfd->fd);
+	if (res != 0)
+		goto out;
+
+	desc = gnutls_session_get_desc(conn->tls_session);
+	log_info("TLS established on fd %d: %s", pollfd->fd, desc ? desc : "");
+	gnutls_free(desc);
+
+	/* The record layer now belongs to the kernel */
+	tls_conn_free(conn);
+
+	res = 0;
+
+out:
+	return res;
+}
@@ -1360,6 +1360,7 @@ static int sqa_init_scst_tgt(struct scsi_qla_host *vha)
 	scst_tgt_set_tgt_priv(scst_tgt, sqa_tgt);
 	scst_tgt_set_sg_tablesize(scst_tgt,
 				  vha->vha_tgt.qla_tgt->sg_tablesize);
+	scst_tgt_set_numa_node(scst_tgt, dev_to_node(&vha->hw->pdev->dev));
 
 	res = sysfs_create_link(scst_sysfs_get_tgt_kobj(scst_tgt),
 				&vha->host->shost_dev.kobj, "host");
@@ -1935,6 +1936,7 @@ static struct qla_tgt_func_tmpl sqa_qla2xxx_template = {
 	.chk_dif_tags		    = sqa_qla2xxx_chk_dif_tags,
 	.add_target		    = sqa_qla2xxx_add_target,
 	.remove_target		    = sqa_qla2xxx_remove_target,
+	.handle_cmd_atomic	    = true,
 };
 
 static int sqa_lport_callback(struct scsi_qla_host *vha,
@@ -2137,6 +2139,9 @@ static int __init sqa_init(void)
 	PRINT_INFO("sqatgt: Initializing SCST Cavium adapter target driver interface - driver version=%s, SCST version=%s, Cavium version=%s",
 		   SQA_VERSION, SCST_VERSION_NAME, QLA2XXX_VERSION);
 
+	/* Let SCST plug its threads, so that CTIO doorbells can be batched */
+	sqa_scst_template.plug_cmd_threads = qlt_ctio_batching_enabled();
+
 	res = scst_register_target_template(&sqa_scst_template);
 
 	if (res) {
@@ -3694,6 +3694,8 @@ struct qla_tgt_counters {
 	uint64_t num_q_full_sent;
 	uint64_t num_alloc_iocb_failed;
 	uint64_t num_term_xchg_sent;
+	uint64_t num_ctio_doorbells;
+	uint64_t num_ctio_batched;
 };
 
 struct qla_counters {
@@ -3822,6 +3824,10 @@ struct qla_qpair {
 	__le32	retry_term_exchg_addr;
 	uint64_t retry_term_jiff;
 	struct qla_tgt_counters tgt_counters;
+	/* CTIOs queued behind a deferred doorbell, under qp_lock_ptr */
+	uint16_t tgt_db_pending;
+	/* Rings the deferred doorbell after ql2xtgt_ctio_batch_usecs */
+	struct hrtimer tgt_db_timer;
 	uint16_t cpuid;
 	struct qla_fw_resources fwres ____cacheline_aligned;
 	u32	cmd_cnt;
@@ -288,7 +288,8 @@ qla_dfs_tgt_counters_show(struct seq_file *s, void *unused)
 	struct qla_qpair *qpair = vha->hw->base_qpair;
 	uint64_t qla_core_sbt_cmd, core_qla_que_buf, qla_core_ret_ctio,
 		core_qla_snd_status, qla_core_ret_sta_ctio, core_qla_free_cmd,
-		num_q_full_sent, num_alloc_iocb_failed, num_term_xchg_sent;
+		num_q_full_sent, num_alloc_iocb_failed, num_term_xchg_sent,
+		num_ctio_doorbells, num_ctio_batched;
 	u16 i;
 	fc_port_t *fcport = NULL;
 
@@ -304,6 +305,8 @@ qla_dfs_tgt_counters_show(struct seq_file *s, void *unused)
 	num_q_full_sent = qpair->tgt_counters.num_q_full_sent;
 	num_alloc_iocb_failed = qpair->tgt_counters.num_alloc_iocb_failed;
 	num_term_xchg_sent = qpair->tgt_counters.num_term_xchg_sent;
+	num_ctio_doorbells = qpair->tgt_counters.num_ctio_doorbells;
+	num_ctio_batched = qpair->tgt_counters.num_ctio_batched;
 
 	for (i = 0; i < vha->hw->max_qpairs; i++) {
 		qpair = vha->hw->queue_pair_map[i];
@@ -320,6 +323,8 @@ qla_dfs_tgt_counters_show(struct seq_file *s, void *unused)
 		num_alloc_iocb_failed +=
 		    qpair->tgt_counters.num_alloc_iocb_failed;
 		num_term_xchg_sent += qpair->tgt_counters.num_term_xchg_sent;
+		num_ctio_doorbells += qpair->tgt_counters.num_ctio_doorbells;
+		num_ctio_batched += qpair->tgt_counters.num_ctio_batched;
 	}
 
 	seq_puts(s, "Target Counters\n");
@@ -341,6 +346,13 @@ qla_dfs_tgt_counters_show(struct seq_file *s, void *unused)
 		num_term_xchg_sent);
 	seq_printf(s, "num Q full sent = %lld\n",
 		num_q_full_sent);
+	seq_printf(s, "num CTIO doorbells = %lld\n",
+		num_ctio_doorbells);
+	seq_printf(s, "num CTIOs per doorbell = %lld.%02lld\n",
+		num_ctio_doorbells ? div64_u64(num_ctio_batched,
+					       num_ctio_doorbells) : 0,
+		num_ctio_doorbells ? div64_u64(num_ctio_batched * 100,
+					       num_ctio_doorbells) % 100 : 0);
 
 	/* DIF stats */
 	seq_printf(s, "DIF Inp Bytes = %lld\n",
@@ -865,6 +865,9 @@ extern void qla2x00_sp_timeout(struct timer_list *);
 extern void qla2x00_bsg_job_done(srb_t *sp, int);
 extern void qla2x00_bsg_sp_free(srb_t *sp);
 extern void qla2x00_start_iocbs(struct scsi_qla_host *, struct req_que *);
+extern void qla2x00_advance_req_ring(struct req_que *);
+extern void qla2x00_ring_req_doorbell(struct scsi_qla_host *,
+	struct req_que *);
 
 /* Interrupt related */
 extern irqreturn_t qla82xx_intr_handler(int, void *);
@@ -9390,6 +9390,7 @@ struct qla_qpair *qla2xxx_create_qpair(struct scsi_qla_host *vha, int qos,
 		qpair->vha = vha;
 		qpair->qp_lock_ptr = &qpair->qp_lock;
 		spin_lock_init(&qpair->qp_lock);
+		qlt_init_qpair_ctio_batch(qpair);
 		qpair->use_shadow_reg = IS_SHADOW_REG_CAPABLE(ha) ? 1 : 0;
 
 		/* Assign available que pair id */
@@ -9534,6 +9535,7 @@ int qla2xxx_delete_qpair(struct scsi_qla_host *vha, struct qla_qpair *qpair)
 		vha->flags.qpairs_rsp_created = 0;
 	}
 	mempool_destroy(qpair->srb_mempool);
+	qlt_stop_qpair_ctio_batch(qpair);
 	kfree(qpair);
 	mutex_unlock(&ha->mq_lock);
 
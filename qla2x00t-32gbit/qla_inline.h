@@ -359,6 +359,22 @@ qla_qpair_to_hint(struct qla_tgt *tgt, struct qla_qpair *qpair)
 	return NULL;
 }
 
+/* Returns the hint of a started qpair whose interrupt is served on @cpu. */
+static inline struct qla_qpair_hint *
+qla_cpu_to_hint(struct qla_tgt *tgt, u16 cpu)
+{
+	struct qla_qpair_hint *h;
+	u16 i;
+
+	for (i = 0; i < tgt->ha->max_qpairs + 1; i++) {
+		h = &tgt->qphints[i];
+		if (h->qpair && h->cpuid == cpu && h->qpair->fw_started)
+			return h;
+	}
+
+	return NULL;
+}
+
 static inline void
 qla_83xx_start_iocbs(struct qla_qpair *qpair)
 {
@@ -456,45 +456,66 @@ queuing_error:
 }
 
 /**
- * qla2x00_start_iocbs() - Execute the IOCB command
+ * qla2x00_advance_req_ring() - Move the ring pointer past the last IOCB
+ * @req: request queue
+ *
+ * The firmware only sees the IOCB after the next qla2x00_ring_req_doorbell().
+ */
+void
+qla2x00_advance_req_ring(struct req_que *req)
+{
+	req->ring_index++;
+	if (req->ring_index == req->length) {
+		req->ring_index = 0;
+		req->ring_ptr = req->ring;
+	} else
+		req->ring_ptr++;
+}
+
+/**
+ * qla2x00_ring_req_doorbell() - Pass the request ring index to the firmware
  * @vha: HA context
  * @req: request queue
  */
 void
-qla2x00_start_iocbs(struct scsi_qla_host *vha, struct req_que *req)
+qla2x00_ring_req_doorbell(struct scsi_qla_host *vha, struct req_que *req)
 {
 	struct qla_hw_data *ha = vha->hw;
 	device_reg_t *reg = ISP_QUE_REG(ha, req->id);
 
-	if (IS_P3P_TYPE(ha)) {
+	/* Set chip new ring index. */
+	if (ha->mqenable || IS_QLA27XX(ha) || IS_QLA28XX(ha)) {
+		wrt_reg_dword(req->req_q_in, req->ring_index);
+	} else if (IS_QLA83XX(ha)) {
+		wrt_reg_dword(req->req_q_in, req->ring_index);
+		rd_reg_dword_relaxed(&ha->iobase->isp24.hccr);
+	} else if (IS_QLAFX00(ha)) {
+		wrt_reg_dword(&reg->ispfx00.req_q_in, req->ring_index);
+		rd_reg_dword_relaxed(&reg->ispfx00.req_q_in);
+		QLAFX00_SET_HST_INTR(ha, ha->rqstq_intr_code);
+	} else if (IS_FWI2_CAPABLE(ha)) {
+		wrt_reg_dword(&reg->isp24.req_q_in, req->ring_index);
+		rd_reg_dword_relaxed(&reg->isp24.req_q_in);
+	} else {
+		wrt_reg_word(ISP_REQ_Q_IN(ha, &reg->isp),
+			req->ring_index);
+		rd_reg_word_relaxed(ISP_REQ_Q_IN(ha, &reg->isp));
+	}
+}
+
+/**
+ * qla2x00_start_iocbs() - Execute the IOCB command
+ * @vha: HA context
+ * @req: request queue
+ */
+void
+qla2x00_start_iocbs(struct scsi_qla_host *vha, struct req_que *req)
+{
+	if (IS_P3P_TYPE(vha->hw)) {
 		qla82xx_start_iocbs(vha);
 	} else {
-		/* Adjust ring index. */
-		req->ring_index++;
-		if (req->ring_index == req->length) {
-			req->ring_index = 0;
-			req->ring_ptr = req->ring;
-		} else
-			req->ring_ptr++;
-
-		/* Set chip new ring index. */
-		if (ha->mqenable || IS_QLA27XX(ha) || IS_QLA28XX(ha)) {
-			wrt_reg_dword(req->req_q_in, req->ring_index);
-		} else if (IS_QLA83XX(ha)) {
-			wrt_reg_dword(req->req_q_in, req->ring_index);
-			rd_reg_dword_relaxed(&ha->iobase->isp24.hccr);
-		} else if (IS_QLAFX00(ha)) {
-			wrt_reg_dword(&reg->ispfx00.req_q_in, req->ring_index);
-			rd_reg_dword_relaxed(&reg->ispfx00.req_q_in);
-			QLAFX00_SET_HST_INTR(ha, ha->rqstq_intr_code);
-		} else if (IS_FWI2_CAPABLE(ha)) {
-			wrt_reg_dword(&reg->isp24.req_q_in, req->ring_index);
-			rd_reg_dword_relaxed(&reg->isp24.req_q_in);
-		} else {
-			wrt_reg_word(ISP_REQ_Q_IN(ha, &reg->isp),
-				req->ring_index);
-			rd_reg_word_relaxed(ISP_REQ_Q_IN(ha, &reg->isp));
-		}
+		qla2x00_advance_req_ring(req);
+		qla2x00_ring_req_doorbell(vha, req);
 	}
 }
 
@@ -466,6 +466,7 @@ static void qla_init_base_qpair(struct scsi_qla_host *vha, struct req_que *req,
 	/* init qpair to this cpu. Will adjust at run time. */
 	qla_cpu_update(rsp->qpair, raw_smp_processor_id());
 	ha->base_qpair->pdev = ha->pdev;
+	qlt_init_qpair_ctio_batch(ha->base_qpair);
 
 	if (IS_QLA27XX(ha) || IS_QLA83XX(ha) || IS_QLA28XX(ha))
 		ha->base_qpair->reqq_start_iocbs = qla_83xx_start_iocbs;
@@ -579,6 +580,7 @@ static void qla2x00_free_queues(struct qla_hw_data *ha)
 		ha->queue_pair_map = NULL;
 	}
 	if (ha->base_qpair) {
+		qlt_stop_qpair_ctio_batch(ha->base_qpair);
 		kfree(ha->base_qpair);
 		ha->base_qpair = NULL;
 	}
@@ -59,6 +59,34 @@ MODULE_PARM_DESC(qlini_mode,
 	"when ready; "
 	"\"enabled\" - initiator mode will always stay enabled.");
 
+static int ql2xtgt_direct_dispatch = 1;
+module_param(ql2xtgt_direct_dispatch, int, 0644);
+MODULE_PARM_DESC(ql2xtgt_direct_dispatch,
+	"Pass new commands to the target module from the ATIO interrupt "
+	"handler instead of through the qla_tgt_wq workqueue, if the target "
+	"module supports that. 0 - disabled, 1 (default) - enabled.");
+
+static int ql2xtgt_local_ctio = 1;
+module_param(ql2xtgt_local_ctio, int, 0644);
+MODULE_PARM_DESC(ql2xtgt_local_ctio,
+	"Send CTIOs through the queue pair whose interrupt is served by the "
+	"submitting CPU, if there is one. Only effective with multiple queue "
+	"pairs. 0 - always use the queue pair chosen per LUN, 1 (default) - "
+	"prefer the CPU-local queue pair.");
+
+static int ql2xtgt_ctio_batch;
+module_param(ql2xtgt_ctio_batch, int, 0444);
+MODULE_PARM_DESC(ql2xtgt_ctio_batch,
+	"Maximum number of CTIOs queued on a queue pair behind one doorbell "
+	"write while an SCST thread is processing a batch of commands. "
+	"0 or 1 (default) - ring the doorbell for every CTIO.");
+
+static int ql2xtgt_ctio_batch_usecs = 50;
+module_param(ql2xtgt_ctio_batch_usecs, int, 0644);
+MODULE_PARM_DESC(ql2xtgt_ctio_batch_usecs,
+	"Upper bound in microseconds for delaying a CTIO behind a deferred "
+	"doorbell. Default is 50.");
+
 int ql2xuctrlirq = 1;
 module_param(ql2xuctrlirq, int, 0644);
 MODULE_PARM_DESC(ql2xuctrlirq,
@@ -3287,6 +3315,150 @@ crc_queuing_error:
 }
 #endif
 
+/*
+ * Whether the target mode driver should ask SCST to process commands under
+ * a block plug, see qlt_start_ctio().
+ */
+bool qlt_ctio_batching_enabled(void)
+{
+	return ql2xtgt_ctio_batch > 1;
+}
+EXPORT_SYMBOL(qlt_ctio_batching_enabled);
+
+/* qp_lock_ptr supposed to be held on entry */
+static void qlt_flush_ctio_batch(struct qla_qpair *qpair)
+{
+	struct req_que *req = qpair->req;
+
+	if (!qpair->tgt_db_pending)
+		return;
+
+	/* The timer callback tolerates an already flushed batch */
+	hrtimer_try_to_cancel(&qpair->tgt_db_timer);
+
+	if (qpair->fw_started) {
+		if (qpair->reqq_start_iocbs)
+			wrt_reg_dword(req->req_q_in, req->ring_index);
+		else
+			qla2x00_ring_req_doorbell(qpair->vha, req);
+		qpair->tgt_counters.num_ctio_doorbells++;
+		qpair->tgt_counters.num_ctio_batched += qpair->tgt_db_pending;
+	}
+	qpair->tgt_db_pending = 0;
+}
+
+/*
+ * Called at the end of the processing pass of the SCST thread that queued
+ * CTIOs behind a deferred doorbell, or when that thread goes to sleep.
+ */
+static void qlt_ctio_unplug(struct blk_plug_cb *cb, bool from_schedule)
+{
+	struct qla_qpair *qpair = cb->data;
+	unsigned long flags;
+
+	spin_lock_irqsave(qpair->qp_lock_ptr, flags);
+	qlt_flush_ctio_batch(qpair);
+	spin_unlock_irqrestore(qpair->qp_lock_ptr, flags);
+
+	kfree(cb);
+}
+
+/*
+ * Bounds the time a CTIO waits behind a deferred doorbell, also if the SCST
+ * thread that queued it keeps processing commands without unplugging.
+ */
+static enum hrtimer_restart qlt_ctio_batch_timer_fn(struct hrtimer *timer)
+{
+	struct qla_qpair *qpair = container_of(timer, struct qla_qpair,
+					       tgt_db_timer);
+	unsigned long flags;
+
+	spin_lock_irqsave(qpair->qp_lock_ptr, flags);
+	qlt_flush_ctio_batch(qpair);
+	spin_unlock_irqrestore(qpair->qp_lock_ptr, flags);
+
+	return HRTIMER_NORESTART;
+}
+
+void qlt_init_qpair_ctio_batch(struct qla_qpair *qpair)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+	hrtimer_setup(&qpair->tgt_db_timer, qlt_ctio_batch_timer_fn,
+		      CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+#else
+	hrtimer_init(&qpair->tgt_db_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	qpair->tgt_db_timer.function = qlt_ctio_batch_timer_fn;
+#endif
+}
+
+/* Must be called before @qpair is freed */
+void qlt_stop_qpair_ctio_batch(struct qla_qpair *qpair)
+{
+	hrtimer_cancel(&qpair->tgt_db_timer);
+}
+
+/*
+ * Hands the CTIO at the ring pointer of @qpair to the firmware. If batching
+ * is enabled and the caller runs inside a plugged SCST processing pass, the
+ * doorbell is deferred until the pass ends, until ql2xtgt_ctio_batch CTIOs
+ * are pending or until the oldest pending one has waited
+ * ql2xtgt_ctio_batch_usecs, whichever comes first.
+ *
+ * qp_lock_ptr supposed to be held on entry.
+ */
+static void qlt_start_ctio(struct scsi_qla_host *vha, struct qla_qpair *qpair)
+{
+	int batch = READ_ONCE(ql2xtgt_ctio_batch);
+
+	if (batch <= 1 || IS_P3P_TYPE(vha->hw) || in_interrupt() ||
+	    !blk_check_plugged(qlt_ctio_unplug, qpair,
+			       sizeof(struct blk_plug_cb))) {
+		if (qpair->reqq_start_iocbs)
+			qpair->reqq_start_iocbs(qpair);
+		else
+			qla2x00_start_iocbs(vha, qpair->req);
+		if (unlikely(qpair->tgt_db_pending)) {
+			/* The doorbell covered the pending CTIOs too */
+			qpair->tgt_counters.num_ctio_batched +=
+				qpair->tgt_db_pending;
+			qpair->tgt_db_pending = 0;
+		}
+		qpair->tgt_counters.num_ctio_doorbells++;
+		qpair->tgt_counters.num_ctio_batched++;
+		return;
+	}
+
+	qla2x00_advance_req_ring(qpair->req);
+	if (qpair->tgt_db_pending++ == 0)
+		hrtimer_start(&qpair->tgt_db_timer,
+			      ns_to_ktime(READ_ONCE(ql2xtgt_ctio_batch_usecs) *
+					  NSEC_PER_USEC),
+			      HRTIMER_MODE_REL);
+
+	if (qpair->tgt_db_pending >= batch)
+		qlt_flush_ctio_batch(qpair);
+}
+
+/*
+ * Moves @cmd to the queue pair whose interrupt is served by the current CPU,
+ * so that both the CTIO submission and its completion stay CPU-local. Must
+ * only be called while no CTIO of @cmd is outstanding: a CTIO completes on
+ * the response queue of the queue pair it was posted on.
+ */
+static void qlt_steer_to_local_qpair(struct qla_tgt_cmd *cmd)
+{
+	struct qla_tgt *tgt = cmd->tgt;
+	struct qla_qpair_hint *h;
+
+	if (!ql2xtgt_local_ctio || !cmd->vha->flags.qpairs_available ||
+	    !tgt || cmd->aborted)
+		return;
+
+	h = qla_cpu_to_hint(tgt, raw_smp_processor_id());
+	if (h)
+		cmd->qpair = h->qpair;
+}
+
 /*
  * Callback to setup response of xmit_type of QLA_TGT_XMIT_DATA and *
  * QLA_TGT_XMIT_STATUS for >= 24xx silicon
@@ -3295,13 +3467,16 @@ int qlt_xmit_response(struct qla_tgt_cmd *cmd, int xmit_type,
 	uint8_t scsi_status)
 {
 	struct scsi_qla_host *vha = cmd->vha;
-	struct qla_qpair *qpair = cmd->qpair;
+	struct qla_qpair *qpair;
 	struct ctio7_to_24xx *pkt;
 	struct qla_tgt_prm prm;
 	uint32_t full_req_cnt = 0;
 	unsigned long flags = 0;
 	int res;
 
+	qlt_steer_to_local_qpair(cmd);
+	qpair = cmd->qpair;
+
 	if (!qpair->fw_started || (cmd->reset_count != qpair->chip_reset) ||
 	    (cmd->sess && cmd->sess->deleted)) {
 		cmd->state = QLA_TGT_STATE_PROCESSED;
@@ -3435,10 +3610,7 @@ int qlt_xmit_response(struct qla_tgt_cmd *cmd, int xmit_type,
 
 	/* Memory Barrier */
 	wmb();
-	if (qpair->reqq_start_iocbs)
-		qpair->reqq_start_iocbs(qpair);
-	else
-		qla2x00_start_iocbs(vha, qpair->req);
+	qlt_start_ctio(vha, qpair);
 	spin_unlock_irqrestore(qpair->qp_lock_ptr, flags);
 
 	return 0;
@@ -3459,7 +3631,10 @@ int qlt_rdy_to_xfer(struct qla_tgt_cmd *cmd)
 	struct qla_tgt_prm prm;
 	unsigned long flags = 0;
 	int res = 0;
-	struct qla_qpair *qpair = cmd->qpair;
+	struct qla_qpair *qpair;
+
+	qlt_steer_to_local_qpair(cmd);
+	qpair = cmd->qpair;
 
 	memset(&prm, 0, sizeof(prm));
 	prm.cmd = cmd;
@@ -3520,10 +3695,7 @@ int qlt_rdy_to_xfer(struct qla_tgt_cmd *cmd)
 
 	/* Memory Barrier */
 	wmb();
-	if (qpair->reqq_start_iocbs)
-		qpair->reqq_start_iocbs(qpair);
-	else
-		qla2x00_start_iocbs(vha, qpair->req);
+	qlt_start_ctio(vha, qpair);
 	spin_unlock_irqrestore(qpair->qp_lock_ptr, flags);
 
 	return res;
@@ -4206,29 +4378,16 @@ static inline int qlt_get_fcp_task_attr(struct scsi_qla_host *vha,
 }
 
 /*
- * Process context for I/O path into tcm_qla2xxx code
+ * Decodes the FCP_CMND of @cmd and passes it to the target module.
  */
-static void __qlt_do_work(struct qla_tgt_cmd *cmd)
+static int qlt_submit_cmd(struct qla_tgt_cmd *cmd)
 {
 	scsi_qla_host_t *vha = cmd->vha;
 	struct qla_hw_data *ha = vha->hw;
-	struct fc_port *sess = cmd->sess;
 	struct atio_from_isp *atio = &cmd->atio;
 	unsigned char *cdb;
-	unsigned long flags;
 	uint32_t data_length;
-	int ret, fcp_task_attr, data_dir, bidi = 0;
-	struct qla_qpair *qpair = cmd->qpair;
-
-	cmd->cmd_in_wq = 0;
-	cmd->trc_flags |= TRC_DO_WORK;
-
-	if (cmd->aborted) {
-		ql_dbg(ql_dbg_tgt_mgt, vha, 0xf082,
-		    "cmd with tag %u is aborted\n",
-		    cmd->atio.u.isp24.exchange_addr);
-		goto out_term;
-	}
+	int fcp_task_attr, data_dir, bidi = 0;
 
 	spin_lock_init(&cmd->cmd_lock);
 	cdb = &atio->u.isp24.fcp_cmnd.cdb[0];
@@ -4249,9 +4408,32 @@ static void __qlt_do_work(struct qla_tgt_cmd *cmd)
 	    atio->u.isp24.fcp_cmnd.task_attr);
 	data_length = get_datalen_for_atio(atio);
 
-	ret = ha->tgt.tgt_ops->handle_cmd(vha, cmd, cdb, data_length,
-				          fcp_task_attr, data_dir, bidi);
-	if (ret != 0)
+	return ha->tgt.tgt_ops->handle_cmd(vha, cmd, cdb, data_length,
+					   fcp_task_attr, data_dir, bidi);
+}
+
+/*
+ * Process context for I/O path into tcm_qla2xxx code
+ */
+static void __qlt_do_work(struct qla_tgt_cmd *cmd)
+{
+	scsi_qla_host_t *vha = cmd->vha;
+	struct qla_hw_data *ha = vha->hw;
+	struct fc_port *sess = cmd->sess;
+	unsigned long flags;
+	struct qla_qpair *qpair = cmd->qpair;
+
+	cmd->cmd_in_wq = 0;
+	cmd->trc_flags |= TRC_DO_WORK;
+
+	if (cmd->aborted) {
+		ql_dbg(ql_dbg_tgt_mgt, vha, 0xf082,
+		    "cmd with tag %u is aborted\n",
+		    cmd->atio.u.isp24.exchange_addr);
+		goto out_term;
+	}
+
+	if (qlt_submit_cmd(cmd) != 0)
 		goto out_term;
 	/*
 	 * Drop extra session reference from qlt_handle_cmd_for_atio().
@@ -4429,6 +4611,35 @@ static struct qla_tgt_cmd *qlt_get_tag(scsi_qla_host_t *vha,
 	return cmd;
 }
 
+/*
+ * Passes a new command to the target module straight from the ATIO handler,
+ * saving the workqueue round trip. On failure the command is released and
+ * -EBUSY returned, so the caller answers the exchange with BUSY status
+ * under the lock it already owns.
+ */
+static int qlt_do_cmd_direct(struct qla_tgt_cmd *cmd)
+{
+	scsi_qla_host_t *vha = cmd->vha;
+	struct qla_hw_data *ha = vha->hw;
+	struct fc_port *sess = cmd->sess;
+	int res = 0;
+
+	cmd->trc_flags |= TRC_DO_WORK;
+
+	if (unlikely(qlt_submit_cmd(cmd) != 0)) {
+		ql_dbg(ql_dbg_io, vha, 0x306a,
+		    "Direct dispatch of cmd %p failed\n", cmd);
+		cmd->trc_flags |= TRC_DO_WORK_ERR;
+		qlt_decr_num_pend_cmds(vha);
+		ha->tgt.tgt_ops->rel_cmd(cmd);
+		res = -EBUSY;
+	}
+
+	/* Drop the extra session reference from qlt_handle_cmd_for_atio(). */
+	ha->tgt.tgt_ops->put_sess(sess);
+	return res;
+}
+
 /* ha->hardware_lock supposed to be held on entry */
 static int qlt_handle_cmd_for_atio(struct scsi_qla_host *vha,
 	struct atio_from_isp *atio)
@@ -4482,9 +4693,13 @@ static int qlt_handle_cmd_for_atio(struct scsi_qla_host *vha,
 		return -EBUSY;
 	}
 
-	cmd->cmd_in_wq = 1;
 	cmd->trc_flags |= TRC_NEW_CMD;
 
+	if (ql2xtgt_direct_dispatch && ha->tgt.tgt_ops->handle_cmd_atomic)
+		return qlt_do_cmd_direct(cmd);
+
+	cmd->cmd_in_wq = 1;
+
 	spin_lock_irqsave(&vha->cmd_list_lock, flags);
 	list_add_tail(&cmd->cmd_list, &vha->qla_cmd_list);
 	spin_unlock_irqrestore(&vha->cmd_list_lock, flags);
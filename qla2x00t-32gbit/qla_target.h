@@ -732,6 +732,12 @@ struct qla_tgt_func_tmpl {
 	int (*chk_dif_tags)(uint32_t tag);
 	void (*add_target)(struct scsi_qla_host *);
 	void (*remove_target)(struct scsi_qla_host *);
+
+	/*
+	 * Set if handle_cmd() may be called from the ATIO interrupt handler,
+	 * i.e. it neither sleeps nor takes the hardware lock.
+	 */
+	bool handle_cmd_atomic;
 };
 
 int qla2x00_wait_for_hba_online(struct scsi_qla_host *);
@@ -1063,6 +1069,9 @@ extern void qlt_fc_port_deleted(struct scsi_qla_host *, fc_port_t *, int);
 extern int __init qlt_init(void);
 extern void qlt_exit(void);
 extern void qlt_update_vp_map(struct scsi_qla_host *, int);
+extern bool qlt_ctio_batching_enabled(void);
+extern void qlt_init_qpair_ctio_batch(struct qla_qpair *);
+extern void qlt_stop_qpair_ctio_batch(struct qla_qpair *);
 extern void qlt_free_session_done(struct work_struct *);
 /*
  * This macro is used during early initializations when host->active_mode
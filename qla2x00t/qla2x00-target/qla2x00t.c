@@ -6267,6 +6267,7 @@ static int q2t_add_target(scsi_qla_host_t *vha)
 	}
 
 	scst_tgt_set_sg_tablesize(tgt->scst_tgt, sg_tablesize);
+	scst_tgt_set_numa_node(tgt->scst_tgt, dev_to_node(&vha->hw->pdev->dev));
 	scst_tgt_set_tgt_priv(tgt->scst_tgt, tgt);
 
 out:
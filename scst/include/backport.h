@@ -33,6 +33,7 @@
 #include <linux/bsg-lib.h>	/* struct bsg_job */
 #include <linux/dmapool.h>
 #include <linux/eventpoll.h>
+#include <linux/highmem.h>
 #include <linux/iocontext.h>
 #include <linux/kobject_ns.h>
 #include <linux/scatterlist.h>	/* struct scatterlist */
@@ -473,6 +474,14 @@ kernel_write_backport(struct file *file, const void *buf, size_t count,
 #define kernel_write kernel_write_backport
 #endif
 
+/* <linux/highmem.h> */
+
+/* See also commit f3ba3c710ac5 */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 11, 0)
+#define kmap_local_page(page) kmap_atomic(page)
+#define kunmap_local(addr) kunmap_atomic(addr)
+#endif
+
 /* <linux/iocontext.h> */
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 21, 0) || \
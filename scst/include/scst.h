@@ -38,6 +38,7 @@
 #include <linux/interrupt.h>
 #include <linux/wait.h>
 #include <linux/cpumask.h>
+#include <linux/hrtimer.h>
 #include <linux/dlm.h>
 #include <asm/unaligned.h>
 
@@ -761,6 +762,13 @@ struct scst_tgt_template {
 	 */
 	unsigned multithreaded_init_done:1;
 
+	/*
+	 * True, if SCST command threads should process their commands under
+	 * a block plug, so that this target driver can batch its submissions
+	 * to the hardware via blk_check_plugged().
+	 */
+	unsigned plug_cmd_threads:1;
+
 	/*
 	 * True, if this target driver supports T10-PI (DIF), i.e. sending and
 	 * receiving DIF PI tags. If false, SCST will not allow to add
@@ -1390,6 +1398,15 @@ struct scst_dev_type {
 	void (*ext_copy_remap)(struct scst_cmd *cmd,
 		struct scst_ext_copy_seg_descr *descr);
 
+	/*
+	 * Called by the Copy Manager to get the number of logical blocks of
+	 * the device, e.g. to check the ranges of POPULATE TOKEN commands.
+	 * Devices without it don't support token based copy offload.
+	 *
+	 * OPTIONAL
+	 */
+	uint64_t (*get_nblocks)(struct scst_device *dev);
+
 	/*
 	 * Called to notify dev handler that a ALUA state change is about to
 	 * be started. Can be used to close open file handlers, which might
@@ -1656,6 +1673,8 @@ struct scst_dev_type {
 /*
  * An SCST target, analog of SCSI target port.
  */
+#define SCST_SESS_REG_LAT_BUCKETS	7
+
 struct scst_tgt {
 	/* List of remote sessions per target, protected by scst_mutex */
 	struct list_head sess_list;
@@ -1737,11 +1756,28 @@ struct scst_tgt {
 
 	uint16_t rel_tgt_id;
 
+	/*
+	 * NUMA node of the target's hardware, e.g. of its HBA, or
+	 * NUMA_NO_NODE, if not known. Set by scst_tgt_set_numa_node() or
+	 * via sysfs. Used for new sessions.
+	 */
+	int tgt_numa_node_id;
+	/* Set, if tgt_numa_node_id was set via sysfs */
+	unsigned int tgt_numa_node_user:1;
+
 	/* How many DIF failures detected on this target on the corresponding stage */
 	atomic_t tgt_dif_app_failed_tgt, tgt_dif_ref_failed_tgt, tgt_dif_guard_failed_tgt;
 	atomic_t tgt_dif_app_failed_scst, tgt_dif_ref_failed_scst, tgt_dif_guard_failed_scst;
 	atomic_t tgt_dif_app_failed_dev, tgt_dif_ref_failed_dev, tgt_dif_guard_failed_dev;
 
+	/*
+	 * Histogram of the time from scst_register_session() until the
+	 * session initialization finished. Bucket i counts sessions that
+	 * took up to 100 * 10^i us, the last one all slower sessions.
+	 */
+	atomic_t sess_reg_lat[SCST_SESS_REG_LAT_BUCKETS];
+	atomic_t sess_reg_failed;
+
 	/* sysfs release completion */
 	struct completion *tgt_kobj_release_cmpl;
 
@@ -1801,6 +1837,41 @@ struct scst_io_stat_entry {
 	uint64_t unaligned_cmd_count;
 };
 
+/*
+ * QoS limits of an ACG, a session or a tgt_dev. Commands exceeding the
+ * limits are parked in qos_cmd_list before execution and released by
+ * qos_timer, when they fit in the limits again.
+ */
+struct scst_qos {
+	spinlock_t qos_lock; /* IRQ lock */
+
+	/* Limits, 0 means unlimited. Protected by qos_lock. */
+	unsigned int qos_iops_limit;
+	unsigned int qos_mbps_limit;
+	unsigned int qos_burst_ms;
+
+	/* Set if any limit set. Read on the fast path without lock. */
+	bool qos_enabled;
+
+	/*
+	 * Earliest times, in ns, when the next command fits in the IOPS and
+	 * bandwidth limits correspondingly. Commands may run ahead of them
+	 * by up to qos_burst_ms.
+	 */
+	u64 qos_iops_tat;
+	u64 qos_bw_tat;
+
+	/* Parked commands in order of arrival, protected by qos_lock */
+	struct list_head qos_cmd_list;
+	int qos_parked_cnt;
+
+	struct hrtimer qos_timer;
+
+	/* Statistics, protected by qos_lock */
+	uint64_t qos_throttled_cmds;
+	uint64_t qos_throttled_ns;
+};
+
 /*
  * SCST session, analog of SCSI I_T nexus
  */
@@ -1880,6 +1951,9 @@ struct scst_session {
 	/* List entry for the list that keeps session, waiting for the init */
 	struct list_head sess_init_list_entry;
 
+	/* Time scst_register_session() was called */
+	ktime_t sess_reg_time;
+
 	/*
 	 * List entry for the list that keeps session, waiting for the shutdown
 	 */
@@ -1916,6 +1990,21 @@ struct scst_session {
 	unsigned int sess_mq:1; /* Multi-queue session, i.e. >1 sessions per same initiator */
 	unsigned int sess_kobj_ready:1;
 
+	/*
+	 * Set if tgt_devs are instantiated on first access to the
+	 * corresponding LUN instead of at session registration.
+	 */
+	unsigned int sess_lazy_tgt_devs:1;
+
+	/* Set if the initial UA was replaced by scst_set_initial_UA() */
+	unsigned int sess_initial_UA_set:1;
+
+	/* Initial UA for lazily instantiated tgt_devs, see above */
+	int sess_initial_UA_key, sess_initial_UA_asc, sess_initial_UA_ascq;
+
+	/* QoS limits of this session */
+	struct scst_qos sess_qos;
+
 	struct kobject sess_kobj; /* session sysfs entry */
 	struct kobject *lat_kobj;
 
@@ -1979,11 +2068,27 @@ struct scst_cmd_threads {
 	int nr_threads; /* number of processing threads */
 	struct list_head threads_list; /* processing threads */
 
+	/* Number of threads waiting for commands, protected by cmd_list_lock */
+	int nr_idle_threads;
+
+	/*
+	 * Elastic pool state. The number of threads added by the elastic
+	 * pool manager is protected by thr_lock, the rest by scst_mutex.
+	 */
+	int nr_elastic_threads;
+	int elastic_busy_samples;
+	int elastic_idle_samples;
+	/* Elastic threads being stopped */
+	atomic_t nr_retiring_threads;
+	/* Owner of the pool, as passed to scst_add_threads() */
+	struct scst_device *thr_dev;
+	struct scst_tgt_dev *thr_tgt_dev;
+
 	struct list_head lists_list_entry;
 };
 
 int scst_set_thr_cpu_mask(struct scst_cmd_threads *cmd_threads,
-			  cpumask_t *cpu_mask);
+			  const cpumask_t *cpu_mask);
 
 struct scst_pr_dlm_data;
 
@@ -2000,6 +2105,13 @@ struct scst_lksb {
 /*
  * Used to execute cmd's in order of arrival, honoring SCSI task attributes
  */
+/*
+ * Number of SN slots and of deferred commands ring buckets in
+ * struct scst_order_data. Must be a power of 2.
+ */
+#define SCST_SN_SLOTS		64
+#define SCST_SN_SLOTS_MASK	(SCST_SN_SLOTS - 1)
+
 struct scst_order_data {
 	/*
 	 * All fields, when needed, protected by sn_lock. Curr_sn must have
@@ -2007,8 +2119,17 @@ struct scst_order_data {
 	 */
 
 	struct list_head skipped_sn_list;
+
+	/* Commands deferred not because of their SN, e.g. due to ACA */
 	struct list_head deferred_cmd_list;
 
+	/*
+	 * Commands deferred until expected_sn reaches their SN, hashed by
+	 * SN & SCST_SN_SLOTS_MASK, so the commands to release are found
+	 * without scanning all deferred commands.
+	 */
+	struct list_head deferred_sn_ring[SCST_SN_SLOTS];
+
 	spinlock_t sn_lock; /* IRQ lock */
 
 	int hq_cmd_count;
@@ -2031,7 +2152,12 @@ struct scst_order_data {
 	int pending_simple_inc_expected_sn;
 
 	atomic_t *cur_sn_slot;
-	atomic_t sn_slots[15];
+	atomic_t sn_slots[SCST_SN_SLOTS];
+
+	/* SN deferral statistics, latencies in ns */
+	u64 sn_deferred_cmds;
+	u64 sn_defer_ns;
+	u64 sn_defer_max_ns;
 
 	/*
 	 * Used to serialized scst_cmd_init_done() if the corresponding
@@ -2133,6 +2259,12 @@ struct scst_cmd {
 	/* Set if cmd is on dev's exec_cmd_list */
 	unsigned int on_dev_exec_list:1;
 
+	/* Set if cmd is queued by the dev's dispatch scheduler */
+	unsigned int dispatch_queued:1;
+
+	/* Set if cmd is counted in dev's dispatch_in_flight */
+	unsigned int dispatch_counted:1;
+
 	/* Set if this cmd passed check for SCSI atomicity */
 	unsigned int scsi_atomicity_checked:1;
 
@@ -2286,9 +2418,33 @@ struct scst_cmd {
 	ktime_t init_wait_time;
 	uint64_t init_wait_tsc;
 
+	/* Time when cmd was parked in a QoS queue, in ns */
+	u64 qos_park_time;
+
+	/*
+	 * Not bitfields, because the QoS timer updates them from hardirq
+	 * context, while other bits in the same word are updated from
+	 * process context.
+	 */
+
+	/* Next QoS level to check, one of SCST_QOS_LEVEL_* constants */
+	u8 qos_level;
+
+	/* Set if cmd is parked in a QoS queue, protected by qos_lock */
+	bool qos_parked;
+
+	/*
+	 * Time when cmd was queued, then dispatched, by the dev's dispatch
+	 * scheduler, in ns. Protected by dev_lock.
+	 */
+	u64 dispatch_time;
+
 	/* List entry for tgt_dev's deferred (SN, ACA, etc.) lists */
 	struct list_head deferred_cmd_list_entry;
 
+	/* Time when cmd was deferred because of its SN, in ns */
+	u64 sn_defer_time;
+
 	/* The corresponding sn_slot in tgt_dev->sn_slots */
 	atomic_t *sn_slot;
 
@@ -2876,6 +3032,26 @@ struct scst_device {
 	 */
 	struct list_head dev_exec_cmd_list;
 
+	/*
+	 * Dispatch scheduler, one of SCST_DISPATCH_* constants, and its
+	 * state. Protected by dev_lock.
+	 */
+	int dispatch_sched;
+	/* Max commands in execution, if dispatch_sched isn't FIFO */
+	int dispatch_depth;
+	/* Current depth, less than dispatch_depth in latency mode */
+	int dispatch_cur_depth;
+	int dispatch_in_flight;
+	int dispatch_queued_cnt;
+	/* Set if some queued commands were aborted, no protection */
+	bool dispatch_abort_pending;
+	/* Latency target in latency mode and average latency, in us */
+	unsigned int dispatch_lat_target_us;
+	unsigned int dispatch_lat_avg_us;
+	unsigned int dispatch_lat_samples;
+	/* Round robin list of tgt_devs with queued commands */
+	struct list_head dispatch_tgt_dev_list;
+
 	/* Memory limits for this device */
 	struct scst_mem_lim dev_mem_lim;
 
@@ -3159,6 +3335,33 @@ struct scst_tgt_dev {
 	/* Set if INQUIRY DATA HAS CHANGED UA is needed */
 	unsigned int inq_changed_ua_needed:1;
 
+	/* QoS limits of this tgt_dev */
+	struct scst_qos tgt_dev_qos;
+
+	/*
+	 * Dispatch scheduler fields, protected by dev_lock. Commands queued
+	 * by the scheduler are linked via their cmd_list_entry.
+	 */
+	struct list_head dispatch_cmd_list;
+	struct list_head dispatch_tgt_dev_list_entry;
+	unsigned int dispatch_weight;
+	int dispatch_deficit;
+	/* Wait time statistics */
+	u64 dispatch_waited_cmds;
+	u64 dispatch_wait_ns;
+	u64 dispatch_wait_max_ns;
+
+	/*
+	 * NUMA node, where commands of this tgt_dev are preferably processed
+	 * and their data buffers allocated, or NUMA_NO_NODE. It is the node
+	 * of the session's target, if known, otherwise of the device.
+	 */
+	int tgt_dev_numa_node_id;
+	/* CPU on tgt_dev_numa_node_id, whose SGV pools are used off-node */
+	int tgt_dev_numa_cpu;
+	/* How many commands were executed on and off tgt_dev_numa_node_id */
+	atomic_t tgt_dev_numa_local_cmds, tgt_dev_numa_remote_cmds;
+
 	/* How many DIF failures detected on this tgt_dev on the corresponding stage */
 	atomic_t tgt_dev_dif_app_failed_tgt, tgt_dev_dif_ref_failed_tgt, tgt_dev_dif_guard_failed_tgt;
 	atomic_t tgt_dev_dif_app_failed_scst, tgt_dev_dif_ref_failed_scst, tgt_dev_dif_guard_failed_scst;
@@ -3291,6 +3494,9 @@ struct scst_acg {
 	/* LUNS addressing method for all LUNs in this ACG */
 	enum scst_lun_addr_method addr_method;
 
+	/* QoS limits shared by all sessions in this ACG */
+	struct scst_qos acg_qos;
+
 	/* Private stuff for target drivers */
 	void *acg_tgt_priv;
 };
@@ -3322,6 +3528,7 @@ struct scst_acn {
  * @tg_kobj:     Sysfs target groups directory.
  * @stpg_transport_id Initiator transport ID for STPG originating I_T nexus, if any
  * @stpg_rel_tgt_id Relative target ID for STPG originating I_T nexus, if any
+ * @stpg_start  Time at which processing of the current STPG command started.
  *
  * Each device is member of zero or one device groups. With each device group
  * there are zero or more target groups associated.
@@ -3336,6 +3543,7 @@ struct scst_dev_group {
 	struct kobject		*tg_kobj;
 	uint8_t			*stpg_transport_id;
 	uint16_t		stpg_rel_tgt_id;
+	ktime_t			stpg_start;
 };
 
 /**
@@ -3449,6 +3657,9 @@ extern const struct scst_opcode_descriptor scst_op_descr_send_diagnostic;
 
 extern const struct scst_opcode_descriptor scst_op_descr_inquiry;
 extern const struct scst_opcode_descriptor scst_op_descr_extended_copy;
+extern const struct scst_opcode_descriptor scst_op_descr_populate_token;
+extern const struct scst_opcode_descriptor scst_op_descr_write_using_token;
+extern const struct scst_opcode_descriptor scst_op_descr_receive_rod_token_info;
 extern const struct scst_opcode_descriptor scst_op_descr_tur;
 extern const struct scst_opcode_descriptor scst_op_descr_reserve6;
 extern const struct scst_opcode_descriptor scst_op_descr_release6;
@@ -3693,6 +3904,21 @@ static inline void scst_tgt_set_sg_tablesize(struct scst_tgt *tgt, int val)
 	tgt->sg_tablesize = val;
 }
 
+/*
+ * Get/Set functions for tgt's NUMA node. Target drivers should set it
+ * to the node of the target hardware, e.g. dev_to_node() of the HBA's
+ * PCI device, before the initiators log in.
+ */
+static inline int scst_tgt_get_numa_node(struct scst_tgt *tgt)
+{
+	return tgt->tgt_numa_node_id;
+}
+
+static inline void scst_tgt_set_numa_node(struct scst_tgt *tgt, int val)
+{
+	tgt->tgt_numa_node_id = val;
+}
+
 /*
  * Get/Set functions for tgt's target private data
  */
@@ -5633,5 +5859,7 @@ struct scst_ext_copy_seg_descr {
 void scst_ext_copy_remap_done(struct scst_cmd *ec_cmd,
 	struct scst_ext_copy_data_descr *dds, int dds_cnt);
 int scst_ext_copy_get_cur_seg_data_len(struct scst_cmd *ec_cmd);
+int scst_cm_tpc_vpd(struct scst_cmd *cmd, uint8_t *buf);
+bool scst_cm_tpc_supported(struct scst_device *dev);
 
 #endif /* __SCST_H */
@@ -304,6 +304,11 @@ static inline int scst_sense_response_code(const uint8_t *sense)
 #define scst_sense_parameter_list_length_invalid ILLEGAL_REQUEST, 0x1A, 0
 #define scst_sense_invalid_opcode		ILLEGAL_REQUEST, 0x20, 0
 #define scst_sense_block_out_range_error	ILLEGAL_REQUEST, 0x21, 0
+#define scst_sense_invalid_token_op		ILLEGAL_REQUEST, 0x23, 0
+#define scst_sense_unsupported_token_type	ILLEGAL_REQUEST, 0x23, 1
+#define scst_sense_token_unknown		ILLEGAL_REQUEST, 0x23, 4
+#define scst_sense_token_expired		ILLEGAL_REQUEST, 0x23, 7
+#define scst_sense_invalid_token_length		ILLEGAL_REQUEST, 0x23, 0xA
 /* Don't use it directly, use scst_set_invalid_field_in_cdb() instead! */
 #define scst_sense_invalid_field_in_cdb		ILLEGAL_REQUEST, 0x24, 0
 #define scst_sense_lun_not_supported		ILLEGAL_REQUEST, 0x25, 0
@@ -318,6 +323,7 @@ static inline int scst_sense_response_code(const uint8_t *sense)
 #define scst_sense_inline_data_length_exceeded	ILLEGAL_REQUEST, 0x26, 0xB
 #define scst_sense_saving_params_unsup		ILLEGAL_REQUEST, 0x39, 0
 #define scst_sense_invalid_message		ILLEGAL_REQUEST, 0x49, 0
+#define scst_sense_insufficient_rod_token_res	ILLEGAL_REQUEST, 0x55, 0xD
 #define scst_sense_parameter_list_length_invalid ILLEGAL_REQUEST, 0x1A, 0
 #define scst_sense_invalid_field_in_command_information_unit ILLEGAL_REQUEST, 0xE, 0x3
 
@@ -408,6 +414,13 @@ static inline int scst_sense_response_code(const uint8_t *sense)
 #define RECEIVE_COPY_RESULTS  0x84
 #endif
 
+/* Service actions of EXTENDED COPY (0x83) */
+#define SA_POPULATE_TOKEN	  0x10
+#define SA_WRITE_USING_TOKEN	  0x11
+
+/* Service actions of RECEIVE COPY RESULTS (0x84) */
+#define SA_RECEIVE_ROD_TOKEN_INFO 0x07
+
 #ifndef SYNCHRONIZE_CACHE_16
 #define SYNCHRONIZE_CACHE_16  0x91
 #endif
@@ -79,11 +79,30 @@ struct scst_event_notify_done {
 	int status;
 };
 
+/*
+ * Replies to several events, then gets several events at once. The events are
+ * returned in buf one after another, each starting at an 8 bytes boundary,
+ * see SCST_EVENT_MULTI_SIZE().
+ */
+struct scst_event_get_multi {
+	aligned_u64 preplies; /* in, array of struct scst_event_notify_done */
+	int32_t replies_cnt; /* in */
+	int32_t replies_done; /* out */
+	int32_t buf_size; /* in; out: needed size, if returned ENOSPC */
+	int32_t events_cnt; /* in: max events to get; out: events in buf */
+	uint8_t buf[]; /* out */
+};
+
+/* Space taken in scst_event_get_multi.buf by event e */
+#define SCST_EVENT_MULTI_SIZE(e)					\
+	((sizeof(struct scst_event) + (e)->payload_len + 7) & ~7UL)
+
 /* IOCTLs */
 #define SCST_EVENT_ALLOW_EVENT		_IOW('u', 1, struct scst_event)
 #define SCST_EVENT_DISALLOW_EVENT	_IOW('u', 2, struct scst_event)
 #define SCST_EVENT_GET_NEXT_EVENT	_IOWR('u', 3, struct scst_event_user)
 #define SCST_EVENT_NOTIFY_DONE		_IOW('u', 4, struct scst_event_notify_done)
+#define SCST_EVENT_REPLY_AND_GET_MULTI	_IOWR('u', 5, struct scst_event_get_multi)
 
 #ifdef __KERNEL__
 void scst_event_queue(uint32_t event_code, const char *issuer_name,
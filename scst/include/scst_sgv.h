@@ -103,5 +103,7 @@ void sgv_pool_free(struct sgv_pool_obj *sgv, struct scst_mem_lim *mem_lim);
 void *sgv_get_priv(struct sgv_pool_obj *sgv);
 
 void scst_init_mem_lim(struct scst_mem_lim *mem_lim);
+bool scst_mem_lim_charge(struct scst_mem_lim *mem_lim, int pages);
+void scst_mem_lim_uncharge(struct scst_mem_lim *mem_lim, int pages);
 
 #endif /* __SCST_SGV_H */
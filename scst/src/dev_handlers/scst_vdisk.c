@@ -99,7 +99,7 @@
 #define	DEF_CDROM_BLOCK_SHIFT		11
 #define	DEF_SECTORS			56
 #define	DEF_HEADS			255
-#define LEN_MEM				(32 * 1024)
+#define LEN_MEM				(1024 * 1024)
 #define DEF_RD_ONLY			0
 #define DEF_WRITE_THROUGH		0
 #define DEF_NV_CACHE			0
@@ -232,6 +232,16 @@ struct scst_vdisk_dev {
 	/* Unmap INQUIRY parameters */
 	uint32_t unmap_opt_gran, unmap_align, unmap_max_lba_cnt;
 
+	/*
+	 * WRITE SAME statistics: bytes done by the backend without data
+	 * transfer (zeroing or unmapping) and bytes written by scst_write_same()
+	 */
+	atomic64_t ws_offloaded_bytes;
+	atomic64_t ws_emulated_bytes;
+
+	/* Set if the backing file does not support FALLOC_FL_ZERO_RANGE */
+	bool zero_range_unsupported;
+
 	struct scst_device *dev;
 	struct list_head vdev_list_entry;
 
@@ -291,6 +301,16 @@ static int num_threads = DEF_NUM_THREADS;
 module_param_named(num_threads, num_threads, int, S_IRUGO);
 MODULE_PARM_DESC(num_threads, "vdisk threads count");
 
+#define DEF_VERIFY_THREADS	8
+static int verify_threads = DEF_VERIFY_THREADS;
+
+module_param_named(verify_threads, verify_threads, int, S_IRUGO);
+MODULE_PARM_DESC(verify_threads, "max number of VERIFY commands executed "
+	"concurrently");
+
+/* Executes VERIFY and the verify part of WRITE AND VERIFY */
+static struct workqueue_struct *vdisk_verify_wq;
+
 /*
  * Used to serialize sense setting between blockio data and DIF tags
  * unsuccessful readings/writings
@@ -1889,6 +1909,82 @@ out:
 	return res;
 }
 
+/*
+ * Zeroes the range without transferring any data. Returns -EOPNOTSUPP if the
+ * backend can't do that, so the caller should fall back to writing zeroes.
+ */
+static int vdisk_zero_range(struct scst_cmd *cmd,
+	struct scst_vdisk_dev *virt_dev, uint64_t start_lba, uint64_t blocks)
+{
+	int res;
+	loff_t off = start_lba << cmd->dev->block_shift;
+	loff_t len = blocks << cmd->dev->block_shift;
+	bool flush = virt_dev->wt_flag && !virt_dev->nv_cache;
+
+	TRACE_ENTRY();
+
+	TRACE_DBG("Zeroing lba %lld (blocks %lld)",
+		  (unsigned long long)start_lba, blocks);
+
+	if (virt_dev->nullio) {
+		res = 0;
+	} else if (virt_dev->blockio) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 12, 0)
+		struct block_device *bdev = virt_dev->bdev;
+		sector_t start_sector = start_lba << (cmd->dev->block_shift - 9);
+		sector_t nr_sects = blocks << (cmd->dev->block_shift - 9);
+
+		res = blkdev_issue_zeroout(bdev, start_sector, nr_sects,
+			cmd->cmd_gfp_mask, BLKDEV_ZERO_NOUNMAP);
+		if (res == 0 && flush)
+			res = vdisk_blockio_flush(bdev, cmd->cmd_gfp_mask, true,
+				NULL, false);
+#else
+		res = -EOPNOTSUPP;
+		goto out;
+#endif
+	} else {
+#ifdef FALLOC_FL_ZERO_RANGE
+		struct file *fd = virt_dev->fd;
+
+		if (READ_ONCE(virt_dev->zero_range_unsupported) ||
+		    fd->f_op->fallocate == NULL) {
+			res = -EOPNOTSUPP;
+			goto out;
+		}
+
+		res = fd->f_op->fallocate(fd,
+			FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE, off, len);
+		if (res == -EOPNOTSUPP) {
+			PRINT_INFO("%s: FALLOC_FL_ZERO_RANGE is not supported by "
+				"the filesystem, WRITE SAME of zeroes will be "
+				"emulated", virt_dev->name);
+			WRITE_ONCE(virt_dev->zero_range_unsupported, true);
+			goto out;
+		}
+		if (res == 0 && flush)
+			res = vfs_fsync_range(fd, off, off + len - 1, 1);
+#else
+		res = -EOPNOTSUPP;
+		goto out;
+#endif
+	}
+
+	if (unlikely(res != 0)) {
+		PRINT_ERROR("Zeroing LBA %lld, blocks %lld failed: %d",
+			(unsigned long long)start_lba, blocks, res);
+		scst_set_cmd_error(cmd, SCST_LOAD_SENSE(scst_sense_write_error));
+		res = -EIO;
+		goto out;
+	}
+
+	atomic64_add(len, &virt_dev->ws_offloaded_bytes);
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
 static enum compl_status_e vdisk_exec_format_unit(struct vdisk_cmd_params *p)
 {
 	int res = CMD_SUCCEEDED;
@@ -2104,7 +2200,6 @@ static const struct scst_opcode_descriptor scst_op_descr_format_unit = {
 	.od_cdb_usage_bits = { FORMAT_UNIT, 0xF0, 0, 0, 0, SCST_OD_DEFAULT_CONTROL_BYTE },
 };
 
-#if 0
 static const struct scst_opcode_descriptor scst_op_descr_get_lba_status = {
 	.od_opcode = SERVICE_ACTION_IN_16,
 	.od_serv_action = SAI_GET_LBA_STATUS,
@@ -2118,7 +2213,6 @@ static const struct scst_opcode_descriptor scst_op_descr_get_lba_status = {
 			       0xFF, 0xFF, 0xFF, 0xFF, 0,
 			       SCST_OD_DEFAULT_CONTROL_BYTE },
 };
-#endif
 
 static const struct scst_opcode_descriptor scst_op_descr_allow_medium_removal = {
 	.od_opcode = ALLOW_MEDIUM_REMOVAL,
@@ -2493,13 +2587,16 @@ static const struct scst_opcode_descriptor scst_op_descr_read_toc = {
 	&scst_op_descr_verify16,
 
 #define VDISK_OPCODE_DESCRIPTORS					\
-	/* &scst_op_descr_get_lba_status, */				\
+	&scst_op_descr_get_lba_status,					\
 	&scst_op_descr_read_capacity16,					\
 	&scst_op_descr_write_same10,					\
 	&scst_op_descr_write_same16,					\
 	&scst_op_descr_unmap,						\
 	&scst_op_descr_format_unit,					\
 	&scst_op_descr_extended_copy,					\
+	&scst_op_descr_populate_token,					\
+	&scst_op_descr_write_using_token,				\
+	&scst_op_descr_receive_rod_token_info,				\
 	&scst_op_descr_cwr,
 
 static const struct scst_opcode_descriptor *vdisk_opcode_descriptors[] = {
@@ -2959,12 +3056,13 @@ static ssize_t vdev_read_sync(struct scst_vdisk_dev *virt_dev, void *buf,
 static enum compl_status_e vdev_verify(struct scst_cmd *cmd, loff_t loff)
 {
 	loff_t err;
-	ssize_t length, len_mem = 0;
-	uint8_t *address_sav, *address = NULL;
+	ssize_t length = 0, len_mem, done, n;
+	uint8_t *address_sav = NULL, *address = NULL;
 	int compare;
 	struct scst_vdisk_dev *virt_dev = cmd->dev->dh_priv;
 	uint8_t *mem_verify = NULL;
 	int64_t data_len = scst_cmd_get_data_len(cmd);
+	int64_t left = data_len;
 	enum scst_dif_actions checks = scst_get_dif_checks(cmd->cmd_dif_actions);
 
 	TRACE_ENTRY();
@@ -2985,23 +3083,24 @@ static enum compl_status_e vdev_verify(struct scst_cmd *cmd, loff_t loff)
 	TRACE_DBG("VERIFY with compare %d at offset %lld and len %lld\n",
 		  compare, loff, (long long)data_len);
 
-	mem_verify = vmalloc(LEN_MEM);
+	if (data_len == 0)
+		goto out;
+
+	mem_verify = vmalloc(min_t(int64_t, data_len, LEN_MEM));
 	if (mem_verify == NULL) {
-		PRINT_ERROR("Unable to allocate memory %d for verify",
-			       LEN_MEM);
+		PRINT_ERROR("Unable to allocate memory %lld for verify",
+			    min_t(int64_t, data_len, LEN_MEM));
 		scst_set_busy(cmd);
 		goto out;
 	}
 
-	if (compare) {
-		length = scst_get_buf_first(cmd, &address);
-		address_sav = address;
-	} else
-		length = data_len;
-
-	while (length > 0) {
-		len_mem = (length > LEN_MEM) ? LEN_MEM : length;
-		TRACE_DBG("Verify: length %zd - len_mem %zd", length, len_mem);
+	/*
+	 * Read the media in big chunks independently from how the data-out
+	 * buffer is split into SG entries.
+	 */
+	while (left > 0) {
+		len_mem = min_t(int64_t, left, LEN_MEM);
+		TRACE_DBG("Verify: left %lld - len_mem %zd", left, len_mem);
 
 		err = vdev_read_sync(virt_dev, mem_verify, len_mem, &loff);
 		if ((err < 0) || (err < len_mem)) {
@@ -3013,42 +3112,54 @@ static enum compl_status_e vdev_verify(struct scst_cmd *cmd, loff_t loff)
 				scst_set_cmd_error(cmd,
 				    SCST_LOAD_SENSE(scst_sense_read_error));
 			}
-			if (compare)
-				scst_put_buf(cmd, address_sav);
-			goto out_free;
+			goto out_put;
 		}
 
-		if (compare && memcmp(address, mem_verify, len_mem) != 0) {
-			TRACE_DBG("Verify: error memcmp length %zd", length);
-			scst_set_cmd_error(cmd,
-			    SCST_LOAD_SENSE(scst_sense_miscompare_error));
-			scst_put_buf(cmd, address_sav);
-			goto out_free;
+		for (done = 0; compare && done < len_mem; done += n) {
+			if (length == 0) {
+				if (address_sav == NULL)
+					length = scst_get_buf_first(cmd, &address);
+				else
+					length = scst_get_buf_next(cmd, &address);
+				address_sav = address;
+				if (length <= 0) {
+					PRINT_ERROR("scst_get_buf_() failed: %zd",
+						    length);
+					scst_set_cmd_error(cmd,
+					    SCST_LOAD_SENSE(scst_sense_internal_failure));
+					address_sav = NULL;
+					goto out_free;
+				}
+			}
+
+			n = min(length, len_mem - done);
+			if (memcmp(address, mem_verify + done, n) != 0) {
+				TRACE_DBG("Verify: error memcmp left %lld",
+					  left);
+				scst_set_cmd_error(cmd,
+				    SCST_LOAD_SENSE(scst_sense_miscompare_error));
+				goto out_put;
+			}
+
+			address += n;
+			length -= n;
+			if (length == 0)
+				scst_put_buf(cmd, address_sav);
 		}
 
 		if (checks != 0) {
 			/* ToDo: check DIF tags as well */
 		}
 
-		length -= len_mem;
-		if (compare)
-			address += len_mem;
-		if (compare && length <= 0) {
-			scst_put_buf(cmd, address_sav);
-			length = scst_get_buf_next(cmd, &address);
-			address_sav = address;
-		}
+		left -= len_mem;
 	}
 
-	if (length < 0) {
-		PRINT_ERROR("scst_get_buf_() failed: %zd", length);
-		scst_set_cmd_error(cmd,
-		    SCST_LOAD_SENSE(scst_sense_internal_failure));
-	}
+out_put:
+	if (length != 0)
+		scst_put_buf(cmd, address_sav);
 
 out_free:
-	if (mem_verify)
-		vfree(mem_verify);
+	vfree(mem_verify);
 
 out:
 	TRACE_EXIT();
@@ -3073,6 +3184,23 @@ static void scst_do_verify_work(struct work_struct *work)
 	cmd->scst_cmd_done(cmd, SCST_CMD_STATE_DEFAULT, SCST_CONTEXT_SAME);
 }
 
+/*
+ * Schedules verifying of the cmd's range on vdisk_verify_wq, so it doesn't
+ * occupy the device's processing threads. Returns false if out of memory.
+ */
+static bool vdisk_queue_verify(struct scst_cmd *cmd, gfp_t gfp_mask)
+{
+	struct scst_verify_work *w = kmalloc(sizeof(*w), gfp_mask);
+
+	if (w == NULL)
+		return false;
+
+	INIT_WORK(&w->work, scst_do_verify_work);
+	w->cmd = cmd;
+	queue_work(vdisk_verify_wq, &w->work);
+	return true;
+}
+
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 1, 0)
 /*
  * See also commit 2ba48ce513c4 ("mirror O_APPEND and O_DIRECT into
@@ -3176,15 +3304,9 @@ static void fileio_async_complete(struct kiocb *iocb, long ret
 		scst_set_cmd_error(cmd,
 				   SCST_LOAD_SENSE(scst_sense_hardw_error));
 	} else if (cmd->do_verify) {
-		struct scst_verify_work *w = kmalloc(sizeof(*w), GFP_ATOMIC);
-
 		cmd->do_verify = false;
-		if (w) {
-			INIT_WORK(&w->work, scst_do_verify_work);
-			w->cmd = cmd;
-			schedule_work(&w->work);
+		if (vdisk_queue_verify(cmd, GFP_ATOMIC))
 			return;
-		}
 
 		scst_set_busy(cmd);
 	}
@@ -3538,6 +3660,8 @@ static void vdisk_exec_write_same_unmap(struct vdisk_cmd_params *p)
 	if (rc != 0)
 		goto out;
 
+	atomic64_add(cmd->data_len, &virt_dev->ws_offloaded_bytes);
+
 out:
 	TRACE_EXIT();
 	return;
@@ -3565,9 +3689,58 @@ static void scst_copy_and_fill(char *dst, const char *src, int len)
 	scst_copy_and_fill_b(dst, src, len, ' ');
 }
 
+/*
+ * WRITE SAME of a block of zeroes: zero the range in the backend instead of
+ * generating writes. Returns -EOPNOTSUPP if not applicable.
+ */
+static int vdisk_write_same_zero(struct vdisk_cmd_params *p)
+{
+	int res = -EOPNOTSUPP;
+	struct scst_cmd *cmd = p->cmd;
+	struct scst_device *dev = cmd->dev;
+	struct scst_vdisk_dev *virt_dev = dev->dh_priv;
+	uint8_t ctrl_offs = (cmd->cdb_len < 32) ? 1 : 10;
+	uint64_t blocks = cmd->data_len >> dev->block_shift;
+	uint8_t *buf;
+	bool zero;
+
+	TRACE_ENTRY();
+
+	if ((cmd->sg_cnt != 1) || (cmd->cdb[ctrl_offs] & 0x6) ||
+	    (dev->dev_dif_type != 0) ||
+	    ((uint64_t)cmd->data_len > dev->max_write_same_len))
+		goto out;
+
+	if (cmd->bufflen != (1 << dev->block_shift))
+		goto out;
+
+	buf = kmap(sg_page(cmd->sg));
+	zero = memchr_inv(buf + cmd->sg->offset, 0, cmd->bufflen) == NULL;
+	kunmap(sg_page(cmd->sg));
+	if (!zero)
+		goto out;
+
+	if ((cmd->lba > virt_dev->nblocks) ||
+	    ((cmd->lba + blocks) > virt_dev->nblocks)) {
+		PRINT_ERROR("Device %s: attempt to write beyond max "
+			"size", virt_dev->name);
+		scst_set_cmd_error(cmd,
+			SCST_LOAD_SENSE(scst_sense_block_out_range_error));
+		res = -EINVAL;
+		goto out;
+	}
+
+	res = vdisk_zero_range(cmd, virt_dev, cmd->lba, blocks);
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
 static enum compl_status_e vdisk_exec_write_same(struct vdisk_cmd_params *p)
 {
 	struct scst_cmd *cmd = p->cmd;
+	struct scst_vdisk_dev *virt_dev = cmd->dev->dh_priv;
 	enum compl_status_e res = CMD_SUCCEEDED;
 	uint8_t ctrl_offs = (cmd->cdb_len < 32) ? 1 : 10;
 
@@ -3589,7 +3762,10 @@ static enum compl_status_e vdisk_exec_write_same(struct vdisk_cmd_params *p)
 
 	if (cmd->cdb[ctrl_offs] & 0x8)
 		vdisk_exec_write_same_unmap(p);
+	else if (vdisk_write_same_zero(p) != -EOPNOTSUPP)
+		goto out;
 	else {
+		atomic64_add(cmd->data_len, &virt_dev->ws_emulated_bytes);
 		scst_write_same(cmd, NULL);
 		res = RUNNING_ASYNC;
 	}
@@ -3670,6 +3846,8 @@ static int vdisk_sup_vpd(uint8_t *buf, struct scst_cmd *cmd,
 	*p++ = 0x83; /* device identification */
 	*p++ = 0x86; /* extended inquiry */
 	if (cmd->dev->type == TYPE_DISK) {
+		if (scst_cm_tpc_supported(cmd->dev))
+			*p++ = 0x8F; /* third-party copy */
 		*p++ = 0xB0; /* block limits */
 		*p++ = 0xB1; /* block device characteristics */
 		if (virt_dev->thin_provisioned)
@@ -4075,6 +4253,9 @@ static enum compl_status_e vdisk_exec_inquiry(struct vdisk_cmd_params *p)
 			resp_len = vdisk_dev_id_vpd(buf, cmd, virt_dev);
 		} else if (cmd->cdb[2] == 0x86) {
 			resp_len = vdisk_ext_inq(buf, cmd, virt_dev);
+		} else if (cmd->cdb[2] == 0x8F && dev->type == TYPE_DISK &&
+			   scst_cm_tpc_supported(dev)) {
+			resp_len = scst_cm_tpc_vpd(cmd, buf);
 		} else if (cmd->cdb[2] == 0xB0 && dev->type == TYPE_DISK) {
 			resp_len = vdisk_block_limits(buf, cmd, virt_dev);
 		} else if (cmd->cdb[2] == 0xB1 && dev->type == TYPE_DISK) {
@@ -5015,11 +5196,129 @@ out:
 	return CMD_SUCCEEDED;
 }
 
+/*
+ * Finds the extent of blocks with the same provisioning status as @lba in a
+ * sparse file by means of SEEK_DATA/SEEK_HOLE. A block that is only partly
+ * backed by data counts as mapped. On success, *next is set to the first
+ * block after the extent, but not beyond @end_lba.
+ */
+static int vdisk_fileio_lba_status(struct scst_vdisk_dev *virt_dev,
+	int block_shift, uint64_t lba, uint64_t end_lba, uint64_t *next,
+	bool *mapped)
+{
+	loff_t pos = lba << block_shift;
+	loff_t data, hole;
+	int res = 0;
+
+	data = vfs_llseek(virt_dev->fd, pos, SEEK_DATA);
+	if (data == -ENXIO) {
+		/* No data at or after pos */
+		*mapped = false;
+		*next = end_lba;
+		goto out;
+	} else if (data < 0) {
+		res = data;
+		goto out;
+	}
+
+	if ((data >> block_shift) > lba) {
+		*mapped = false;
+		*next = min_t(uint64_t, data >> block_shift, end_lba);
+		goto out;
+	}
+
+	hole = vfs_llseek(virt_dev->fd, data, SEEK_HOLE);
+	if (hole == -ENXIO) {
+		/* The file has been truncated under us */
+		hole = end_lba << block_shift;
+	} else if (hole < 0) {
+		res = hole;
+		goto out;
+	}
+
+	*mapped = true;
+	*next = min_t(uint64_t, DIV_ROUND_UP(hole, 1 << block_shift), end_lba);
+
+out:
+	return res;
+}
+
 static enum compl_status_e vdisk_exec_get_lba_status(struct vdisk_cmd_params *p)
 {
-	/* Changing it don't forget to add it to vdisk_opcode_descriptors! */
-	scst_set_invalid_field_in_cdb(p->cmd, 1,
-			0 | SCST_INVAL_FIELD_BIT_OFFS_VALID);
+	struct scst_cmd *cmd = p->cmd;
+	struct scst_device *dev = cmd->dev;
+	struct scst_vdisk_dev *virt_dev = dev->dh_priv;
+	uint64_t lba = cmd->lba, nblocks = virt_dev->nblocks, next;
+	bool sparse_file, mapped;
+	int32_t length, off = 8;
+	uint8_t *buf;
+	int rc;
+
+	TRACE_ENTRY();
+
+	if (lba >= nblocks) {
+		TRACE_DBG("GET LBA STATUS: LBA %lld beyond the end of device "
+			"%s", (unsigned long long)lba, dev->virt_name);
+		scst_set_cmd_error(cmd,
+			SCST_LOAD_SENSE(scst_sense_block_out_range_error));
+		goto out;
+	}
+
+	length = scst_get_buf_full_sense(cmd, &buf);
+	if (unlikely(length <= 0))
+		goto out;
+
+	memset(buf, 0, length);
+
+	/*
+	 * Only the mapping of thin provisioned FILEIO devices is known. All
+	 * other blocks are reported as mapped, which is also what LBPME=0
+	 * implies. There is no block layer interface to query the mapping
+	 * of a thin provisioned block device, e.g. of a dm-thin volume.
+	 */
+	sparse_file = !virt_dev->blockio && !virt_dev->nullio &&
+		      virt_dev->thin_provisioned && (virt_dev->fd != NULL);
+
+	while ((off + 16 <= length) && (lba < nblocks)) {
+		if (sparse_file) {
+			rc = vdisk_fileio_lba_status(virt_dev, dev->block_shift,
+					lba, nblocks, &next, &mapped);
+			if (unlikely(rc != 0)) {
+				PRINT_ERROR("GET LBA STATUS: looking up the "
+					"mapping of LBA %lld of %s failed: %d",
+					(unsigned long long)lba,
+					dev->virt_name, rc);
+				scst_set_cmd_error(cmd,
+					SCST_LOAD_SENSE(scst_sense_read_error));
+				goto out_put;
+			}
+		} else {
+			next = nblocks;
+			mapped = true;
+		}
+
+		next = min_t(uint64_t, next, lba + U32_MAX);
+
+		put_unaligned_be64(lba, &buf[off]);
+		put_unaligned_be32(next - lba, &buf[off + 8]);
+		/* PROVISIONING STATUS: 0 - mapped, 1 - deallocated */
+		buf[off + 12] = mapped ? 0 : 1;
+
+		off += 16;
+		lba = next;
+	}
+
+	if (length >= 4)
+		put_unaligned_be32(off - 4, &buf[0]);
+
+	if (off < cmd->resp_data_len)
+		scst_set_resp_data_len(cmd, off);
+
+out_put:
+	scst_put_buf_full(cmd, buf);
+
+out:
+	TRACE_EXIT();
 	return CMD_SUCCEEDED;
 }
 
@@ -5671,14 +5970,8 @@ static inline void blockio_check_finish(struct scst_blockio_work *blockio_work)
 	cmd = blockio_work->cmd;
 
 	if (unlikely(cmd->do_verify)) {
-		struct scst_verify_work *w = kmalloc(sizeof(*w), GFP_ATOMIC);
-
 		cmd->do_verify = false;
-		if (w) {
-			INIT_WORK(&w->work, scst_do_verify_work);
-			w->cmd = cmd;
-			schedule_work(&w->work);
-		} else {
+		if (!vdisk_queue_verify(cmd, GFP_ATOMIC)) {
 			scst_set_busy(cmd);
 			cmd->completed = 1;
 			cmd->scst_cmd_done(cmd, SCST_CMD_STATE_DEFAULT,
@@ -6282,7 +6575,12 @@ out:
 
 static enum compl_status_e vdev_exec_verify(struct vdisk_cmd_params *p)
 {
-	return vdev_verify(p->cmd, p->loff);
+	struct scst_cmd *cmd = p->cmd;
+
+	if (vdisk_queue_verify(cmd, cmd->cmd_gfp_mask))
+		return RUNNING_ASYNC;
+
+	return vdev_verify(cmd, p->loff);
 }
 
 static enum compl_status_e blockio_exec_write_verify(struct vdisk_cmd_params *p)
@@ -6302,7 +6600,7 @@ static enum compl_status_e fileio_exec_write_verify(struct vdisk_cmd_params *p)
 	p->cmd->do_verify = false;
 	/* O_DSYNC flag is used for WT devices */
 	if (scsi_status_is_good(p->cmd->status))
-		vdev_exec_verify(p);
+		return vdev_exec_verify(p);
 	return CMD_SUCCEEDED;
 }
 
@@ -6425,6 +6723,13 @@ static void vdisk_task_mgmt_fn_done(struct scst_mgmt_cmd *mcmd,
 	return;
 }
 
+static uint64_t vdisk_get_nblocks(struct scst_device *dev)
+{
+	struct scst_vdisk_dev *virt_dev = dev->dh_priv;
+
+	return virt_dev->nblocks;
+}
+
 #ifdef CONFIG_DEBUG_EXT_COPY_REMAP
 static void vdev_ext_copy_remap(struct scst_cmd *cmd,
 	struct scst_ext_copy_seg_descr *seg)
@@ -8166,6 +8471,32 @@ static ssize_t vdisk_sysfs_tst_show(struct kobject *kobj,
 	return pos;
 }
 
+static ssize_t vdisk_sysfs_ws_offloaded_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	struct scst_device *dev;
+	struct scst_vdisk_dev *virt_dev;
+
+	dev = container_of(kobj, struct scst_device, dev_kobj);
+	virt_dev = dev->dh_priv;
+
+	return sprintf(buf, "%lld\n",
+		(long long)atomic64_read(&virt_dev->ws_offloaded_bytes));
+}
+
+static ssize_t vdisk_sysfs_ws_emulated_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	struct scst_device *dev;
+	struct scst_vdisk_dev *virt_dev;
+
+	dev = container_of(kobj, struct scst_device, dev_kobj);
+	virt_dev = dev->dh_priv;
+
+	return sprintf(buf, "%lld\n",
+		(long long)atomic64_read(&virt_dev->ws_emulated_bytes));
+}
+
 static ssize_t vdisk_sysfs_rotational_show(struct kobject *kobj,
 	struct kobj_attribute *attr, char *buf)
 {
@@ -9436,6 +9767,11 @@ static struct kobj_attribute vdisk_tst_attr =
 	__ATTR(tst, S_IRUGO, vdisk_sysfs_tst_show, NULL);
 static struct kobj_attribute vdisk_rotational_attr =
 	__ATTR(rotational, S_IRUGO, vdisk_sysfs_rotational_show, NULL);
+static struct kobj_attribute vdisk_ws_offloaded_attr =
+	__ATTR(ws_offloaded_bytes, S_IRUGO, vdisk_sysfs_ws_offloaded_show,
+	       NULL);
+static struct kobj_attribute vdisk_ws_emulated_attr =
+	__ATTR(ws_emulated_bytes, S_IRUGO, vdisk_sysfs_ws_emulated_show, NULL);
 static struct kobj_attribute vdisk_expl_alua_attr =
 	__ATTR(expl_alua, S_IWUSR|S_IRUGO, vdisk_sysfs_expl_alua_show,
 	       vdisk_sysfs_expl_alua_store);
@@ -9538,6 +9874,8 @@ static const struct attribute *vdisk_fileio_attrs[] = {
 	&vdev_usn_attr.attr,
 	&vdev_inq_vend_specific_attr.attr,
 	&vdev_async_attr.attr,
+	&vdisk_ws_offloaded_attr.attr,
+	&vdisk_ws_emulated_attr.attr,
 	NULL,
 };
 
@@ -9580,6 +9918,7 @@ static struct scst_dev_type vdisk_file_devtype = {
 	.detach_tgt =		vdisk_detach_tgt,
 	.parse =		fileio_parse,
 	.exec =			fileio_exec,
+	.get_nblocks =		vdisk_get_nblocks,
 	.on_free_cmd =		fileio_on_free_cmd,
 	.task_mgmt_fn_done =	vdisk_task_mgmt_fn_done,
 #ifdef CONFIG_DEBUG_EXT_COPY_REMAP
@@ -9628,6 +9967,8 @@ static const struct attribute *vdisk_blockio_attrs[] = {
 	&vdev_usn_attr.attr,
 	&vdev_inq_vend_specific_attr.attr,
 	&vdisk_tp_attr.attr,
+	&vdisk_ws_offloaded_attr.attr,
+	&vdisk_ws_emulated_attr.attr,
 	NULL,
 };
 
@@ -9665,6 +10006,7 @@ static struct scst_dev_type vdisk_blk_devtype = {
 	.detach_tgt =		vdisk_detach_tgt,
 	.parse =		non_fileio_parse,
 	.exec =			blockio_exec,
+	.get_nblocks =		vdisk_get_nblocks,
 	.on_alua_state_change_start = blockio_on_alua_state_change_start,
 	.on_alua_state_change_finish = blockio_on_alua_state_change_finish,
 	.task_mgmt_fn_done =	vdisk_task_mgmt_fn_done,
@@ -9704,6 +10046,8 @@ static const struct attribute *vdisk_nullio_attrs[] = {
 	&vdev_usn_attr.attr,
 	&vdev_inq_vend_specific_attr.attr,
 	&vdisk_rotational_attr.attr,
+	&vdisk_ws_offloaded_attr.attr,
+	&vdisk_ws_emulated_attr.attr,
 	NULL,
 };
 
@@ -9737,6 +10081,7 @@ static struct scst_dev_type vdisk_null_devtype = {
 	.detach_tgt =		vdisk_detach_tgt,
 	.parse =		non_fileio_parse,
 	.exec =			nullio_exec,
+	.get_nblocks =		vdisk_get_nblocks,
 	.task_mgmt_fn_done =	vdisk_task_mgmt_fn_done,
 	.devt_priv =		(void *)nullio_ops,
 	.get_supported_opcodes = vdisk_get_supported_opcodes,
@@ -10026,9 +10371,22 @@ static int __init init_scst_vdisk_driver(void)
 	vdisk_file_devtype.threads_num = num_threads;
 	vcdrom_devtype.threads_num = num_threads;
 
+	if (verify_threads < 1) {
+		PRINT_ERROR("verify_threads can not be less than 1, use "
+			"default %d", DEF_VERIFY_THREADS);
+		verify_threads = DEF_VERIFY_THREADS;
+	}
+
+	vdisk_verify_wq = alloc_workqueue("vdisk_verify",
+				WQ_UNBOUND | WQ_MEM_RECLAIM, verify_threads);
+	if (vdisk_verify_wq == NULL) {
+		res = -ENOMEM;
+		goto out_free_slab;
+	}
+
 	res = init_scst_vdisk(&vdisk_file_devtype);
 	if (res != 0)
-		goto out_free_slab;
+		goto out_free_wq;
 
 	res = init_scst_vdisk(&vdisk_blk_devtype);
 	if (res != 0)
@@ -10054,6 +10412,9 @@ out_free_blk:
 out_free_vdisk:
 	exit_scst_vdisk(&vdisk_file_devtype);
 
+out_free_wq:
+	destroy_workqueue(vdisk_verify_wq);
+
 out_free_slab:
 	kmem_cache_destroy(blockio_work_cachep);
 
@@ -10069,6 +10430,8 @@ static void __exit exit_scst_vdisk_driver(void)
 	exit_scst_vdisk(&vdisk_file_devtype);
 	exit_scst_vdisk(&vcdrom_devtype);
 
+	destroy_workqueue(vdisk_verify_wq);
+
 	kmem_cache_destroy(blockio_work_cachep);
 	kmem_cache_destroy(vdisk_cmd_param_cachep);
 }
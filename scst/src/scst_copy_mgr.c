@@ -10,6 +10,7 @@
 #include <linux/slab.h>
 #include <asm/unaligned.h>
 #include <linux/delay.h>
+#include <linux/random.h>
 
 #ifdef INSIDE_KERNEL_TREE
 #include <scst/scst.h>
@@ -43,6 +44,25 @@
 /* MAXIMUM DESCRIPTOR LIST LENGTH */
 #define SCST_MAX_SEG_DESC_LEN 0xFFFF
 
+/* MAXIMUM SEGMENT LENGTH */
+#define SCST_CM_MAX_SEG_LEN	(256*1024*1024)
+
+/*
+ * ROD tokens of POPULATE TOKEN and WRITE USING TOKEN. Only "access upon
+ * reference" tokens are created, i.e. WRITE USING TOKEN reads the data
+ * represented by the token at the time of the copy.
+ */
+#define SCST_CM_ROD_TYPE_ACCESS_UPON_REF 0x00010000
+#define SCST_CM_ROD_TOKEN_LEN		512
+#define SCST_CM_ROD_MAX_RANGES		64
+/* MAXIMUM TOKEN TRANSFER SIZE, in bytes */
+#define SCST_CM_ROD_MAX_SIZE		(1024*1024*1024)
+/* Inactivity timeouts, in seconds */
+#define SCST_CM_ROD_DEF_INACT_TIMEOUT	60
+#define SCST_CM_ROD_MAX_INACT_TIMEOUT	300
+#define SCST_CM_ROD_CLEANUP_TIME	(10*HZ)
+#define SCST_CM_MAX_ROD_TOKENS_DEF	1024
+
 static struct scst_tgt *scst_cm_tgt;
 static struct scst_session *scst_cm_sess;
 
@@ -80,9 +100,20 @@ struct scst_cm_list_id {
 	unsigned int cm_done:1;
 	unsigned int cm_can_be_immed_free:1;
 
+	/* Set for 32-bit list ids of the ROD token commands */
+	unsigned int cm_lid4:1;
+
+	/* Service action and block shift of the ROD token command */
+	uint8_t cm_serv_action;
+	uint8_t cm_block_shift;
+
 	int cm_segs_processed;
+	/* For POPULATE TOKEN - size of data represented by the token */
 	int64_t cm_written_size; /* in bytes */
 
+	/* Copy of the created ROD token for RECEIVE ROD TOKEN INFORMATION */
+	uint8_t *cm_rod_token;
+
 	unsigned long cm_time_to_free; /* in jiffies */
 
 	int cm_status;
@@ -90,6 +121,42 @@ struct scst_cm_list_id {
 	uint8_t cm_sense[SCST_SENSE_BUFFERSIZE];
 };
 
+struct scst_cm_rod_range {
+	uint64_t lba;
+	uint32_t blocks;
+};
+
+/* Protected by scst_cm_mutex */
+struct scst_cm_rod_token {
+	struct list_head cm_rod_token_list_entry;
+
+	/* Copy manager's tgt_dev of the device the data is on */
+	struct scst_tgt_dev *rod_tgt_dev;
+
+	uint64_t rod_id;
+	uint64_t rod_blocks;
+
+	unsigned long rod_inact_timeout; /* in jiffies */
+	unsigned long rod_expires; /* in jiffies */
+
+	uint8_t rod_token[SCST_CM_ROD_TOKEN_LEN];
+
+	int rod_ranges_cnt;
+	struct scst_cm_rod_range rod_ranges[];
+};
+
+/* Protected by scst_cm_mutex */
+static LIST_HEAD(scst_cm_rod_token_list);
+static int scst_cm_rod_tokens_cnt;
+static uint64_t scst_cm_next_rod_id;
+
+/* Not protected, because no need */
+static unsigned int scst_cm_max_rod_tokens = SCST_CM_MAX_ROD_TOKENS_DEF;
+
+static void scst_cm_rod_token_cleanup_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(scst_cm_rod_token_cleanup_work,
+	scst_cm_rod_token_cleanup_work_fn);
+
 struct scst_cm_internal_cmd_priv {
 	/* Must be the first for scst_finish_internal_cmd()! */
 	scst_i_finish_fn_t cm_finish_fn;
@@ -712,11 +779,9 @@ out:
 	return;
 }
 
-static void scst_cm_store_list_id_details(struct scst_cmd *ec_cmd)
+static void __scst_cm_store_list_id_details(struct scst_cmd *ec_cmd,
+	struct scst_cm_list_id *l)
 {
-	struct scst_cm_ec_cmd_priv *priv = ec_cmd->cmd_data_descriptors;
-	struct scst_cm_list_id *l = priv->cm_list_id;
-
 	TRACE_ENTRY();
 
 	if (l != NULL) {
@@ -748,6 +813,13 @@ static void scst_cm_store_list_id_details(struct scst_cmd *ec_cmd)
 	return;
 }
 
+static void scst_cm_store_list_id_details(struct scst_cmd *ec_cmd)
+{
+	struct scst_cm_ec_cmd_priv *priv = ec_cmd->cmd_data_descriptors;
+
+	__scst_cm_store_list_id_details(ec_cmd, priv->cm_list_id);
+}
+
 static void scst_cm_ec_cmd_done(struct scst_cmd *ec_cmd)
 {
 #ifdef CONFIG_SCST_EXTRACHECKS
@@ -1590,6 +1662,8 @@ out_done:
 	goto out;
 }
 
+static void scst_cm_populate_token(struct scst_cmd *cmd);
+
 static void scst_cm_process_cur_seg_descr(struct scst_cmd *ec_cmd)
 {
 	int rc;
@@ -1619,8 +1693,11 @@ enum scst_exec_res scst_cm_ext_copy_exec(struct scst_cmd *ec_cmd)
 
 	TRACE_ENTRY();
 
-	if (unlikely(priv == NULL))
+	if (unlikely(priv == NULL)) {
+		if (ec_cmd->cdb[1] == SA_POPULATE_TOKEN)
+			scst_cm_populate_token(ec_cmd);
 		goto out_local_done;
+	}
 
 	if (unlikely(scst_cm_is_ec_cmd_done(ec_cmd))) {
 		TRACE_DBG("ec_cmd %p done", ec_cmd);
@@ -1864,17 +1941,17 @@ static void scst_cm_del_free_list_id(struct scst_cm_list_id *l)
 
 	list_del(&l->sess_cm_list_id_entry);
 
+	kfree(l->cm_rod_token);
 	kfree(l);
 
 	TRACE_EXIT();
 	return;
 }
 
-static void scst_cm_sched_del_list_id(struct scst_cmd *ec_cmd)
+static void __scst_cm_sched_del_list_id(struct scst_cmd *ec_cmd,
+	struct scst_cm_list_id *l)
 {
 	struct scst_session *sess = ec_cmd->sess;
-	struct scst_cm_ec_cmd_priv *priv = ec_cmd->cmd_data_descriptors;
-	struct scst_cm_list_id *l = priv->cm_list_id;
 	unsigned long flags;
 
 	TRACE_ENTRY();
@@ -1920,8 +1997,15 @@ out:
 	return;
 }
 
+static void scst_cm_sched_del_list_id(struct scst_cmd *ec_cmd)
+{
+	struct scst_cm_ec_cmd_priv *priv = ec_cmd->cmd_data_descriptors;
+
+	__scst_cm_sched_del_list_id(ec_cmd, priv->cm_list_id);
+}
+
 static struct scst_cm_list_id *scst_cm_add_list_id(struct scst_cmd *cmd,
-	int list_id)
+	int list_id, bool lid4)
 {
 	struct scst_cm_list_id *res;
 	struct scst_session *sess = cmd->sess;
@@ -1937,12 +2021,13 @@ static struct scst_cm_list_id *scst_cm_add_list_id(struct scst_cmd *cmd,
 	}
 
 	res->cm_lid = list_id;
+	res->cm_lid4 = lid4;
 	res->cm_list_id_state = SCST_CM_LIST_ID_STATE_ACTIVE;
 
 	spin_lock_irq(&scst_cm_lock);
 
 	list_for_each_entry(l, &sess->sess_cm_list_id_list, sess_cm_list_id_entry) {
-		if (l->cm_lid == list_id) {
+		if ((l->cm_lid == list_id) && (l->cm_lid4 == lid4)) {
 			if (l->cm_list_id_state == SCST_CM_LIST_ID_STATE_PENDING_FREE) {
 				scst_cm_del_free_list_id(l);
 				break;
@@ -2039,7 +2124,7 @@ static void scst_cm_copy_status(struct scst_cmd *cmd)
 
 	spin_lock_irq(&scst_cm_lock);
 	list_for_each_entry(l, &sess->sess_cm_list_id_list, sess_cm_list_id_entry) {
-		if (l->cm_lid == list_id) {
+		if ((l->cm_lid == list_id) && !l->cm_lid4) {
 			TRACE_DBG("list id %p found (id %d)", l, list_id);
 			found = true;
 			break;
@@ -2116,7 +2201,7 @@ static void scst_cm_failed_seg_details(struct scst_cmd *cmd)
 
 	spin_lock_irq(&scst_cm_lock);
 	list_for_each_entry(l, &sess->sess_cm_list_id_list, sess_cm_list_id_entry) {
-		if (l->cm_lid == list_id) {
+		if ((l->cm_lid == list_id) && !l->cm_lid4) {
 			TRACE_DBG("list id %p found (id %d)", l, list_id);
 			found = true;
 			break;
@@ -2213,7 +2298,7 @@ static void scst_cm_oper_parameters(struct scst_cmd *cmd)
 	put_unaligned_be32(SCST_MAX_SEG_DESC_LEN, &tbuf[12]);
 
 	/* MAXIMUM SEGMENT LENGTH: 256MB */
-	put_unaligned_be32(256*1024*1024, &tbuf[16]);
+	put_unaligned_be32(SCST_CM_MAX_SEG_LEN, &tbuf[16]);
 
 	/* No inline and held data. No stream device max data size. */
 
@@ -2249,6 +2334,178 @@ out:
 	return;
 }
 
+static void scst_cm_rod_token_info(struct scst_cmd *cmd)
+{
+	ssize_t length = 0;
+	uint8_t *buf, *tbuf;
+	int size, list_id, offs;
+	struct scst_cm_list_id *l;
+	struct scst_session *sess = cmd->sess;
+	bool found = false;
+
+	TRACE_ENTRY();
+
+	list_id = get_unaligned_be32(&cmd->cdb[2]);
+
+	size = 32 + SCST_SENSE_BUFFERSIZE + 4 + 2 + SCST_CM_ROD_TOKEN_LEN;
+
+	tbuf = kzalloc(size, GFP_KERNEL);
+	if (tbuf == NULL) {
+		TRACE(TRACE_OUT_OF_MEM, "Unable to allocate RECEIVE ROD TOKEN "
+			"INFORMATION buffer (size %d)", size);
+		goto out_busy;
+	}
+
+	spin_lock_irq(&scst_cm_lock);
+	list_for_each_entry(l, &sess->sess_cm_list_id_list, sess_cm_list_id_entry) {
+		if ((l->cm_lid == list_id) && l->cm_lid4) {
+			TRACE_DBG("list id %p found (id %d)", l, list_id);
+			found = true;
+			break;
+		}
+	}
+	if (found) {
+		tbuf[4] = l->cm_serv_action;
+		if (l->cm_list_id_state == SCST_CM_LIST_ID_STATE_ACTIVE) {
+			tbuf[5] = 0x10; /* in progress, foreground */
+			put_unaligned_be32(1000, &tbuf[8]); /* in ms */
+		} else if (l->cm_status == 0)
+			tbuf[5] = 1; /* completed without errors */
+		else
+			tbuf[5] = 2; /* completed with errors */
+
+		tbuf[12] = l->cm_status;
+		EXTRACHECKS_BUG_ON(l->cm_sense_len > SCST_SENSE_BUFFERSIZE);
+		tbuf[13] = l->cm_sense_len;
+		tbuf[14] = l->cm_sense_len;
+		tbuf[15] = 0xF1; /* transfer count in logical blocks */
+		put_unaligned_be64(l->cm_written_size >> l->cm_block_shift,
+			&tbuf[16]);
+		if (l->cm_sense_len > 0)
+			memcpy(&tbuf[32], l->cm_sense, l->cm_sense_len);
+
+		offs = 32 + l->cm_sense_len;
+		if ((l->cm_rod_token != NULL) &&
+		    (l->cm_list_id_state != SCST_CM_LIST_ID_STATE_ACTIVE)) {
+			/* ROD TOKEN DESCRIPTORS LENGTH */
+			put_unaligned_be32(2 + SCST_CM_ROD_TOKEN_LEN, &tbuf[offs]);
+			memcpy(&tbuf[offs + 6], l->cm_rod_token,
+				SCST_CM_ROD_TOKEN_LEN);
+			size = offs + 6 + SCST_CM_ROD_TOKEN_LEN;
+		} else
+			size = offs + 4;
+
+		put_unaligned_be32(size - 4, &tbuf[0]);
+
+		if ((l->cm_list_id_state != SCST_CM_LIST_ID_STATE_ACTIVE) &&
+		    (cmd->bufflen >= size)) {
+			l->cm_can_be_immed_free = 1;
+			if (l->cm_done)
+				scst_cm_del_free_list_id(l);
+		}
+	}
+
+	l = NULL; /* after unlock it can be immediately get dead */
+
+	spin_unlock_irq(&scst_cm_lock);
+
+	if (!found)
+		goto out_list_id_not_found;
+
+	length = scst_get_buf_full_sense(cmd, &buf);
+	if (unlikely(length <= 0))
+		goto out_free;
+
+	length = min_t(int, size, length);
+
+	memcpy(buf, tbuf, length);
+	scst_set_resp_data_len(cmd, length);
+
+	scst_put_buf_full(cmd, buf);
+
+out_free:
+	kfree(tbuf);
+
+	TRACE_EXIT();
+	return;
+
+out_list_id_not_found:
+	TRACE_DBG("list_id %d not found", list_id);
+	scst_set_invalid_field_in_cdb(cmd, 2, 0);
+	goto out_free;
+
+out_busy:
+	scst_set_busy(cmd);
+	goto out_free;
+}
+
+/**
+ * scst_cm_tpc_vpd() - build Third-party Copy VPD page (8Fh)
+ * @cmd:	INQUIRY command
+ * @buf:	zeroed buffer of at least 128 bytes with byte 0 already set
+ *
+ * Returns the response length.
+ */
+int scst_cm_tpc_vpd(struct scst_cmd *cmd, uint8_t *buf)
+{
+	static const uint8_t cmds[] = {
+		EXTENDED_COPY, 3, 0, SA_POPULATE_TOKEN, SA_WRITE_USING_TOKEN,
+		RECEIVE_COPY_RESULTS, 4, 0, 3, 4, SA_RECEIVE_ROD_TOKEN_INFO,
+	};
+	int block_shift = cmd->dev->block_shift;
+	uint8_t *p = &buf[4];
+
+	buf[1] = 0x8F;
+
+	/* Block Device ROD Token Limits descriptor */
+	put_unaligned_be16(0x0000, &p[0]);
+	put_unaligned_be16(0x20, &p[2]);
+	put_unaligned_be16(SCST_CM_ROD_MAX_RANGES, &p[10]);
+	put_unaligned_be32(SCST_CM_ROD_MAX_INACT_TIMEOUT, &p[12]);
+	put_unaligned_be32(SCST_CM_ROD_DEF_INACT_TIMEOUT, &p[16]);
+	put_unaligned_be64(SCST_CM_ROD_MAX_SIZE >> block_shift, &p[20]);
+	put_unaligned_be64(SCST_CM_MAX_SEG_LEN >> block_shift, &p[28]);
+	p += 36;
+
+	/* Supported Commands descriptor */
+	BUILD_BUG_ON((sizeof(cmds) + 1) % 4 != 0);
+	put_unaligned_be16(0x0001, &p[0]);
+	put_unaligned_be16(sizeof(cmds) + 1, &p[2]);
+	p[4] = sizeof(cmds);
+	memcpy(&p[5], cmds, sizeof(cmds));
+	p += 4 + sizeof(cmds) + 1;
+
+	/* Supported Descriptors descriptor */
+	put_unaligned_be16(0x0004, &p[0]);
+	put_unaligned_be16(4, &p[2]);
+	p[4] = 2;
+	p[5] = 2; /* block device to block device */
+	p[6] = 0xE4; /* identification descriptor */
+	p += 8;
+
+	/* Supported ROD Types descriptor */
+	put_unaligned_be16(0x0108, &p[0]);
+	put_unaligned_be16(12, &p[2]);
+	put_unaligned_be16(8, &p[6]);
+	put_unaligned_be32(SCST_CM_ROD_TYPE_ACCESS_UPON_REF, &p[8]);
+	p[12] = 3; /* TOKEN_IN and TOKEN_OUT */
+	p += 16;
+
+	/* General Copy Operations descriptor */
+	put_unaligned_be16(0x8001, &p[0]);
+	put_unaligned_be16(0x20, &p[2]);
+	put_unaligned_be32(0xFFFF, &p[4]); /* TOTAL CONCURRENT COPIES */
+	put_unaligned_be32(0xFF, &p[8]); /* MAXIMUM IDENTIFIED CONCURRENT COPIES */
+	put_unaligned_be32(SCST_CM_MAX_SEG_LEN, &p[12]);
+	p[16] = 16; /* DATA SEGMENT GRANULARITY, 64K */
+	p += 36;
+
+	put_unaligned_be16(p - &buf[4], &buf[2]);
+
+	return p - buf;
+}
+EXPORT_SYMBOL_GPL(scst_cm_tpc_vpd);
+
 enum scst_exec_res scst_cm_rcv_copy_res_exec(struct scst_cmd *cmd)
 {
 	enum scst_exec_res res = SCST_EXEC_COMPLETED;
@@ -2268,6 +2525,9 @@ enum scst_exec_res scst_cm_rcv_copy_res_exec(struct scst_cmd *cmd)
 	case 4: /* failed segment details */
 		scst_cm_failed_seg_details(cmd);
 		break;
+	case SA_RECEIVE_ROD_TOKEN_INFO:
+		scst_cm_rod_token_info(cmd);
+		break;
 	default:
 		TRACE(TRACE_MINOR, "%s: action %d not supported", cmd->op_name,
 			action);
@@ -2618,14 +2878,126 @@ out_err:
 	goto out;
 }
 
+/* scst_cm_mutex supposed to be held */
+static void scst_cm_free_rod_token(struct scst_cm_rod_token *t)
+{
+	lockdep_assert_held(&scst_cm_mutex);
+
+	TRACE_DBG("Freeing ROD token %p (id %llx)", t,
+		(unsigned long long)t->rod_id);
+
+	list_del(&t->cm_rod_token_list_entry);
+	scst_cm_rod_tokens_cnt--;
+	kfree(t);
+	return;
+}
+
+/* scst_cm_mutex supposed to be held */
+static void scst_cm_purge_expired_rod_tokens(void)
+{
+	struct scst_cm_rod_token *t, *tt;
+
+	lockdep_assert_held(&scst_cm_mutex);
+
+	list_for_each_entry_safe(t, tt, &scst_cm_rod_token_list,
+				cm_rod_token_list_entry) {
+		if (time_after_eq(jiffies, t->rod_expires))
+			scst_cm_free_rod_token(t);
+	}
+	return;
+}
+
+static void scst_cm_rod_token_cleanup_work_fn(struct work_struct *work)
+{
+	TRACE_ENTRY();
+
+	mutex_lock(&scst_cm_mutex);
+
+	scst_cm_purge_expired_rod_tokens();
+
+	if (!list_empty(&scst_cm_rod_token_list))
+		schedule_delayed_work(&scst_cm_rod_token_cleanup_work,
+			SCST_CM_ROD_CLEANUP_TIME);
+
+	mutex_unlock(&scst_cm_mutex);
+
+	TRACE_EXIT();
+	return;
+}
+
+/* scst_cm_mutex supposed to be held */
+static struct scst_cm_rod_token *scst_cm_find_rod_token(const uint8_t *token)
+{
+	struct scst_cm_rod_token *t;
+	uint64_t id = get_unaligned_be64(&token[8]);
+
+	lockdep_assert_held(&scst_cm_mutex);
+
+	list_for_each_entry(t, &scst_cm_rod_token_list, cm_rod_token_list_entry) {
+		if ((t->rod_id == id) &&
+		    (memcmp(t->rod_token, token, SCST_CM_ROD_TOKEN_LEN) == 0))
+			return t;
+	}
+
+	return NULL;
+}
+
+/*
+ * scst_cm_mutex supposed to be held. Returns the copy manager's designator
+ * of dev, if any.
+ */
+static struct scst_cm_desig *scst_cm_find_dev_desig(const struct scst_device *dev)
+{
+	struct scst_cm_desig *des;
+
+	lockdep_assert_held(&scst_cm_mutex);
+
+	list_for_each_entry(des, &scst_cm_desig_list, cm_desig_list_entry) {
+		if (des->desig_tgt_dev->dev == dev)
+			return des;
+	}
+
+	return NULL;
+}
+
+/**
+ * scst_cm_tpc_supported() - whether third-party copy is supported for a device
+ * @dev:	device
+ *
+ * Returns true if the copy manager supports POPULATE TOKEN and WRITE USING
+ * TOKEN for @dev, i.e. if its Third-party Copy VPD page should be reported.
+ */
+bool scst_cm_tpc_supported(struct scst_device *dev)
+{
+	bool res;
+
+	if (dev->handler->get_nblocks == NULL)
+		return false;
+
+	mutex_lock(&scst_cm_mutex);
+	res = (scst_cm_find_dev_desig(dev) != NULL);
+	mutex_unlock(&scst_cm_mutex);
+
+	return res;
+}
+EXPORT_SYMBOL_GPL(scst_cm_tpc_supported);
+
 static void scst_cm_dev_free_designators(struct scst_device *dev)
 {
 	struct scst_cm_desig *des, *t;
+	struct scst_cm_rod_token *rt, *rtt;
 
 	TRACE_ENTRY();
 
 	mutex_lock(&scst_cm_mutex);
 
+	/* ROD tokens refer to the designators' tgt_devs, so revoke them */
+	list_for_each_entry_safe(rt, rtt, &scst_cm_rod_token_list,
+				cm_rod_token_list_entry) {
+		if (rt->rod_tgt_dev->dev == dev)
+			scst_cm_free_rod_token(rt);
+	}
+
 	list_for_each_entry_safe(des, t, &scst_cm_desig_list, cm_desig_list_entry) {
 		if (des->desig_tgt_dev->dev == dev) {
 			TRACE_DBG("Deleting des %p", des);
@@ -2795,6 +3167,12 @@ void scst_cm_on_dev_unregister(struct scst_device *dev)
 	return;
 }
 
+/* Returns true if @tgt is the copy manager's target */
+bool scst_cm_is_cm_tgt(const struct scst_tgt *tgt)
+{
+	return (scst_cm_tgt != NULL) && (tgt == scst_cm_tgt);
+}
+
 /* scst_mutex supposed to be held */
 int scst_cm_on_add_acg(struct scst_acg *acg)
 {
@@ -3410,6 +3788,515 @@ static void scst_cm_free_ec_priv(struct scst_cmd *ec_cmd, bool unblock_dev)
 	return;
 }
 
+/*
+ * Maps the data represented by a ROD token, starting offs blocks into it,
+ * onto the WRITE USING TOKEN destination ranges in dst. Returns the number
+ * of needed segments and, if d isn't NULL, fills them. Destination blocks
+ * beyond the data represented by the token are left untouched, the
+ * transfer count in RECEIVE ROD TOKEN INFORMATION tells how much was written.
+ */
+static int scst_cm_map_wut_segs(struct scst_ext_copy_seg_descr *d,
+	const struct scst_cm_rod_range *src, int src_cnt, uint64_t offs,
+	const uint8_t *dst, int dst_cnt, int block_shift,
+	struct scst_tgt_dev *src_tgt_dev, struct scst_tgt_dev *dst_tgt_dev)
+{
+	uint64_t s_done, d_done = 0;
+	uint64_t max_blocks = SCST_CM_MAX_SEG_LEN >> block_shift;
+	int si = 0, di = 0, n = 0;
+
+	while ((si < src_cnt) && (offs >= src[si].blocks)) {
+		offs -= src[si].blocks;
+		si++;
+	}
+	s_done = offs;
+
+	while ((si < src_cnt) && (di < dst_cnt)) {
+		const uint8_t *r = &dst[di * 16];
+		uint64_t s_left = src[si].blocks - s_done;
+		uint64_t d_left = get_unaligned_be32(&r[8]) - d_done;
+		uint64_t blocks;
+
+		if (s_left == 0) {
+			si++;
+			s_done = 0;
+			continue;
+		}
+		if (d_left == 0) {
+			di++;
+			d_done = 0;
+			continue;
+		}
+
+		blocks = min(min(s_left, d_left), max_blocks);
+
+		if (d != NULL) {
+			struct scst_ext_copy_seg_descr *sd = &d[n];
+
+			sd->type = SCST_EXT_COPY_SEG_DATA;
+			sd->src_tgt_dev = src_tgt_dev;
+			sd->data_descr.src_lba = src[si].lba + s_done;
+			sd->dst_tgt_dev = dst_tgt_dev;
+			sd->data_descr.dst_lba = get_unaligned_be64(&r[0]) + d_done;
+			sd->data_descr.data_len = blocks << block_shift;
+			sd->tgt_descr_offs = 536 + di * 16;
+
+			TRACE(TRACE_DEBUG|TRACE_SCSI, "WUT seg %d: src_lba %lld, "
+				"dst_lba %lld, len %d", n,
+				(long long)sd->data_descr.src_lba,
+				(long long)sd->data_descr.dst_lba,
+				sd->data_descr.data_len);
+		}
+
+		n++;
+		s_done += blocks;
+		d_done += blocks;
+	}
+
+	return n;
+}
+
+/*
+ * WRITE USING TOKEN. Converted into segment descriptors of the referenced
+ * ROD token's data, so the copy itself is done by the EXTENDED COPY engine,
+ * including remapping by the dev handler where it supports it.
+ */
+static int scst_cm_parse_wut_descriptors(struct scst_cmd *ec_cmd)
+{
+	int res = 0, rc, cnt, seg_cnt, ranges_cnt;
+	struct scst_cm_list_id *plist_id = NULL;
+	struct scst_cm_ec_cmd_priv *p;
+	struct scst_cm_rod_token *t;
+	struct scst_cm_rod_range *ranges = NULL;
+	struct scst_cm_desig *des;
+	struct scst_tgt_dev *src_tgt_dev, *dst_tgt_dev;
+	const uint8_t *token;
+	uint64_t offs, rod_blocks;
+	ssize_t length = 0;
+	uint8_t *buf;
+	bool read_only;
+	unsigned long flags;
+
+	TRACE_ENTRY();
+
+	length = scst_get_buf_full_sense(ec_cmd, &buf);
+	if (unlikely(length <= 0)) {
+		if (length == 0)
+			goto out_put;
+		else
+			goto out_abn;
+	}
+
+	if (length < 536) {
+		PRINT_WARNING("Too small WRITE USING TOKEN data len %d",
+			(int)length);
+		scst_set_invalid_field_in_cdb(ec_cmd, 10, 0);
+		goto out_abn_put;
+	}
+
+	TRACE_BUFF_FLAG(TRACE_DEBUG, "buf", buf, length);
+
+	plist_id = scst_cm_add_list_id(ec_cmd,
+			get_unaligned_be32(&ec_cmd->cdb[6]), true);
+	if (plist_id == NULL)
+		goto out_abn_put;
+
+	plist_id->cm_serv_action = SA_WRITE_USING_TOKEN;
+	plist_id->cm_block_shift = ec_cmd->dev->block_shift;
+
+	rc = get_unaligned_be16(&buf[534]);
+	if ((get_unaligned_be16(&buf[0]) + 2 > length) || (536 + rc > length)) {
+		PRINT_WARNING("Parameters truncation");
+		scst_set_cmd_error(ec_cmd,
+			SCST_LOAD_SENSE(scst_sense_parameter_list_length_invalid));
+		goto out_del_abn_put;
+	}
+
+	if ((rc == 0) || ((rc % 16) != 0)) {
+		PRINT_WARNING("Invalid block device range descriptors len %d", rc);
+		scst_set_invalid_field_in_parm_list(ec_cmd, 534, 0);
+		goto out_del_abn_put;
+	}
+
+	cnt = rc / 16;
+	if (cnt > SCST_CM_ROD_MAX_RANGES) {
+		PRINT_WARNING("Too many range descriptors %d", cnt);
+		scst_set_cmd_error(ec_cmd,
+			SCST_LOAD_SENSE(scst_sense_too_many_segment_descriptors));
+		goto out_del_abn_put;
+	}
+
+	token = &buf[16];
+	if (get_unaligned_be32(&token[0]) != SCST_CM_ROD_TYPE_ACCESS_UPON_REF) {
+		TRACE(TRACE_MINOR, "Unsupported ROD type %x",
+			get_unaligned_be32(&token[0]));
+		scst_set_cmd_error(ec_cmd,
+			SCST_LOAD_SENSE(scst_sense_unsupported_token_type));
+		goto out_del_abn_put;
+	}
+
+	if (get_unaligned_be16(&token[6]) != SCST_CM_ROD_TOKEN_LEN - 8) {
+		TRACE(TRACE_MINOR, "Invalid ROD token len %d",
+			get_unaligned_be16(&token[6]));
+		scst_set_cmd_error(ec_cmd,
+			SCST_LOAD_SENSE(scst_sense_invalid_token_length));
+		goto out_del_abn_put;
+	}
+
+	offs = get_unaligned_be64(&buf[8]);
+
+	mutex_lock(&scst_cm_mutex);
+
+	t = scst_cm_find_rod_token(token);
+	if (t == NULL) {
+		mutex_unlock(&scst_cm_mutex);
+		TRACE(TRACE_MINOR|TRACE_SCSI, "Unknown ROD token (initiator "
+			"%s)", ec_cmd->sess->initiator_name);
+		scst_set_cmd_error(ec_cmd,
+			SCST_LOAD_SENSE(scst_sense_token_unknown));
+		goto out_del_abn_put;
+	}
+
+	if (time_after_eq(jiffies, t->rod_expires)) {
+		TRACE(TRACE_MINOR|TRACE_SCSI, "ROD token %llx expired",
+			(unsigned long long)t->rod_id);
+		scst_cm_free_rod_token(t);
+		mutex_unlock(&scst_cm_mutex);
+		scst_set_cmd_error(ec_cmd,
+			SCST_LOAD_SENSE(scst_sense_token_expired));
+		goto out_del_abn_put;
+	}
+
+	des = scst_cm_find_dev_desig(ec_cmd->dev);
+	if (des == NULL) {
+		mutex_unlock(&scst_cm_mutex);
+		TRACE(TRACE_MINOR, "Device %s not known to the copy manager",
+			ec_cmd->dev->virt_name);
+		scst_set_cmd_error(ec_cmd,
+			SCST_LOAD_SENSE(scst_sense_invalid_token_op));
+		goto out_del_abn_put;
+	}
+
+	dst_tgt_dev = des->desig_tgt_dev;
+	src_tgt_dev = t->rod_tgt_dev;
+	rod_blocks = t->rod_blocks;
+	ranges_cnt = t->rod_ranges_cnt;
+
+	ranges = kmemdup(t->rod_ranges, ranges_cnt * sizeof(*ranges),
+			GFP_KERNEL);
+	if (ranges == NULL) {
+		mutex_unlock(&scst_cm_mutex);
+		TRACE(TRACE_OUT_OF_MEM, "Unable to allocate ROD ranges "
+			"(count %d)", ranges_cnt);
+		scst_set_busy(ec_cmd);
+		goto out_del_abn_put;
+	}
+
+	if (buf[2] & 2) /* DEL_TKN */
+		scst_cm_free_rod_token(t);
+	else
+		t->rod_expires = jiffies + t->rod_inact_timeout;
+
+	mutex_unlock(&scst_cm_mutex);
+
+	if (src_tgt_dev->dev->block_size != dst_tgt_dev->dev->block_size) {
+		PRINT_WARNING("ROD token block size %d doesn't match %d",
+			src_tgt_dev->dev->block_size,
+			dst_tgt_dev->dev->block_size);
+		scst_set_cmd_error(ec_cmd,
+			SCST_LOAD_SENSE(scst_sense_invalid_token_op));
+		goto out_free_ranges;
+	}
+
+	if (offs >= rod_blocks) {
+		PRINT_WARNING("Offset into ROD %lld beyond token size %lld",
+			(long long)offs, (long long)rod_blocks);
+		scst_set_invalid_field_in_parm_list(ec_cmd, 8, 0);
+		goto out_free_ranges;
+	}
+
+	if (!scst_cm_check_access(ec_cmd->sess->initiator_name,
+			src_tgt_dev->dev, &read_only)) {
+		scst_set_cmd_error(ec_cmd,
+			SCST_LOAD_SENSE(scst_sense_invalid_token_op));
+		goto out_free_ranges;
+	}
+
+	seg_cnt = scst_cm_map_wut_segs(NULL, ranges, ranges_cnt, offs,
+			&buf[536], cnt, dst_tgt_dev->dev->block_shift,
+			NULL, NULL);
+	if (seg_cnt > SCST_CM_MAX_SEG_DESCR_CNT) {
+		PRINT_WARNING("Too many segments %d", seg_cnt);
+		scst_set_cmd_error(ec_cmd,
+			SCST_LOAD_SENSE(scst_sense_too_many_segment_descriptors));
+		goto out_free_ranges;
+	}
+
+	TRACE_DBG("seg_cnt %d", seg_cnt);
+
+	p = kzalloc(sizeof(*p) + seg_cnt * sizeof(struct scst_ext_copy_seg_descr), GFP_KERNEL);
+	if (p == NULL) {
+		TRACE(TRACE_OUT_OF_MEM, "Unable to allocate WRITE USING TOKEN "
+			"descriptors (seg_cnt %d)", seg_cnt);
+		scst_set_busy(ec_cmd);
+		goto out_free_ranges;
+	}
+
+	p->cm_list_id = plist_id;
+	plist_id = NULL;
+	INIT_LIST_HEAD(&p->cm_sorted_devs_list);
+	INIT_LIST_HEAD(&p->cm_internal_cmd_list);
+	p->cm_error = SCST_CM_ERROR_NONE;
+	mutex_init(&p->cm_mutex);
+
+	ec_cmd->cmd_data_descriptors = p;
+	ec_cmd->cmd_data_descriptors_cnt = seg_cnt;
+
+	scst_cm_map_wut_segs(p->cm_seg_descrs, ranges, ranges_cnt, offs,
+		&buf[536], cnt, dst_tgt_dev->dev->block_shift,
+		src_tgt_dev, dst_tgt_dev);
+
+	res = scst_cm_add_to_descr_list(ec_cmd, ec_cmd->tgt_dev);
+	if (res != 0)
+		goto out_free_p;
+
+	res = scst_cm_add_to_descr_list(ec_cmd, src_tgt_dev);
+	if (res != 0)
+		goto out_free_p;
+
+	kfree(ranges);
+
+out_put:
+	scst_put_buf_full(ec_cmd, buf);
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+
+out_free_p:
+	plist_id = p->cm_list_id;
+	scst_cm_free_ec_priv(ec_cmd, false);
+
+out_free_ranges:
+	kfree(ranges);
+
+out_del_abn_put:
+	spin_lock_irqsave(&scst_cm_lock, flags);
+	scst_cm_del_free_list_id(plist_id);
+	spin_unlock_irqrestore(&scst_cm_lock, flags);
+
+out_abn_put:
+	scst_put_buf_full(ec_cmd, buf);
+
+out_abn:
+	scst_set_cmd_abnormal_done_state(ec_cmd);
+	res = -1;
+	goto out;
+}
+
+/*
+ * POPULATE TOKEN. Creates a ROD token representing the data in the given
+ * ranges of cmd's device. Nothing is read until the token is used.
+ */
+static void scst_cm_populate_token(struct scst_cmd *cmd)
+{
+	struct scst_device *dev = cmd->dev;
+	struct scst_cm_list_id *l;
+	struct scst_cm_rod_token *t = NULL;
+	struct scst_cm_desig *des;
+	uint32_t inact, rod_type;
+	uint64_t blocks = 0, nblocks;
+	ssize_t length;
+	uint8_t *buf, *tok;
+	int i, rd_len, cnt;
+
+	TRACE_ENTRY();
+
+	l = scst_cm_add_list_id(cmd, get_unaligned_be32(&cmd->cdb[6]), true);
+	if (l == NULL)
+		goto out;
+
+	l->cm_serv_action = SA_POPULATE_TOKEN;
+	l->cm_block_shift = dev->block_shift;
+
+	if (dev->handler->get_nblocks == NULL) {
+		TRACE(TRACE_MINOR, "%s not supported by device %s",
+			cmd->op_name, dev->virt_name);
+		scst_set_invalid_field_in_cdb(cmd, 1,
+			SCST_INVAL_FIELD_BIT_OFFS_VALID | 0);
+		goto out_done;
+	}
+
+	length = scst_get_buf_full_sense(cmd, &buf);
+	if (unlikely(length <= 0))
+		goto out_done;
+
+	if (length < 16) {
+		PRINT_WARNING("Too small POPULATE TOKEN data len %d",
+			(int)length);
+		scst_set_invalid_field_in_cdb(cmd, 10, 0);
+		goto out_put;
+	}
+
+	rd_len = get_unaligned_be16(&buf[14]);
+	if ((get_unaligned_be16(&buf[0]) + 2 > length) ||
+	    (16 + rd_len > length)) {
+		PRINT_WARNING("Parameters truncation");
+		scst_set_cmd_error(cmd,
+			SCST_LOAD_SENSE(scst_sense_parameter_list_length_invalid));
+		goto out_put;
+	}
+
+	rod_type = get_unaligned_be32(&buf[8]);
+	if ((buf[2] & 2) && (rod_type != 0) && /* RTV */
+	    (rod_type != SCST_CM_ROD_TYPE_ACCESS_UPON_REF)) {
+		TRACE(TRACE_MINOR, "Unsupported ROD type %x", rod_type);
+		scst_set_invalid_field_in_parm_list(cmd, 8, 0);
+		goto out_put;
+	}
+
+	inact = get_unaligned_be32(&buf[4]);
+	if (inact == 0)
+		inact = SCST_CM_ROD_DEF_INACT_TIMEOUT;
+	else if (inact > SCST_CM_ROD_MAX_INACT_TIMEOUT) {
+		TRACE(TRACE_MINOR, "Too big inactivity timeout %d", inact);
+		scst_set_invalid_field_in_parm_list(cmd, 4, 0);
+		goto out_put;
+	}
+
+	if ((rd_len == 0) || ((rd_len % 16) != 0)) {
+		PRINT_WARNING("Invalid block device range descriptors len %d",
+			rd_len);
+		scst_set_invalid_field_in_parm_list(cmd, 14, 0);
+		goto out_put;
+	}
+
+	cnt = rd_len / 16;
+	if (cnt > SCST_CM_ROD_MAX_RANGES) {
+		PRINT_WARNING("Too many range descriptors %d", cnt);
+		scst_set_cmd_error(cmd,
+			SCST_LOAD_SENSE(scst_sense_too_many_segment_descriptors));
+		goto out_put;
+	}
+
+	t = kzalloc(sizeof(*t) + cnt * sizeof(t->rod_ranges[0]), GFP_KERNEL);
+	if (t == NULL) {
+		TRACE(TRACE_OUT_OF_MEM, "Unable to allocate ROD token "
+			"(ranges %d)", cnt);
+		scst_set_busy(cmd);
+		goto out_put;
+	}
+
+	nblocks = dev->handler->get_nblocks(dev);
+	for (i = 0; i < cnt; i++) {
+		const uint8_t *r = &buf[16 + i * 16];
+		struct scst_cm_rod_range *rr = &t->rod_ranges[i];
+
+		rr->lba = get_unaligned_be64(&r[0]);
+		rr->blocks = get_unaligned_be32(&r[8]);
+		if ((rr->lba > nblocks) || (rr->blocks > nblocks - rr->lba)) {
+			TRACE(TRACE_MINOR, "Range %d (LBA %lld, %d blocks) "
+				"beyond the end of device %s (%lld blocks)", i,
+				(long long)rr->lba, rr->blocks, dev->virt_name,
+				(long long)nblocks);
+			scst_set_invalid_field_in_parm_list(cmd, 16 + i * 16, 0);
+			goto out_free;
+		}
+		blocks += rr->blocks;
+	}
+	t->rod_ranges_cnt = cnt;
+	t->rod_blocks = blocks;
+	t->rod_inact_timeout = inact * HZ;
+
+	if ((blocks == 0) ||
+	    ((blocks << dev->block_shift) > SCST_CM_ROD_MAX_SIZE)) {
+		PRINT_WARNING("Invalid ROD token size %lld blocks",
+			(long long)blocks);
+		scst_set_invalid_field_in_parm_list(cmd, 16, 0);
+		goto out_free;
+	}
+
+	tok = t->rod_token;
+	put_unaligned_be32(SCST_CM_ROD_TYPE_ACCESS_UPON_REF, &tok[0]);
+	put_unaligned_be16(SCST_CM_ROD_TOKEN_LEN - 8, &tok[6]);
+	/* NUMBER OF BYTES REPRESENTED */
+	put_unaligned_be64(blocks << dev->block_shift, &tok[56]);
+	/* Makes the token impossible to guess */
+	get_random_bytes(&tok[128], SCST_CM_ROD_TOKEN_LEN - 128);
+
+	mutex_lock(&scst_cm_mutex);
+
+	des = scst_cm_find_dev_desig(dev);
+	if (des == NULL) {
+		mutex_unlock(&scst_cm_mutex);
+		TRACE(TRACE_MINOR, "Device %s not known to the copy manager",
+			dev->virt_name);
+		scst_set_cmd_error(cmd,
+			SCST_LOAD_SENSE(scst_sense_invalid_token_op));
+		goto out_free;
+	}
+
+	scst_cm_purge_expired_rod_tokens();
+
+	if (scst_cm_rod_tokens_cnt >= scst_cm_max_rod_tokens) {
+		mutex_unlock(&scst_cm_mutex);
+		PRINT_WARNING("Too many ROD tokens (max %u)",
+			scst_cm_max_rod_tokens);
+		scst_set_cmd_error(cmd,
+			SCST_LOAD_SENSE(scst_sense_insufficient_rod_token_res));
+		goto out_free;
+	}
+
+	l->cm_rod_token = kmalloc(SCST_CM_ROD_TOKEN_LEN, GFP_KERNEL);
+	if (l->cm_rod_token == NULL) {
+		mutex_unlock(&scst_cm_mutex);
+		TRACE(TRACE_OUT_OF_MEM, "%s", "Unable to allocate ROD token copy");
+		scst_set_busy(cmd);
+		goto out_free;
+	}
+
+	t->rod_tgt_dev = des->desig_tgt_dev;
+	t->rod_id = scst_cm_next_rod_id++;
+	put_unaligned_be64(t->rod_id, &tok[8]);
+
+	/* CREATOR LOGICAL UNIT DESCRIPTOR in the target descriptor format */
+	tok[16] = 0xE4;
+	tok[17] = dev->type & 0x1F;
+	memcpy(&tok[20], des->desig, min(des->desig_len, 24));
+	put_unaligned_be24(dev->block_size, &tok[16 + 29]);
+
+	t->rod_expires = jiffies + t->rod_inact_timeout;
+	list_add_tail(&t->cm_rod_token_list_entry, &scst_cm_rod_token_list);
+	scst_cm_rod_tokens_cnt++;
+
+	schedule_delayed_work(&scst_cm_rod_token_cleanup_work,
+		SCST_CM_ROD_CLEANUP_TIME);
+
+	memcpy(l->cm_rod_token, tok, SCST_CM_ROD_TOKEN_LEN);
+	l->cm_written_size = blocks << dev->block_shift;
+
+	TRACE(TRACE_DEBUG|TRACE_SCSI, "ROD token %p (id %llx, dev %s, blocks "
+		"%lld, ranges %d) created", t, (unsigned long long)t->rod_id,
+		dev->virt_name, (long long)blocks, cnt);
+
+	mutex_unlock(&scst_cm_mutex);
+
+	t = NULL;
+
+out_free:
+	kfree(t);
+
+out_put:
+	scst_put_buf_full(cmd, buf);
+
+out_done:
+	__scst_cm_store_list_id_details(cmd, l);
+	__scst_cm_sched_del_list_id(cmd, l);
+
+out:
+	TRACE_EXIT();
+	return;
+}
+
 int scst_cm_parse_descriptors(struct scst_cmd *ec_cmd)
 {
 	int res = 0, rc;
@@ -3426,6 +4313,11 @@ int scst_cm_parse_descriptors(struct scst_cmd *ec_cmd)
 
 	EXTRACHECKS_BUG_ON(ec_cmd->cmd_data_descriptors != NULL);
 
+	if (ec_cmd->cdb[1] == SA_WRITE_USING_TOKEN) {
+		res = scst_cm_parse_wut_descriptors(ec_cmd);
+		goto out;
+	}
+
 	length = scst_get_buf_full_sense(ec_cmd, &buf);
 	if (unlikely(length <= 0)) {
 		if (length == 0)
@@ -3450,7 +4342,7 @@ int scst_cm_parse_descriptors(struct scst_cmd *ec_cmd)
 	switch (list_id_usage) {
 	case 0:
 	case 2:
-		plist_id = scst_cm_add_list_id(ec_cmd, list_id);
+		plist_id = scst_cm_add_list_id(ec_cmd, list_id, false);
 		if (plist_id == NULL)
 			goto out_abn_put;
 		break;
@@ -3733,8 +4625,74 @@ static struct kobj_attribute scst_cm_allow_not_conn_copy_attr =
 		scst_cm_allow_not_conn_copy_show,
 		scst_cm_allow_not_conn_copy_store);
 
+static ssize_t scst_cm_max_rod_tokens_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	ssize_t res;
+
+	TRACE_ENTRY();
+
+	res = sprintf(buf, "%u\n%s", scst_cm_max_rod_tokens,
+		(scst_cm_max_rod_tokens == SCST_CM_MAX_ROD_TOKENS_DEF) ?
+			"" : SCST_SYSFS_KEY_MARK "\n");
+
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+static ssize_t scst_cm_max_rod_tokens_store(struct kobject *kobj,
+	struct kobj_attribute *attr, const char *buffer, size_t size)
+{
+	ssize_t res;
+	unsigned long val;
+
+	TRACE_ENTRY();
+
+	res = kstrtoul(buffer, 0, &val);
+	if (res != 0) {
+		PRINT_ERROR("strtoul() for %s failed: %zd", buffer, res);
+		goto out;
+	}
+
+	if (val > INT_MAX) {
+		PRINT_ERROR("Invalid max ROD tokens %lu", val);
+		res = -EINVAL;
+		goto out;
+	}
+
+	scst_cm_max_rod_tokens = val;
+
+	res = size;
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+static struct kobj_attribute scst_cm_max_rod_tokens_attr =
+	__ATTR(max_rod_tokens, S_IRUGO|S_IWUSR,
+		scst_cm_max_rod_tokens_show,
+		scst_cm_max_rod_tokens_store);
+
+static ssize_t scst_cm_rod_tokens_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	ssize_t res;
+
+	mutex_lock(&scst_cm_mutex);
+	res = sprintf(buf, "%d\n", scst_cm_rod_tokens_cnt);
+	mutex_unlock(&scst_cm_mutex);
+
+	return res;
+}
+
+static struct kobj_attribute scst_cm_rod_tokens_attr =
+	__ATTR(rod_tokens, S_IRUGO, scst_cm_rod_tokens_show, NULL);
+
 static const struct attribute *scst_cm_tgtt_attrs[] = {
 	&scst_cm_allow_not_conn_copy_attr.attr,
+	&scst_cm_max_rod_tokens_attr.attr,
+	&scst_cm_rod_tokens_attr.attr,
 	NULL,
 };
 
@@ -3870,10 +4828,21 @@ out_unreg_tgtt:
 	goto out;
 }
 
-void __exit scst_cm_exit(void)
+/* Not __exit, because it is also called from the error path of init_scst() */
+void scst_cm_exit(void)
 {
+	struct scst_cm_rod_token *t, *tt;
+
 	TRACE_ENTRY();
 
+	cancel_delayed_work_sync(&scst_cm_rod_token_cleanup_work);
+
+	mutex_lock(&scst_cm_mutex);
+	list_for_each_entry_safe(t, tt, &scst_cm_rod_token_list,
+				cm_rod_token_list_entry)
+		scst_cm_free_rod_token(t);
+	mutex_unlock(&scst_cm_mutex);
+
 	scst_unregister_session(scst_cm_sess, true, NULL);
 	scst_unregister_target(scst_cm_tgt);
 	scst_unregister_target_template(&scst_cm_tgtt);
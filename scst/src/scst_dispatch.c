@@ -0,0 +1,344 @@
+/*
+ *  scst_dispatch.c
+ *
+ *  Per-device dispatch scheduler. By default commands ready for execution
+ *  are passed to the dev handler in the order they became ready (FIFO), so
+ *  an initiator with a deep queue can starve initiators with shallow ones.
+ *  Optionally, the number of commands in execution on a device can be
+ *  limited and the commands exceeding the limit queued per tgt_dev and
+ *  released by deficit round robin, weighted by the tgt_devs' weights. In
+ *  the latency mode the limit is additionally adjusted to keep the average
+ *  execution latency at the target.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation, version 2
+ *  of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ */
+
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#ifndef INSIDE_KERNEL_TREE
+#include <linux/version.h>
+#endif
+
+#ifdef INSIDE_KERNEL_TREE
+#include <scst/scst.h>
+#else
+#include "scst.h"
+#endif
+
+#include "scst_priv.h"
+
+/* Latency mode adjusts the depth once per so many completions */
+#define SCST_DISPATCH_LAT_PERIOD	16
+
+static const char *const scst_dispatch_sched_names[] = {
+	[SCST_DISPATCH_FIFO] = "fifo",
+	[SCST_DISPATCH_DRR] = "drr",
+	[SCST_DISPATCH_LATENCY] = "latency",
+};
+
+const char *scst_dispatch_sched_name(int sched)
+{
+	return scst_dispatch_sched_names[sched];
+}
+
+/* Returns one of SCST_DISPATCH_* constants or -EINVAL */
+int scst_dispatch_sched_parse(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(scst_dispatch_sched_names); i++) {
+		if (sysfs_streq(name, scst_dispatch_sched_names[i]))
+			return i;
+	}
+
+	return -EINVAL;
+}
+
+static inline u64 scst_dispatch_now(void)
+{
+	return ktime_to_ns(ktime_get());
+}
+
+static inline int scst_dispatch_cost(const struct scst_cmd *cmd)
+{
+	return max_t(int, cmd->bufflen + cmd->out_bufflen,
+		     SCST_DISPATCH_MIN_COST);
+}
+
+/* Must be called under dev_lock */
+static void scst_dispatch_cmd(struct scst_cmd *cmd, u64 now)
+{
+	struct scst_device *dev = cmd->dev;
+	struct scst_tgt_dev *tgt_dev = cmd->tgt_dev;
+	struct scst_cmd_threads *cmd_threads = cmd->cmd_threads;
+	u64 wait = now - cmd->dispatch_time;
+	unsigned long flags;
+
+	list_del(&cmd->cmd_list_entry);
+	if (list_empty(&tgt_dev->dispatch_cmd_list)) {
+		list_del(&tgt_dev->dispatch_tgt_dev_list_entry);
+		tgt_dev->dispatch_deficit = 0;
+	}
+	dev->dispatch_queued_cnt--;
+
+	tgt_dev->dispatch_waited_cmds++;
+	tgt_dev->dispatch_wait_ns += wait;
+	if (wait > tgt_dev->dispatch_wait_max_ns)
+		tgt_dev->dispatch_wait_max_ns = wait;
+
+	cmd->dispatch_queued = 0;
+	cmd->dispatch_counted = 1;
+	cmd->dispatch_time = now;
+	dev->dispatch_in_flight++;
+
+	TRACE_DBG("Dispatching cmd %p (dev %s, in flight %d, waited %llu ns)",
+		cmd, dev->virt_name, dev->dispatch_in_flight,
+		(unsigned long long)wait);
+
+	spin_lock_irqsave(&cmd_threads->cmd_list_lock, flags);
+	list_add_tail(&cmd->cmd_list_entry, &cmd_threads->active_cmd_list);
+	wake_up(&cmd_threads->cmd_list_waitQ);
+	spin_unlock_irqrestore(&cmd_threads->cmd_list_lock, flags);
+}
+
+/* Dispatches aborted commands regardless of the depth */
+static void scst_dispatch_release_aborted(struct scst_device *dev, u64 now)
+{
+	struct scst_tgt_dev *tgt_dev, *tt;
+	struct scst_cmd *cmd, *t;
+
+	list_for_each_entry_safe(tgt_dev, tt, &dev->dispatch_tgt_dev_list,
+				 dispatch_tgt_dev_list_entry) {
+		list_for_each_entry_safe(cmd, t, &tgt_dev->dispatch_cmd_list,
+					 cmd_list_entry) {
+			if (test_bit(SCST_CMD_ABORTED, &cmd->cmd_flags)) {
+				TRACE_MGMT_DBG("Dispatching aborted cmd %p",
+					cmd);
+				scst_dispatch_cmd(cmd, now);
+			}
+		}
+	}
+}
+
+/*
+ * Dispatches queued commands by deficit round robin until the depth is
+ * reached. With force all queued commands are dispatched.
+ *
+ * Must be called under dev_lock.
+ */
+static void scst_dispatch_release(struct scst_device *dev, bool force)
+{
+	u64 now;
+
+	if (dev->dispatch_queued_cnt == 0)
+		return;
+
+	now = scst_dispatch_now();
+
+	if (unlikely(READ_ONCE(dev->dispatch_abort_pending))) {
+		WRITE_ONCE(dev->dispatch_abort_pending, false);
+		scst_dispatch_release_aborted(dev, now);
+	}
+
+	while ((dev->dispatch_queued_cnt > 0) &&
+	       (force || (dev->dispatch_in_flight < dev->dispatch_cur_depth))) {
+		struct scst_tgt_dev *tgt_dev;
+		struct scst_cmd *cmd;
+		int cost;
+
+		tgt_dev = list_first_entry(&dev->dispatch_tgt_dev_list,
+				struct scst_tgt_dev, dispatch_tgt_dev_list_entry);
+		cmd = list_first_entry(&tgt_dev->dispatch_cmd_list,
+				struct scst_cmd, cmd_list_entry);
+		cost = scst_dispatch_cost(cmd);
+
+		if (tgt_dev->dispatch_deficit < cost) {
+			/* This tgt_dev's round is over */
+			tgt_dev->dispatch_deficit += tgt_dev->dispatch_weight *
+						     SCST_DISPATCH_QUANTUM;
+			list_move_tail(&tgt_dev->dispatch_tgt_dev_list_entry,
+				       &dev->dispatch_tgt_dev_list);
+			continue;
+		}
+
+		tgt_dev->dispatch_deficit -= cost;
+		scst_dispatch_cmd(cmd, now);
+	}
+}
+
+/*
+ * Returns true if cmd was queued, because its dev already has the maximum
+ * number of commands in execution. Otherwise cmd is counted in execution.
+ *
+ * Must be called under dev_lock.
+ */
+bool __scst_dispatch_check(struct scst_cmd *cmd)
+{
+	struct scst_device *dev = cmd->dev;
+	struct scst_tgt_dev *tgt_dev = cmd->tgt_dev;
+
+	lockdep_assert_held(&dev->dev_lock);
+
+	/*
+	 * HEAD OF QUEUE commands should go first and commands blocking the
+	 * device must not wait behind commands blocked by them.
+	 */
+	if (unlikely(cmd->queue_type == SCST_CMD_QUEUE_HEAD_OF_QUEUE) ||
+	    unlikely(cmd->unblock_dev) ||
+	    test_bit(SCST_CMD_ABORTED, &cmd->cmd_flags))
+		return false;
+
+	if ((dev->dispatch_queued_cnt == 0) &&
+	    (dev->dispatch_in_flight < dev->dispatch_cur_depth)) {
+		cmd->dispatch_counted = 1;
+		cmd->dispatch_time = scst_dispatch_now();
+		dev->dispatch_in_flight++;
+		return false;
+	}
+
+	TRACE_DBG("Queuing cmd %p (dev %s, in flight %d, queued %d)", cmd,
+		dev->virt_name, dev->dispatch_in_flight,
+		dev->dispatch_queued_cnt);
+
+	if (list_empty(&tgt_dev->dispatch_cmd_list))
+		list_add_tail(&tgt_dev->dispatch_tgt_dev_list_entry,
+			      &dev->dispatch_tgt_dev_list);
+	list_add_tail(&cmd->cmd_list_entry, &tgt_dev->dispatch_cmd_list);
+	cmd->dispatch_queued = 1;
+	cmd->dispatch_time = scst_dispatch_now();
+	dev->dispatch_queued_cnt++;
+
+	return true;
+}
+
+/* Must be called under dev_lock */
+static void scst_dispatch_adjust_depth(struct scst_device *dev,
+	unsigned int lat_us)
+{
+	if (dev->dispatch_lat_samples == 0)
+		dev->dispatch_lat_avg_us = lat_us;
+	else
+		dev->dispatch_lat_avg_us = dev->dispatch_lat_avg_us -
+			dev->dispatch_lat_avg_us / 8 + lat_us / 8;
+
+	if (++dev->dispatch_lat_samples % SCST_DISPATCH_LAT_PERIOD != 0)
+		return;
+
+	if (dev->dispatch_lat_avg_us > dev->dispatch_lat_target_us) {
+		if (dev->dispatch_cur_depth > 1)
+			dev->dispatch_cur_depth -= max(dev->dispatch_cur_depth / 4,
+						       1);
+	} else if (dev->dispatch_cur_depth < dev->dispatch_depth)
+		dev->dispatch_cur_depth++;
+
+	TRACE_DBG("dev %s: latency %u us (target %u us), depth %d",
+		dev->virt_name, dev->dispatch_lat_avg_us,
+		dev->dispatch_lat_target_us, dev->dispatch_cur_depth);
+}
+
+/*
+ * Called when execution of a counted cmd finished. Must be called under
+ * dev_lock.
+ */
+void __scst_dispatch_done(struct scst_cmd *cmd)
+{
+	struct scst_device *dev = cmd->dev;
+
+	lockdep_assert_held(&dev->dev_lock);
+
+	cmd->dispatch_counted = 0;
+	dev->dispatch_in_flight--;
+	EXTRACHECKS_BUG_ON(dev->dispatch_in_flight < 0);
+
+	if (dev->dispatch_sched == SCST_DISPATCH_LATENCY)
+		scst_dispatch_adjust_depth(dev,
+			div_u64(scst_dispatch_now() - cmd->dispatch_time,
+				NSEC_PER_USEC));
+
+	scst_dispatch_release(dev, false);
+}
+
+/*
+ * Makes the next release dispatch cmd, if it is queued, without waiting for
+ * its turn. Called with IRQs off, hence can't take dev_lock to check
+ * cmd->dispatch_queued, so the next release looks for aborted commands
+ * under dev_lock instead. That's race free, since SCST_CMD_ABORTED is set
+ * before and __scst_dispatch_check() doesn't queue aborted commands. The
+ * release is guaranteed, because there are always commands in execution,
+ * while some are queued.
+ */
+void scst_dispatch_abort_cmd(struct scst_cmd *cmd)
+{
+	struct scst_device *dev = cmd->dev;
+
+	if (likely(READ_ONCE(dev->dispatch_sched) == SCST_DISPATCH_FIFO))
+		return;
+
+	TRACE_MGMT_DBG("Aborted cmd %p, dev %s", cmd, dev->virt_name);
+	WRITE_ONCE(dev->dispatch_abort_pending, true);
+}
+
+void scst_dispatch_dev_init(struct scst_device *dev)
+{
+	dev->dispatch_sched = SCST_DISPATCH_FIFO;
+	dev->dispatch_depth = SCST_DISPATCH_DEF_DEPTH;
+	dev->dispatch_cur_depth = SCST_DISPATCH_DEF_DEPTH;
+	dev->dispatch_lat_target_us = SCST_DISPATCH_DEF_LAT_TARGET_US;
+	INIT_LIST_HEAD(&dev->dispatch_tgt_dev_list);
+}
+
+void scst_dispatch_tgt_dev_init(struct scst_tgt_dev *tgt_dev)
+{
+	INIT_LIST_HEAD(&tgt_dev->dispatch_cmd_list);
+	INIT_LIST_HEAD(&tgt_dev->dispatch_tgt_dev_list_entry);
+	tgt_dev->dispatch_weight = SCST_DISPATCH_DEF_WEIGHT;
+}
+
+/*
+ * Sets the dispatch scheduler of dev and its parameters. Negative depth
+ * and zero lat_target_us mean to keep the current values.
+ */
+int scst_dispatch_set(struct scst_device *dev, int sched, int depth,
+	unsigned int lat_target_us)
+{
+	TRACE_ENTRY();
+
+	spin_lock_bh(&dev->dev_lock);
+
+	dev->dispatch_sched = sched;
+	if (depth > 0)
+		dev->dispatch_depth = depth;
+	if (lat_target_us != 0)
+		dev->dispatch_lat_target_us = lat_target_us;
+
+	/* The latency mode starts from the full depth */
+	dev->dispatch_cur_depth = dev->dispatch_depth;
+	dev->dispatch_lat_samples = 0;
+	dev->dispatch_lat_avg_us = 0;
+
+	scst_dispatch_release(dev, sched == SCST_DISPATCH_FIFO);
+
+	spin_unlock_bh(&dev->dev_lock);
+
+	TRACE_EXIT();
+	return 0;
+}
+
+void scst_dispatch_set_weight(struct scst_tgt_dev *tgt_dev,
+	unsigned int weight)
+{
+	struct scst_device *dev = tgt_dev->dev;
+
+	spin_lock_bh(&dev->dev_lock);
+	tgt_dev->dispatch_weight = weight;
+	spin_unlock_bh(&dev->dev_lock);
+}
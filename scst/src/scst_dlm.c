@@ -333,7 +333,7 @@ static int scst_copy_from_dlm(struct scst_device *dev, dlm_lockspace_t *ls,
 			scst_dlm_pr_rm_reg_ls(ls, reg);
 			reg->lksb.lksb.sb_lkid = reg_lksb[i].lksb.sb_lkid;
 			reg->dlm_idx = i;
-			memcpy(reg->lvb, reg_lvb_content, sizeof(reg->lvb));
+			memcpy(reg->lvb, reg_lvb, sizeof(reg->lvb));
 			if (reg_lvb->is_holder) {
 				if (dev->pr_is_set)
 					scst_pr_clear_holder(dev);
@@ -361,9 +361,14 @@ static int scst_copy_from_dlm(struct scst_device *dev, dlm_lockspace_t *ls,
 
 	scst_pr_write_unlock(dev);
 
+	memcpy(&pr_dlm->synced_lvb, lvb, sizeof(pr_dlm->synced_lvb));
+	pr_dlm->synced_lvb_valid = true;
+
 	res = 0;
 
 out:
+	if (res < 0)
+		pr_dlm->synced_lvb_valid = false;
 	vfree(reg_lksb);
 	return res;
 
@@ -414,17 +419,24 @@ static void scst_copy_res_to_dlm(struct scst_device *dev, struct pr_lvb *lvb)
 
 /*
  * Update PR and registrant information in the DLM LVB's. Caller must hold
- * PR_DATA_LOCK in PW mode.
+ * PR_DATA_LOCK in PW mode. Unless @all is set, only the registrant LVB's
+ * that differ from the local state are rewritten.
+ *
+ * Returns true if any LVB has been modified, i.e. if the other nodes have to
+ * be notified.
  */
-static void scst_copy_to_dlm(struct scst_device *dev, dlm_lockspace_t *ls)
+static bool scst_copy_to_dlm(struct scst_device *dev, dlm_lockspace_t *ls,
+			     bool all)
 {
 	struct scst_pr_dlm_data *const pr_dlm = dev->pr_dlm;
 	struct pr_lvb *lvb = (void *)pr_dlm->lvb;
-	struct pr_reg_lvb *reg_lvb;
+	struct pr_lvb prev_lvb = *lvb;
+	struct pr_reg_lvb *reg_lvb = (void *)pr_dlm->reg_lvb_buf;
 	struct scst_dev_registrant *reg;
 	int i;
 	char reg_name[32];
 	uint32_t nr_registrants, tid_size;
+	bool modified = all;
 
 	lockdep_assert_held(&pr_dlm->ls_mutex);
 
@@ -450,48 +462,71 @@ static void scst_copy_to_dlm(struct scst_device *dev, dlm_lockspace_t *ls)
 			snprintf(reg_name, sizeof(reg_name), PR_REG_LOCK, i);
 			if (scst_dlm_lock_wait(ls, DLM_LOCK_NL,
 					       &reg->lksb, 0, reg_name, NULL)
-			    >= 0)
+			    >= 0) {
 				reg->dlm_idx = i;
+				/* The LVB content is unknown, so rewrite it */
+				memset(reg->lvb, 0, sizeof(reg->lvb));
+			}
 		}
 	}
 
+	if (memcmp(&prev_lvb, lvb, sizeof(prev_lvb)) != 0)
+		modified = true;
+
 	list_for_each_entry(reg, &dev->dev_registrants_list,
 			    dev_registrants_list_entry) {
 		if (WARN_ON(!reg->lksb.lksb.sb_lkid))
 			continue;
+		memset(reg_lvb, 0, sizeof(pr_dlm->reg_lvb_buf));
+		reg_lvb->key = reg->key;
+		reg_lvb->rel_tgt_id = cpu_to_be16(reg->rel_tgt_id);
+		reg_lvb->version = 1;
+		reg_lvb->is_holder = dev->pr_holder == reg;
+		tid_size = scst_tid_size(reg->transport_id);
+#if 0
+		PRINT_INFO("Copying transport ID into %s." PR_REG_LOCK
+			   " (len %d)", dev->virt_name, reg->dlm_idx,
+			   tid_size);
+		print_hex_dump(KERN_DEBUG, "", DUMP_PREFIX_OFFSET, 16,
+			       1, reg->transport_id, tid_size, 1);
+#endif
+		if (WARN(tid_size > sizeof(reg_lvb->tid),
+			 "tid_size %d > %zd\n", tid_size,
+			 sizeof(reg_lvb->tid)))
+			tid_size = sizeof(reg_lvb->tid);
+		memcpy(reg_lvb->tid, reg->transport_id, tid_size);
+		/*
+		 * reg->lvb holds the LVB content as of the latest write or
+		 * read of it by this node, so skip unmodified registrants.
+		 */
+		if (!all && memcmp(reg->lvb, reg_lvb, sizeof(reg->lvb)) == 0)
+			continue;
 		snprintf(reg_name, sizeof(reg_name), PR_REG_LOCK, reg->dlm_idx);
 		if (scst_dlm_lock_wait(ls, DLM_LOCK_PW, &reg->lksb,
 				       DLM_LKF_VALBLK | DLM_LKF_CONVERT,
 				       reg_name, NULL) >= 0) {
-			reg_lvb = (void *)reg->lksb.lksb.sb_lvbptr;
-			memset(reg->lvb, 0, sizeof(reg->lvb));
-			reg_lvb->key = reg->key;
-			reg_lvb->rel_tgt_id = cpu_to_be16(reg->rel_tgt_id);
-			reg_lvb->version = 1;
-			reg_lvb->is_holder = dev->pr_holder == reg;
-			tid_size = scst_tid_size(reg->transport_id);
-#if 0
-			PRINT_INFO("Copying transport ID into %s." PR_REG_LOCK
-				   " (len %d)", dev->virt_name, reg->dlm_idx,
-				   tid_size);
-			print_hex_dump(KERN_DEBUG, "", DUMP_PREFIX_OFFSET, 16,
-				       1, reg->transport_id, tid_size, 1);
-#endif
-			if (WARN(tid_size > sizeof(reg_lvb->tid),
-				 "tid_size %d > %zd\n", tid_size,
-				 sizeof(reg_lvb->tid)))
-				tid_size = sizeof(reg_lvb->tid);
-			memcpy(reg_lvb->tid, reg->transport_id, tid_size);
+			memcpy(reg->lvb, reg_lvb, sizeof(reg->lvb));
 			scst_dlm_lock_wait(ls, DLM_LOCK_CR, &reg->lksb,
 					   DLM_LKF_CONVERT | DLM_LKF_VALBLK,
 					   reg_name, NULL);
+			modified = true;
 		} else {
 			PRINT_ERROR("Failed to lock %s.%s", dev->virt_name,
 				    reg_name);
+			memset(reg->lvb, 0, sizeof(reg->lvb));
 		}
 	}
 
 	scst_pr_write_unlock(dev);
+
+	memcpy(&pr_dlm->synced_lvb, lvb, sizeof(pr_dlm->synced_lvb));
+	pr_dlm->synced_lvb_valid = true;
+
+	TRACE_PR("%s: PR generation %u, LVB's %s", dev->virt_name,
+		 be32_to_cpu(lvb->pr_generation),
+		 modified ? "updated" : "unchanged");
+
+	return modified;
 }
 
 /*
@@ -926,7 +961,7 @@ static dlm_lockspace_t *get_lockspace(struct scst_device *dev)
 
 	switch (lvb->version) {
 	case 0:
-		scst_copy_to_dlm(dev, ls);
+		scst_copy_to_dlm(dev, ls, true);
 		break;
 	case 1:
 		res = scst_copy_from_dlm(dev, ls, &modified_lvb);
@@ -1000,8 +1035,11 @@ static void scst_dlm_pr_write_lock(struct scst_device *dev,
 
 	scst_dlm_lock_wait(ls, DLM_LOCK_EX, pr_lksb, 0, PR_LOCK, NULL);
 	if (pr_lksb->lksb.sb_lkid) {
-		scst_pr_toggle_lock(pr_dlm, ls, PR_POST_UPDATE_LOCK);
-		scst_pr_toggle_lock(pr_dlm, ls, PR_PRE_UPDATE_LOCK);
+		/*
+		 * The other nodes are only notified from
+		 * scst_dlm_pr_write_unlock() and only if the PR state has
+		 * been modified.
+		 */
 		scst_dlm_lock_wait(ls, DLM_LOCK_PW,
 				   &pr_dlm->data_lksb,
 				   DLM_LKF_CONVERT | DLM_LKF_VALBLK,
@@ -1023,16 +1061,27 @@ static void scst_dlm_pr_write_unlock(struct scst_device *dev,
 	struct scst_pr_dlm_data *const pr_dlm = dev->pr_dlm;
 	dlm_lockspace_t *ls = pr_dlm->ls;
 
+	bool modified;
+
 	scst_pr_write_unlock(dev);
 
 	if (!pr_lksb->lksb.sb_lkid)
 		return;
 
-	scst_copy_to_dlm(dev, ls);
+	modified = scst_copy_to_dlm(dev, ls, false);
 	scst_dlm_lock_wait(ls, DLM_LOCK_CR, &pr_dlm->data_lksb,
 			   DLM_LKF_CONVERT | DLM_LKF_VALBLK, PR_DATA_LOCK,
 			   NULL);
-	scst_pr_toggle_lock(pr_dlm, ls, PR_POST_UPDATE_LOCK);
+	/*
+	 * Tell the other nodes to reread the LVB's in one notification round.
+	 * A PR OUT command that did not modify the PR state, e.g. a RESERVE
+	 * by the reservation holder as repeatedly sent by failover cluster
+	 * software, does not need any.
+	 */
+	if (modified) {
+		scst_pr_toggle_lock(pr_dlm, ls, PR_PRE_UPDATE_LOCK);
+		scst_pr_toggle_lock(pr_dlm, ls, PR_POST_UPDATE_LOCK);
+	}
 	scst_dlm_unlock_wait(ls, pr_lksb);
 }
 
@@ -1086,7 +1135,7 @@ static void scst_dlm_res_unlock(struct scst_device *dev,
 		      pr_dlm->reserved_by_nodeid);
 
 	if (update_lvb)
-		scst_copy_to_dlm(dev, ls);
+		update_lvb = scst_copy_to_dlm(dev, ls, false);
 	scst_dlm_lock_wait(ls, DLM_LOCK_CR, &pr_dlm->data_lksb,
 			   DLM_LKF_CONVERT | DLM_LKF_VALBLK, PR_DATA_LOCK,
 			   NULL);
@@ -1212,7 +1261,7 @@ static void scst_copy_to_dlm_work(struct work_struct *work)
 		PRINT_INFO("%s.%s LVB not valid\n", dev->virt_name,
 			   PR_DATA_LOCK);
 
-	scst_copy_to_dlm(dev, ls);
+	scst_copy_to_dlm(dev, ls, true);
 	scst_dlm_lock_wait(ls, DLM_LOCK_CR, &pr_dlm->data_lksb,
 			   DLM_LKF_CONVERT | DLM_LKF_VALBLK, PR_DATA_LOCK,
 			   NULL);
@@ -1272,10 +1321,27 @@ static void scst_copy_from_dlm_work(struct work_struct *work)
 	if (pr_dlm->data_lksb.lksb.sb_flags & DLM_SBF_VALNOTVALID) {
 		PRINT_WARNING("%s.%s has an invalid lock value block",
 			      dev->virt_name, PR_DATA_LOCK);
+		pr_dlm->synced_lvb_valid = false;
 		res = -EINVAL;
 		goto unlock_pr;
 	}
-	res = scst_copy_from_dlm(dev, ls, &modified_lvb);
+	/*
+	 * Every PR state modification changes the PR_DATA_LOCK LVB, at
+	 * least its PR generation, reservation or number of registrants. So
+	 * if it still matches the one of the latest synchronization, the
+	 * local copy is up to date and rereading all registrant LVB's, two
+	 * DLM round trips per registrant, can be skipped.
+	 */
+	if (pr_dlm->synced_lvb_valid &&
+	    memcmp(&pr_dlm->synced_lvb, pr_dlm->lvb,
+		   sizeof(pr_dlm->synced_lvb)) == 0) {
+		TRACE_PR("%s: PR generation %u unchanged, skipping LVB reread",
+			 dev->virt_name,
+			 be32_to_cpu(pr_dlm->synced_lvb.pr_generation));
+		res = 0;
+	} else {
+		res = scst_copy_from_dlm(dev, ls, &modified_lvb);
+	}
 	scst_dlm_lock_wait(ls, DLM_LOCK_CR, &pr_dlm->data_lksb,
 			   DLM_LKF_CONVERT | DLM_LKF_VALBLK, PR_DATA_LOCK,
 			   NULL);
@@ -35,6 +35,46 @@
 #define PR_POST_UPDATE_LOCK	"pr_post_%d"
 #define PR_REG_LOCK		"pr_reg_%02d"
 
+/**
+ * struct pr_lvb - PR_DATA_LOCK LVB data format
+ * @nr_registrants: number of reservation keys that have been registered
+ * @pr_generation:  persistent reservation generation
+ * @version:	    version of this structure
+ * @pr_is_set:	    whether the device has been reserved persistently
+ * @pr_type:	    persistent reservation type
+ * @pr_scope:	    persistent reservation scope
+ * @pr_aptpl:	    persistent reservation APTPL
+ * @reserved_by_nodeid: Corosync node ID of the node holding an SPC-2
+ *                  reservation. Zero if no SPC-2 reservation is held.
+ */
+struct pr_lvb {
+	__be32	nr_registrants;
+	__be32	pr_generation;
+	u8	version;
+	u8	pr_is_set;
+	u8	pr_type;
+	u8	pr_scope;
+	u8	pr_aptpl;
+	u8      reserved[3];
+	__be32  reserved_by_nodeid;
+};
+
+/**
+ * struct pr_reg_lvb - PR_REG_LOCK LVB data format
+ * @key:	reservation key
+ * @rel_tgt_id:	relative target id
+ * @version:	version of this structure
+ * @is_holder:	whether or not holding the reservation
+ * @tid:	transport ID - up to 228 bytes for iSCSI
+ */
+struct pr_reg_lvb {
+	__be64	key;
+	__be16	rel_tgt_id;
+	u8	version;
+	u8	is_holder;
+	u8	tid[228];
+};
+
 /*
  * Data members needed for managing PR data via the DLM.
  *
@@ -107,48 +147,20 @@ struct scst_pr_dlm_data {
 	/* PR_DATA_LOCK LVB. */
 	uint8_t  lvb[PR_DLM_LVB_LEN];
 
-	/* SPC-2 reservation state information. */
-	uint32_t reserved_by_nodeid;
-};
+	/*
+	 * Copy of the PR_DATA_LOCK LVB as of the latest synchronization of
+	 * the local PR state with the DLM. As long as the PR_DATA_LOCK LVB
+	 * matches it, including the PR generation, the registrant LVBs need
+	 * not be reread. Protected by ls_mutex.
+	 */
+	struct pr_lvb synced_lvb;
+	bool synced_lvb_valid;
 
-/**
- * struct pr_lvb - PR_DATA_LOCK LVB data format
- * @nr_registrants: number of reservation keys that have been registered
- * @pr_generation:  persistent reservation generation
- * @version:	    version of this structure
- * @pr_is_set:	    whether the device has been reserved persistently
- * @pr_type:	    persistent reservation type
- * @pr_scope:	    persistent reservation scope
- * @pr_aptpl:	    persistent reservation APTPL
- * @reserved_by_nodeid: Corosync node ID of the node holding an SPC-2
- *                  reservation. Zero if no SPC-2 reservation is held.
- */
-struct pr_lvb {
-	__be32	nr_registrants;
-	__be32	pr_generation;
-	u8	version;
-	u8	pr_is_set;
-	u8	pr_type;
-	u8	pr_scope;
-	u8	pr_aptpl;
-	u8      reserved[3];
-	__be32  reserved_by_nodeid;
-};
+	/* Buffer for building a PR_REG_LOCK LVB. Protected by ls_mutex. */
+	uint8_t  reg_lvb_buf[PR_DLM_LVB_LEN];
 
-/**
- * struct pr_reg_lvb - PR_REG_LOCK LVB data format
- * @key:	reservation key
- * @rel_tgt_id:	relative target id
- * @version:	version of this structure
- * @is_holder:	whether or not holding the reservation
- * @tid:	transport ID - up to 228 bytes for iSCSI
- */
-struct pr_reg_lvb {
-	__be64	key;
-	__be16	rel_tgt_id;
-	u8	version;
-	u8	is_holder;
-	u8	tid[228];
+	/* SPC-2 reservation state information. */
+	uint32_t reserved_by_nodeid;
 };
 
 #endif /* __SCST_PRES_DLM_H */
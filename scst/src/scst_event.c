@@ -751,22 +751,13 @@ out:
 	return res;
 }
 
-/* scst_event_mutex supposed to be held. Might drop it, then get back. */
-static int scst_event_user_next_event(struct scst_event_priv *priv,
-	void __user *arg)
+/*
+ * scst_event_mutex supposed to be held. Might drop it, then get back.
+ * Returns 0 if there is at least one queued event.
+ */
+static int scst_event_wait_queued(struct scst_event_priv *priv)
 {
-	int res, rc;
-	int32_t max_event_size, needed_size;
-	struct scst_event_entry *event_entry;
-	struct scst_event_user __user *event_user = arg;
-
-	TRACE_ENTRY();
-
-	res = get_user(max_event_size, (int32_t __user *)arg);
-	if (res != 0) {
-		PRINT_ERROR("Failed to get max event size: %d", res);
-		goto out;
-	};
+	int res = 0;
 
 	/* Waiting for at least one event, if blocking */
 	while (list_empty(&priv->queued_events_list)) {
@@ -787,6 +778,49 @@ static int scst_event_user_next_event(struct scst_event_priv *priv,
 		}
 	}
 
+out:
+	return res;
+}
+
+/* scst_event_mutex supposed to be held */
+static void scst_event_dequeue(struct scst_event_priv *priv,
+	struct scst_event_entry *event_entry)
+{
+	if (event_entry->event_notify_fn) {
+		TRACE_DBG("Moving event entry %p to processing events list",
+			event_entry);
+		list_move_tail(&event_entry->events_list_entry,
+			&priv->processing_events_list);
+	} else {
+		TRACE_MEM("Deleting event entry %p", event_entry);
+		list_del(&event_entry->events_list_entry);
+		kfree(event_entry);
+	}
+
+	priv->queued_events_cnt--;
+}
+
+/* scst_event_mutex supposed to be held. Might drop it, then get back. */
+static int scst_event_user_next_event(struct scst_event_priv *priv,
+	void __user *arg)
+{
+	int res, rc;
+	int32_t max_event_size, needed_size;
+	struct scst_event_entry *event_entry;
+	struct scst_event_user __user *event_user = arg;
+
+	TRACE_ENTRY();
+
+	res = get_user(max_event_size, (int32_t __user *)arg);
+	if (res != 0) {
+		PRINT_ERROR("Failed to get max event size: %d", res);
+		goto out;
+	};
+
+	res = scst_event_wait_queued(priv);
+	if (res != 0)
+		goto out;
+
 	EXTRACHECKS_BUG_ON(list_empty(&priv->queued_events_list));
 
 	event_entry = list_entry(priv->queued_events_list.next,
@@ -810,18 +844,7 @@ static int scst_event_user_next_event(struct scst_event_priv *priv,
 		goto out;
 	}
 
-	if (event_entry->event_notify_fn) {
-		TRACE_DBG("Moving event entry %p to processing events list",
-			event_entry);
-		list_move_tail(&event_entry->events_list_entry,
-			&priv->processing_events_list);
-	} else {
-		TRACE_MEM("Deleting event entry %p", event_entry);
-		list_del(&event_entry->events_list_entry);
-		kfree(event_entry);
-	}
-
-	priv->queued_events_cnt--;
+	scst_event_dequeue(priv, event_entry);
 
 	res = 0;
 
@@ -831,33 +854,23 @@ out:
 }
 
 /* scst_event_mutex supposed to be held. Might drop it, then get back. */
-static int scst_event_user_notify_done(struct scst_event_priv *priv,
-	void __user *arg)
+static int __scst_event_notify_done(struct scst_event_priv *priv,
+	const struct scst_event_notify_done *n)
 {
-	int res, rc;
-	struct scst_event_notify_done n;
+	int res = 0;
 	struct scst_event_entry *e;
 	bool found = false;
 
 	TRACE_ENTRY();
 
-	rc = copy_from_user(&n, arg, sizeof(n));
-	if (rc != 0) {
-		PRINT_ERROR("Failed to copy %d user's bytes of notify done", rc);
-		res = -EFAULT;
-		goto out;
-	}
-
-	res = 0;
-
 	list_for_each_entry(e, &priv->processing_events_list, events_list_entry) {
-		if (e->event.event_id == n.event_id) {
+		if (e->event.event_id == n->event_id) {
 			found = true;
 			break;
 		}
 	}
 	if (!found) {
-		PRINT_ERROR("Waiting event for id %u not found", n.event_id);
+		PRINT_ERROR("Waiting event for id %u not found", n->event_id);
 		res = -ENOENT;
 		goto out;
 	}
@@ -870,7 +883,7 @@ static int scst_event_user_notify_done(struct scst_event_priv *priv,
 
 	if (e->event_notify_fn != NULL) {
 		TRACE_DBG("Calling notify_fn of event_entry %p", e);
-		e->event_notify_fn(&e->event, e->notify_fn_priv, n.status);
+		e->event_notify_fn(&e->event, e->notify_fn_priv, n->status);
 	}
 
 	TRACE_MEM("Freeing event entry %p", e);
@@ -884,6 +897,144 @@ out:
 	return res;
 }
 
+/* scst_event_mutex supposed to be held. Might drop it, then get back. */
+static int scst_event_user_notify_done(struct scst_event_priv *priv,
+	void __user *arg)
+{
+	int res, rc;
+	struct scst_event_notify_done n;
+
+	TRACE_ENTRY();
+
+	rc = copy_from_user(&n, arg, sizeof(n));
+	if (rc != 0) {
+		PRINT_ERROR("Failed to copy %d user's bytes of notify done", rc);
+		res = -EFAULT;
+		goto out;
+	}
+
+	res = __scst_event_notify_done(priv, &n);
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+/*
+ * scst_event_mutex supposed to be held. Might drop it, then get back.
+ *
+ * Processes all replies, then returns as many queued events as fit in the
+ * user's buffer, so that a storm of events costs one ioctl() per batch
+ * instead of one ioctl() and one poll() wake up per event.
+ */
+static int scst_event_user_get_multi(struct scst_event_priv *priv,
+	void __user *arg)
+{
+	int res = 0, rc, i, pos = 0;
+	struct scst_event_get_multi __user *m = arg;
+	struct scst_event_get_multi gm;
+	struct scst_event_notify_done __user *replies;
+	struct scst_event_entry *event_entry;
+	int32_t events_cnt = 0;
+
+	TRACE_ENTRY();
+
+	rc = copy_from_user(&gm, m, sizeof(gm));
+	if (rc != 0) {
+		PRINT_ERROR("Failed to copy %d user's bytes of get multi", rc);
+		res = -EFAULT;
+		goto out;
+	}
+
+	if ((gm.replies_cnt < 0) || (gm.buf_size < 0) || (gm.events_cnt < 0)) {
+		PRINT_ERROR("Invalid get multi (replies_cnt %d, buf_size %d, "
+			"events_cnt %d)", gm.replies_cnt, gm.buf_size,
+			gm.events_cnt);
+		res = -EINVAL;
+		goto out;
+	}
+
+	TRACE_DBG("replies_cnt %d, buf_size %d, events_cnt %d", gm.replies_cnt,
+		gm.buf_size, gm.events_cnt);
+
+	replies = (struct scst_event_notify_done __user *)
+		(unsigned long)gm.preplies;
+	for (i = 0; i < gm.replies_cnt; i++) {
+		struct scst_event_notify_done n;
+
+		rc = copy_from_user(&n, &replies[i], sizeof(n));
+		if (rc != 0) {
+			PRINT_ERROR("Failed to copy %d user's bytes of reply %d",
+				rc, i);
+			res = -EFAULT;
+			break;
+		}
+
+		res = __scst_event_notify_done(priv, &n);
+		if (res != 0)
+			break;
+	}
+
+	rc = put_user(i, &m->replies_done);
+	if ((res == 0) && (rc != 0))
+		res = rc;
+	if (res != 0)
+		goto out;
+
+	/* Don't block the caller, who has just replied, if nothing is queued */
+	if ((gm.replies_cnt == 0) || !list_empty(&priv->queued_events_list)) {
+		res = scst_event_wait_queued(priv);
+		if (res != 0)
+			goto out_put_cnt;
+	}
+
+	while ((events_cnt < gm.events_cnt) &&
+	       !list_empty(&priv->queued_events_list)) {
+		int32_t needed_size;
+
+		event_entry = list_entry(priv->queued_events_list.next,
+				struct scst_event_entry, events_list_entry);
+
+		needed_size = sizeof(event_entry->event) +
+			      event_entry->event.payload_len;
+		if (pos + needed_size > gm.buf_size) {
+			if (events_cnt == 0) {
+				TRACE_DBG("Too big event (size %d, max size %d)",
+					needed_size, gm.buf_size);
+				res = put_user(needed_size, &m->buf_size);
+				if (res == 0)
+					res = -ENOSPC;
+			}
+			break;
+		}
+
+		rc = copy_to_user(&m->buf[pos], &event_entry->event,
+				  needed_size);
+		if (rc != 0) {
+			PRINT_ERROR("Copy to user failed (%d)", rc);
+			if (events_cnt == 0)
+				res = -EFAULT;
+			break;
+		}
+
+		pos += SCST_EVENT_MULTI_SIZE(&event_entry->event);
+		events_cnt++;
+
+		scst_event_dequeue(priv, event_entry);
+	}
+
+	TRACE_DBG("%d events returned (%d bytes)", events_cnt, pos);
+
+out_put_cnt:
+	rc = put_user(events_cnt, &m->events_cnt);
+	if ((res == 0) && (rc != 0))
+		res = rc;
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
 /* scst_event_mutex supposed to be held */
 static int scst_event_create_priv(struct file *file)
 {
@@ -985,6 +1136,11 @@ static long scst_event_ioctl(struct file *file, unsigned int cmd,
 		res = scst_event_user_notify_done(priv, (void __user *)arg);
 		break;
 
+	case SCST_EVENT_REPLY_AND_GET_MULTI:
+		TRACE_DBG("%s", "REPLY_AND_GET_MULTI");
+		res = scst_event_user_get_multi(priv, (void __user *)arg);
+		break;
+
 	default:
 		PRINT_ERROR("Invalid ioctl cmd %x", cmd);
 		res = -EINVAL;
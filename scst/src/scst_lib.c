@@ -110,6 +110,49 @@ const struct scst_opcode_descriptor scst_op_descr_extended_copy = {
 };
 EXPORT_SYMBOL(scst_op_descr_extended_copy);
 
+const struct scst_opcode_descriptor scst_op_descr_populate_token = {
+	.od_opcode = EXTENDED_COPY,
+	.od_serv_action = SA_POPULATE_TOKEN,
+	.od_serv_action_valid = 1,
+	.od_support = 3, /* supported as in the standard */
+	.od_cdb_size = 16,
+	.od_nominal_timeout = SCST_DEFAULT_NOMINAL_TIMEOUT_SEC,
+	.od_recommended_timeout = SCST_GENERIC_DISK_SMALL_TIMEOUT/HZ,
+	.od_cdb_usage_bits = { EXTENDED_COPY, SA_POPULATE_TOKEN, 0, 0, 0, 0,
+			       0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+			       0, SCST_OD_DEFAULT_CONTROL_BYTE },
+};
+EXPORT_SYMBOL(scst_op_descr_populate_token);
+
+const struct scst_opcode_descriptor scst_op_descr_write_using_token = {
+	.od_opcode = EXTENDED_COPY,
+	.od_serv_action = SA_WRITE_USING_TOKEN,
+	.od_serv_action_valid = 1,
+	.od_support = 3, /* supported as in the standard */
+	.od_cdb_size = 16,
+	.od_nominal_timeout = SCST_DEFAULT_NOMINAL_TIMEOUT_SEC,
+	.od_recommended_timeout = SCST_GENERIC_DISK_REG_TIMEOUT/HZ,
+	.od_cdb_usage_bits = { EXTENDED_COPY, SA_WRITE_USING_TOKEN, 0, 0, 0, 0,
+			       0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+			       0, SCST_OD_DEFAULT_CONTROL_BYTE },
+};
+EXPORT_SYMBOL(scst_op_descr_write_using_token);
+
+const struct scst_opcode_descriptor scst_op_descr_receive_rod_token_info = {
+	.od_opcode = RECEIVE_COPY_RESULTS,
+	.od_serv_action = SA_RECEIVE_ROD_TOKEN_INFO,
+	.od_serv_action_valid = 1,
+	.od_support = 3, /* supported as in the standard */
+	.od_cdb_size = 16,
+	.od_nominal_timeout = SCST_DEFAULT_NOMINAL_TIMEOUT_SEC,
+	.od_recommended_timeout = SCST_GENERIC_DISK_SMALL_TIMEOUT/HZ,
+	.od_cdb_usage_bits = { RECEIVE_COPY_RESULTS, SA_RECEIVE_ROD_TOKEN_INFO,
+			       0xFF, 0xFF, 0xFF, 0xFF, 0, 0, 0, 0,
+			       0xFF, 0xFF, 0xFF, 0xFF, 0,
+			       SCST_OD_DEFAULT_CONTROL_BYTE },
+};
+EXPORT_SYMBOL(scst_op_descr_receive_rod_token_info);
+
 const struct scst_opcode_descriptor scst_op_descr_tur = {
 	.od_opcode = TEST_UNIT_READY,
 	.od_support = 3, /* supported as in the standard */
@@ -2395,6 +2438,12 @@ void scst_set_initial_UA(struct scst_session *sess, int key, int asc, int ascq)
 	TRACE_MGMT_DBG("Setting for sess %p initial UA %x/%x/%x", sess, key,
 		asc, ascq);
 
+	/* For tgt_devs instantiated later, see scst_alloc_add_tgt_dev() */
+	sess->sess_initial_UA_key = key;
+	sess->sess_initial_UA_asc = asc;
+	sess->sess_initial_UA_ascq = ascq;
+	sess->sess_initial_UA_set = 1;
+
 	rcu_read_lock();
 	for (i = 0; i < SESS_TGT_DEV_LIST_HASH_SIZE; i++) {
 		struct list_head *head = &sess->sess_tgt_dev_list[i];
@@ -2852,6 +2901,37 @@ void scst_dev_inquiry_data_changed(struct scst_device *dev)
 }
 EXPORT_SYMBOL(scst_dev_inquiry_data_changed);
 
+/*
+ * Returns true if both ACGs map the same devices to the same LUNs with the
+ * same access mode. scst_mutex supposed to be held.
+ */
+static bool scst_acg_luns_equal(struct scst_acg *acg1, struct scst_acg *acg2)
+{
+	struct scst_acg_dev *a1, *a2;
+	int cnt1 = 0, cnt2 = 0;
+
+	list_for_each_entry(a2, &acg2->acg_dev_list, acg_dev_list_entry)
+		cnt2++;
+
+	list_for_each_entry(a1, &acg1->acg_dev_list, acg_dev_list_entry) {
+		bool found = false;
+
+		list_for_each_entry(a2, &acg2->acg_dev_list,
+				    acg_dev_list_entry) {
+			if (a1->lun == a2->lun && a1->dev == a2->dev &&
+			    a1->acg_dev_rd_only == a2->acg_dev_rd_only) {
+				found = true;
+				break;
+			}
+		}
+		if (!found)
+			return false;
+		cnt1++;
+	}
+
+	return cnt1 == cnt2;
+}
+
 /* The activity supposed to be suspended and scst_mutex held */
 static void scst_check_reassign_sess(struct scst_session *sess)
 {
@@ -2919,6 +2999,9 @@ retry_add:
 		}
 		mutex_unlock(&sess->tgt_dev_list_mutex);
 
+		if (sess->sess_lazy_tgt_devs)
+			continue;
+
 		luns_changed = true;
 
 		TRACE_MGMT_DBG("sess %p: Allocing new tgt_dev for LUN %lld",
@@ -2967,6 +3050,10 @@ next:
 		goto retry_add;
 	}
 
+	/* Not instantiated LUNs can't be checked via tgt_devs */
+	if (sess->sess_lazy_tgt_devs && !luns_changed)
+		luns_changed = !scst_acg_luns_equal(old_acg, acg);
+
 	sess->acg = acg;
 
 	TRACE_DBG("Moving sess %p from acg %s to acg %s", sess,
@@ -4091,6 +4178,7 @@ int scst_alloc_tgt(struct scst_tgt_template *tgtt, struct scst_tgt **tgt)
 	t->tgt_hw_dif_ip_supported = tgtt->hw_dif_ip_supported;
 	t->tgt_hw_dif_same_sg_layout_required = tgtt->hw_dif_same_sg_layout_required;
 	t->tgt_supported_dif_block_sizes = tgtt->supported_dif_block_sizes;
+	t->tgt_numa_node_id = NUMA_NO_NODE;
 	spin_lock_init(&t->tgt_lock);
 	INIT_LIST_HEAD(&t->retry_cmd_list);
 	timer_setup(&t->retry_timer, scst_tgt_retry_timer_fn, 0);
@@ -4133,6 +4221,8 @@ static void scst_init_order_data(struct scst_order_data *order_data)
 
 	spin_lock_init(&order_data->sn_lock);
 	INIT_LIST_HEAD(&order_data->deferred_cmd_list);
+	for (i = 0; i < ARRAY_SIZE(order_data->deferred_sn_ring); i++)
+		INIT_LIST_HEAD(&order_data->deferred_sn_ring[i]);
 	INIT_LIST_HEAD(&order_data->skipped_sn_list);
 	order_data->curr_sn = (typeof(order_data->curr_sn))(-20);
 	order_data->expected_sn = order_data->curr_sn;
@@ -4222,6 +4312,7 @@ int scst_alloc_device(gfp_t gfp_mask, int nodeid, struct scst_device **out_dev)
 	lockdep_set_class(&dev->dev_lock, &dev->dev_lock_key);
 	INIT_LIST_HEAD(&dev->dev_exec_cmd_list);
 	INIT_LIST_HEAD(&dev->blocked_cmd_list);
+	scst_dispatch_dev_init(dev);
 	INIT_LIST_HEAD(&dev->dev_tgt_dev_list);
 	INIT_LIST_HEAD(&dev->dev_acg_dev_list);
 	INIT_LIST_HEAD(&dev->ext_blockers_list);
@@ -4452,6 +4543,8 @@ int scst_acg_add_lun(struct scst_acg *acg, struct kobject *parent,
 	list_add_tail(&acg_dev->dev_acg_dev_list_entry, &dev->dev_acg_dev_list);
 
 	list_for_each_entry(sess, &acg->acg_sess_list, acg_sess_list_entry) {
+		if (sess->sess_lazy_tgt_devs)
+			continue;
 		res = scst_alloc_add_tgt_dev(sess, acg_dev, &tgt_dev);
 		if (res == -EPERM)
 			continue;
@@ -4683,6 +4776,7 @@ int scst_alloc_add_acg(struct scst_tgt *tgt, const char *acg_name,
 	INIT_LIST_HEAD(&acg->acg_sess_list);
 	INIT_LIST_HEAD(&acg->acn_list);
 	cpumask_copy(&acg->acg_cpu_mask, &default_cpu_mask);
+	scst_qos_init(&acg->acg_qos);
 	acg->acg_name = kstrdup(acg_name, GFP_KERNEL);
 	if (acg->acg_name == NULL) {
 		PRINT_ERROR("%s", "Allocation of acg_name failed");
@@ -4805,6 +4899,8 @@ static void scst_free_acg(struct scst_acg *acg)
 			list_is_last(&acn->acn_list_entry, &acg->acn_list));
 	}
 
+	scst_qos_exit(&acg->acg_qos);
+
 	kfree(acg->acg_name);
 	kfree(acg);
 
@@ -5072,6 +5168,69 @@ static int scst_ioc_keeper_thread(void *arg)
 	return 0;
 }
 
+static atomic_t scst_numa_cpu_rr = ATOMIC_INIT(0);
+
+/*
+ * Chooses the NUMA node for tgt_dev: the node of the target hardware, if
+ * known, because that is where data buffers are DMA'ed to and from,
+ * otherwise the node of the device. Also picks a CPU of that node, whose
+ * SGV pools are used, if a command is processed on another node. Those
+ * CPUs are spread round robin to not pile all tgt_devs on one pool.
+ */
+void scst_tgt_dev_init_numa(struct scst_tgt_dev *tgt_dev)
+{
+	int node = tgt_dev->sess->tgt->tgt_numa_node_id;
+	const struct cpumask *mask;
+	unsigned int i;
+	int cpu;
+
+	if (node == NUMA_NO_NODE)
+		node = tgt_dev->dev->dev_numa_node_id;
+
+	tgt_dev->tgt_dev_numa_node_id = NUMA_NO_NODE;
+	tgt_dev->tgt_dev_numa_cpu = -1;
+	atomic_set(&tgt_dev->tgt_dev_numa_local_cmds, 0);
+	atomic_set(&tgt_dev->tgt_dev_numa_remote_cmds, 0);
+
+	if ((node < 0) || (node >= nr_node_ids) || !node_online(node))
+		goto out;
+
+	mask = cpumask_of_node(node);
+	if (cpumask_empty(mask))
+		goto out;
+
+	i = (unsigned int)atomic_inc_return(&scst_numa_cpu_rr) %
+		cpumask_weight(mask);
+	for_each_cpu(cpu, mask) {
+		if (i-- == 0)
+			break;
+	}
+
+	tgt_dev->tgt_dev_numa_node_id = node;
+	tgt_dev->tgt_dev_numa_cpu = cpu;
+
+	TRACE_DBG("tgt_dev %p (dev %s): NUMA node %d, cpu %d", tgt_dev,
+		tgt_dev->dev->virt_name, node, cpu);
+
+out:
+	return;
+}
+
+/*
+ * Returns the CPU mask for the per-initiator threads of tgt_dev. The ACG
+ * cpu_mask, if set, wins over the NUMA node of tgt_dev.
+ */
+const struct cpumask *scst_tgt_dev_cpu_mask(const struct scst_tgt_dev *tgt_dev)
+{
+	const struct cpumask *mask = &tgt_dev->acg_dev->acg->acg_cpu_mask;
+
+	if (cpumask_equal(mask, &default_cpu_mask) &&
+	    (tgt_dev->tgt_dev_numa_node_id != NUMA_NO_NODE))
+		mask = cpumask_of_node(tgt_dev->tgt_dev_numa_node_id);
+
+	return mask;
+}
+
 /* scst_mutex supposed to be held */
 int scst_tgt_dev_setup_threads(struct scst_tgt_dev *tgt_dev)
 {
@@ -5307,8 +5466,11 @@ static int scst_alloc_add_tgt_dev(struct scst_session *sess,
 	atomic_set(&tgt_dev->tgt_dev_dif_app_failed_dev, 0);
 	atomic_set(&tgt_dev->tgt_dev_dif_ref_failed_dev, 0);
 	atomic_set(&tgt_dev->tgt_dev_dif_guard_failed_dev, 0);
+	scst_qos_init(&tgt_dev->tgt_dev_qos);
+	scst_dispatch_tgt_dev_init(tgt_dev);
 
 	tgt_dev->sess = sess;
+	scst_tgt_dev_init_numa(tgt_dev);
 	atomic_set(&tgt_dev->tgt_dev_cmd_count, 0);
 	if (acg_dev->acg->acg_black_hole_type != SCST_ACG_BLACK_HOLE_NONE)
 		set_bit(SCST_TGT_DEV_BLACK_HOLE, &tgt_dev->tgt_dev_flags);
@@ -5370,8 +5532,13 @@ static int scst_alloc_add_tgt_dev(struct scst_session *sess,
 	    sess->tgt->tgtt->xmit_response_atomic)
 		tgt_dev->tgt_dev_after_exec_atomic = 1;
 
-	sl = scst_set_sense(sense_buffer, sizeof(sense_buffer),
-		dev->d_sense, SCST_LOAD_SENSE(scst_sense_reset_UA));
+	if (sess->sess_lazy_tgt_devs && sess->sess_initial_UA_set)
+		sl = scst_set_sense(sense_buffer, sizeof(sense_buffer),
+			dev->d_sense, sess->sess_initial_UA_key,
+			sess->sess_initial_UA_asc, sess->sess_initial_UA_ascq);
+	else
+		sl = scst_set_sense(sense_buffer, sizeof(sense_buffer),
+			dev->d_sense, SCST_LOAD_SENSE(scst_sense_reset_UA));
 	scst_alloc_set_UA(tgt_dev, sense_buffer, sl, 0);
 
 	if (sess->tgt->tgtt->get_initiator_port_transport_id == NULL) {
@@ -5530,6 +5697,8 @@ static void scst_free_tgt_dev(struct scst_tgt_dev *tgt_dev)
 
 	scst_tgt_dev_stop_threads(tgt_dev);
 
+	scst_qos_exit(&tgt_dev->tgt_dev_qos);
+
 	lockdep_unregister_key(&tgt_dev->tgt_dev_key);
 
 	kmem_cache_free(scst_tgtd_cachep, tgt_dev);
@@ -5549,6 +5718,18 @@ int scst_sess_alloc_tgt_devs(struct scst_session *sess)
 
 	TRACE_ENTRY();
 
+	/*
+	 * The copy manager looks its tgt_devs up directly, so it always
+	 * needs all of them.
+	 */
+	sess->sess_lazy_tgt_devs = scst_lazy_tgt_devs &&
+				   !scst_cm_is_cm_tgt(sess->tgt);
+	if (sess->sess_lazy_tgt_devs) {
+		TRACE_MGMT_DBG("sess %p: tgt_devs will be instantiated on "
+			"first access", sess);
+		goto out;
+	}
+
 	list_for_each_entry(acg_dev, &sess->acg->acg_dev_list,
 			acg_dev_list_entry) {
 		res = scst_alloc_add_tgt_dev(sess, acg_dev, &tgt_dev);
@@ -5567,6 +5748,61 @@ out_free:
 	goto out;
 }
 
+/*
+ * scst_sess_add_lazy_tgt_dev() - instantiate the tgt_dev for a LUN on demand
+ *
+ * Called on the first access to @lun by a session with lazily instantiated
+ * tgt_devs. Returns 0 if the tgt_dev exists on return, -ENOENT if @lun isn't
+ * in the session's ACG or another error code. Must be called from thread
+ * context without any command or mgmt cmd reference held, because
+ * scst_mutex might be held by somebody waiting for activity suspension.
+ */
+int scst_sess_add_lazy_tgt_dev(struct scst_session *sess, uint64_t lun)
+{
+	int res;
+	struct scst_acg_dev *acg_dev;
+	struct scst_tgt_dev *tgt_dev;
+
+	TRACE_ENTRY();
+
+	mutex_lock(&scst_mutex);
+
+	if (unlikely(sess->shut_phase != SCST_SESS_SPH_READY ||
+		     sess->acg == NULL)) {
+		res = -ENODEV;
+		goto out_unlock;
+	}
+
+	/* Somebody else might have done it while we were waiting */
+	mutex_lock(&sess->tgt_dev_list_mutex);
+	tgt_dev = scst_lookup_tgt_dev(sess, lun);
+	mutex_unlock(&sess->tgt_dev_list_mutex);
+	if (tgt_dev != NULL) {
+		res = 0;
+		goto out_unlock;
+	}
+
+	res = -ENOENT;
+	list_for_each_entry(acg_dev, &sess->acg->acg_dev_list,
+			    acg_dev_list_entry) {
+		if (acg_dev->lun != lun)
+			continue;
+
+		res = scst_alloc_add_tgt_dev(sess, acg_dev, &tgt_dev);
+		if (res == 0)
+			TRACE_MGMT_DBG("sess %p: instantiated tgt_dev %p for "
+				"LUN %lld", sess, tgt_dev,
+				(unsigned long long)lun);
+		break;
+	}
+
+out_unlock:
+	mutex_unlock(&scst_mutex);
+
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
 void scst_sess_free_tgt_devs(struct scst_session *sess)
 {
 	int i;
@@ -6112,6 +6348,10 @@ struct scst_write_same_priv {
 
 	struct scatterlist *ws_sg_full;
 	int ws_sg_full_cnt;
+
+	/* Replicated pattern buffer, if allocated, and its order */
+	struct page *ws_pg;
+	int ws_pg_order;
 };
 
 #ifdef CONFIG_SCST_EXTRACHECKS
@@ -6230,7 +6470,7 @@ static int scst_ws_push_single_write(struct scst_write_same_priv *wsp,
 		dif_bufflen = blocks << SCST_DIF_TAG_SHIFT;
 		cmd->expected_transfer_len_full += dif_bufflen;
 
-		dif_sg = sgv_pool_alloc(ws_cmd->tgt_dev->pools[raw_smp_processor_id()],
+		dif_sg = sgv_pool_alloc(scst_tgt_dev_sgv_pool(ws_cmd->tgt_dev),
 			dif_bufflen, GFP_KERNEL, 0, &dif_sg_cnt, &dif_sgv,
 			&cmd->dev->dev_mem_lim, NULL);
 		if (unlikely(dif_sg == NULL)) {
@@ -6301,12 +6541,8 @@ static void scst_ws_finished(struct scst_write_same_priv *wsp)
 
 	sBUG_ON(wsp->ws_cur_in_flight != 0);
 
-	if (wsp->ws_sg_full &&
-	    sg_page(&wsp->ws_sg_full[0]) != sg_page(ws_cmd->sg))
-		__free_page(sg_page(&wsp->ws_sg_full[0]));
-	else if (wsp->ws_sg_tails && wsp->ws_sg_tails[0].sg_cnt != 0 &&
-		 sg_page(&wsp->ws_sg_tails[0].sg[0]) != sg_page(ws_cmd->sg))
-		__free_page(sg_page(&wsp->ws_sg_tails[0].sg[0]));
+	if (wsp->ws_pg != NULL)
+		__free_pages(wsp->ws_pg, wsp->ws_pg_order);
 	kfree(wsp->ws_sg_full);
 	if (wsp->ws_sg_tails) {
 		for (i = 0; wsp->ws_descriptors[i].sdd_blocks != 0; i++)
@@ -6530,7 +6766,7 @@ static int scst_ws_sg_tails_get(struct scst_data_descriptor *where, struct scst_
 void scst_write_same(struct scst_cmd *cmd, struct scst_data_descriptor *where)
 {
 	struct scst_write_same_priv *wsp;
-	int i, rc;
+	int i, rc, order;
 	struct page *pg = NULL;
 	unsigned int offset, length, mult, ws_sg_full_blocks, ws_sg_tail_blocks;
 	uint8_t ctrl_offs = (cmd->cdb_len < 32) ? 1 : 10;
@@ -6598,25 +6834,32 @@ void scst_write_same(struct scst_cmd *cmd, struct scst_data_descriptor *where)
 	wsp->ws_cur_descr = 0;
 	wsp->ws_cur_lba = where[0].sdd_lba;
 	wsp->ws_left_to_send = where[0].sdd_blocks;
-	wsp->ws_max_each = SCST_MAX_EACH_INTERNAL_IO_SIZE >> cmd->dev->block_shift;
-
-	if (scst_ws_sg_tails_get(where, wsp) == -ENOMEM)
-		goto out_busy;
 
-	if (cmd->bufflen <= PAGE_SIZE / 2)
-		pg = alloc_page(GFP_KERNEL);
+	/*
+	 * Replicate the pattern into as big buffer as we can get, so each
+	 * generated WRITE can be big without needing more SG entries.
+	 */
+	for (order = SCST_WS_PATTERN_ORDER; order >= 0; order--) {
+		if (cmd->bufflen > (PAGE_SIZE << order) / 2)
+			break;
+		pg = alloc_pages(GFP_KERNEL | __GFP_NOWARN, order);
+		if (pg != NULL)
+			break;
+	}
 	if (pg) {
 		struct page *src_pg;
 		void *src, *dst;
 		int k;
 
+		wsp->ws_pg = pg;
+		wsp->ws_pg_order = order;
+
 		mult = 0;
 		src_pg = sg_page(cmd->sg);
 		src = kmap(src_pg);
-		dst = kmap(pg);
-		for (k = 0; k < PAGE_SIZE; k += cmd->bufflen, mult++)
+		dst = page_address(pg);
+		for (k = 0; k < (PAGE_SIZE << order); k += cmd->bufflen, mult++)
 			memcpy(dst + k, src + cmd->sg->offset, cmd->bufflen);
-		kunmap(pg);
 		kunmap(src_pg);
 		offset = 0;
 		length = k;
@@ -6627,6 +6870,17 @@ void scst_write_same(struct scst_cmd *cmd, struct scst_data_descriptor *where)
 		mult = 1;
 	}
 
+	/* Not more SG entries per WRITE than with the page sized buffer */
+	wsp->ws_max_each = min_t(unsigned int, SCST_WS_MAX_EACH_IO_SIZE,
+		(SCST_MAX_EACH_INTERNAL_IO_SIZE / PAGE_SIZE) * length) >>
+			cmd->dev->block_shift;
+
+	TRACE_DBG("ws cmd %p: pattern buffer %d bytes (mult %d), max each %d "
+		"blocks", cmd, length, mult, wsp->ws_max_each);
+
+	if (scst_ws_sg_tails_get(where, wsp) == -ENOMEM)
+		goto out_free;
+
 	if (wsp->ws_sg_full_cnt != 0) {
 		ws_sg_full_blocks = wsp->ws_sg_full_cnt;
 		wsp->ws_sg_full_cnt = (ws_sg_full_blocks + mult - 1) / mult;
@@ -6685,8 +6939,8 @@ out:
 	return;
 
 out_free:
-	if (pg && pg != sg_page(cmd->sg))
-		__free_page(pg);
+	if (wsp->ws_pg != NULL)
+		__free_pages(wsp->ws_pg, wsp->ws_pg_order);
 	kfree(wsp);
 
 out_busy:
@@ -6991,6 +7245,8 @@ int scst_finish_internal_cmd(struct scst_cmd *cmd)
 		goto out;
 	}
 
+	scst_cmd_thr_release(cmd);
+
 	spin_lock_irqsave(&cmd->sess->sess_list_lock, flags);
 	list_del(&cmd->sess_cmd_list_entry);
 	cmd->done = 1;
@@ -7120,6 +7376,7 @@ struct scst_session *scst_alloc_session(struct scst_tgt *tgt, gfp_t gfp_mask,
 			  sess_cm_list_id_cleanup_work_fn);
 	INIT_DELAYED_WORK(&sess->hw_pending_work, scst_hw_pending_work_fn);
 	spin_lock_init(&sess->lat_stats_lock);
+	scst_qos_init(&sess->sess_qos);
 
 	sess->initiator_name = kstrdup(initiator_name, gfp_mask);
 	if (sess->initiator_name == NULL) {
@@ -7192,6 +7449,8 @@ void scst_free_session(struct scst_session *sess)
 	 */
 	mutex_unlock(&scst_mutex);
 
+	scst_qos_exit(&sess->sess_qos);
+
 	kfree(sess->transport_id);
 	kvfree(sess->lat_stats);
 	kfree(sess->initiator_name);
@@ -7762,7 +8021,7 @@ int scst_alloc_space(struct scst_cmd *cmd)
 	if (cmd->no_sgv)
 		flags |= SGV_POOL_ALLOC_NO_CACHED;
 
-	cmd->sg = sgv_pool_alloc(tgt_dev->pools[raw_smp_processor_id()],
+	cmd->sg = sgv_pool_alloc(scst_tgt_dev_sgv_pool(tgt_dev),
 			cmd->bufflen, gfp_mask, flags, &cmd->sg_cnt, &cmd->sgv,
 			&cmd->dev->dev_mem_lim, NULL);
 	if (unlikely(cmd->sg == NULL))
@@ -7783,7 +8042,7 @@ int scst_alloc_space(struct scst_cmd *cmd)
 		else
 			dif_bufflen = cmd->bufflen;
 
-		cmd->dif_sg = sgv_pool_alloc(tgt_dev->pools[raw_smp_processor_id()],
+		cmd->dif_sg = sgv_pool_alloc(scst_tgt_dev_sgv_pool(tgt_dev),
 			dif_bufflen, gfp_mask, flags, &cmd->dif_sg_cnt, &cmd->dif_sgv,
 			&cmd->dev->dev_mem_lim, NULL);
 		if (unlikely(cmd->dif_sg == NULL))
@@ -7813,7 +8072,7 @@ int scst_alloc_space(struct scst_cmd *cmd)
 	if (cmd->data_direction != SCST_DATA_BIDI)
 		goto success;
 
-	cmd->out_sg = sgv_pool_alloc(tgt_dev->pools[raw_smp_processor_id()],
+	cmd->out_sg = sgv_pool_alloc(scst_tgt_dev_sgv_pool(tgt_dev),
 			cmd->out_bufflen, gfp_mask, flags, &cmd->out_sg_cnt,
 			&cmd->out_sgv, &cmd->dev->dev_mem_lim, NULL);
 	if (unlikely(cmd->out_sg == NULL))
@@ -11760,7 +12019,24 @@ static int get_cdb_info_compare_and_write(struct scst_cmd *cmd,
 static int get_cdb_info_ext_copy(struct scst_cmd *cmd,
 	const struct scst_sdbops *sdbops)
 {
-	if (unlikely(cmd->cdb[1] != 0)) {
+	switch (cmd->cdb[1]) {
+	case 0:
+		break;
+	case SA_POPULATE_TOKEN:
+		/*
+		 * Only reads, and only at WRITE USING TOKEN time, so neither
+		 * a medium write nor blocking of the involved devices.
+		 */
+		cmd->op_name = "POPULATE TOKEN";
+		cmd->op_flags &= ~(SCST_WRITE_MEDIUM |
+				   SCST_CAN_GEN_3PARTY_COMMANDS |
+				   SCST_DESCRIPTORS_BASED);
+		cmd->op_flags |= SCST_WRITE_EXCL_ALLOWED;
+		break;
+	case SA_WRITE_USING_TOKEN:
+		cmd->op_name = "WRITE USING TOKEN";
+		break;
+	default:
 		PRINT_WARNING("Not supported %s service action 0x%x",
 			scst_get_opcode_name(cmd), cmd->cdb[1]);
 		scst_set_invalid_field_in_cdb(cmd, 1,
@@ -13204,6 +13480,46 @@ static void scst_free_all_UA(struct scst_tgt_dev *tgt_dev)
 	return;
 }
 
+/*
+ * sn_lock supposed to be locked and IRQs off. Releases deferred cmd with the
+ * expected SN. Returns true, if there can't be other commands with this SN.
+ */
+static bool scst_release_deferred_sn_cmd(struct scst_order_data *order_data,
+	struct scst_cmd *cmd, bool *first, bool *activate, struct scst_cmd **res)
+{
+	bool stop = (cmd->sn_slot == NULL);
+
+	TRACE_SN("Deferred command %p (sn %d, set %d) found",
+		cmd, cmd->sn, cmd->sn_set);
+
+	order_data->def_cmd_count--;
+	list_del(&cmd->deferred_cmd_list_entry);
+
+	if (*activate) {
+		spin_lock(&cmd->cmd_threads->cmd_list_lock);
+		TRACE_SN("Adding cmd %p to active cmd list", cmd);
+		list_add_tail(&cmd->cmd_list_entry,
+			&cmd->cmd_threads->active_cmd_list);
+		wake_up(&cmd->cmd_threads->cmd_list_waitQ);
+		spin_unlock(&cmd->cmd_threads->cmd_list_lock);
+		/* !! At this point cmd can be already dead !! */
+	}
+	if (*first) {
+		if (!*activate)
+			*res = cmd;
+		if (stop) {
+			/*
+			 * Then there can be only one command with this SN,
+			 * so there's no point to iterate further.
+			 */
+			return true;
+		}
+		*first = false;
+		*activate = true;
+	}
+	return false;
+}
+
 /*
  * sn_lock supposed to be locked and IRQs off. Might drop then reacquire
  * it inside.
@@ -13216,6 +13532,8 @@ struct scst_cmd *__scst_check_deferred_commands_locked(
 	struct scst_cmd *res = NULL, *cmd, *t;
 	typeof(order_data->expected_sn) expected_sn = order_data->expected_sn;
 	bool activate = !return_first, first = true, found = false;
+	struct list_head *bucket;
+	u64 now = 0, wait;
 
 	TRACE_ENTRY();
 
@@ -13246,39 +13564,40 @@ restart:
 			wake_up(&cmd->cmd_threads->cmd_list_waitQ);
 			spin_unlock(&cmd->cmd_threads->cmd_list_lock);
 		} else if ((cmd->sn == expected_sn) || !cmd->sn_set) {
-			bool stop = (cmd->sn_slot == NULL);
+			found = true;
+			if (scst_release_deferred_sn_cmd(order_data, cmd,
+					&first, &activate, &res))
+				goto out;
+		}
+	}
 
-			TRACE_SN("Deferred command %p (sn %d, set %d) found",
-				cmd, cmd->sn, cmd->sn_set);
+	/* Only commands with SN == expected_sn or colliding ones are here */
+	bucket = &order_data->deferred_sn_ring[expected_sn & SCST_SN_SLOTS_MASK];
+	list_for_each_entry_safe(cmd, t, bucket, deferred_cmd_list_entry) {
+		EXTRACHECKS_BUG_ON(!cmd->sn_set);
 
-			order_data->def_cmd_count--;
-			list_del(&cmd->deferred_cmd_list_entry);
+		if (cmd->sn != expected_sn)
+			continue;
 
-			if (activate) {
-				spin_lock(&cmd->cmd_threads->cmd_list_lock);
-				TRACE_SN("Adding cmd %p to active cmd list", cmd);
-				list_add_tail(&cmd->cmd_list_entry,
-					&cmd->cmd_threads->active_cmd_list);
-				wake_up(&cmd->cmd_threads->cmd_list_waitQ);
-				spin_unlock(&cmd->cmd_threads->cmd_list_lock);
-				/* !! At this point cmd can be already dead !! */
-			}
-			if (first) {
-				if (!activate)
-					res = cmd;
-				if (stop) {
-					/*
-					 * Then there can be only one command
-					 * with this SN, so there's no point
-					 * to iterate further.
-					 */
-					goto out;
-				}
-				first = false;
-				activate = true;
+		if (unlikely(order_data->aca_tgt_dev != 0)) {
+			if (!test_bit(SCST_CMD_ABORTED, &cmd->cmd_flags)) {
+				/* To prevent defer/release storms during ACA */
+				continue;
 			}
-			found = true;
 		}
+
+		if (now == 0)
+			now = ktime_to_ns(ktime_get());
+		wait = now - cmd->sn_defer_time;
+		order_data->sn_deferred_cmds++;
+		order_data->sn_defer_ns += wait;
+		if (wait > order_data->sn_defer_max_ns)
+			order_data->sn_defer_max_ns = wait;
+
+		found = true;
+		if (scst_release_deferred_sn_cmd(order_data, cmd,
+				&first, &activate, &res))
+			goto out;
 	}
 	if (found)
 		goto out;
@@ -14019,6 +14338,24 @@ int scst_get_max_lun_commands(struct scst_session *sess, uint64_t lun)
 		goto out_unlock;
 	}
 
+	if (sess->sess_lazy_tgt_devs && (sess->acg != NULL)) {
+		struct scst_acg_dev *acg_dev;
+
+		/* Most of tgt_devs might not be instantiated yet */
+		list_for_each_entry(acg_dev, &sess->acg->acg_dev_list,
+				    acg_dev_list_entry) {
+			if (lun != NO_SUCH_LUN) {
+				if (acg_dev->lun != lun)
+					continue;
+				res = acg_dev->dev->max_tgt_dev_commands;
+				break;
+			}
+			if (res > acg_dev->dev->max_tgt_dev_commands)
+				res = acg_dev->dev->max_tgt_dev_commands;
+		}
+		goto out_unlock;
+	}
+
 	if (lun != NO_SUCH_LUN) {
 		struct list_head *head =
 			&sess->sess_tgt_dev_list[SESS_TGT_DEV_LIST_HASH_FN(lun)];
@@ -14108,6 +14445,22 @@ void scst_reassign_retained_sess_states(struct scst_session *new_sess,
 			}
 		}
 
+		if ((new_tgt_dev == NULL) && (old_tgt_dev != NULL) &&
+		    new_sess->sess_lazy_tgt_devs && (new_sess->acg != NULL)) {
+			struct scst_acg_dev *acg_dev;
+
+			/* Instantiate it to have where to retain the states */
+			list_for_each_entry(acg_dev, &new_sess->acg->acg_dev_list,
+					    acg_dev_list_entry) {
+				if (acg_dev->dev != dev)
+					continue;
+				if (scst_alloc_add_tgt_dev(new_sess, acg_dev,
+							   &new_tgt_dev) != 0)
+					new_tgt_dev = NULL;
+				break;
+			}
+		}
+
 		if ((new_tgt_dev == NULL) || (old_tgt_dev == NULL)) {
 			TRACE_DBG("new_tgt_dev %p or old_sess %p is NULL, "
 				"skipping (dev %s)", new_tgt_dev, old_tgt_dev,
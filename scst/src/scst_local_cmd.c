@@ -61,6 +61,33 @@ enum scst_exec_res scst_report_luns_local(struct scst_cmd *cmd)
 	memset(buffer, 0, buffer_size);
 	offs = 8;
 
+	if (cmd->sess->sess_lazy_tgt_devs) {
+		struct scst_acg_dev *acg_dev;
+
+		/*
+		 * Most of tgt_devs might not be instantiated yet, so report
+		 * the LUNs of the ACG. scst_acg_add_lun() and
+		 * scst_acg_del_lun() change that list under scst_mutex.
+		 */
+		mutex_lock(&scst_mutex);
+		list_for_each_entry(acg_dev, &cmd->sess->acg->acg_dev_list,
+				    acg_dev_list_entry) {
+			if (!overflow) {
+				if ((buffer_size - offs) < 8) {
+					overflow = 1;
+					goto inc_acg_dev_cnt;
+				}
+				*(__force __be64 *)&buffer[offs]
+					= scst_pack_lun(acg_dev->lun,
+						cmd->sess->acg->addr_method);
+				offs += 8;
+			}
+inc_acg_dev_cnt:
+			dev_cnt++;
+		}
+		mutex_unlock(&scst_mutex);
+	}
+
 	rcu_read_lock();
 	for (i = 0; i < SESS_TGT_DEV_LIST_HASH_SIZE; i++) {
 		struct list_head *head = &cmd->sess->sess_tgt_dev_list[i];
@@ -69,6 +96,9 @@ enum scst_exec_res scst_report_luns_local(struct scst_cmd *cmd)
 					sess_tgt_dev_list_entry) {
 			struct scst_tgt_dev_UA *ua;
 
+			if (cmd->sess->sess_lazy_tgt_devs)
+				goto clear_ua;
+
 			if (!overflow) {
 				if ((buffer_size - offs) < 8) {
 					overflow = 1;
@@ -82,6 +112,7 @@ enum scst_exec_res scst_report_luns_local(struct scst_cmd *cmd)
 inc_dev_cnt:
 			dev_cnt++;
 
+clear_ua:
 			/* Clear sense_reported_luns_data_changed UA. */
 			spin_lock_bh(&tgt_dev->tgt_dev_lock);
 			list_for_each_entry(ua, &tgt_dev->UA_list,
@@ -30,6 +30,7 @@
 #include <linux/kthread.h>
 #include <linux/delay.h>
 #include <linux/lockdep.h>
+#include <linux/workqueue.h>
 
 #ifdef INSIDE_KERNEL_TREE
 #include <scst/scst.h>
@@ -125,6 +126,7 @@ wait_queue_head_t scst_mgmt_cmd_list_waitQ;
 wait_queue_head_t scst_mgmt_waitQ;
 spinlock_t scst_mgmt_lock;
 struct list_head scst_sess_init_list;
+wait_queue_head_t scst_sess_init_waitQ;
 struct list_head scst_sess_shut_list;
 
 wait_queue_head_t scst_dev_cmd_waitQ;
@@ -133,8 +135,12 @@ static struct mutex scst_cmd_threads_mutex;
 /* protected by scst_cmd_threads_mutex */
 static struct list_head scst_cmd_threads_list;
 
+/* Woken up when an elastic thread is stopped */
+static DECLARE_WAIT_QUEUE_HEAD(scst_elastic_retire_waitQ);
+
 static struct task_struct *scst_init_cmd_thread;
 static struct task_struct *scst_mgmt_thread;
+static struct task_struct **scst_sess_init_threads_tasks;
 static struct task_struct *scst_mgmt_cmd_thread;
 
 /*
@@ -158,10 +164,19 @@ cpumask_t default_cpu_mask;
 spinlock_t scst_measure_latency_lock;
 atomic_t scst_measure_latency;
 
+/* Number of registered target templates with plug_cmd_threads set */
+atomic_t scst_plug_cmd_threads_cnt;
+
 int scst_threads;
 module_param_named(scst_threads, scst_threads, int, S_IRUGO);
 MODULE_PARM_DESC(scst_threads, "SCSI target threads count");
 
+unsigned int scst_elastic_threads_max;
+module_param_named(elastic_threads_max, scst_elastic_threads_max, uint,
+	S_IRUGO);
+MODULE_PARM_DESC(elastic_threads_max, "Max number of threads the elastic "
+	"pool manager can add to each threads pool (default 0, i.e. disabled)");
+
 static unsigned int scst_max_cmd_mem;
 module_param_named(scst_max_cmd_mem, scst_max_cmd_mem, int, S_IRUGO);
 MODULE_PARM_DESC(scst_max_cmd_mem, "Maximum memory allowed to be consumed by "
@@ -179,6 +194,19 @@ MODULE_PARM_DESC(forcibly_close_sessions,
 "If enabled, close the sessions associated with an access control group (ACG)"
 " when an ACG is deleted via sysfs instead of returning -EBUSY. (default: false)");
 
+static int scst_sess_init_threads = 4;
+module_param_named(sess_init_threads, scst_sess_init_threads, int, S_IRUGO);
+MODULE_PARM_DESC(sess_init_threads, "Number of threads initializing sessions "
+	"registered from atomic context in parallel (default: 4)");
+
+bool scst_lazy_tgt_devs;
+module_param_named(lazy_tgt_devs, scst_lazy_tgt_devs, bool,
+		   S_IWUSR | S_IRUGO);
+MODULE_PARM_DESC(lazy_tgt_devs, "If enabled, the per-LUN state of a session "
+	"(tgt_dev) is instantiated on the first command or task management "
+	"function to that LUN instead of for all LUNs at login. Affects only "
+	"sessions registered after the change. (default: false)");
+
 bool scst_auto_cm_assignment = true;
 module_param_named(auto_cm_assignment, scst_auto_cm_assignment, bool,
 		   S_IWUSR | S_IRUGO);
@@ -288,6 +316,9 @@ int __scst_register_target_template(struct scst_tgt_template *vtt,
 	mutex_unlock(&scst_mutex2);
 	mutex_unlock(&scst_mutex);
 
+	if (vtt->plug_cmd_threads)
+		atomic_inc(&scst_plug_cmd_threads_cnt);
+
 	PRINT_INFO("Target template %s registered successfully", vtt->name);
 
 out:
@@ -387,6 +418,9 @@ void scst_unregister_target_template(struct scst_tgt_template *vtt)
 	list_del(&vtt->scst_template_list_entry);
 	mutex_unlock(&scst_mutex2);
 
+	if (vtt->plug_cmd_threads)
+		atomic_dec(&scst_plug_cmd_threads_cnt);
+
 	/* Wait for outstanding sysfs mgmt calls completed */
 	while (vtt->tgtt_active_sysfs_works_count > 0) {
 		mutex_unlock(&scst_mutex);
@@ -1023,7 +1057,9 @@ static int scst_register_device(struct scsi_device *scsidp)
 	if (res != 0)
 		goto out;
 
-	res = scst_alloc_device(GFP_KERNEL, NUMA_NO_NODE, &dev);
+	/* The node of the SCSI device is inherited from its HBA */
+	res = scst_alloc_device(GFP_KERNEL, dev_to_node(&scsidp->sdev_gendev),
+				&dev);
 	if (res != 0)
 		goto out_unlock;
 
@@ -1665,8 +1701,9 @@ void scst_unregister_virtual_dev_driver(struct scst_dev_type *dev_type)
 }
 EXPORT_SYMBOL_GPL(scst_unregister_virtual_dev_driver);
 
-int scst_add_threads(struct scst_cmd_threads *cmd_threads,
-	struct scst_device *dev, struct scst_tgt_dev *tgt_dev, int num)
+static int __scst_add_threads(struct scst_cmd_threads *cmd_threads,
+	struct scst_device *dev, struct scst_tgt_dev *tgt_dev, int num,
+	bool elastic)
 {
 	int res = 0, i;
 	struct scst_cmd_thread_t *thr;
@@ -1686,6 +1723,10 @@ int scst_add_threads(struct scst_cmd_threads *cmd_threads,
 	TRACE_DBG("cmd_threads %p, dev %s, tgt_dev %p, num %d, n %d",
 		cmd_threads, dev ? dev->virt_name : "NULL", tgt_dev, num, n);
 
+	/* For the elastic pool manager */
+	cmd_threads->thr_dev = dev;
+	cmd_threads->thr_tgt_dev = tgt_dev;
+
 	if (tgt_dev != NULL) {
 		struct scst_tgt_dev *t;
 
@@ -1697,7 +1738,7 @@ int scst_add_threads(struct scst_cmd_threads *cmd_threads,
 		}
 		tgt_dev->thread_index = tgt_dev_num;
 
-		nodeid = tgt_dev->dev->dev_numa_node_id;
+		nodeid = tgt_dev->tgt_dev_numa_node_id;
 	} else if (dev != NULL)
 		nodeid = dev->dev_numa_node_id;
 
@@ -1712,6 +1753,7 @@ int scst_add_threads(struct scst_cmd_threads *cmd_threads,
 		INIT_LIST_HEAD(&thr->thr_active_cmd_list);
 		spin_lock_init(&thr->thr_cmd_list_lock);
 		thr->thr_cmd_threads = cmd_threads;
+		thr->elastic = elastic;
 
 		if (dev != NULL) {
 			thr->cmd_thread = kthread_create_on_node(scst_cmd_thread,
@@ -1738,7 +1780,16 @@ int scst_add_threads(struct scst_cmd_threads *cmd_threads,
 			 * scst_check_reassign_sess()!
 			 */
 			rc = set_cpus_allowed_ptr(thr->cmd_thread,
-				&tgt_dev->acg_dev->acg->acg_cpu_mask);
+				scst_tgt_dev_cpu_mask(tgt_dev));
+			if (rc != 0)
+				PRINT_ERROR("Setting CPU affinity failed: "
+					"%d", rc);
+		} else if ((dev != NULL) && (nodeid != NUMA_NO_NODE) &&
+			   node_online(nodeid)) {
+			int rc;
+
+			rc = set_cpus_allowed_ptr(thr->cmd_thread,
+				cpumask_of_node(nodeid));
 			if (rc != 0)
 				PRINT_ERROR("Setting CPU affinity failed: "
 					"%d", rc);
@@ -1747,6 +1798,8 @@ int scst_add_threads(struct scst_cmd_threads *cmd_threads,
 		spin_lock(&cmd_threads->thr_lock);
 		list_add(&thr->thread_list_entry, &cmd_threads->threads_list);
 		cmd_threads->nr_threads++;
+		if (elastic)
+			cmd_threads->nr_elastic_threads++;
 		spin_unlock(&cmd_threads->thr_lock);
 
 		TRACE_DBG("Added thr %p to threads list (nr_threads %d, n %d)",
@@ -1774,6 +1827,12 @@ out:
 	return res;
 }
 
+int scst_add_threads(struct scst_cmd_threads *cmd_threads,
+	struct scst_device *dev, struct scst_tgt_dev *tgt_dev, int num)
+{
+	return __scst_add_threads(cmd_threads, dev, tgt_dev, num, false);
+}
+
 /*
  * The being stopped threads must not have assigned commands, which usually
  * means suspended activities.
@@ -1794,6 +1853,8 @@ void scst_del_threads(struct scst_cmd_threads *cmd_threads, int num)
 				list_del(&ct->thread_list_entry);
 				ct->being_stopped = true;
 				cmd_threads->nr_threads--;
+				if (ct->elastic)
+					cmd_threads->nr_elastic_threads--;
 				break;
 			}
 		}
@@ -1809,6 +1870,10 @@ void scst_del_threads(struct scst_cmd_threads *cmd_threads, int num)
 		kmem_cache_free(scst_thr_cachep, ct);
 	}
 
+	/* The pool may be freed after return */
+	wait_event(scst_elastic_retire_waitQ,
+		   atomic_read(&cmd_threads->nr_retiring_threads) == 0);
+
 	EXTRACHECKS_BUG_ON((cmd_threads->nr_threads == 0) &&
 		(cmd_threads->io_context != NULL));
 
@@ -1818,7 +1883,7 @@ void scst_del_threads(struct scst_cmd_threads *cmd_threads, int num)
 
 /* scst_mutex supposed to be held */
 int scst_set_thr_cpu_mask(struct scst_cmd_threads *cmd_threads,
-			  cpumask_t *cpu_mask)
+			  const cpumask_t *cpu_mask)
 {
 	struct scst_cmd_thread_t *thr;
 	int rc = 0;
@@ -1836,6 +1901,286 @@ int scst_set_thr_cpu_mask(struct scst_cmd_threads *cmd_threads,
 }
 EXPORT_SYMBOL(scst_set_thr_cpu_mask);
 
+/*
+ * Elastic threads pools. Once per SCST_ELASTIC_INTERVAL the manager samples
+ * each threads pool and adds a thread, if commands are waiting on the
+ * pool's active cmd list, but no thread is idle, e.g. because all of them
+ * are blocked in exec. It stops an added thread, if the pool has idle
+ * threads for long enough.
+ */
+#define SCST_ELASTIC_INTERVAL		(HZ / 10)
+/* Samples with commands waiting and no idle threads before growing */
+#define SCST_ELASTIC_GROW_SAMPLES	2
+/* Samples with idle threads before shrinking, i.e. 10 seconds */
+#define SCST_ELASTIC_SHRINK_SAMPLES	100
+#define SCST_ELASTIC_LOG_SIZE		32
+
+struct scst_elastic_event {
+	unsigned long time; /* in jiffies */
+	int old_num, new_num;
+	char pool[64];
+	char reason[48];
+};
+
+static void scst_elastic_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(scst_elastic_work, scst_elastic_work_fn);
+static bool scst_elastic_stopping;
+
+static DEFINE_SPINLOCK(scst_elastic_log_lock);
+/* Protected by scst_elastic_log_lock */
+static struct scst_elastic_event scst_elastic_log[SCST_ELASTIC_LOG_SIZE];
+static unsigned int scst_elastic_log_cnt;
+
+/* scst_cmd_threads_mutex supposed to be held */
+static void scst_elastic_pool_name(const struct scst_cmd_threads *cmd_threads,
+	char *buf, int size)
+{
+	const struct scst_tgt_dev *tgt_dev = cmd_threads->thr_tgt_dev;
+
+	if (cmd_threads == &scst_main_cmd_threads)
+		strlcpy(buf, "main", size);
+	else if (tgt_dev != NULL)
+		snprintf(buf, size, "%s/%s", tgt_dev->dev->virt_name,
+			tgt_dev->sess->initiator_name);
+	else if (cmd_threads->thr_dev != NULL)
+		strlcpy(buf, cmd_threads->thr_dev->virt_name, size);
+	else
+		snprintf(buf, size, "%p", cmd_threads);
+}
+
+static void scst_elastic_log_add(struct scst_cmd_threads *cmd_threads,
+	int old_num, int new_num, const char *reason)
+{
+	struct scst_elastic_event *e;
+
+	spin_lock(&scst_elastic_log_lock);
+	e = &scst_elastic_log[scst_elastic_log_cnt % SCST_ELASTIC_LOG_SIZE];
+	e->time = jiffies;
+	e->old_num = old_num;
+	e->new_num = new_num;
+	scst_elastic_pool_name(cmd_threads, e->pool, sizeof(e->pool));
+	strlcpy(e->reason, reason, sizeof(e->reason));
+	scst_elastic_log_cnt++;
+	spin_unlock(&scst_elastic_log_lock);
+
+	TRACE_MGMT_DBG("Threads pool %s: %d -> %d threads (%s)", e->pool,
+		old_num, new_num, reason);
+}
+
+static bool scst_elastic_thr_blocked(struct task_struct *t)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 14, 0)
+	return (READ_ONCE(t->__state) & TASK_UNINTERRUPTIBLE) != 0;
+#else
+	return (READ_ONCE(t->state) & TASK_UNINTERRUPTIBLE) != 0;
+#endif
+}
+
+/*
+ * Detaches an idle elastic thread from cmd_threads and moves it to retired.
+ * It is stopped later out of scst_mutex, because it might need scst_mutex
+ * to finish its commands.
+ */
+static bool scst_elastic_retire(struct scst_cmd_threads *cmd_threads,
+	struct list_head *retired)
+{
+	struct scst_cmd_thread_t *thr;
+	bool res = false;
+
+	spin_lock(&cmd_threads->thr_lock);
+	list_for_each_entry(thr, &cmd_threads->threads_list,
+			    thread_list_entry) {
+		if (!thr->elastic || thr->being_stopped ||
+		    (atomic_read(&thr->thr_assigned_cmds) != 0))
+			continue;
+		list_del(&thr->thread_list_entry);
+		thr->being_stopped = true;
+		thr->retiring = true;
+		cmd_threads->nr_threads--;
+		cmd_threads->nr_elastic_threads--;
+		atomic_inc(&cmd_threads->nr_retiring_threads);
+		list_add_tail(&thr->thread_list_entry, retired);
+		res = true;
+		break;
+	}
+	spin_unlock(&cmd_threads->thr_lock);
+
+	return res;
+}
+
+/*
+ * scst_mutex and scst_cmd_threads_mutex supposed to be held. Returns true
+ * if cmd_threads has elastic threads.
+ */
+static bool scst_elastic_check_pool(struct scst_cmd_threads *cmd_threads,
+	struct list_head *retired)
+{
+	struct scst_cmd_thread_t *thr;
+	unsigned int max = READ_ONCE(scst_elastic_threads_max);
+	int nr, nr_elastic, idle, blocked = 0;
+	bool pending;
+	char reason[48];
+
+	spin_lock_irq(&cmd_threads->cmd_list_lock);
+	pending = !list_empty(&cmd_threads->active_cmd_list);
+	idle = cmd_threads->nr_idle_threads;
+	spin_unlock_irq(&cmd_threads->cmd_list_lock);
+
+	spin_lock(&cmd_threads->thr_lock);
+	nr = cmd_threads->nr_threads;
+	nr_elastic = cmd_threads->nr_elastic_threads;
+	list_for_each_entry(thr, &cmd_threads->threads_list,
+			    thread_list_entry) {
+		if (scst_elastic_thr_blocked(thr->cmd_thread))
+			blocked++;
+	}
+	spin_unlock(&cmd_threads->thr_lock);
+
+	if (nr == 0)
+		goto out;
+
+	if (pending && (idle == 0))
+		cmd_threads->elastic_busy_samples++;
+	else
+		cmd_threads->elastic_busy_samples = 0;
+
+	if ((idle > 0) && !pending)
+		cmd_threads->elastic_idle_samples++;
+	else
+		cmd_threads->elastic_idle_samples = 0;
+
+	if (nr_elastic > max) {
+		if (scst_elastic_retire(cmd_threads, retired))
+			scst_elastic_log_add(cmd_threads, nr, nr - 1,
+				"elastic_threads_max lowered");
+	} else if ((cmd_threads->elastic_busy_samples >= SCST_ELASTIC_GROW_SAMPLES) ||
+		   ((cmd_threads->elastic_busy_samples > 0) && (blocked == nr))) {
+		cmd_threads->elastic_busy_samples = 0;
+		if (nr_elastic == max)
+			goto out;
+		if (blocked > 0)
+			snprintf(reason, sizeof(reason),
+				"%d of %d threads blocked in exec", blocked, nr);
+		else
+			strlcpy(reason, "commands waiting, no idle threads",
+				sizeof(reason));
+		if (__scst_add_threads(cmd_threads, cmd_threads->thr_dev,
+				cmd_threads->thr_tgt_dev, 1, true) == 0)
+			scst_elastic_log_add(cmd_threads, nr, nr + 1, reason);
+	} else if (cmd_threads->elastic_idle_samples >= SCST_ELASTIC_SHRINK_SAMPLES) {
+		cmd_threads->elastic_idle_samples = 0;
+		if ((nr_elastic > 0) && scst_elastic_retire(cmd_threads, retired))
+			scst_elastic_log_add(cmd_threads, nr, nr - 1, "idle");
+	}
+
+out:
+	return cmd_threads->nr_elastic_threads > 0;
+}
+
+static void scst_elastic_work_fn(struct work_struct *work)
+{
+	struct scst_cmd_threads *cmd_threads;
+	struct scst_cmd_thread_t *thr, *t;
+	LIST_HEAD(retired);
+	bool elastic = false;
+
+	TRACE_ENTRY();
+
+	/* Don't delay management operations, try next time instead */
+	if (!mutex_trylock(&scst_mutex)) {
+		elastic = true;
+		goto out_resched;
+	}
+
+	mutex_lock(&scst_cmd_threads_mutex);
+	list_for_each_entry(cmd_threads, &scst_cmd_threads_list,
+			    lists_list_entry) {
+		if (scst_elastic_check_pool(cmd_threads, &retired))
+			elastic = true;
+	}
+	mutex_unlock(&scst_cmd_threads_mutex);
+
+	mutex_unlock(&scst_mutex);
+
+	list_for_each_entry_safe(thr, t, &retired, thread_list_entry) {
+		/* The pool stays alive until nr_retiring_threads is 0 */
+		cmd_threads = thr->thr_cmd_threads;
+
+		list_del(&thr->thread_list_entry);
+		kthread_stop(thr->cmd_thread);
+		kmem_cache_free(scst_thr_cachep, thr);
+
+		atomic_dec(&cmd_threads->nr_retiring_threads);
+		wake_up_all(&scst_elastic_retire_waitQ);
+	}
+
+out_resched:
+	if (!READ_ONCE(scst_elastic_stopping) &&
+	    ((READ_ONCE(scst_elastic_threads_max) > 0) || elastic))
+		schedule_delayed_work(&scst_elastic_work, SCST_ELASTIC_INTERVAL);
+
+	TRACE_EXIT();
+	return;
+}
+
+void scst_elastic_threads_start(void)
+{
+	if ((READ_ONCE(scst_elastic_threads_max) > 0) &&
+	    !READ_ONCE(scst_elastic_stopping))
+		schedule_delayed_work(&scst_elastic_work, SCST_ELASTIC_INTERVAL);
+}
+
+static void scst_elastic_threads_stop(void)
+{
+	WRITE_ONCE(scst_elastic_stopping, true);
+	cancel_delayed_work_sync(&scst_elastic_work);
+}
+
+/* Lists all threads pools: name, number of threads, of them elastic */
+int scst_elastic_threads_show(char *buf)
+{
+	struct scst_cmd_threads *cmd_threads;
+	char name[64];
+	int pos = 0;
+
+	mutex_lock(&scst_cmd_threads_mutex);
+	list_for_each_entry(cmd_threads, &scst_cmd_threads_list,
+			    lists_list_entry) {
+		if (cmd_threads->nr_threads == 0)
+			continue;
+		scst_elastic_pool_name(cmd_threads, name, sizeof(name));
+		pos += scnprintf(&buf[pos], SCST_SYSFS_BLOCK_SIZE - pos,
+			"%s %d %d\n", name, cmd_threads->nr_threads,
+			cmd_threads->nr_elastic_threads);
+	}
+	mutex_unlock(&scst_cmd_threads_mutex);
+
+	return pos;
+}
+
+/* Shows the last resizes of threads pools, from oldest to newest */
+int scst_elastic_threads_log_show(char *buf)
+{
+	unsigned int i, first;
+	int pos = 0;
+
+	spin_lock(&scst_elastic_log_lock);
+	first = (scst_elastic_log_cnt > SCST_ELASTIC_LOG_SIZE) ?
+		scst_elastic_log_cnt - SCST_ELASTIC_LOG_SIZE : 0;
+	for (i = first; i < scst_elastic_log_cnt; i++) {
+		const struct scst_elastic_event *e =
+			&scst_elastic_log[i % SCST_ELASTIC_LOG_SIZE];
+		unsigned int age = jiffies_to_msecs(jiffies - e->time);
+
+		pos += scnprintf(&buf[pos], SCST_SYSFS_BLOCK_SIZE - pos,
+			"-%u.%03us %s %d -> %d: %s\n", age / 1000, age % 1000,
+			e->pool, e->old_num, e->new_num, e->reason);
+	}
+	spin_unlock(&scst_elastic_log_lock);
+
+	return pos;
+}
+
 /* The activity supposed to be suspended and scst_mutex held */
 void scst_stop_dev_threads(struct scst_device *dev)
 {
@@ -2061,6 +2406,8 @@ EXPORT_SYMBOL_GPL(scst_deinit_threads);
 
 static void scst_stop_global_threads(void)
 {
+	int i;
+
 	TRACE_ENTRY();
 
 	mutex_lock(&scst_mutex);
@@ -2071,6 +2418,14 @@ static void scst_stop_global_threads(void)
 		kthread_stop(scst_mgmt_cmd_thread);
 	if (scst_mgmt_thread)
 		kthread_stop(scst_mgmt_thread);
+	if (scst_sess_init_threads_tasks) {
+		for (i = 0; i < scst_sess_init_threads; i++) {
+			if (scst_sess_init_threads_tasks[i])
+				kthread_stop(scst_sess_init_threads_tasks[i]);
+		}
+		kfree(scst_sess_init_threads_tasks);
+		scst_sess_init_threads_tasks = NULL;
+	}
 	if (scst_init_cmd_thread)
 		kthread_stop(scst_init_cmd_thread);
 
@@ -2083,7 +2438,8 @@ static void scst_stop_global_threads(void)
 /* It does NOT stop ran threads on error! */
 static int scst_start_global_threads(int num)
 {
-	int res;
+	int res, i;
+	struct task_struct *t;
 
 	TRACE_ENTRY();
 
@@ -2120,6 +2476,28 @@ static int scst_start_global_threads(int num)
 		goto out_unlock;
 	}
 
+	if (scst_sess_init_threads < 1)
+		scst_sess_init_threads = 1;
+
+	scst_sess_init_threads_tasks = kcalloc(scst_sess_init_threads,
+				sizeof(*scst_sess_init_threads_tasks), GFP_KERNEL);
+	if (scst_sess_init_threads_tasks == NULL) {
+		res = -ENOMEM;
+		goto out_unlock;
+	}
+
+	for (i = 0; i < scst_sess_init_threads; i++) {
+		t = kthread_run(scst_sess_init_thread, NULL,
+				"scst_sessinitd%d", i);
+		if (IS_ERR(t)) {
+			res = PTR_ERR(t);
+			PRINT_ERROR("kthread_create() for sess init failed: %d",
+				res);
+			goto out_unlock;
+		}
+		scst_sess_init_threads_tasks[i] = t;
+	}
+
 out_unlock:
 	mutex_unlock(&scst_mutex);
 
@@ -2287,6 +2665,7 @@ static int __init init_scst(void)
 	init_waitqueue_head(&scst_mgmt_waitQ);
 	spin_lock_init(&scst_mgmt_lock);
 	INIT_LIST_HEAD(&scst_sess_init_list);
+	init_waitqueue_head(&scst_sess_init_waitQ);
 	INIT_LIST_HEAD(&scst_sess_shut_list);
 	init_waitqueue_head(&scst_dev_cmd_waitQ);
 	mutex_init(&scst_suspend_mutex);
@@ -2422,7 +2801,9 @@ static int __init init_scst(void)
 	if (res != 0)
 		goto out_event_exit;
 
-	scst_tg_init();
+	res = scst_tg_init();
+	if (res != 0)
+		goto out_sysfs_cleanup;
 
 	if (scst_max_cmd_mem == 0) {
 		struct sysinfo si;
@@ -2489,6 +2870,12 @@ static int __init init_scst(void)
 	if (res != 0)
 		goto out_thread_free;
 
+	res = scst_mgmt_init();
+	if (res != 0)
+		goto out_cm_exit;
+
+	scst_elastic_threads_start();
+
 #ifdef CONFIG_SCST_NO_TOTAL_MEM_CHECKS
 	PRINT_INFO("SCST version %s loaded successfully (global max mem for commands "
 		"ignored, per device %dMB)", SCST_VERSION_STRING, scst_max_dev_cmd_mem);
@@ -2505,6 +2892,9 @@ out:
 	return res;
 
 
+out_cm_exit:
+	scst_cm_exit();
+
 out_thread_free:
 	scst_stop_global_threads();
 	percpu_ref_exit(&scst_mcmd_count);
@@ -2590,8 +2980,11 @@ static void __exit exit_scst(void)
 
 	/* ToDo: unregister_cpu_notifier() */
 
+	scst_mgmt_exit();
+
 	scst_cm_exit();
 
+	scst_elastic_threads_stop();
 
 	scst_stop_global_threads();
 
@@ -828,6 +828,9 @@ static bool sgv_check_allowed_mem(struct scst_mem_lim *mem_lim, int pages)
 	int alloced;
 	bool res = true;
 
+	if (mem_lim == NULL)
+		goto out;
+
 	alloced = atomic_add_return(pages, &mem_lim->alloced_pages);
 	if (unlikely(alloced > mem_lim->max_allowed_pages)) {
 		TRACE(TRACE_OUT_OF_MEM, "Requested amount of memory "
@@ -843,12 +846,16 @@ static bool sgv_check_allowed_mem(struct scst_mem_lim *mem_lim, int pages)
 	TRACE_MEM("mem_lim %p, pages %d, res %d, new alloced %d", mem_lim,
 		pages, res, atomic_read(&mem_lim->alloced_pages));
 
+out:
 	return res;
 }
 
 /* No locks */
 static void sgv_uncheck_allowed_mem(struct scst_mem_lim *mem_lim, int pages)
 {
+	if (mem_lim == NULL)
+		return;
+
 	atomic_sub(pages, &mem_lim->alloced_pages);
 
 	TRACE_MEM("mem_lim %p, pages %d, new alloced %d", mem_lim,
@@ -856,6 +863,34 @@ static void sgv_uncheck_allowed_mem(struct scst_mem_lim *mem_lim, int pages)
 	return;
 }
 
+/**
+ * scst_mem_lim_charge - charge memory against a memory limit
+ * @mem_lim:	memory limits
+ * @pages:	number of pages
+ *
+ * Description:
+ *    Accounts pages allocated outside of mem_lim, e.g. a target driver's
+ *    buffer adopted by a command, as if they were allocated by
+ *    sgv_pool_alloc() with mem_lim. Returns false, if the limit would be
+ *    exceeded. Should be undone by scst_mem_lim_uncharge().
+ */
+bool scst_mem_lim_charge(struct scst_mem_lim *mem_lim, int pages)
+{
+	return sgv_check_allowed_mem(mem_lim, pages);
+}
+EXPORT_SYMBOL_GPL(scst_mem_lim_charge);
+
+/**
+ * scst_mem_lim_uncharge - undo scst_mem_lim_charge()
+ * @mem_lim:	memory limits
+ * @pages:	number of pages
+ */
+void scst_mem_lim_uncharge(struct scst_mem_lim *mem_lim, int pages)
+{
+	sgv_uncheck_allowed_mem(mem_lim, pages);
+}
+EXPORT_SYMBOL_GPL(scst_mem_lim_uncharge);
+
 /**
  * sgv_pool_alloc - allocate an SG vector from the SGV pool
  * @pool:	the cache to alloc from
@@ -864,7 +899,7 @@ static void sgv_uncheck_allowed_mem(struct scst_mem_lim *mem_lim, int pages)
  * @flags:	the allocation flags
  * @count:	the resulting count of SG entries in the resulting SG vector
  * @sgv:	the resulting SGV object
- * @mem_lim:	memory limits
+ * @mem_lim:	memory limits, may be NULL to check only the global limit
  * @priv:	pointer to private for this allocation data
  *
  * Description:
@@ -1150,7 +1185,7 @@ EXPORT_SYMBOL_GPL(sgv_get_priv);
 /**
  * sgv_pool_free - free previously allocated SG vector
  * @obj:	the SGV object to free
- * @mem_lim:	memory limits
+ * @mem_lim:	memory limits passed to sgv_pool_alloc()
  *
  * Description:
  *    Frees previously allocated SG vector and updates memory limits
@@ -0,0 +1,304 @@
+/*
+ *  scst_mgmt.c
+ *
+ *  Bulk management interface. Applies a whole batch of management
+ *  commands, each in the same format as written into the corresponding
+ *  sysfs "mgmt" attribute, with a single write() into /dev/scst_mgmt.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation, version 2
+ *  of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ */
+
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/device.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/uaccess.h>
+#include <linux/capability.h>
+#ifndef INSIDE_KERNEL_TREE
+#include <linux/version.h>
+#endif
+
+#ifdef INSIDE_KERNEL_TREE
+#include <scst/scst.h>
+#else
+#include "scst.h"
+#endif
+
+#include "scst_priv.h"
+
+#define SCST_MGMT_NAME		"scst_mgmt"
+
+/* Max size of a batch written in one write() call */
+#define SCST_MGMT_MAX_BATCH	(16 * 1024 * 1024)
+
+static struct class *scst_mgmt_sysfs_class;
+static int scst_mgmt_major;
+
+struct scst_mgmt_priv {
+	/* Serializes batches written via the same file descriptor */
+	struct mutex mgmt_mutex;
+
+	/* Status of the last batch, protected by mgmt_mutex */
+	unsigned int applied;
+	unsigned int failed_line;
+	int res;
+	s64 time_us;
+};
+
+/*
+ * Returns true if commands for @path suspend activity on their own. The
+ * activity is then suspended once for a whole run of such commands instead
+ * of waiting for all outstanding commands to complete for each of them.
+ */
+static bool scst_mgmt_path_suspends(const char *path)
+{
+	int len = strlen(path);
+	static const char * const suffixes[] = {
+		"/ini_groups/mgmt",
+		"/initiators/mgmt",
+	};
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(suffixes); i++) {
+		int l = strlen(suffixes[i]);
+
+		if (len >= l && strcmp(&path[len - l], suffixes[i]) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+static bool scst_mgmt_path_neutral(const char *path)
+{
+	int len = strlen(path);
+	static const char suffix[] = "/luns/mgmt";
+
+	return len >= sizeof(suffix) - 1 &&
+	       strcmp(&path[len - (sizeof(suffix) - 1)], suffix) == 0;
+}
+
+static int scst_mgmt_apply_batch(struct scst_mgmt_priv *priv, char *batch)
+{
+	int res = 0;
+	unsigned int line_no = 0;
+	bool suspended = false;
+	char *line, *path, *cmd;
+
+	TRACE_ENTRY();
+
+	while ((line = strsep(&batch, "\n")) != NULL) {
+		line_no++;
+
+		line = strim(line);
+		if (*line == '\0' || *line == '#')
+			continue;
+
+		cmd = line;
+		path = strsep(&cmd, " \t");
+		cmd = cmd ? skip_spaces(cmd) : path + strlen(path);
+
+		if (scst_mgmt_path_suspends(path)) {
+			if (!suspended) {
+				res = scst_suspend_activity(
+					SCST_SUSPEND_TIMEOUT_USER);
+				if (res != 0)
+					goto out_failed;
+				suspended = true;
+			}
+		} else if (suspended && !scst_mgmt_path_neutral(path)) {
+			scst_resume_activity();
+			suspended = false;
+		}
+
+		res = scst_sysfs_mgmt_apply(path, cmd);
+		if (res != 0)
+			goto out_failed;
+
+		priv->applied++;
+		cond_resched();
+	}
+
+out_resume:
+	if (suspended)
+		scst_resume_activity();
+
+	TRACE_EXIT_RES(res);
+	return res;
+
+out_failed:
+	PRINT_ERROR("Management batch failed at line %u: %d", line_no, res);
+	priv->failed_line = line_no;
+	goto out_resume;
+}
+
+static ssize_t scst_mgmt_write(struct file *file, const char __user *buf,
+	size_t count, loff_t *ppos)
+{
+	struct scst_mgmt_priv *priv = file->private_data;
+	ssize_t res;
+	char *batch;
+	ktime_t start;
+
+	TRACE_ENTRY();
+
+	if (!capable(CAP_SYS_ADMIN)) {
+		res = -EPERM;
+		goto out;
+	}
+
+	if (count > SCST_MGMT_MAX_BATCH) {
+		PRINT_ERROR("Management batch too big (%zd bytes, max %d)",
+			count, SCST_MGMT_MAX_BATCH);
+		res = -E2BIG;
+		goto out;
+	}
+
+	batch = vmalloc(count + 1);
+	if (batch == NULL) {
+		res = -ENOMEM;
+		goto out;
+	}
+
+	if (copy_from_user(batch, buf, count) != 0) {
+		res = -EFAULT;
+		goto out_free;
+	}
+	batch[count] = '\0';
+
+	res = mutex_lock_interruptible(&priv->mgmt_mutex);
+	if (res != 0)
+		goto out_free;
+
+	priv->applied = 0;
+	priv->failed_line = 0;
+
+	start = ktime_get();
+	priv->res = scst_mgmt_apply_batch(priv, batch);
+	priv->time_us = ktime_us_delta(ktime_get(), start);
+
+	TRACE_MGMT_DBG("Management batch: %u commands applied in %lld us (res %d)",
+		priv->applied, priv->time_us, priv->res);
+
+	res = priv->res ? : count;
+
+	mutex_unlock(&priv->mgmt_mutex);
+
+out_free:
+	vfree(batch);
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+/*
+ * Returns the status of the last batch written via this file descriptor:
+ * "applied=<commands> failed_line=<line or 0> result=<errno> time_us=<us>"
+ */
+static ssize_t scst_mgmt_read(struct file *file, char __user *buf,
+	size_t count, loff_t *ppos)
+{
+	struct scst_mgmt_priv *priv = file->private_data;
+	char status[96];
+	int len;
+
+	mutex_lock(&priv->mgmt_mutex);
+	len = scnprintf(status, sizeof(status),
+		"applied=%u failed_line=%u result=%d time_us=%lld\n",
+		priv->applied, priv->failed_line, priv->res, priv->time_us);
+	mutex_unlock(&priv->mgmt_mutex);
+
+	return simple_read_from_buffer(buf, count, ppos, status, len);
+}
+
+static int scst_mgmt_open(struct inode *inode, struct file *file)
+{
+	struct scst_mgmt_priv *priv;
+
+	priv = kzalloc(sizeof(*priv), GFP_KERNEL);
+	if (priv == NULL)
+		return -ENOMEM;
+
+	mutex_init(&priv->mgmt_mutex);
+	file->private_data = priv;
+
+	return 0;
+}
+
+static int scst_mgmt_release(struct inode *inode, struct file *file)
+{
+	kfree(file->private_data);
+	file->private_data = NULL;
+	return 0;
+}
+
+static const struct file_operations scst_mgmt_fops = {
+	.owner		= THIS_MODULE,
+	.open		= scst_mgmt_open,
+	.read		= scst_mgmt_read,
+	.write		= scst_mgmt_write,
+	.release	= scst_mgmt_release,
+	.llseek		= noop_llseek,
+};
+
+int scst_mgmt_init(void)
+{
+	int res = 0;
+	struct device *dev;
+
+	TRACE_ENTRY();
+
+	scst_mgmt_sysfs_class = class_create(THIS_MODULE, SCST_MGMT_NAME);
+	if (IS_ERR(scst_mgmt_sysfs_class)) {
+		PRINT_ERROR("Unable create sysfs class for SCST management");
+		res = PTR_ERR(scst_mgmt_sysfs_class);
+		goto out;
+	}
+
+	scst_mgmt_major = register_chrdev(0, SCST_MGMT_NAME, &scst_mgmt_fops);
+	if (scst_mgmt_major < 0) {
+		res = scst_mgmt_major;
+		PRINT_ERROR("register_chrdev() failed: %d", res);
+		goto out_class;
+	}
+
+	dev = device_create(scst_mgmt_sysfs_class, NULL,
+			    MKDEV(scst_mgmt_major, 0), NULL, SCST_MGMT_NAME);
+	if (IS_ERR(dev)) {
+		res = PTR_ERR(dev);
+		goto out_chrdev;
+	}
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+
+out_chrdev:
+	unregister_chrdev(scst_mgmt_major, SCST_MGMT_NAME);
+
+out_class:
+	class_destroy(scst_mgmt_sysfs_class);
+	goto out;
+}
+
+void scst_mgmt_exit(void)
+{
+	TRACE_ENTRY();
+
+	device_destroy(scst_mgmt_sysfs_class, MKDEV(scst_mgmt_major, 0));
+	unregister_chrdev(scst_mgmt_major, SCST_MGMT_NAME);
+	class_destroy(scst_mgmt_sysfs_class);
+
+	TRACE_EXIT();
+	return;
+}
@@ -119,6 +119,14 @@ static inline void scst_set_cmd_state(struct scst_cmd *cmd,
 #define SCST_MAX_EACH_INTERNAL_IO_SIZE	     (128*1024)
 #define SCST_MAX_IN_FLIGHT_INTERNAL_COMMANDS 32
 
+/*
+ * WRITE SAME emulation: order of the buffer the pattern block is replicated
+ * into and the max size of each generated WRITE, when such a buffer could
+ * be allocated.
+ */
+#define SCST_WS_PATTERN_ORDER		     4
+#define SCST_WS_MAX_EACH_IO_SIZE	     (1024*1024)
+
 /*
  * Compatibility with real-time (CONFIG_PREEMPT_RT_FULL) kernels.
  * In such kernels:
@@ -154,6 +162,7 @@ extern unsigned int scst_max_dev_cmd_mem;
 
 extern bool scst_forcibly_close_sessions;
 extern bool scst_auto_cm_assignment;
+extern bool scst_lazy_tgt_devs;
 
 extern mempool_t *scst_mgmt_mempool;
 extern mempool_t *scst_mgmt_stub_mempool;
@@ -184,6 +193,12 @@ extern int scst_max_tasklet_cmd;
 
 #define SCST_DEF_POLL_NS 0
 extern unsigned long scst_poll_ns;
+extern atomic_t scst_plug_cmd_threads_cnt;
+
+extern unsigned int scst_elastic_threads_max;
+void scst_elastic_threads_start(void);
+int scst_elastic_threads_show(char *buf);
+int scst_elastic_threads_log_show(char *buf);
 
 extern spinlock_t scst_init_lock;
 extern struct list_head scst_init_cmd_list;
@@ -210,6 +225,7 @@ extern struct scst_percpu_info scst_percpu_infos[NR_CPUS];
 extern wait_queue_head_t scst_mgmt_waitQ;
 extern spinlock_t scst_mgmt_lock;
 extern struct list_head scst_sess_init_list;
+extern wait_queue_head_t scst_sess_init_waitQ;
 extern struct list_head scst_sess_shut_list;
 
 extern cpumask_t default_cpu_mask;
@@ -221,8 +237,23 @@ struct scst_cmd_thread_t {
 	struct scst_cmd_threads *thr_cmd_threads;
 	struct list_head thread_list_entry;
 	bool being_stopped;
+	/* Set if added by the elastic pool manager */
+	bool elastic;
+	/* Set if being stopped by the elastic pool manager */
+	bool retiring;
+	/* Number of not yet finished commands assigned to this thread */
+	atomic_t thr_assigned_cmds;
 };
 
+/* Called when cmd can't be queued to its assigned thread anymore */
+static inline void scst_cmd_thr_release(struct scst_cmd *cmd)
+{
+	if (cmd->cmd_thr != NULL) {
+		atomic_dec(&cmd->cmd_thr->thr_assigned_cmds);
+		cmd->cmd_thr = NULL;
+	}
+}
+
 static inline bool scst_set_io_context(struct scst_cmd *cmd,
 				       struct io_context **old)
 {
@@ -279,6 +310,40 @@ extern void scst_stop_dev_threads(struct scst_device *dev);
 extern int scst_tgt_dev_setup_threads(struct scst_tgt_dev *tgt_dev);
 extern void scst_tgt_dev_stop_threads(struct scst_tgt_dev *tgt_dev);
 
+void scst_tgt_dev_init_numa(struct scst_tgt_dev *tgt_dev);
+const struct cpumask *scst_tgt_dev_cpu_mask(const struct scst_tgt_dev *tgt_dev);
+
+/*
+ * Returns the SGV pool to allocate tgt_dev's data buffers from: the one of
+ * the current CPU, if it is on the tgt_dev's NUMA node, otherwise the one
+ * of tgt_dev's CPU on that node.
+ */
+static inline struct sgv_pool *scst_tgt_dev_sgv_pool(
+	const struct scst_tgt_dev *tgt_dev)
+{
+	int cpu = raw_smp_processor_id();
+
+	if ((tgt_dev->tgt_dev_numa_node_id != NUMA_NO_NODE) &&
+	    (cpu_to_node(cpu) != tgt_dev->tgt_dev_numa_node_id))
+		cpu = tgt_dev->tgt_dev_numa_cpu;
+
+	return tgt_dev->pools[cpu];
+}
+
+/* Counts whether cmd is executed on the NUMA node of its tgt_dev */
+static inline void scst_numa_account(struct scst_cmd *cmd)
+{
+	struct scst_tgt_dev *tgt_dev = cmd->tgt_dev;
+
+	if (tgt_dev->tgt_dev_numa_node_id == NUMA_NO_NODE)
+		return;
+
+	if (numa_node_id() == tgt_dev->tgt_dev_numa_node_id)
+		atomic_inc(&tgt_dev->tgt_dev_numa_local_cmds);
+	else
+		atomic_inc(&tgt_dev->tgt_dev_numa_remote_cmds);
+}
+
 extern struct scst_dev_type scst_null_devtype;
 
 char *scst_get_cmd_state_name(char *name, int len, unsigned int state);
@@ -335,6 +400,7 @@ void scst_cmd_tasklet(long p);
 int scst_init_thread(void *arg);
 int scst_tm_thread(void *arg);
 int scst_global_mgmt_thread(void *arg);
+int scst_sess_init_thread(void *arg);
 
 void scst_cmd_set_write_no_data_received(struct scst_cmd *cmd);
 
@@ -365,6 +431,7 @@ struct scst_acg *scst_find_acg(const struct scst_session *sess);
 void scst_check_reassign_sessions(void);
 
 int scst_sess_alloc_tgt_devs(struct scst_session *sess);
+int scst_sess_add_lazy_tgt_dev(struct scst_session *sess, uint64_t lun);
 void scst_sess_free_tgt_devs(struct scst_session *sess);
 struct scst_tgt_dev *scst_lookup_tgt_dev(struct scst_session *sess, u64 lun);
 void scst_nexus_loss(struct scst_tgt_dev *tgt_dev, bool queue_UA);
@@ -433,8 +500,9 @@ void scst_finish_cmd_mgmt(struct scst_cmd *cmd);
 
 static inline void scst_devt_cleanup(struct scst_dev_type *devt) { }
 
-void scst_tg_init(void);
+int scst_tg_init(void);
 void scst_tg_cleanup(void);
+int scst_alua_transitions_show(char *buf);
 int scst_dg_add(struct kobject *parent, const char *name);
 int scst_dg_remove(const char *name);
 struct scst_dev_group *scst_lookup_dg_by_kobj(struct kobject *kobj);
@@ -469,6 +537,7 @@ void scst_tg_tgt_sysfs_del(struct scst_target_group *tg,
 extern const struct sysfs_ops scst_sysfs_ops;
 int scst_sysfs_init(void);
 void scst_sysfs_cleanup(void);
+int scst_sysfs_mgmt_apply(char *path, char *cmd);
 int scst_tgtt_sysfs_create(struct scst_tgt_template *tgtt);
 void scst_tgtt_sysfs_del(struct scst_tgt_template *tgtt);
 int scst_tgt_sysfs_create(struct scst_tgt *tgt);
@@ -758,6 +827,7 @@ void scst_cm_update_dev(struct scst_device *dev);
 int scst_cm_on_dev_register(struct scst_device *dev);
 void scst_cm_on_dev_unregister(struct scst_device *dev);
 
+bool scst_cm_is_cm_tgt(const struct scst_tgt *tgt);
 int scst_cm_on_add_acg(struct scst_acg *acg);
 void scst_cm_on_del_acg(struct scst_acg *acg);
 int scst_cm_on_add_lun(struct scst_acg_dev *acg_dev, uint64_t lun,
@@ -823,6 +893,88 @@ bool scst_is_relative_target_port_id_unique(uint16_t id,
 int scst_event_init(void);
 void scst_event_exit(void);
 
+int scst_mgmt_init(void);
+void scst_mgmt_exit(void);
+
+/* QoS levels, in order of checking */
+#define SCST_QOS_LEVEL_TGT_DEV	0
+#define SCST_QOS_LEVEL_SESS	1
+#define SCST_QOS_LEVEL_ACG	2
+#define SCST_QOS_LEVELS		3
+
+#define SCST_QOS_DEF_BURST_MS	100
+
+/* Number of scst_qos with any limit set */
+extern atomic_t scst_qos_active;
+
+void scst_qos_init(struct scst_qos *q);
+void scst_qos_exit(struct scst_qos *q);
+bool __scst_qos_throttle(struct scst_cmd *cmd);
+void scst_qos_abort_cmd(struct scst_cmd *cmd);
+ssize_t scst_qos_attr_show(struct scst_qos *q, const char *name, char *buf);
+ssize_t scst_qos_attr_store(struct scst_qos *q, const char *name,
+	const char *buf, size_t count);
+ssize_t scst_qos_stats_show(struct scst_qos *q, char *buf);
+void scst_qos_stats_reset(struct scst_qos *q);
+
+/*
+ * Returns true if cmd was parked, because it exceeds the QoS limits of its
+ * tgt_dev, session or ACG. Then it will be put back on its active cmd list
+ * later.
+ */
+static inline bool scst_qos_throttle(struct scst_cmd *cmd)
+{
+	if (likely(atomic_read(&scst_qos_active) == 0) ||
+	    (cmd->qos_level == SCST_QOS_LEVELS))
+		return false;
+	return __scst_qos_throttle(cmd);
+}
+
+/* Dispatch schedulers */
+#define SCST_DISPATCH_FIFO	0
+#define SCST_DISPATCH_DRR	1
+#define SCST_DISPATCH_LATENCY	2
+
+#define SCST_DISPATCH_DEF_DEPTH		64
+#define SCST_DISPATCH_DEF_LAT_TARGET_US	2000
+#define SCST_DISPATCH_DEF_WEIGHT	1
+#define SCST_DISPATCH_MAX_WEIGHT	100
+/* DRR quantum per unit of weight and min cost of a command, in bytes */
+#define SCST_DISPATCH_QUANTUM		(128 * 1024)
+#define SCST_DISPATCH_MIN_COST		4096
+
+void scst_dispatch_dev_init(struct scst_device *dev);
+void scst_dispatch_tgt_dev_init(struct scst_tgt_dev *tgt_dev);
+bool __scst_dispatch_check(struct scst_cmd *cmd);
+void __scst_dispatch_done(struct scst_cmd *cmd);
+void scst_dispatch_abort_cmd(struct scst_cmd *cmd);
+int scst_dispatch_set(struct scst_device *dev, int sched, int depth,
+	unsigned int lat_target_us);
+void scst_dispatch_set_weight(struct scst_tgt_dev *tgt_dev,
+	unsigned int weight);
+const char *scst_dispatch_sched_name(int sched);
+int scst_dispatch_sched_parse(const char *name);
+
+/*
+ * Returns true if cmd was queued by the dispatch scheduler of its dev. Then
+ * it will be put back on its active cmd list later. Must be called under
+ * dev_lock.
+ */
+static inline bool scst_dispatch_check(struct scst_cmd *cmd)
+{
+	if (likely(cmd->dev->dispatch_sched == SCST_DISPATCH_FIFO) ||
+	    cmd->dispatch_counted)
+		return false;
+	return __scst_dispatch_check(cmd);
+}
+
+/* Must be called under dev_lock */
+static inline void scst_dispatch_done(struct scst_cmd *cmd)
+{
+	if (unlikely(cmd->dispatch_counted))
+		__scst_dispatch_done(cmd);
+}
+
 int scst_event_queue_lun_not_found(const struct scst_cmd *cmd);
 int scst_event_queue_negative_luns_inquiry(const struct scst_tgt *tgt,
 	const char *initiator_name);
@@ -0,0 +1,364 @@
+/*
+ *  scst_qos.c
+ *
+ *  Per-ACG, per-session and per-tgt_dev IOPS and bandwidth limits.
+ *
+ *  Each limit is a token bucket, kept in the form of the earliest time the
+ *  next command fits in the limit. A command may run ahead of that time by
+ *  up to the burst time. Commands exceeding the limits are parked before
+ *  execution and put back on their active cmd list by a high resolution
+ *  timer, so no processing thread ever waits for them.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation, version 2
+ *  of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ */
+
+#include <linux/kernel.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#ifndef INSIDE_KERNEL_TREE
+#include <linux/version.h>
+#endif
+
+#ifdef INSIDE_KERNEL_TREE
+#include <scst/scst.h>
+#else
+#include "scst.h"
+#endif
+
+#include "scst_priv.h"
+
+atomic_t scst_qos_active = ATOMIC_INIT(0);
+
+static inline u64 scst_qos_now(void)
+{
+	return ktime_to_ns(ktime_get());
+}
+
+static struct scst_qos *scst_qos_of(struct scst_cmd *cmd, int level)
+{
+	switch (level) {
+	case SCST_QOS_LEVEL_TGT_DEV:
+		return cmd->tgt_dev ? &cmd->tgt_dev->tgt_dev_qos : NULL;
+	case SCST_QOS_LEVEL_SESS:
+		return &cmd->sess->sess_qos;
+	default:
+		return &cmd->sess->acg->acg_qos;
+	}
+}
+
+/*
+ * Charges cmd to the buckets of q, if it fits in the limits. Otherwise
+ * returns false and in *ready the time when it will fit.
+ *
+ * Must be called under qos_lock.
+ */
+static bool scst_qos_charge(struct scst_qos *q, struct scst_cmd *cmd,
+	u64 now, u64 *ready)
+{
+	u64 burst = (u64)q->qos_burst_ms * NSEC_PER_MSEC;
+	u64 tat = 0;
+
+	if (q->qos_iops_limit != 0)
+		tat = q->qos_iops_tat;
+	if (q->qos_mbps_limit != 0)
+		tat = max(tat, q->qos_bw_tat);
+
+	if (tat > now + burst) {
+		*ready = tat - burst;
+		return false;
+	}
+
+	if (q->qos_iops_limit != 0)
+		q->qos_iops_tat = max(q->qos_iops_tat, now) +
+			div_u64(NSEC_PER_SEC, q->qos_iops_limit);
+	if (q->qos_mbps_limit != 0) {
+		u64 bytes = cmd->bufflen + cmd->out_bufflen;
+
+		q->qos_bw_tat = max(q->qos_bw_tat, now) +
+			div64_u64(bytes * NSEC_PER_SEC,
+				  (u64)q->qos_mbps_limit << 20);
+	}
+
+	return true;
+}
+
+/*
+ * Moves to released all parked commands, which fit in the limits now or
+ * were aborted, and rearms the timer for the rest.
+ *
+ * Must be called under qos_lock.
+ */
+static void __scst_qos_release(struct scst_qos *q, struct list_head *released)
+{
+	struct scst_cmd *cmd, *t;
+	u64 now = scst_qos_now(), ready = 0;
+	bool blocked = false;
+
+	list_for_each_entry_safe(cmd, t, &q->qos_cmd_list, cmd_list_entry) {
+		if (!test_bit(SCST_CMD_ABORTED, &cmd->cmd_flags) &&
+		    q->qos_enabled) {
+			/* Keep the order of arrival */
+			if (blocked || !scst_qos_charge(q, cmd, now, &ready)) {
+				blocked = true;
+				continue;
+			}
+		}
+
+		TRACE_DBG("QoS: releasing cmd %p (level %d)", cmd,
+			cmd->qos_level);
+		list_move_tail(&cmd->cmd_list_entry, released);
+		cmd->qos_parked = false;
+		q->qos_parked_cnt--;
+		q->qos_throttled_ns += now - cmd->qos_park_time;
+	}
+
+	if (blocked)
+		hrtimer_start(&q->qos_timer, ns_to_ktime(ready),
+			      HRTIMER_MODE_ABS);
+}
+
+/* Puts released commands back on their active cmd lists */
+static void scst_qos_requeue(struct list_head *released)
+{
+	struct scst_cmd *cmd, *t;
+	unsigned long flags;
+
+	list_for_each_entry_safe(cmd, t, released, cmd_list_entry) {
+		struct scst_cmd_threads *cmd_threads = cmd->cmd_threads;
+
+		/* This level is passed */
+		cmd->qos_level++;
+
+		spin_lock_irqsave(&cmd_threads->cmd_list_lock, flags);
+		list_move_tail(&cmd->cmd_list_entry,
+			       &cmd_threads->active_cmd_list);
+		wake_up(&cmd_threads->cmd_list_waitQ);
+		spin_unlock_irqrestore(&cmd_threads->cmd_list_lock, flags);
+	}
+}
+
+static enum hrtimer_restart scst_qos_timer_fn(struct hrtimer *timer)
+{
+	struct scst_qos *q = container_of(timer, struct scst_qos, qos_timer);
+	LIST_HEAD(released);
+	unsigned long flags;
+
+	spin_lock_irqsave(&q->qos_lock, flags);
+	__scst_qos_release(q, &released);
+	spin_unlock_irqrestore(&q->qos_lock, flags);
+
+	scst_qos_requeue(&released);
+
+	return HRTIMER_NORESTART;
+}
+
+/* Returns true if cmd was parked in q */
+static bool scst_qos_park(struct scst_qos *q, struct scst_cmd *cmd)
+{
+	bool res = false;
+	unsigned long flags;
+	u64 now, ready;
+
+	spin_lock_irqsave(&q->qos_lock, flags);
+
+	if (!q->qos_enabled)
+		goto out_unlock;
+
+	now = scst_qos_now();
+
+	/* Don't overtake already parked commands */
+	if (list_empty(&q->qos_cmd_list)) {
+		if (scst_qos_charge(q, cmd, now, &ready))
+			goto out_unlock;
+		hrtimer_start(&q->qos_timer, ns_to_ktime(ready),
+			      HRTIMER_MODE_ABS);
+	}
+
+	TRACE_DBG("QoS: parking cmd %p (level %d)", cmd, cmd->qos_level);
+
+	cmd->qos_parked = true;
+	cmd->qos_park_time = now;
+	list_add_tail(&cmd->cmd_list_entry, &q->qos_cmd_list);
+	q->qos_parked_cnt++;
+	q->qos_throttled_cmds++;
+	res = true;
+
+out_unlock:
+	spin_unlock_irqrestore(&q->qos_lock, flags);
+	return res;
+}
+
+bool __scst_qos_throttle(struct scst_cmd *cmd)
+{
+	bool res = false;
+
+	if (unlikely(cmd->internal) ||
+	    test_bit(SCST_CMD_ABORTED, &cmd->cmd_flags)) {
+		cmd->qos_level = SCST_QOS_LEVELS;
+		goto out;
+	}
+
+	while (cmd->qos_level < SCST_QOS_LEVELS) {
+		struct scst_qos *q = scst_qos_of(cmd, cmd->qos_level);
+
+		if ((q != NULL) && READ_ONCE(q->qos_enabled) &&
+		    scst_qos_park(q, cmd)) {
+			res = true;
+			break;
+		}
+		cmd->qos_level++;
+	}
+
+out:
+	return res;
+}
+
+/* Releases cmd without waiting for the limits, if it is parked */
+void scst_qos_abort_cmd(struct scst_cmd *cmd)
+{
+	struct scst_qos *q = scst_qos_of(cmd, cmd->qos_level);
+	unsigned long flags;
+
+	if (q == NULL)
+		return;
+
+	spin_lock_irqsave(&q->qos_lock, flags);
+	if (cmd->qos_parked) {
+		TRACE_MGMT_DBG("QoS: releasing aborted cmd %p", cmd);
+		hrtimer_start(&q->qos_timer, ns_to_ktime(scst_qos_now()),
+			      HRTIMER_MODE_ABS);
+	}
+	spin_unlock_irqrestore(&q->qos_lock, flags);
+}
+
+void scst_qos_init(struct scst_qos *q)
+{
+	spin_lock_init(&q->qos_lock);
+	INIT_LIST_HEAD(&q->qos_cmd_list);
+	q->qos_burst_ms = SCST_QOS_DEF_BURST_MS;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+	hrtimer_setup(&q->qos_timer, scst_qos_timer_fn, CLOCK_MONOTONIC,
+		      HRTIMER_MODE_ABS);
+#else
+	hrtimer_init(&q->qos_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	q->qos_timer.function = scst_qos_timer_fn;
+#endif
+}
+
+/* All commands of q's owner must be finished at this point */
+void scst_qos_exit(struct scst_qos *q)
+{
+	hrtimer_cancel(&q->qos_timer);
+	WARN_ON_ONCE(!list_empty(&q->qos_cmd_list));
+	if (q->qos_enabled)
+		atomic_dec(&scst_qos_active);
+}
+
+static unsigned int *scst_qos_field(struct scst_qos *q, const char *name)
+{
+	if (strcmp(name, "qos_iops_limit") == 0)
+		return &q->qos_iops_limit;
+	else if (strcmp(name, "qos_mbps_limit") == 0)
+		return &q->qos_mbps_limit;
+	else if (strcmp(name, "qos_burst_ms") == 0)
+		return &q->qos_burst_ms;
+	sBUG();
+	return NULL;
+}
+
+ssize_t scst_qos_attr_show(struct scst_qos *q, const char *name, char *buf)
+{
+	unsigned int *field = scst_qos_field(q, name);
+	unsigned int v = READ_ONCE(*field);
+	bool def;
+
+	if (field == &q->qos_burst_ms)
+		def = (v == SCST_QOS_DEF_BURST_MS);
+	else
+		def = (v == 0);
+
+	return sprintf(buf, "%u\n%s", v, def ? "" : SCST_SYSFS_KEY_MARK "\n");
+}
+
+ssize_t scst_qos_attr_store(struct scst_qos *q, const char *name,
+	const char *buf, size_t count)
+{
+	unsigned int *field = scst_qos_field(q, name);
+	LIST_HEAD(released);
+	unsigned long flags;
+	unsigned int v;
+	bool enabled;
+	int res;
+
+	TRACE_ENTRY();
+
+	res = kstrtouint(buf, 0, &v);
+	if (res != 0) {
+		PRINT_ERROR("Invalid %s value: %s", name, buf);
+		goto out;
+	}
+
+	spin_lock_irqsave(&q->qos_lock, flags);
+
+	*field = v;
+	enabled = (q->qos_iops_limit != 0) || (q->qos_mbps_limit != 0);
+	if (enabled != q->qos_enabled) {
+		if (enabled)
+			atomic_inc(&scst_qos_active);
+		else
+			atomic_dec(&scst_qos_active);
+		WRITE_ONCE(q->qos_enabled, enabled);
+	}
+
+	/* Start from full buckets with the new limits */
+	q->qos_iops_tat = 0;
+	q->qos_bw_tat = 0;
+
+	__scst_qos_release(q, &released);
+
+	spin_unlock_irqrestore(&q->qos_lock, flags);
+
+	scst_qos_requeue(&released);
+
+	res = count;
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+ssize_t scst_qos_stats_show(struct scst_qos *q, char *buf)
+{
+	unsigned long flags;
+	uint64_t cmds, ns;
+	int parked;
+
+	spin_lock_irqsave(&q->qos_lock, flags);
+	cmds = q->qos_throttled_cmds;
+	ns = q->qos_throttled_ns;
+	parked = q->qos_parked_cnt;
+	spin_unlock_irqrestore(&q->qos_lock, flags);
+
+	return sprintf(buf, "throttled_cmds %llu\nthrottled_us %llu\n"
+		"parked %d\n", (unsigned long long)cmds,
+		(unsigned long long)div_u64(ns, NSEC_PER_USEC), parked);
+}
+
+void scst_qos_stats_reset(struct scst_qos *q)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&q->qos_lock, flags);
+	q->qos_throttled_cmds = 0;
+	q->qos_throttled_ns = 0;
+	spin_unlock_irqrestore(&q->qos_lock, flags);
+}
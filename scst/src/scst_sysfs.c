@@ -1907,6 +1907,66 @@ static struct kobj_attribute scst_tgt_black_hole =
 	__ATTR(black_hole, S_IRUGO | S_IWUSR,
 	       scst_tgt_black_hole_show, scst_tgt_black_hole_store);
 
+/*
+ * Defines QoS limits attributes qos_iops_limit, qos_mbps_limit, qos_burst_ms
+ * and statistics attribute qos_stats for objects, which struct scst_qos is
+ * returned by get_qos(kobj).
+ */
+#define SCST_QOS_SYSFS_ATTRS(prefix, get_qos)				\
+static ssize_t prefix##_qos_show(struct kobject *kobj,			\
+	struct kobj_attribute *attr, char *buf)				\
+{									\
+	return scst_qos_attr_show(get_qos(kobj), attr->attr.name, buf);	\
+}									\
+									\
+static ssize_t prefix##_qos_store(struct kobject *kobj,			\
+	struct kobj_attribute *attr, const char *buf, size_t count)	\
+{									\
+	return scst_qos_attr_store(get_qos(kobj), attr->attr.name, buf,	\
+				   count);				\
+}									\
+									\
+static ssize_t prefix##_qos_stats_show(struct kobject *kobj,		\
+	struct kobj_attribute *attr, char *buf)				\
+{									\
+	return scst_qos_stats_show(get_qos(kobj), buf);			\
+}									\
+									\
+static ssize_t prefix##_qos_stats_store(struct kobject *kobj,		\
+	struct kobj_attribute *attr, const char *buf, size_t count)	\
+{									\
+	scst_qos_stats_reset(get_qos(kobj));				\
+	return count;							\
+}									\
+									\
+static struct kobj_attribute prefix##_qos_iops_limit_attr =		\
+	__ATTR(qos_iops_limit, S_IRUGO | S_IWUSR, prefix##_qos_show,	\
+	       prefix##_qos_store);					\
+static struct kobj_attribute prefix##_qos_mbps_limit_attr =		\
+	__ATTR(qos_mbps_limit, S_IRUGO | S_IWUSR, prefix##_qos_show,	\
+	       prefix##_qos_store);					\
+static struct kobj_attribute prefix##_qos_burst_ms_attr =		\
+	__ATTR(qos_burst_ms, S_IRUGO | S_IWUSR, prefix##_qos_show,	\
+	       prefix##_qos_store);					\
+static struct kobj_attribute prefix##_qos_stats_attr =			\
+	__ATTR(qos_stats, S_IRUGO | S_IWUSR, prefix##_qos_stats_show,	\
+	       prefix##_qos_stats_store)
+
+#define SCST_QOS_SYSFS_ATTRS_LIST(prefix)				\
+	&prefix##_qos_iops_limit_attr.attr,				\
+	&prefix##_qos_mbps_limit_attr.attr,				\
+	&prefix##_qos_burst_ms_attr.attr,				\
+	&prefix##_qos_stats_attr.attr
+
+static struct scst_qos *scst_tgt_kobj_qos(struct kobject *kobj)
+{
+	struct scst_tgt *tgt = container_of(kobj, struct scst_tgt, tgt_kobj);
+
+	return &tgt->default_acg->acg_qos;
+}
+
+SCST_QOS_SYSFS_ATTRS(scst_tgt, scst_tgt_kobj_qos);
+
 static ssize_t __scst_acg_cpu_mask_show(struct scst_acg *acg, char *buf)
 {
 	int res;
@@ -1958,7 +2018,8 @@ static int __scst_acg_process_cpu_mask_store(struct scst_tgt *tgt,
 
 				if (tgt_dev->active_cmd_threads != &tgt_dev->tgt_dev_cmd_threads)
 					continue;
-				rc = scst_set_thr_cpu_mask(tgt_dev->active_cmd_threads, cpu_mask);
+				rc = scst_set_thr_cpu_mask(tgt_dev->active_cmd_threads,
+					scst_tgt_dev_cpu_mask(tgt_dev));
 				if (rc != 0)
 					PRINT_ERROR("Setting CPU affinity"
 						    " failed: %d", rc);
@@ -2801,6 +2862,109 @@ static struct kobj_attribute scst_tgt_dif_checks_failed_attr =
 		scst_tgt_dif_checks_failed_show,
 		scst_tgt_dif_checks_failed_store);
 
+static ssize_t scst_tgt_sess_reg_latency_show(struct kobject *kobj,
+			    struct kobj_attribute *attr, char *buf)
+{
+	static const char * const bucket_names[SCST_SESS_REG_LAT_BUCKETS] = {
+		"<= 100 us", "<= 1 ms", "<= 10 ms", "<= 100 ms", "<= 1 s",
+		"<= 10 s", "> 10 s",
+	};
+	int pos = 0, i;
+	struct scst_tgt *tgt;
+
+	tgt = container_of(kobj, struct scst_tgt, tgt_kobj);
+
+	for (i = 0; i < SCST_SESS_REG_LAT_BUCKETS; i++)
+		pos += scnprintf(&buf[pos], SCST_SYSFS_BLOCK_SIZE - pos,
+			"%s\t%d\n", bucket_names[i],
+			atomic_read(&tgt->sess_reg_lat[i]));
+	pos += scnprintf(&buf[pos], SCST_SYSFS_BLOCK_SIZE - pos,
+		"failed\t\t%d\n", atomic_read(&tgt->sess_reg_failed));
+
+	return pos;
+}
+
+static ssize_t scst_tgt_sess_reg_latency_store(struct kobject *kobj,
+	struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	struct scst_tgt *tgt;
+	int i;
+
+	tgt = container_of(kobj, struct scst_tgt, tgt_kobj);
+
+	PRINT_INFO("Zeroing session registration latency statistics for "
+		"target %s", tgt->tgt_name);
+
+	for (i = 0; i < SCST_SESS_REG_LAT_BUCKETS; i++)
+		atomic_set(&tgt->sess_reg_lat[i], 0);
+	atomic_set(&tgt->sess_reg_failed, 0);
+
+	return count;
+}
+
+static struct kobj_attribute scst_tgt_sess_reg_latency_attr =
+	__ATTR(sess_reg_latency, S_IRUGO | S_IWUSR,
+		scst_tgt_sess_reg_latency_show,
+		scst_tgt_sess_reg_latency_store);
+
+static ssize_t scst_tgt_numa_node_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	struct scst_tgt *tgt;
+	int res;
+
+	TRACE_ENTRY();
+
+	tgt = container_of(kobj, struct scst_tgt, tgt_kobj);
+
+	res = sprintf(buf, "%d\n%s", tgt->tgt_numa_node_id,
+		tgt->tgt_numa_node_user ? SCST_SYSFS_KEY_MARK "\n" : "");
+
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+static ssize_t scst_tgt_numa_node_store(struct kobject *kobj,
+	struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	struct scst_tgt *tgt;
+	int res, node;
+
+	TRACE_ENTRY();
+
+	tgt = container_of(kobj, struct scst_tgt, tgt_kobj);
+
+	res = kstrtoint(buf, 0, &node);
+	if (res != 0) {
+		PRINT_ERROR("kstrtoint() for %s failed: %d ", buf, res);
+		goto out;
+	}
+	if ((node != NUMA_NO_NODE) &&
+	    ((node < 0) || (node >= nr_node_ids) || !node_online(node))) {
+		PRINT_ERROR("Invalid NUMA node %d", node);
+		res = -EINVAL;
+		goto out;
+	}
+
+	mutex_lock(&scst_mutex);
+	tgt->tgt_numa_node_id = node;
+	tgt->tgt_numa_node_user = 1;
+	mutex_unlock(&scst_mutex);
+
+	PRINT_INFO("Set NUMA node of target %s to %d (applies to new "
+		"sessions)", tgt->tgt_name, node);
+
+	res = count;
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+static struct kobj_attribute scst_tgt_numa_node_attr =
+	__ATTR(numa_node, S_IRUGO | S_IWUSR, scst_tgt_numa_node_show,
+	       scst_tgt_numa_node_store);
+
 #define SCST_TGT_SYSFS_STAT_ATTR(member_name, attr, dir, result_op)	\
 static int scst_tgt_sysfs_##attr##_show_work_fn(			\
 				struct scst_sysfs_work_item *work)	\
@@ -2879,6 +3043,8 @@ static struct attribute *scst_tgt_attrs[] = {
 	&scst_tgt_io_grouping_type.attr,
 	&scst_tgt_black_hole.attr,
 	&scst_tgt_cpu_mask.attr,
+	&scst_tgt_numa_node_attr.attr,
+	SCST_QOS_SYSFS_ATTRS_LIST(scst_tgt),
 	&scst_tgt_unknown_cmd_count_attr.attr,
 	&scst_tgt_write_cmd_count_attr.attr,
 	&scst_tgt_write_io_count_kb_attr.attr,
@@ -2890,6 +3056,7 @@ static struct attribute *scst_tgt_attrs[] = {
 	&scst_tgt_bidi_io_count_kb_attr.attr,
 	&scst_tgt_bidi_unaligned_cmd_count_attr.attr,
 	&scst_tgt_none_cmd_count_attr.attr,
+	&scst_tgt_sess_reg_latency_attr.attr,
 	NULL,
 };
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 2, 0)
@@ -3598,6 +3765,209 @@ static struct kobj_attribute dev_numa_node_id_attr =
 	__ATTR(numa_node_id, S_IRUGO | S_IWUSR, scst_dev_numa_node_id_show,
 		scst_dev_numa_node_id_store);
 
+static ssize_t scst_dev_dispatch_sched_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	struct scst_device *dev;
+	int sched;
+
+	dev = container_of(kobj, struct scst_device, dev_kobj);
+
+	sched = READ_ONCE(dev->dispatch_sched);
+
+	return sprintf(buf, "%s\n%s", scst_dispatch_sched_name(sched),
+		(sched != SCST_DISPATCH_FIFO) ? SCST_SYSFS_KEY_MARK "\n" : "");
+}
+
+static ssize_t scst_dev_dispatch_sched_store(struct kobject *kobj,
+	struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	int res;
+	struct scst_device *dev;
+
+	TRACE_ENTRY();
+
+	dev = container_of(kobj, struct scst_device, dev_kobj);
+
+	res = scst_dispatch_sched_parse(buf);
+	if (res < 0) {
+		PRINT_ERROR("Unknown dispatch scheduler %.*s", (int)count, buf);
+		goto out;
+	}
+
+	PRINT_INFO("Setting dispatch scheduler %s for device %s",
+		scst_dispatch_sched_name(res), dev->virt_name);
+
+	res = scst_dispatch_set(dev, res, -1, 0);
+	if (res == 0)
+		res = count;
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+static struct kobj_attribute dev_dispatch_sched_attr =
+	__ATTR(dispatch_sched, S_IRUGO | S_IWUSR, scst_dev_dispatch_sched_show,
+		scst_dev_dispatch_sched_store);
+
+static ssize_t scst_dev_dispatch_depth_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	struct scst_device *dev;
+	int depth;
+
+	dev = container_of(kobj, struct scst_device, dev_kobj);
+
+	depth = READ_ONCE(dev->dispatch_depth);
+
+	return sprintf(buf, "%d\n%s", depth,
+		(depth != SCST_DISPATCH_DEF_DEPTH) ? SCST_SYSFS_KEY_MARK "\n" : "");
+}
+
+static ssize_t scst_dev_dispatch_depth_store(struct kobject *kobj,
+	struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	int res;
+	struct scst_device *dev;
+	unsigned int depth;
+
+	TRACE_ENTRY();
+
+	dev = container_of(kobj, struct scst_device, dev_kobj);
+
+	res = kstrtouint(buf, 0, &depth);
+	if (res != 0) {
+		PRINT_ERROR("kstrtouint() for %s failed: %d ", buf, res);
+		goto out;
+	}
+	if ((depth == 0) || (depth > INT_MAX)) {
+		PRINT_ERROR("Illegal dispatch depth %u", depth);
+		res = -EINVAL;
+		goto out;
+	}
+
+	res = scst_dispatch_set(dev, READ_ONCE(dev->dispatch_sched), depth, 0);
+	if (res == 0)
+		res = count;
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+static struct kobj_attribute dev_dispatch_depth_attr =
+	__ATTR(dispatch_depth, S_IRUGO | S_IWUSR, scst_dev_dispatch_depth_show,
+		scst_dev_dispatch_depth_store);
+
+static ssize_t scst_dev_dispatch_latency_target_us_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	struct scst_device *dev;
+	unsigned int target;
+
+	dev = container_of(kobj, struct scst_device, dev_kobj);
+
+	target = READ_ONCE(dev->dispatch_lat_target_us);
+
+	return sprintf(buf, "%u\n%s", target,
+		(target != SCST_DISPATCH_DEF_LAT_TARGET_US) ?
+			SCST_SYSFS_KEY_MARK "\n" : "");
+}
+
+static ssize_t scst_dev_dispatch_latency_target_us_store(struct kobject *kobj,
+	struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	int res;
+	struct scst_device *dev;
+	unsigned int target;
+
+	TRACE_ENTRY();
+
+	dev = container_of(kobj, struct scst_device, dev_kobj);
+
+	res = kstrtouint(buf, 0, &target);
+	if (res != 0) {
+		PRINT_ERROR("kstrtouint() for %s failed: %d ", buf, res);
+		goto out;
+	}
+	if (target == 0) {
+		PRINT_ERROR("Illegal dispatch latency target %u", target);
+		res = -EINVAL;
+		goto out;
+	}
+
+	res = scst_dispatch_set(dev, READ_ONCE(dev->dispatch_sched), -1,
+		target);
+	if (res == 0)
+		res = count;
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+static struct kobj_attribute dev_dispatch_latency_target_us_attr =
+	__ATTR(dispatch_latency_target_us, S_IRUGO | S_IWUSR,
+		scst_dev_dispatch_latency_target_us_show,
+		scst_dev_dispatch_latency_target_us_store);
+
+static ssize_t scst_dev_dispatch_stats_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	struct scst_device *dev;
+	int pos;
+
+	dev = container_of(kobj, struct scst_device, dev_kobj);
+
+	spin_lock_bh(&dev->dev_lock);
+	pos = sprintf(buf, "in_flight %d\nqueued %d\ncur_depth %d\n"
+		"latency_avg_us %u\n", dev->dispatch_in_flight,
+		dev->dispatch_queued_cnt, dev->dispatch_cur_depth,
+		dev->dispatch_lat_avg_us);
+	spin_unlock_bh(&dev->dev_lock);
+
+	return pos;
+}
+
+static struct kobj_attribute dev_dispatch_stats_attr =
+	__ATTR(dispatch_stats, S_IRUGO, scst_dev_dispatch_stats_show, NULL);
+
+static ssize_t scst_dev_sn_defer_stats_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	struct scst_device *dev;
+	struct scst_tgt_dev *tgt_dev;
+	const struct scst_order_data *order_data;
+	u64 cmds, defer_ns, max_ns;
+
+	dev = container_of(kobj, struct scst_device, dev_kobj);
+
+	/* Statistics, so read without sn_lock */
+	spin_lock_bh(&dev->dev_lock);
+	order_data = &dev->dev_order_data;
+	cmds = order_data->sn_deferred_cmds;
+	defer_ns = order_data->sn_defer_ns;
+	max_ns = order_data->sn_defer_max_ns;
+	list_for_each_entry(tgt_dev, &dev->dev_tgt_dev_list,
+			    dev_tgt_dev_list_entry) {
+		order_data = &tgt_dev->tgt_dev_order_data;
+		cmds += order_data->sn_deferred_cmds;
+		defer_ns += order_data->sn_defer_ns;
+		max_ns = max(max_ns, order_data->sn_defer_max_ns);
+	}
+	spin_unlock_bh(&dev->dev_lock);
+
+	return sprintf(buf, "deferred_cmds %llu\ndefer_avg_us %llu\n"
+		"defer_max_us %llu\n", (unsigned long long)cmds,
+		(unsigned long long)(cmds ?
+			div64_u64(defer_ns, cmds * NSEC_PER_USEC) : 0),
+		(unsigned long long)div_u64(max_ns, NSEC_PER_USEC));
+}
+
+static struct kobj_attribute dev_sn_defer_stats_attr =
+	__ATTR(sn_defer_stats, S_IRUGO, scst_dev_sn_defer_stats_show, NULL);
+
 static ssize_t scst_dev_block_show(struct kobject *kobj,
 	struct kobj_attribute *attr, char *buf)
 {
@@ -3731,6 +4101,11 @@ static struct attribute *scst_dev_attrs[] = {
 	&dev_max_tgt_dev_commands_attr.attr,
 	&dev_numa_node_id_attr.attr,
 	&dev_block_attr.attr,
+	&dev_dispatch_sched_attr.attr,
+	&dev_dispatch_depth_attr.attr,
+	&dev_dispatch_latency_target_us_attr.attr,
+	&dev_dispatch_stats_attr.attr,
+	&dev_sn_defer_stats_attr.attr,
 	NULL,
 };
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 2, 0)
@@ -4221,15 +4596,176 @@ static ssize_t scst_tgt_dev_dif_checks_failed_store(struct kobject *kobj,
 	return count;
 }
 
-static struct kobj_attribute tgt_dev_dif_checks_failed_attr =
-	__ATTR(dif_checks_failed, S_IRUGO | S_IWUSR,
-		scst_tgt_dev_dif_checks_failed_show,
-		scst_tgt_dev_dif_checks_failed_store);
+static struct kobj_attribute tgt_dev_dif_checks_failed_attr =
+	__ATTR(dif_checks_failed, S_IRUGO | S_IWUSR,
+		scst_tgt_dev_dif_checks_failed_show,
+		scst_tgt_dev_dif_checks_failed_store);
+
+static ssize_t scst_tgt_dev_dispatch_weight_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	struct scst_tgt_dev *tgt_dev;
+
+	tgt_dev = container_of(kobj, struct scst_tgt_dev, tgt_dev_kobj);
+
+	/* Not a key: the weight is lost together with the session */
+	return sprintf(buf, "%u\n", READ_ONCE(tgt_dev->dispatch_weight));
+}
+
+static ssize_t scst_tgt_dev_dispatch_weight_store(struct kobject *kobj,
+	struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	int res;
+	struct scst_tgt_dev *tgt_dev;
+	unsigned int weight;
+
+	TRACE_ENTRY();
+
+	tgt_dev = container_of(kobj, struct scst_tgt_dev, tgt_dev_kobj);
+
+	res = kstrtouint(buf, 0, &weight);
+	if (res != 0) {
+		PRINT_ERROR("kstrtouint() for %s failed: %d ", buf, res);
+		goto out;
+	}
+	if ((weight == 0) || (weight > SCST_DISPATCH_MAX_WEIGHT)) {
+		PRINT_ERROR("Illegal dispatch weight %u (allowed 1-%d)",
+			weight, SCST_DISPATCH_MAX_WEIGHT);
+		res = -EINVAL;
+		goto out;
+	}
+
+	scst_dispatch_set_weight(tgt_dev, weight);
+
+	res = count;
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+static struct kobj_attribute tgt_dev_dispatch_weight_attr =
+	__ATTR(dispatch_weight, S_IRUGO | S_IWUSR,
+		scst_tgt_dev_dispatch_weight_show,
+		scst_tgt_dev_dispatch_weight_store);
+
+static ssize_t scst_dispatch_wait_show(char *buf, u64 cmds, u64 wait_ns,
+	u64 max_ns)
+{
+	return sprintf(buf, "waited_cmds %llu\nwait_avg_us %llu\n"
+		"wait_max_us %llu\n", (unsigned long long)cmds,
+		(unsigned long long)(cmds ?
+			div64_u64(wait_ns, cmds * NSEC_PER_USEC) : 0),
+		(unsigned long long)div_u64(max_ns, NSEC_PER_USEC));
+}
+
+static ssize_t scst_tgt_dev_dispatch_wait_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	struct scst_tgt_dev *tgt_dev;
+	struct scst_device *dev;
+	u64 cmds, wait_ns, max_ns;
+
+	tgt_dev = container_of(kobj, struct scst_tgt_dev, tgt_dev_kobj);
+	dev = tgt_dev->dev;
+
+	spin_lock_bh(&dev->dev_lock);
+	cmds = tgt_dev->dispatch_waited_cmds;
+	wait_ns = tgt_dev->dispatch_wait_ns;
+	max_ns = tgt_dev->dispatch_wait_max_ns;
+	spin_unlock_bh(&dev->dev_lock);
+
+	return scst_dispatch_wait_show(buf, cmds, wait_ns, max_ns);
+}
+
+static void scst_tgt_dev_dispatch_wait_reset(struct scst_tgt_dev *tgt_dev)
+{
+	struct scst_device *dev = tgt_dev->dev;
+
+	spin_lock_bh(&dev->dev_lock);
+	tgt_dev->dispatch_waited_cmds = 0;
+	tgt_dev->dispatch_wait_ns = 0;
+	tgt_dev->dispatch_wait_max_ns = 0;
+	spin_unlock_bh(&dev->dev_lock);
+}
+
+static ssize_t scst_tgt_dev_dispatch_wait_store(struct kobject *kobj,
+	struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	struct scst_tgt_dev *tgt_dev;
+
+	tgt_dev = container_of(kobj, struct scst_tgt_dev, tgt_dev_kobj);
+
+	scst_tgt_dev_dispatch_wait_reset(tgt_dev);
+
+	return count;
+}
+
+static struct kobj_attribute tgt_dev_dispatch_wait_attr =
+	__ATTR(dispatch_wait, S_IRUGO | S_IWUSR,
+		scst_tgt_dev_dispatch_wait_show,
+		scst_tgt_dev_dispatch_wait_store);
+
+static ssize_t scst_numa_stats_show(char *buf, int node, int local,
+	int remote)
+{
+	return sprintf(buf, "node %d\nlocal_cmds %d\nremote_cmds %d\n",
+		node, local, remote);
+}
+
+static ssize_t scst_tgt_dev_numa_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	struct scst_tgt_dev *tgt_dev;
+
+	tgt_dev = container_of(kobj, struct scst_tgt_dev, tgt_dev_kobj);
+
+	return scst_numa_stats_show(buf, tgt_dev->tgt_dev_numa_node_id,
+		atomic_read(&tgt_dev->tgt_dev_numa_local_cmds),
+		atomic_read(&tgt_dev->tgt_dev_numa_remote_cmds));
+}
+
+static void scst_tgt_dev_numa_reset(struct scst_tgt_dev *tgt_dev)
+{
+	atomic_set(&tgt_dev->tgt_dev_numa_local_cmds, 0);
+	atomic_set(&tgt_dev->tgt_dev_numa_remote_cmds, 0);
+}
+
+static ssize_t scst_tgt_dev_numa_store(struct kobject *kobj,
+	struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	struct scst_tgt_dev *tgt_dev;
+
+	tgt_dev = container_of(kobj, struct scst_tgt_dev, tgt_dev_kobj);
+
+	scst_tgt_dev_numa_reset(tgt_dev);
+
+	return count;
+}
+
+static struct kobj_attribute tgt_dev_numa_attr =
+	__ATTR(numa, S_IRUGO | S_IWUSR, scst_tgt_dev_numa_show,
+		scst_tgt_dev_numa_store);
+
+static struct scst_qos *scst_tgt_dev_kobj_qos(struct kobject *kobj)
+{
+	struct scst_tgt_dev *tgt_dev;
+
+	tgt_dev = container_of(kobj, struct scst_tgt_dev, tgt_dev_kobj);
+
+	return &tgt_dev->tgt_dev_qos;
+}
+
+SCST_QOS_SYSFS_ATTRS(tgt_dev, scst_tgt_dev_kobj_qos);
 
 static struct attribute *scst_tgt_dev_attrs[] = {
 	&tgt_dev_thread_idx_attr.attr,
 	&tgt_dev_thread_pid_attr.attr,
 	&tgt_dev_active_commands_attr.attr,
+	&tgt_dev_dispatch_weight_attr.attr,
+	&tgt_dev_dispatch_wait_attr.attr,
+	&tgt_dev_numa_attr.attr,
+	SCST_QOS_SYSFS_ATTRS_LIST(tgt_dev),
 	NULL,
 };
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 2, 0)
@@ -4793,6 +5329,126 @@ static struct kobj_attribute session_force_close_attr =
 	__ATTR(force_close, S_IWUSR, NULL, scst_sess_force_close_store);
 
 
+static ssize_t scst_sess_sysfs_dispatch_wait_show(struct kobject *kobj,
+			    struct kobj_attribute *attr, char *buf)
+{
+	struct scst_session *sess;
+	u64 cmds = 0, wait_ns = 0, max_ns = 0;
+	int t;
+
+	sess = container_of(kobj, struct scst_session, sess_kobj);
+
+	rcu_read_lock();
+	for (t = SESS_TGT_DEV_LIST_HASH_SIZE-1; t >= 0; t--) {
+		struct list_head *head = &sess->sess_tgt_dev_list[t];
+		struct scst_tgt_dev *tgt_dev;
+
+		list_for_each_entry_rcu(tgt_dev, head,
+					sess_tgt_dev_list_entry) {
+			struct scst_device *dev = tgt_dev->dev;
+
+			spin_lock_bh(&dev->dev_lock);
+			cmds += tgt_dev->dispatch_waited_cmds;
+			wait_ns += tgt_dev->dispatch_wait_ns;
+			max_ns = max(max_ns, tgt_dev->dispatch_wait_max_ns);
+			spin_unlock_bh(&dev->dev_lock);
+		}
+	}
+	rcu_read_unlock();
+
+	return scst_dispatch_wait_show(buf, cmds, wait_ns, max_ns);
+}
+
+static ssize_t scst_sess_sysfs_dispatch_wait_store(struct kobject *kobj,
+	struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	struct scst_session *sess;
+	int t;
+
+	sess = container_of(kobj, struct scst_session, sess_kobj);
+
+	rcu_read_lock();
+	for (t = SESS_TGT_DEV_LIST_HASH_SIZE-1; t >= 0; t--) {
+		struct list_head *head = &sess->sess_tgt_dev_list[t];
+		struct scst_tgt_dev *tgt_dev;
+
+		list_for_each_entry_rcu(tgt_dev, head,
+					sess_tgt_dev_list_entry)
+			scst_tgt_dev_dispatch_wait_reset(tgt_dev);
+	}
+	rcu_read_unlock();
+
+	return count;
+}
+
+static struct kobj_attribute session_dispatch_wait_attr =
+	__ATTR(dispatch_wait, S_IRUGO | S_IWUSR,
+		scst_sess_sysfs_dispatch_wait_show,
+		scst_sess_sysfs_dispatch_wait_store);
+
+static ssize_t scst_sess_sysfs_numa_show(struct kobject *kobj,
+			    struct kobj_attribute *attr, char *buf)
+{
+	struct scst_session *sess;
+	int local = 0, remote = 0;
+	int t;
+
+	sess = container_of(kobj, struct scst_session, sess_kobj);
+
+	rcu_read_lock();
+	for (t = SESS_TGT_DEV_LIST_HASH_SIZE-1; t >= 0; t--) {
+		struct list_head *head = &sess->sess_tgt_dev_list[t];
+		struct scst_tgt_dev *tgt_dev;
+
+		list_for_each_entry_rcu(tgt_dev, head,
+					sess_tgt_dev_list_entry) {
+			local += atomic_read(&tgt_dev->tgt_dev_numa_local_cmds);
+			remote += atomic_read(&tgt_dev->tgt_dev_numa_remote_cmds);
+		}
+	}
+	rcu_read_unlock();
+
+	return scst_numa_stats_show(buf, sess->tgt->tgt_numa_node_id, local,
+		remote);
+}
+
+static ssize_t scst_sess_sysfs_numa_store(struct kobject *kobj,
+	struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	struct scst_session *sess;
+	int t;
+
+	sess = container_of(kobj, struct scst_session, sess_kobj);
+
+	rcu_read_lock();
+	for (t = SESS_TGT_DEV_LIST_HASH_SIZE-1; t >= 0; t--) {
+		struct list_head *head = &sess->sess_tgt_dev_list[t];
+		struct scst_tgt_dev *tgt_dev;
+
+		list_for_each_entry_rcu(tgt_dev, head,
+					sess_tgt_dev_list_entry)
+			scst_tgt_dev_numa_reset(tgt_dev);
+	}
+	rcu_read_unlock();
+
+	return count;
+}
+
+static struct kobj_attribute session_numa_attr =
+	__ATTR(numa, S_IRUGO | S_IWUSR, scst_sess_sysfs_numa_show,
+		scst_sess_sysfs_numa_store);
+
+static struct scst_qos *scst_sess_kobj_qos(struct kobject *kobj)
+{
+	struct scst_session *sess;
+
+	sess = container_of(kobj, struct scst_session, sess_kobj);
+
+	return &sess->sess_qos;
+}
+
+SCST_QOS_SYSFS_ATTRS(session, scst_sess_kobj_qos);
+
 static struct attribute *scst_session_attrs[] = {
 	&session_commands_attr.attr,
 	&session_active_commands_attr.attr,
@@ -4808,6 +5464,9 @@ static struct attribute *scst_session_attrs[] = {
 	&session_bidi_io_count_kb_attr.attr,
 	&session_bidi_unaligned_cmd_count_attr.attr,
 	&session_none_cmd_count_attr.attr,
+	&session_dispatch_wait_attr.attr,
+	&session_numa_attr.attr,
+	SCST_QOS_SYSFS_ATTRS_LIST(session),
 	NULL,
 };
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 2, 0)
@@ -5474,6 +6133,20 @@ static struct kobj_attribute scst_acg_black_hole =
 	__ATTR(black_hole, S_IRUGO | S_IWUSR,
 	       scst_acg_black_hole_show, scst_acg_black_hole_store);
 
+static struct scst_qos *scst_acg_kobj_qos(struct kobject *kobj)
+{
+	struct scst_acg *acg = container_of(kobj, struct scst_acg, acg_kobj);
+
+	return &acg->acg_qos;
+}
+
+SCST_QOS_SYSFS_ATTRS(scst_acg, scst_acg_kobj_qos);
+
+static const struct attribute *scst_acg_qos_attrs[] = {
+	SCST_QOS_SYSFS_ATTRS_LIST(scst_acg),
+	NULL,
+};
+
 static ssize_t scst_acg_cpu_mask_show(struct kobject *kobj,
 	struct kobj_attribute *attr, char *buf)
 {
@@ -5611,6 +6284,13 @@ int scst_acg_sysfs_create(struct scst_tgt *tgt,
 		goto out_del;
 	}
 
+	res = sysfs_create_files(&acg->acg_kobj, scst_acg_qos_attrs);
+	if (res != 0) {
+		PRINT_ERROR("Can't add QoS attributes for acg %s",
+			acg->acg_name);
+		goto out_del;
+	}
+
 	if (acg->tgt->tgtt->acg_attrs) {
 		res = sysfs_create_files(&acg->acg_kobj,
 					 acg->tgt->tgtt->acg_attrs);
@@ -6940,8 +7620,18 @@ static struct kobj_attribute scst_device_groups_mgmt =
 	__ATTR(mgmt, S_IRUGO | S_IWUSR, scst_device_groups_mgmt_show,
 	       scst_device_groups_mgmt_store);
 
+static ssize_t scst_device_groups_transitions_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	return scst_alua_transitions_show(buf);
+}
+
+static struct kobj_attribute scst_device_groups_transitions =
+	__ATTR(transitions, S_IRUGO, scst_device_groups_transitions_show, NULL);
+
 static const struct attribute *scst_device_groups_attrs[] = {
 	&scst_device_groups_mgmt.attr,
+	&scst_device_groups_transitions.attr,
 	NULL,
 };
 
@@ -7056,12 +7746,14 @@ static struct kobj_attribute scst_measure_latency_attr =
 static ssize_t scst_threads_show(struct kobject *kobj,
 	struct kobj_attribute *attr, char *buf)
 {
-	int count;
+	int count, nr;
 
 	TRACE_ENTRY();
 
-	count = sprintf(buf, "%d\n%s", scst_main_cmd_threads.nr_threads,
-		(scst_main_cmd_threads.nr_threads != scst_threads) ?
+	/* Elastic threads are not a part of the configuration */
+	nr = scst_main_cmd_threads.nr_threads -
+		scst_main_cmd_threads.nr_elastic_threads;
+	count = sprintf(buf, "%d\n%s", nr, (nr != scst_threads) ?
 			SCST_SYSFS_KEY_MARK "\n" : "");
 
 	TRACE_EXIT();
@@ -7091,7 +7783,8 @@ static int scst_process_threads_store(int newtn)
 	if (res != 0)
 		goto out_resume;
 
-	oldtn = scst_main_cmd_threads.nr_threads;
+	oldtn = scst_main_cmd_threads.nr_threads -
+		scst_main_cmd_threads.nr_elastic_threads;
 
 	delta = newtn - oldtn;
 	if (delta < 0)
@@ -7159,6 +7852,70 @@ static struct kobj_attribute scst_threads_attr =
 	__ATTR(threads, S_IRUGO | S_IWUSR, scst_threads_show,
 	       scst_threads_store);
 
+static ssize_t scst_elastic_threads_max_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	int count;
+
+	TRACE_ENTRY();
+
+	count = sprintf(buf, "%u\n%s", scst_elastic_threads_max,
+		(scst_elastic_threads_max != 0) ? SCST_SYSFS_KEY_MARK "\n" : "");
+
+	TRACE_EXIT();
+	return count;
+}
+
+static ssize_t scst_elastic_threads_max_store(struct kobject *kobj,
+	struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	int res;
+	unsigned int val;
+
+	TRACE_ENTRY();
+
+	res = kstrtouint(buf, 0, &val);
+	if (res != 0) {
+		PRINT_ERROR("kstrtouint() for %s failed: %d ", buf, res);
+		goto out;
+	}
+
+	WRITE_ONCE(scst_elastic_threads_max, val);
+	PRINT_INFO("Changed elastic_threads_max to %u", val);
+
+	/* Lowering the limit is done by the already running manager */
+	scst_elastic_threads_start();
+
+	res = count;
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+static struct kobj_attribute scst_elastic_threads_max_attr =
+	__ATTR(elastic_threads_max, S_IRUGO | S_IWUSR,
+	       scst_elastic_threads_max_show, scst_elastic_threads_max_store);
+
+static ssize_t scst_elastic_threads_show_attr(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	return scst_elastic_threads_show(buf);
+}
+
+static struct kobj_attribute scst_elastic_threads_attr =
+	__ATTR(elastic_threads, S_IRUGO, scst_elastic_threads_show_attr, NULL);
+
+static ssize_t scst_elastic_threads_log_show_attr(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	return scst_elastic_threads_log_show(buf);
+}
+
+static struct kobj_attribute scst_elastic_threads_log_attr =
+	__ATTR(elastic_threads_log, S_IRUGO,
+	       scst_elastic_threads_log_show_attr, NULL);
+
 static ssize_t scst_setup_id_show(struct kobject *kobj,
 				  struct kobj_attribute *attr, char *buf)
 {
@@ -7596,6 +8353,9 @@ static struct kobj_attribute scst_last_sysfs_mgmt_res_attr =
 static struct attribute *scst_sysfs_root_def_attrs[] = {
 	&scst_measure_latency_attr.attr,
 	&scst_threads_attr.attr,
+	&scst_elastic_threads_max_attr.attr,
+	&scst_elastic_threads_attr.attr,
+	&scst_elastic_threads_log_attr.attr,
 	&scst_setup_id_attr.attr,
 	&scst_max_tasklet_cmd_attr.attr,
 	&scst_poll_us_attr.attr,
@@ -7629,6 +8389,234 @@ static struct kobj_type scst_sysfs_root_ktype = {
 #endif
 };
 
+/*
+ ** Bulk management
+ **/
+
+/* scst_mutex supposed to be locked */
+static struct scst_tgt_template *scst_mgmt_find_tgtt(const char *name)
+{
+	struct scst_tgt_template *tgtt;
+
+	list_for_each_entry(tgtt, &scst_template_list,
+			    scst_template_list_entry) {
+		if (strcmp(tgtt->name, name) == 0)
+			return tgtt;
+	}
+
+	return NULL;
+}
+
+/* scst_mutex supposed to be locked */
+static struct scst_tgt *scst_mgmt_find_tgt(const char *tgtt_name,
+	const char *tgt_name)
+{
+	struct scst_tgt_template *tgtt;
+	struct scst_tgt *tgt;
+
+	tgtt = scst_mgmt_find_tgtt(tgtt_name);
+	if (tgtt == NULL)
+		return NULL;
+
+	list_for_each_entry(tgt, &tgtt->tgt_list, tgt_list_entry) {
+		if (strcmp(tgt->tgt_name, tgt_name) == 0)
+			return tgt;
+	}
+
+	return NULL;
+}
+
+/* scst_mutex supposed to be locked */
+static struct scst_dev_type *scst_mgmt_find_devt(const char *name,
+	struct list_head *list)
+{
+	struct scst_dev_type *devt;
+
+	list_for_each_entry(devt, list, dev_type_list_entry) {
+		if (strcmp(devt->name, name) == 0)
+			return devt;
+	}
+
+	return NULL;
+}
+
+/*
+ * scst_sysfs_mgmt_apply() - processes a management command without sysfs
+ * @path: path of the management attribute, either absolute or relative to
+ *	  /sys/kernel/scst_tgt. Modified by this function.
+ * @cmd:  command as it would be written into that attribute
+ *
+ * Processes @cmd synchronously in the context of the caller, so no sysfs
+ * work is queued and -EAGAIN is never returned. Supported attributes:
+ *
+ *   handlers/<handler>/mgmt
+ *   targets/<driver>/mgmt
+ *   targets/<driver>/<target>/enabled
+ *   targets/<driver>/<target>/luns/mgmt
+ *   targets/<driver>/<target>/ini_groups/mgmt
+ *   targets/<driver>/<target>/ini_groups/<group>/luns/mgmt
+ *   targets/<driver>/<target>/ini_groups/<group>/initiators/mgmt
+ */
+int scst_sysfs_mgmt_apply(char *path, char *cmd)
+{
+	int res, n = 0;
+	char *c[7], *p;
+	struct scst_tgt_template *tgtt = NULL;
+	struct scst_tgt *tgt = NULL;
+	struct scst_acg *acg = NULL;
+	struct scst_dev_type *devt = NULL;
+	enum {
+		SCST_MGMT_DEVT,
+		SCST_MGMT_DEVT_PASS_THROUGH,
+		SCST_MGMT_TGTT,
+		SCST_MGMT_TGT_ENABLE,
+		SCST_MGMT_LUNS,
+		SCST_MGMT_INI_GROUPS,
+		SCST_MGMT_INITIATORS,
+	} action;
+
+	TRACE_ENTRY();
+
+	TRACE_DBG("path %s, cmd %s", path, cmd);
+
+	if (strncmp(path, "/sys/kernel/scst_tgt/", 21) == 0)
+		path += 21;
+
+	while ((p = strsep(&path, "/")) != NULL) {
+		if (*p == '\0')
+			continue;
+		if (n == ARRAY_SIZE(c))
+			goto out_bad_path;
+		c[n++] = p;
+	}
+
+	if (n == 3 && strcmp(c[0], "handlers") == 0 &&
+	    strcmp(c[2], "mgmt") == 0) {
+		action = SCST_MGMT_DEVT;
+	} else if (n < 3 || strcmp(c[0], "targets") != 0) {
+		goto out_bad_path;
+	} else if (n == 3 && strcmp(c[2], "mgmt") == 0) {
+		action = SCST_MGMT_TGTT;
+	} else if (n == 4 && strcmp(c[3], "enabled") == 0) {
+		action = SCST_MGMT_TGT_ENABLE;
+	} else if (n == 5 && strcmp(c[3], "luns") == 0 &&
+		   strcmp(c[4], "mgmt") == 0) {
+		action = SCST_MGMT_LUNS;
+	} else if (n == 5 && strcmp(c[3], "ini_groups") == 0 &&
+		   strcmp(c[4], "mgmt") == 0) {
+		action = SCST_MGMT_INI_GROUPS;
+	} else if (n == 7 && strcmp(c[3], "ini_groups") == 0 &&
+		   strcmp(c[5], "luns") == 0 && strcmp(c[6], "mgmt") == 0) {
+		action = SCST_MGMT_LUNS;
+	} else if (n == 7 && strcmp(c[3], "ini_groups") == 0 &&
+		   strcmp(c[5], "initiators") == 0 &&
+		   strcmp(c[6], "mgmt") == 0) {
+		action = SCST_MGMT_INITIATORS;
+	} else {
+		goto out_bad_path;
+	}
+
+	res = mutex_lock_interruptible(&scst_mutex);
+	if (res != 0)
+		goto out;
+
+	/*
+	 * Nothing found here is referenced. Same as for the sysfs works, the
+	 * processing functions below recheck the pointers under scst_mutex.
+	 */
+	switch (action) {
+	case SCST_MGMT_DEVT:
+		devt = scst_mgmt_find_devt(c[1], &scst_virtual_dev_type_list);
+		if (devt == NULL) {
+			devt = scst_mgmt_find_devt(c[1], &scst_dev_type_list);
+			action = SCST_MGMT_DEVT_PASS_THROUGH;
+		}
+		if (devt == NULL) {
+			PRINT_ERROR("Handler %s not found", c[1]);
+			res = -ENOENT;
+			goto out_unlock;
+		}
+		break;
+	case SCST_MGMT_TGTT:
+		tgtt = scst_mgmt_find_tgtt(c[1]);
+		if (tgtt == NULL) {
+			PRINT_ERROR("Target driver %s not found", c[1]);
+			res = -ENOENT;
+			goto out_unlock;
+		}
+		break;
+	default:
+		tgt = scst_mgmt_find_tgt(c[1], c[2]);
+		if (tgt == NULL) {
+			PRINT_ERROR("Target %s/%s not found", c[1], c[2]);
+			res = -ENOENT;
+			goto out_unlock;
+		}
+		acg = tgt->default_acg;
+		if (n == 7) {
+			acg = scst_tgt_find_acg(tgt, c[4]);
+			if (acg == NULL) {
+				PRINT_ERROR("Group %s not found in target %s",
+					c[4], tgt->tgt_name);
+				res = -ENOENT;
+				goto out_unlock;
+			}
+		}
+		/* Dropped by scst_process_tgt_enable_store() */
+		if (action == SCST_MGMT_TGT_ENABLE)
+			kobject_get(&tgt->tgt_kobj);
+		break;
+	}
+
+	mutex_unlock(&scst_mutex);
+
+	switch (action) {
+	case SCST_MGMT_DEVT:
+		res = scst_process_devt_mgmt_store(cmd, devt);
+		break;
+	case SCST_MGMT_DEVT_PASS_THROUGH:
+		res = scst_process_devt_pass_through_mgmt_store(cmd, devt);
+		break;
+	case SCST_MGMT_TGTT:
+		res = scst_process_tgtt_mgmt_store(cmd, tgtt);
+		break;
+	case SCST_MGMT_TGT_ENABLE:
+		p = scst_get_next_lexem(&cmd);
+		if (strcmp(p, "0") != 0 && strcmp(p, "1") != 0) {
+			PRINT_ERROR("%s: Requested action not understood: %s",
+				__func__, p);
+			kobject_put(&tgt->tgt_kobj);
+			res = -EINVAL;
+			break;
+		}
+		res = scst_process_tgt_enable_store(tgt, *p == '1');
+		break;
+	case SCST_MGMT_LUNS:
+		res = __scst_process_luns_mgmt_store(cmd, tgt, acg, n == 5);
+		break;
+	case SCST_MGMT_INI_GROUPS:
+		res = scst_process_ini_group_mgmt_store(cmd, tgt);
+		break;
+	case SCST_MGMT_INITIATORS:
+		res = scst_process_acg_ini_mgmt_store(cmd, tgt, acg);
+		break;
+	}
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+
+out_unlock:
+	mutex_unlock(&scst_mutex);
+	goto out;
+
+out_bad_path:
+	PRINT_ERROR("Unsupported management attribute path (%d components)",
+		n);
+	res = -EINVAL;
+	goto out;
+}
+
 /*
  ** Sysfs user info
  **/
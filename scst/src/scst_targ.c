@@ -32,6 +32,7 @@
 #include <linux/delay.h>
 #include <linux/ktime.h>
 #include <linux/vmalloc.h>
+#include <linux/blkdev.h>
 #include <scsi/sg.h>
 
 #ifdef INSIDE_KERNEL_TREE
@@ -44,7 +45,7 @@
 #include "scst_pres.h"
 
 static void scst_cmd_set_sn(struct scst_cmd *cmd);
-static int __scst_init_cmd(struct scst_cmd *cmd);
+static int __scst_init_cmd(struct scst_cmd *cmd, bool may_sleep);
 static struct scst_cmd *__scst_find_cmd_by_tag(struct scst_session *sess,
 	uint64_t tag, bool to_abort);
 static void scst_process_redirect_cmd(struct scst_cmd *cmd,
@@ -446,6 +447,14 @@ static bool scst_check_blocked_dev(struct scst_cmd *cmd)
 
 	spin_lock_bh(&dev->dev_lock);
 	res = scst_do_check_blocked_dev(cmd);
+	if (!res && unlikely(scst_dispatch_check(cmd))) {
+		/* Undo increments, as for blocked cmds */
+		dev->on_dev_cmd_count--;
+		cmd->dec_on_dev_needed = 0;
+		TRACE_DBG("New dec on_dev_count %d (cmd %p)",
+			dev->on_dev_cmd_count, cmd);
+		res = true;
+	}
 	spin_unlock_bh(&dev->dev_lock);
 
 out:
@@ -525,6 +534,8 @@ void __scst_check_unblock_dev(struct scst_cmd *cmd)
 			dev->on_dev_cmd_count, cmd);
 	}
 
+	scst_dispatch_done(cmd);
+
 	if (unlikely(cmd->scsi_atomic_blocked_cmds != NULL))
 		scst_check_unblock_scsi_atomic_cmds(cmd);
 
@@ -706,7 +717,7 @@ EXPORT_SYMBOL(scst_rx_cmd);
  */
 static int scst_init_cmd(struct scst_cmd *cmd, enum scst_exec_context *context)
 {
-	int rc, res = 0;
+	int rc = 0, res = 0;
 
 	TRACE_ENTRY();
 
@@ -721,7 +732,11 @@ static int scst_init_cmd(struct scst_cmd *cmd, enum scst_exec_context *context)
 	 * in comment in scst_do_job_init().
 	 */
 
-	rc = __scst_init_cmd(cmd);
+	/*
+	 * Don't block the target driver on scst_mutex here. Not yet
+	 * instantiated tgt_devs are instantiated by the init thread.
+	 */
+	rc = __scst_init_cmd(cmd, false);
 	if (unlikely(rc > 0))
 		goto out_redirect;
 	else if (unlikely(rc != 0)) {
@@ -756,7 +771,7 @@ out:
 	return res;
 
 out_redirect:
-	if (cmd->preprocessing_only) {
+	if (cmd->preprocessing_only && (rc != 2)) {
 		/*
 		 * Poor man solution for single threaded targets, where
 		 * blocking receiver at least sometimes means blocking all.
@@ -2594,6 +2609,8 @@ static enum scst_exec_res scst_do_real_exec(struct scst_cmd *cmd)
 
 	ctx_changed = scst_set_io_context(cmd, &old_ctx);
 
+	scst_numa_account(cmd);
+
 	scst_set_cmd_state(cmd, SCST_CMD_STATE_EXEC_WAIT);
 
 	if (devt->exec) {
@@ -3050,8 +3067,10 @@ defer:
 				TRACE_SN("Deferring cmd %p (sn=%d, set %d, "
 					"expected_sn=%d)", cmd, cmd->sn,
 					cmd->sn_set, expected_sn);
+				cmd->sn_defer_time = ktime_to_ns(ktime_get());
 				list_add_tail(&cmd->deferred_cmd_list_entry,
-					      &order_data->deferred_cmd_list);
+					&order_data->deferred_sn_ring[cmd->sn &
+						SCST_SN_SLOTS_MASK]);
 				res = SCST_CMD_STATE_RES_CONT_NEXT;
 			}
 			spin_unlock_irq(&order_data->sn_lock);
@@ -3875,6 +3894,8 @@ static int scst_finish_cmd(struct scst_cmd *cmd)
 		}
 	}
 
+	scst_cmd_thr_release(cmd);
+
 	if (likely(cmd->tgt_dev != NULL)) {
 		/*
 		 * We must decrement @tgt_dev->tgt_dev_cmd_count
@@ -4020,10 +4041,9 @@ again:
 	case SCST_CMD_QUEUE_SIMPLE:
 		if (order_data->prev_cmd_ordered) {
 			if (atomic_read(order_data->cur_sn_slot) != 0) {
-				order_data->cur_sn_slot++;
-				if (order_data->cur_sn_slot == order_data->sn_slots +
-								ARRAY_SIZE(order_data->sn_slots))
-					order_data->cur_sn_slot = order_data->sn_slots;
+				order_data->cur_sn_slot = &order_data->sn_slots[
+					(order_data->cur_sn_slot - order_data->sn_slots + 1) &
+						SCST_SN_SLOTS_MASK];
 				if (unlikely(atomic_read(order_data->cur_sn_slot) != 0)) {
 					static int q;
 
@@ -4155,6 +4175,8 @@ struct scst_tgt_dev *scst_lookup_tgt_dev(struct scst_session *sess, u64 lun)
 /**
  * scst_translate_lun() - Translate @cmd->lun into a tgt_dev pointer.
  * @cmd: SCSI command for which to translate the LUN number.
+ * @may_sleep: Whether a not yet instantiated tgt_dev may be instantiated here,
+ *	which is only the case in the init thread.
  *
  * Initialize the following @cmd members: counted, cmd_threads,
  * tgt_dev, cur_order_data, dev and devt.
@@ -4163,17 +4185,19 @@ struct scst_tgt_dev *scst_lookup_tgt_dev(struct scst_session *sess, u64 lun)
  * structures used in this function are either protected by an RCU read lock or
  * only change while activity is suspended.
  *
- * Return: 0 on success, > 0 if further processing of @cmd must wait for command
- *    processing to resume or < 0 if LUN translation failed.
+ * Return: 0 on success, 1 if further processing of @cmd must wait for command
+ *    processing to resume, 2 if the tgt_dev of @cmd must be instantiated by
+ *    the init thread or < 0 if LUN translation failed.
  */
-static int scst_translate_lun(struct scst_cmd *cmd)
+static int scst_translate_lun(struct scst_cmd *cmd, bool may_sleep)
 {
 	struct scst_tgt_dev *tgt_dev = NULL;
 	int res;
-	bool nul_dev = false;
+	bool nul_dev = false, lazy_tried = false;
 
 	TRACE_ENTRY();
 
+again:
 	if (likely(scst_get_cmd(cmd))) {
 		TRACE_DBG("Finding tgt_dev for cmd %p (lun %lld)", cmd,
 			(unsigned long long)cmd->lun);
@@ -4208,6 +4232,21 @@ static int scst_translate_lun(struct scst_cmd *cmd)
 			}
 		}
 		rcu_read_unlock();
+		if (unlikely(res != 0) && !nul_dev &&
+		    cmd->sess->sess_lazy_tgt_devs && !lazy_tried) {
+			scst_put_cmd(cmd);
+			if (!may_sleep) {
+				TRACE_DBG("Instantiating tgt_dev for LUN %lld "
+					"in thread context (cmd %p)",
+					(unsigned long long)cmd->lun, cmd);
+				res = 2;
+				goto out;
+			}
+			/* On failure the retry reports the LUN as not found */
+			lazy_tried = true;
+			scst_sess_add_lazy_tgt_dev(cmd->sess, cmd->lun);
+			goto again;
+		}
 		if (unlikely(res != 0)) {
 			if (!nul_dev) {
 				TRACE(TRACE_MINOR,
@@ -4224,6 +4263,7 @@ static int scst_translate_lun(struct scst_cmd *cmd)
 		res = 1;
 	}
 
+out:
 	TRACE_EXIT_RES(res);
 	return res;
 }
@@ -4313,19 +4353,21 @@ out_bypass_aca:
 /**
  * __scst_init_cmd() - Translate the LUN, parse the CDB and set the sequence nr.
  * @cmd: SCSI command to initialize.
+ * @may_sleep: Whether the caller is allowed to sleep.
  *
  * No locks, but might be on IRQ.
  *
  * Return: 0 on success, > 0 if further processing of @cmd must wait for command
- *    processing to resume or < 0 if LUN translation failed.
+ *    processing to resume or be done by the init thread (see
+ *    scst_translate_lun()) or < 0 if LUN translation failed.
  */
-static int __scst_init_cmd(struct scst_cmd *cmd)
+static int __scst_init_cmd(struct scst_cmd *cmd, bool may_sleep)
 {
 	int res = 0;
 
 	TRACE_ENTRY();
 
-	res = scst_translate_lun(cmd);
+	res = scst_translate_lun(cmd, may_sleep);
 	if (likely(res == 0)) {
 		struct scst_tgt_dev *tgt_dev = cmd->tgt_dev;
 		struct scst_device *dev = cmd->dev;
@@ -4439,7 +4481,7 @@ restart:
 			continue;
 		if (!test_bit(SCST_CMD_ABORTED, &cmd->cmd_flags)) {
 			spin_unlock_irq(&scst_init_lock);
-			rc = __scst_init_cmd(cmd);
+			rc = __scst_init_cmd(cmd, true);
 			spin_lock_irq(&scst_init_lock);
 			if (rc > 0) {
 				TRACE_MGMT_DBG("%s",
@@ -4646,6 +4688,10 @@ void scst_process_active_cmd(struct scst_cmd *cmd, bool atomic)
 			break;
 
 		case SCST_CMD_STATE_EXEC_CHECK_SN:
+			if (unlikely(scst_qos_throttle(cmd))) {
+				res = SCST_CMD_STATE_RES_CONT_NEXT;
+				break;
+			}
 			if (tm_dbg_check_cmd(cmd) != 0) {
 				res = SCST_CMD_STATE_RES_CONT_NEXT;
 				TRACE_MGMT_DBG("Skipping cmd %p (tag %llu), "
@@ -4796,11 +4842,19 @@ static void scst_do_job_active(struct list_head *cmd_list,
 	return;
 }
 
+static inline bool scst_thr_should_stop(struct scst_cmd_thread_t *thr)
+{
+	/* A retiring thread must first finish the commands assigned to it */
+	return kthread_should_stop() &&
+	       (!thr->retiring || (atomic_read(&thr->thr_assigned_cmds) == 0));
+}
+
 static inline int test_cmd_threads(struct scst_cmd_thread_t *thr)
 {
 	int res = !list_empty(&thr->thr_active_cmd_list) ||
-		  !list_empty(&thr->thr_cmd_threads->active_cmd_list) ||
-		  unlikely(kthread_should_stop()) ||
+		  (!thr->retiring &&
+		   !list_empty(&thr->thr_cmd_threads->active_cmd_list)) ||
+		  unlikely(scst_thr_should_stop(thr)) ||
 		  tm_dbg_is_release();
 	return res;
 }
@@ -4809,7 +4863,8 @@ int scst_cmd_thread(void *arg)
 {
 	struct scst_cmd_thread_t *thr = arg;
 	struct scst_cmd_threads *p_cmd_threads = thr->thr_cmd_threads;
-	bool someth_done, p_locked, thr_locked;
+	bool someth_done, p_locked, thr_locked, plugged;
+	struct blk_plug plug;
 
 	TRACE_ENTRY();
 
@@ -4826,7 +4881,22 @@ int scst_cmd_thread(void *arg)
 
 	spin_lock_irq(&p_cmd_threads->cmd_list_lock);
 	spin_lock(&thr->thr_cmd_list_lock);
-	while (!kthread_should_stop()) {
+	while (!scst_thr_should_stop(thr)) {
+		if (unlikely(thr->retiring) && !test_cmd_threads(thr)) {
+			/*
+			 * Don't wait on cmd_list_waitQ to not consume wake ups
+			 * meant for other threads.
+			 */
+			if (!list_empty(&p_cmd_threads->active_cmd_list))
+				wake_up(&p_cmd_threads->cmd_list_waitQ);
+			spin_unlock(&thr->thr_cmd_list_lock);
+			spin_unlock_irq(&p_cmd_threads->cmd_list_lock);
+			schedule_timeout_interruptible(HZ / 10);
+			spin_lock_irq(&p_cmd_threads->cmd_list_lock);
+			spin_lock(&thr->thr_cmd_list_lock);
+			continue;
+		}
+
 		if (!test_cmd_threads(thr)) {
 			DEFINE_WAIT(wait);
 
@@ -4836,11 +4906,13 @@ int scst_cmd_thread(void *arg)
 					&wait, TASK_INTERRUPTIBLE);
 				if (test_cmd_threads(thr))
 					break;
+				p_cmd_threads->nr_idle_threads++;
 				spin_unlock(&thr->thr_cmd_list_lock);
 				spin_unlock_irq(&p_cmd_threads->cmd_list_lock);
 				schedule();
 				spin_lock_irq(&p_cmd_threads->cmd_list_lock);
 				spin_lock(&thr->thr_cmd_list_lock);
+				p_cmd_threads->nr_idle_threads--;
 			} while (!test_cmd_threads(thr));
 			finish_wait(&p_cmd_threads->cmd_list_waitQ, &wait);
 		}
@@ -4858,8 +4930,16 @@ int scst_cmd_thread(void *arg)
 		 * during its iterations when the more global queue is empty.
 		 * Why 2:1? 2 is average number of intermediate commands states
 		 * reaching this point here.
+		 *
+		 * If a target driver asked for it, the whole pass runs plugged,
+		 * so that the target driver, which queues its responses via
+		 * blk_check_plugged(), can post them to the hardware with a
+		 * single doorbell at the end.
 		 */
 
+		plugged = atomic_read(&scst_plug_cmd_threads_cnt) != 0;
+		if (plugged)
+			blk_start_plug(&plug);
 		p_locked = true;
 		thr_locked = true;
 		do {
@@ -4867,7 +4947,8 @@ int scst_cmd_thread(void *arg)
 
 			someth_done = false;
 again:
-			if (!list_empty(&p_cmd_threads->active_cmd_list)) {
+			if (!thr->retiring &&
+			    !list_empty(&p_cmd_threads->active_cmd_list)) {
 				struct scst_cmd *cmd;
 
 				if (!p_locked) {
@@ -4897,6 +4978,7 @@ again:
 					TRACE_DBG("Assigning thread %p on cmd %p",
 						thr, cmd);
 					cmd->cmd_thr = thr;
+					atomic_inc(&thr->thr_assigned_cmds);
 				}
 
 				scst_process_active_cmd(cmd, false);
@@ -4949,6 +5031,9 @@ again:
 			thr_locked = false;
 		}
 
+		if (plugged)
+			blk_finish_plug(&plug);
+
 		if (scst_poll_ns > 0) {
 			ktime_t end, kt;
 
@@ -4960,6 +5045,8 @@ again:
 				if (!list_empty(&p_cmd_threads->active_cmd_list) ||
 				    !list_empty(&thr->thr_active_cmd_list)) {
 					TRACE_DBG("Poll successful");
+					if (plugged)
+						blk_start_plug(&plug);
 					goto again;
 				}
 				cpu_relax();
@@ -5023,12 +5110,14 @@ static int scst_mgmt_translate_lun(struct scst_mgmt_cmd *mcmd)
 {
 	struct scst_tgt_dev *tgt_dev;
 	int res;
+	bool lazy_tried = false;
 
 	TRACE_ENTRY();
 
 	TRACE_DBG("Finding tgt_dev for mgmt cmd %p (lun %lld)", mcmd,
 	      (unsigned long long)mcmd->lun);
 
+again:
 	res = scst_get_mgmt(mcmd);
 	if (unlikely(res != 0))
 		goto out;
@@ -5044,6 +5133,12 @@ static int scst_mgmt_translate_lun(struct scst_mgmt_cmd *mcmd)
 	} else {
 		scst_put_mcmd(mcmd);
 		res = -1;
+		if (mcmd->sess->sess_lazy_tgt_devs && !lazy_tried) {
+			/* Called from the TM thread, so sleeping is fine */
+			lazy_tried = true;
+			scst_sess_add_lazy_tgt_dev(mcmd->sess, mcmd->lun);
+			goto again;
+		}
 	}
 
 out:
@@ -5378,6 +5473,12 @@ void scst_abort_cmd(struct scst_cmd *cmd, struct scst_mgmt_cmd *mcmd,
 		wake_up(&scst_init_cmd_list_waitQ);
 	}
 
+	if (unlikely(READ_ONCE(cmd->qos_parked)))
+		scst_qos_abort_cmd(cmd);
+
+	if (cmd->dev != NULL)
+		scst_dispatch_abort_cmd(cmd);
+
 	if (!cmd->finished && call_dev_task_mgmt_fn_received &&
 	    (cmd->tgt_dev != NULL))
 		scst_call_dev_task_mgmt_fn_received(mcmd, cmd->tgt_dev);
@@ -5555,6 +5656,29 @@ static bool __scst_check_unblock_aborted_cmd(struct scst_cmd *cmd,
 	return res;
 }
 
+/* sn_lock supposed to be held and IRQs off */
+static void __scst_unblock_aborted_deferred_cmds(
+	struct scst_order_data *order_data, struct list_head *list,
+	const struct scst_tgt *tgt, const struct scst_session *sess)
+{
+	struct scst_cmd *cmd, *tcmd;
+
+	list_for_each_entry_safe(cmd, tcmd, list, deferred_cmd_list_entry) {
+		if ((tgt != NULL) && (tgt != cmd->tgt))
+			continue;
+		if ((sess != NULL) && (sess != cmd->sess))
+			continue;
+
+		if (__scst_check_unblock_aborted_cmd(cmd,
+				&cmd->deferred_cmd_list_entry, false)) {
+			TRACE_MGMT_DBG("Unblocked aborted SN cmd %p (sn %u)",
+				cmd, cmd->sn);
+			order_data->def_cmd_count--;
+		}
+	}
+	return;
+}
+
 void __scst_unblock_aborted_cmds(const struct scst_tgt *tgt,
 	const struct scst_session *sess, const struct scst_device *device)
 {
@@ -5567,6 +5691,7 @@ void __scst_unblock_aborted_cmds(const struct scst_tgt *tgt,
 	list_for_each_entry(dev, &scst_dev_list, dev_list_entry) {
 		struct scst_cmd *cmd, *tcmd;
 		struct scst_tgt_dev *tgt_dev;
+		int i;
 
 		if ((device != NULL) && (device != dev))
 			continue;
@@ -5595,22 +5720,11 @@ void __scst_unblock_aborted_cmds(const struct scst_tgt *tgt,
 			struct scst_order_data *order_data = tgt_dev->curr_order_data;
 
 			spin_lock(&order_data->sn_lock);
-			list_for_each_entry_safe(cmd, tcmd,
-					&order_data->deferred_cmd_list,
-					deferred_cmd_list_entry) {
-
-				if ((tgt != NULL) && (tgt != cmd->tgt))
-					continue;
-				if ((sess != NULL) && (sess != cmd->sess))
-					continue;
-
-				if (__scst_check_unblock_aborted_cmd(cmd,
-						&cmd->deferred_cmd_list_entry, false)) {
-					TRACE_MGMT_DBG("Unblocked aborted SN "
-						"cmd %p (sn %u)", cmd, cmd->sn);
-					order_data->def_cmd_count--;
-				}
-			}
+			__scst_unblock_aborted_deferred_cmds(order_data,
+				&order_data->deferred_cmd_list, tgt, sess);
+			for (i = 0; i < ARRAY_SIZE(order_data->deferred_sn_ring); i++)
+				__scst_unblock_aborted_deferred_cmds(order_data,
+					&order_data->deferred_sn_ring[i], tgt, sess);
 			spin_unlock(&order_data->sn_lock);
 		}
 		local_irq_enable_nort();
@@ -7225,15 +7339,43 @@ restart:
 	return name;
 }
 
+static void scst_sess_reg_lat_account(struct scst_session *sess, int res)
+{
+	struct scst_tgt *tgt = sess->tgt;
+	s64 us = ktime_us_delta(ktime_get(), sess->sess_reg_time);
+	s64 lim = 100;
+	int i;
+
+	TRACE_MGMT_DBG("Registration of sess %p (ini %s) took %lld us: %d",
+		sess, sess->initiator_name, (long long)us, res);
+
+	if (res != 0) {
+		atomic_inc(&tgt->sess_reg_failed);
+		return;
+	}
+
+	for (i = 0; i < SCST_SESS_REG_LAT_BUCKETS - 1; i++, lim *= 10) {
+		if (us <= lim)
+			break;
+	}
+	atomic_inc(&tgt->sess_reg_lat[i]);
+	return;
+}
+
 static int scst_init_session(struct scst_session *sess)
 {
-	int res = 0;
+	int res = 0, tid_res = 0;
 	struct scst_cmd *cmd, *cmd_tmp;
 	struct scst_mgmt_cmd *mcmd, *tm;
 	int mwake = 0;
 
 	TRACE_ENTRY();
 
+	/* The transport ID doesn't depend on anything protected by scst_mutex */
+	if (sess->tgt->tgtt->get_initiator_port_transport_id != NULL)
+		tid_res = sess->tgt->tgtt->get_initiator_port_transport_id(
+					sess->tgt, sess, &sess->transport_id);
+
 	mutex_lock(&scst_mutex);
 
 	sess->acg = scst_find_acg(sess);
@@ -7251,8 +7393,7 @@ static int scst_init_session(struct scst_session *sess)
 	INIT_LIST_HEAD(&sess->sysfs_sess_list_entry);
 
 	if (sess->tgt->tgtt->get_initiator_port_transport_id != NULL) {
-		res = sess->tgt->tgtt->get_initiator_port_transport_id(
-					sess->tgt, sess, &sess->transport_id);
+		res = tid_res;
 		if (res != 0) {
 			PRINT_ERROR("Unable to make initiator %s port "
 				"transport id", sess->initiator_name);
@@ -7330,6 +7471,8 @@ failed:
 	if (mwake)
 		wake_up(&scst_mgmt_cmd_list_waitQ);
 
+	scst_sess_reg_lat_account(sess, res);
+
 	scst_sess_put(sess);
 
 	TRACE_EXIT();
@@ -7355,6 +7498,7 @@ static struct scst_session *__scst_register_session(struct scst_tgt *tgt, int at
 
 	scst_sess_set_tgt_priv(sess, tgt_priv);
 	sess->sess_mq = mq;
+	sess->sess_reg_time = ktime_get();
 
 	scst_sess_get(sess); /* one held until sess is inited */
 
@@ -7366,7 +7510,7 @@ static struct scst_session *__scst_register_session(struct scst_tgt *tgt, int at
 		list_add_tail(&sess->sess_init_list_entry,
 			      &scst_sess_init_list);
 		spin_unlock_irqrestore(&scst_mgmt_lock, flags);
-		wake_up(&scst_mgmt_waitQ);
+		wake_up(&scst_sess_init_waitQ);
 	} else {
 		res = scst_init_session(sess);
 		if (res != 0)
@@ -7592,29 +7736,41 @@ void scst_unregister_session_non_gpl(struct scst_session *sess)
 EXPORT_SYMBOL(scst_unregister_session_non_gpl);
 
 static inline int test_mgmt_list(void)
+{
+	int res = !list_empty(&scst_sess_shut_list) ||
+		  unlikely(kthread_should_stop());
+	return res;
+}
+
+static inline int test_sess_init_list(void)
 {
 	int res = !list_empty(&scst_sess_init_list) ||
-		  !list_empty(&scst_sess_shut_list) ||
 		  unlikely(kthread_should_stop());
 	return res;
 }
 
-int scst_global_mgmt_thread(void *arg)
+/*
+ * Initializes sessions registered from atomic context. Several of these
+ * threads run, see the sess_init_threads module parameter, so a slow
+ * initialization, e.g. of a session with many LUNs, doesn't delay the
+ * registration of all other sessions. They are still serialized by
+ * scst_mutex while the session is added to the target and its tgt_devs
+ * are allocated.
+ */
+int scst_sess_init_thread(void *arg)
 {
 	struct scst_session *sess;
 
 	TRACE_ENTRY();
 
-	PRINT_INFO("Management thread started");
-
 	current->flags |= PF_NOFREEZE;
 
 	set_user_nice(current, -10);
 
 	spin_lock_irq(&scst_mgmt_lock);
 	while (!kthread_should_stop()) {
-		wait_event_locked(scst_mgmt_waitQ, test_mgmt_list(), lock_irq,
-				  scst_mgmt_lock);
+		wait_event_locked(scst_sess_init_waitQ, test_sess_init_list(),
+				  lock_irq, scst_mgmt_lock);
 
 		while (!list_empty(&scst_sess_init_list)) {
 			sess = list_first_entry(&scst_sess_init_list,
@@ -7641,6 +7797,29 @@ int scst_global_mgmt_thread(void *arg)
 
 			spin_lock_irq(&scst_mgmt_lock);
 		}
+	}
+	spin_unlock_irq(&scst_mgmt_lock);
+
+	TRACE_EXIT();
+	return 0;
+}
+
+int scst_global_mgmt_thread(void *arg)
+{
+	struct scst_session *sess;
+
+	TRACE_ENTRY();
+
+	PRINT_INFO("Management thread started");
+
+	current->flags |= PF_NOFREEZE;
+
+	set_user_nice(current, -10);
+
+	spin_lock_irq(&scst_mgmt_lock);
+	while (!kthread_should_stop()) {
+		wait_event_locked(scst_mgmt_waitQ, test_mgmt_list(), lock_irq,
+				  scst_mgmt_lock);
 
 		while (!list_empty(&scst_sess_shut_list)) {
 			sess = list_first_entry(&scst_sess_shut_list,
@@ -18,6 +18,7 @@
 #include <linux/moduleparam.h>
 #include <linux/delay.h>
 #include <linux/kmod.h>
+#include <linux/workqueue.h>
 #include <asm/unaligned.h>
 #ifdef INSIDE_KERNEL_TREE
 #include <scst/scst.h>
@@ -55,6 +56,32 @@ module_param(alua_invariant_check, bool, 0644);
 MODULE_PARM_DESC(alua_invariant_check,
 		 "Enables a run-time ALUA state invariant check. (default: false)");
 
+/* Runs the on_alua_state_change_*() callbacks of several devices at once */
+static struct workqueue_struct *scst_alua_wq;
+
+/* Commands delayed in the transitioning state, protected by the lock below */
+static LIST_HEAD(scst_alua_retry_list);
+static DEFINE_SPINLOCK(scst_alua_retry_lock);
+
+#define SCST_ALUA_HIST_SIZE	16
+#define SCST_ALUA_HIST_NAME_LEN	32
+
+/* A recent ALUA state transition, see scst_alua_hist_add() */
+struct scst_alua_transition {
+	unsigned long		time;
+	char			dg_name[SCST_ALUA_HIST_NAME_LEN];
+	char			tg_name[SCST_ALUA_HIST_NAME_LEN];
+	enum scst_tg_state	old_state;
+	enum scst_tg_state	new_state;
+	int			dev_cnt;
+	s64			duration_us;
+	bool			stpg;
+};
+
+/* Protected by scst_dg_mutex */
+static struct scst_alua_transition scst_alua_hist[SCST_ALUA_HIST_SIZE];
+static unsigned int scst_alua_hist_cnt;
+
 /* Global SCST ALUA lock/unlock functions (scst_dg_mutex) */
 void scst_alua_lock(void)
 {
@@ -68,12 +95,82 @@ void scst_alua_unlock(void)
 }
 EXPORT_SYMBOL(scst_alua_unlock);
 
+static void scst_alua_cb_work_fn(struct work_struct *work);
+
+/* Whether the current thread runs an on_alua_state_change_*() callback work */
+static bool scst_in_alua_cb_work(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 15, 0)
+	struct work_struct *work = current_work();
+
+	return work && work->func == scst_alua_cb_work_fn;
+#else
+	return current->flags & PF_WQ_WORKER;
+#endif
+}
+
 void lockdep_assert_alua_lock_held(void)
 {
-	lockdep_assert_held(&scst_dg_mutex);
+	/*
+	 * The on_alua_state_change_*() callbacks are invoked by scst_alua_wq
+	 * workers while the thread changing the ALUA state holds
+	 * scst_dg_mutex and waits for them.
+	 */
+	if (scst_in_alua_cb_work())
+		WARN_ON_ONCE(!mutex_is_locked(&scst_dg_mutex));
+	else
+		lockdep_assert_held(&scst_dg_mutex);
 }
 EXPORT_SYMBOL(lockdep_assert_alua_lock_held);
 
+static void scst_alua_hist_add(struct scst_dev_group *dg,
+	struct scst_target_group *tg, enum scst_tg_state old_state,
+	enum scst_tg_state new_state, int dev_cnt, ktime_t start, bool stpg)
+{
+	struct scst_alua_transition *t;
+
+	lockdep_assert_held(&scst_dg_mutex);
+
+	t = &scst_alua_hist[scst_alua_hist_cnt++ % SCST_ALUA_HIST_SIZE];
+	t->time = jiffies;
+	strlcpy(t->dg_name, dg->name, sizeof(t->dg_name));
+	strlcpy(t->tg_name, tg->name, sizeof(t->tg_name));
+	t->old_state = old_state;
+	t->new_state = new_state;
+	t->dev_cnt = dev_cnt;
+	t->duration_us = ktime_us_delta(ktime_get(), start);
+	t->stpg = stpg;
+}
+
+/* Shows the last ALUA state transitions, from oldest to newest */
+int scst_alua_transitions_show(char *buf)
+{
+	unsigned int i, first;
+	int pos = 0, res;
+
+	res = mutex_lock_interruptible(&scst_dg_mutex);
+	if (res)
+		return res;
+
+	first = (scst_alua_hist_cnt > SCST_ALUA_HIST_SIZE) ?
+		scst_alua_hist_cnt - SCST_ALUA_HIST_SIZE : 0;
+	for (i = first; i < scst_alua_hist_cnt; i++) {
+		const struct scst_alua_transition *t =
+			&scst_alua_hist[i % SCST_ALUA_HIST_SIZE];
+		unsigned int age = jiffies_to_msecs(jiffies - t->time);
+
+		pos += scnprintf(&buf[pos], SCST_SYSFS_BLOCK_SIZE - pos,
+			"-%u.%03us %s/%s %s -> %s: %d devices, %lld us%s\n",
+			age / 1000, age % 1000, t->dg_name, t->tg_name,
+			scst_alua_state_name(t->old_state),
+			scst_alua_state_name(t->new_state), t->dev_cnt,
+			t->duration_us, t->stpg ? " (STPG)" : "");
+	}
+	mutex_unlock(&scst_dg_mutex);
+
+	return pos;
+}
+
 const char *scst_alua_state_name(enum scst_tg_state s)
 {
 	int i;
@@ -410,17 +507,13 @@ out:
 struct scst_alua_retry {
 	struct scst_cmd *alua_retry_cmd;
 	struct delayed_work alua_retry_work;
+	struct list_head alua_retry_list_entry;
 };
 
-static void scst_alua_transitioning_work_fn(struct work_struct *work)
+static void scst_alua_retry_cmd(struct scst_alua_retry *retry)
 {
-	struct scst_alua_retry *retry =
-		container_of(work, struct scst_alua_retry,
-			     alua_retry_work.work);
 	struct scst_cmd *cmd = retry->alua_retry_cmd;
 
-	TRACE_ENTRY();
-
 	TRACE_DBG("Retrying transitioning cmd %p", cmd);
 
 	spin_lock_irq(&cmd->cmd_threads->cmd_list_lock);
@@ -430,6 +523,50 @@ static void scst_alua_transitioning_work_fn(struct work_struct *work)
 	spin_unlock_irq(&cmd->cmd_threads->cmd_list_lock);
 
 	kfree(retry);
+}
+
+static void scst_alua_transitioning_work_fn(struct work_struct *work)
+{
+	struct scst_alua_retry *retry =
+		container_of(work, struct scst_alua_retry,
+			     alua_retry_work.work);
+
+	TRACE_ENTRY();
+
+	spin_lock_bh(&scst_alua_retry_lock);
+	list_del(&retry->alua_retry_list_entry);
+	spin_unlock_bh(&scst_alua_retry_lock);
+
+	scst_alua_retry_cmd(retry);
+
+	TRACE_EXIT();
+	return;
+}
+
+/*
+ * Retry the commands for the devices of @dg delayed in the transitioning
+ * state now instead of when their delay expires.
+ */
+static void scst_alua_kick_retries(struct scst_dev_group *dg)
+{
+	struct scst_alua_retry *retry, *t;
+	LIST_HEAD(list);
+
+	TRACE_ENTRY();
+
+	spin_lock_bh(&scst_alua_retry_lock);
+	list_for_each_entry_safe(retry, t, &scst_alua_retry_list,
+				 alua_retry_list_entry) {
+		if (!__lookup_dg_dev_by_dev(dg, retry->alua_retry_cmd->dev))
+			continue;
+		/* If the work is already running, it will retry the cmd */
+		if (cancel_delayed_work(&retry->alua_retry_work))
+			list_move_tail(&retry->alua_retry_list_entry, &list);
+	}
+	spin_unlock_bh(&scst_alua_retry_lock);
+
+	list_for_each_entry_safe(retry, t, &list, alua_retry_list_entry)
+		scst_alua_retry_cmd(retry);
 
 	TRACE_EXIT();
 	return;
@@ -491,7 +628,11 @@ static int scst_tg_accept_transitioning(struct scst_cmd *cmd)
 		INIT_DELAYED_WORK(&retry->alua_retry_work,
 				  scst_alua_transitioning_work_fn);
 		cmd->already_transitioning = 1;
+		spin_lock_bh(&scst_alua_retry_lock);
+		list_add_tail(&retry->alua_retry_list_entry,
+			      &scst_alua_retry_list);
 		schedule_delayed_work(&retry->alua_retry_work, HZ/2);
+		spin_unlock_bh(&scst_alua_retry_lock);
 		res = SCST_ALUA_CHECK_DELAYED;
 		goto out;
 	}
@@ -944,26 +1085,18 @@ out_fail:
 }
 
 /*
- * __scst_tgt_set_state - Update the ALUA filter of a LUN and invoke callbacks
+ * __scst_tgt_set_state - Update the ALUA filter of a LUN
  * @tg: ALUA target group of which the state is changing.
  * @tgt_dev: LUN to be updated.
  * @state: new ALUA state.
- * @invoke_callbacks: Whether or not to invoke the on_alua_state_changed_*
- *	callback functions.
  */
 static void __scst_tgt_set_state(struct scst_target_group *tg,
-	struct scst_tgt_dev *tgt_dev, enum scst_tg_state state,
-	bool invoke_callbacks)
+	struct scst_tgt_dev *tgt_dev, enum scst_tg_state state)
 {
 	bool gen_ua = state != SCST_TG_STATE_TRANSITIONING;
 	struct scst_tgt *tgt = tgt_dev->sess->tgt;
-	enum scst_tg_state old_state = tg->state;
-	struct scst_device *dev = tgt_dev->dev;
 	struct scst_dev_group *dg = tg->dg;
 
-	if (invoke_callbacks && dev->handler->on_alua_state_change_start)
-		dev->handler->on_alua_state_change_start(dev, old_state,
-							 state);
 	/*
 	 * If the ALUA state transition is caused by an STPG command and if
 	 * the STPG command has been received through the target port of which
@@ -973,24 +1106,134 @@ static void __scst_tgt_set_state(struct scst_target_group *tg,
 	    tid_equal(dg->stpg_transport_id, tgt_dev->sess->transport_id))
 		gen_ua = false;
 	scst_tg_change_tgt_dev_state(tgt_dev, state, gen_ua);
-	if (invoke_callbacks && dev->handler->on_alua_state_change_finish)
-		dev->handler->on_alua_state_change_finish(dev, old_state,
-							  state);
+}
+
+/*
+ * Whether the on_alua_state_change_*() callbacks of @dev have to be invoked
+ * for an ALUA state change of @tg. That is the case if @dev is exported
+ * through a target port of @tg. Otherwise the callbacks are only invoked if
+ * the target group has no remote targets, e.g. if the device doesn't have
+ * any LUNs yet or only LUNs that are not included in @tg (like the default
+ * copy manager LUN of a blockio device).
+ *
+ * See also 29548a4a ("scst: Remove the on_alua_state_change_*()
+ * callback functions"), d333ce82 ("Restore the on_alua_state_change_*()
+ * callback functions") and https://github.com/SCST-project/scst/issues/55.
+ */
+static bool scst_alua_dev_needs_callbacks(struct scst_target_group *tg,
+					  struct scst_device *dev,
+					  bool tg_is_remote)
+{
+	struct scst_tgt_dev *tgt_dev;
+
+	list_for_each_entry(tgt_dev, &dev->dev_tgt_dev_list,
+			    dev_tgt_dev_list_entry) {
+		if (__scst_tg_have_tgt(tg, tgt_dev->sess->tgt))
+			return true;
+	}
+
+	return !tg_is_remote;
+}
+
+static void scst_alua_dev_callback(struct scst_device *dev,
+	enum scst_tg_state old_state, enum scst_tg_state new_state,
+	bool finish)
+{
+	if (!finish) {
+		if (dev->handler->on_alua_state_change_start)
+			dev->handler->on_alua_state_change_start(dev, old_state,
+								 new_state);
+	} else {
+		if (dev->handler->on_alua_state_change_finish)
+			dev->handler->on_alua_state_change_finish(dev, old_state,
+								  new_state);
+	}
+}
+
+struct scst_alua_cb_work {
+	struct work_struct work;
+	struct scst_device *dev;
+	enum scst_tg_state old_state;
+	enum scst_tg_state new_state;
+	bool finish;
+	atomic_t *left;
+	struct completion *done;
+};
+
+static void scst_alua_cb_work_fn(struct work_struct *work)
+{
+	struct scst_alua_cb_work *w =
+		container_of(work, struct scst_alua_cb_work, work);
+
+	scst_alua_dev_callback(w->dev, w->old_state, w->new_state, w->finish);
+
+	if (atomic_dec_and_test(w->left))
+		complete(w->done);
+}
+
+/*
+ * Invoke the on_alua_state_change_start() or on_alua_state_change_finish()
+ * callbacks of the @cnt devices in @works. Since e.g. vdisk_blockio closes
+ * or reopens the backing device from these callbacks, the callbacks of
+ * different devices are invoked concurrently from scst_alua_wq and only the
+ * final completion is waited for.
+ */
+static void scst_alua_run_callbacks(struct scst_alua_cb_work *works, int cnt,
+				    bool finish)
+{
+	DECLARE_COMPLETION_ONSTACK(done);
+	atomic_t left;
+	int i;
+
+	if (cnt == 1) {
+		scst_alua_dev_callback(works[0].dev, works[0].old_state,
+				       works[0].new_state, finish);
+		return;
+	}
+
+	atomic_set(&left, 1);
+
+	for (i = 0; i < cnt; i++) {
+		struct scst_alua_cb_work *w = &works[i];
+		struct scst_dev_type *handler = w->dev->handler;
+
+		if (finish ? !handler->on_alua_state_change_finish :
+			     !handler->on_alua_state_change_start)
+			continue;
+
+		w->finish = finish;
+		w->left = &left;
+		w->done = &done;
+		INIT_WORK(&w->work, scst_alua_cb_work_fn);
+		atomic_inc(&left);
+		queue_work(scst_alua_wq, &w->work);
+	}
+
+	if (!atomic_dec_and_test(&left))
+		wait_for_completion(&done);
 }
 
 /*
  * Update the ALUA filter of those LUNs (tgt_dev) whose target port is a member
  * of target group @tg and that export a device that is a member of the device
  * group @tg->dg.
+ *
+ * The state change happens in three steps: the start callbacks of all
+ * devices are invoked, then the ALUA filters of all LUNs are updated and
+ * finally the finish callbacks of all devices are invoked. That way the time
+ * a device group spends in its state change is bounded by its slowest device
+ * instead of the sum over its devices.
  */
 static void __scst_tg_set_state(struct scst_target_group *tg,
 				enum scst_tg_state state)
 {
+	enum scst_tg_state old_state = tg->state;
+	struct scst_alua_cb_work *works = NULL;
 	struct scst_dg_dev *dg_dev;
 	struct scst_device *dev;
 	struct scst_tgt_dev *tgt_dev;
-	struct scst_tgt *tgt;
-	bool invoke_callbacks;
+	ktime_t start = ktime_get();
+	int dev_cnt = 0, cb_cnt = 0;
 	bool tg_is_remote;
 
 	sBUG_ON(state >= ARRAY_SIZE(scst_alua_filter));
@@ -1002,58 +1245,85 @@ static void __scst_tg_set_state(struct scst_target_group *tg,
 	/*
 	 * If the target group has a target with NULL target device,
 	 * that means that this target is remote one, so we shouldn't
-	 * call on_alua_state_change_*() callbacks then.
-	 *
-	 * See also 29548a4a ("scst: Remove the on_alua_state_change_*()
-	 * callback functions") and d333ce82 ("Restore the
-	 * on_alua_state_change_*() callback functions").
+	 * call on_alua_state_change_*() callbacks then, unless the device
+	 * is exported through a local target port of this target group.
 	 */
 	tg_is_remote = __scst_tg_have_tgt(tg, NULL);
 
+	list_for_each_entry(dg_dev, &tg->dg->dev_list, entry)
+		dev_cnt++;
+
+	if (dev_cnt > 1) {
+		works = kvcalloc(dev_cnt, sizeof(*works), GFP_KERNEL);
+		if (!works)
+			PRINT_WARNING("Unable to allocate ALUA callback works "
+				"for %d devices, invoking the callbacks serially",
+				dev_cnt);
+	}
+
 	list_for_each_entry(dg_dev, &tg->dg->dev_list, entry) {
-		invoke_callbacks = true;
 		dev = dg_dev->dev;
 
-		list_for_each_entry(tgt_dev, &dev->dev_tgt_dev_list,
-				    dev_tgt_dev_list_entry) {
-			tgt = tgt_dev->sess->tgt;
+		if (!scst_alua_dev_needs_callbacks(tg, dev, tg_is_remote))
+			continue;
 
-			if (__scst_tg_have_tgt(tg, tgt)) {
-				__scst_tgt_set_state(tg, tgt_dev, state,
-						     invoke_callbacks);
-				invoke_callbacks = false;
-			}
+		if (works) {
+			works[cb_cnt].dev = dev;
+			works[cb_cnt].old_state = old_state;
+			works[cb_cnt].new_state = state;
+		} else {
+			scst_alua_dev_callback(dev, old_state, state, false);
 		}
+		cb_cnt++;
+	}
 
-		/*
-		 * There are several cases when `invoke_callbacks` can
-		 * still be true here:
-		 * - The SCST device still doesn't have any target
-		 *   devices, or have only those that aren't included
-		 *   in the given target group (e.g. the default copy
-		 *   manager for a blockio devices).
-		 * - Target group has remote targets.
-		 *
-		 * We should call on_alua_state_chage_*() callbacks only
-		 * in the first case.
-		 *
-		 * See also https://github.com/SCST-project/scst/issues/55.
-		 */
-		if (invoke_callbacks && !tg_is_remote) {
-			if (dev->handler->on_alua_state_change_start)
-				dev->handler->on_alua_state_change_start(dev, tg->state, state);
+	if (works && cb_cnt > 0)
+		scst_alua_run_callbacks(works, cb_cnt, false);
 
-			if (dev->handler->on_alua_state_change_finish)
-				dev->handler->on_alua_state_change_finish(dev, tg->state, state);
+	list_for_each_entry(dg_dev, &tg->dg->dev_list, entry) {
+		dev = dg_dev->dev;
+
+		list_for_each_entry(tgt_dev, &dev->dev_tgt_dev_list,
+				    dev_tgt_dev_list_entry) {
+			if (__scst_tg_have_tgt(tg, tgt_dev->sess->tgt))
+				__scst_tgt_set_state(tg, tgt_dev, state);
+		}
+	}
+
+	if (works) {
+		if (cb_cnt > 0)
+			scst_alua_run_callbacks(works, cb_cnt, true);
+		kvfree(works);
+	} else {
+		list_for_each_entry(dg_dev, &tg->dg->dev_list, entry) {
+			dev = dg_dev->dev;
+			if (scst_alua_dev_needs_callbacks(tg, dev, tg_is_remote))
+				scst_alua_dev_callback(dev, old_state, state,
+						       true);
 		}
 	}
 
 	tg->state = state;
 
+	if (old_state == SCST_TG_STATE_TRANSITIONING)
+		scst_alua_kick_retries(tg->dg);
+
 	scst_check_alua_invariant();
 
-	PRINT_INFO("Changed ALUA state of %s/%s into %s", tg->dg->name,
-		   tg->name, scst_alua_state_name(state));
+	/*
+	 * While an STPG is being processed, state changes are made by its
+	 * on_stpg script, so account them to the STPG.
+	 */
+	if (tg->dg->stpg_transport_id)
+		scst_alua_hist_add(tg->dg, tg, old_state, state, dev_cnt,
+				   tg->dg->stpg_start, true);
+	else
+		scst_alua_hist_add(tg->dg, tg, old_state, state, dev_cnt,
+				   start, false);
+
+	PRINT_INFO("Changed ALUA state of %s/%s into %s (%lld us)",
+		   tg->dg->name, tg->name, scst_alua_state_name(state),
+		   ktime_us_delta(ktime_get(), start));
 }
 
 int scst_tg_set_state(struct scst_target_group *tg, enum scst_tg_state state)
@@ -1433,8 +1703,17 @@ struct scst_dev_group *scst_lookup_dg_by_dev(struct scst_device *dev)
  * Target group module management.
  */
 
-void scst_tg_init(void)
+int scst_tg_init(void)
 {
+	int res = 0;
+
+	scst_alua_wq = alloc_workqueue("scst_alua_wq", WQ_UNBOUND, 0);
+	if (!scst_alua_wq) {
+		PRINT_ERROR("Unable to allocate the ALUA workqueue");
+		res = -ENOMEM;
+	}
+
+	return res;
 }
 
 void scst_tg_cleanup(void)
@@ -1448,6 +1727,8 @@ void scst_tg_cleanup(void)
 		__scst_dg_remove(tg);
 	}
 	mutex_unlock(&scst_dg_mutex);
+
+	destroy_workqueue(scst_alua_wq);
 }
 
 /*
@@ -1784,6 +2065,7 @@ static int scst_emit_stpg_event(struct scst_cmd *cmd, struct scst_dev_group *dg,
 		goto out;
 	}
 
+	dg->stpg_start = ktime_get();
 	dg->stpg_rel_tgt_id = cmd->tgt->rel_tgt_id;
 	dg->stpg_transport_id = kmemdup(cmd->sess->transport_id,
 		scst_tid_size(cmd->sess->transport_id), GFP_KERNEL);
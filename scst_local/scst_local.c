@@ -21,6 +21,7 @@
 #include <linux/slab.h>
 #include <linux/completion.h>
 #include <linux/spinlock.h>
+#include <linux/llist.h>
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)
 #include <linux/blk-mq.h>
 #else
@@ -72,6 +73,11 @@ static unsigned long scst_local_trace_flag = SCST_LOCAL_DEFAULT_LOG_FLAGS;
 #endif
 
 #define SCST_LOCAL_VERSION "3.7.0"
+
+/* See also commit c6e3bf98cfd3 ("scsi: core: Add support for polling") # v5.13 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 13, 0)
+#define SCST_LOCAL_MQ_POLL 1
+#endif
 static const char *scst_local_version_date = "20110901";
 
 /* Some statistics */
@@ -84,6 +90,19 @@ module_param_named(add_default_tgt, scst_local_add_default_tgt, bool, S_IRUGO);
 MODULE_PARM_DESC(add_default_tgt, "add (default) or not on start default "
 	"target scst_local_tgt with default session scst_local_host");
 
+static bool scst_local_mq_sessions;
+module_param_named(mq_sessions, scst_local_mq_sessions, bool, S_IRUGO);
+MODULE_PARM_DESC(mq_sessions, "register one SCST MQ session per hardware "
+	"queue instead of one session per SCSI host. MQ sessions don't support "
+	"reservations and COMPARE AND WRITE (default: false)");
+
+#ifdef SCST_LOCAL_MQ_POLL
+static unsigned int scst_local_poll_queues;
+module_param_named(poll_queues, scst_local_poll_queues, uint, S_IRUGO);
+MODULE_PARM_DESC(poll_queues, "number of hardware queues with polled "
+	"completion, in addition to one queue per CPU (default: 0)");
+#endif
+
 static struct workqueue_struct *aen_workqueue;
 
 struct scst_aen_work_item {
@@ -123,11 +142,44 @@ struct scst_local_sess {
 	struct work_struct remove_work;
 
 	struct list_head sessions_list_entry;
+
+	int nr_hw_queues;
+	int nr_poll_queues;
+
+	/*
+	 * If mq_sessions is set, one SCST session per hardware queue.
+	 * hwq_sess[0] is scst_sess.
+	 */
+	struct scst_session **hwq_sess;
+
+#ifdef SCST_LOCAL_MQ_POLL
+	/* Per hardware queue lists of commands awaiting scst_local_mq_poll() */
+	struct llist_head *poll_done;
+#endif
+};
+
+#ifdef SCST_LOCAL_MQ_POLL
+struct scst_local_cmd_priv {
+	struct llist_node poll_entry;
+	struct scsi_cmnd *scmd;
 };
+#endif
 
 #define to_scst_lcl_sess(d) \
 	container_of(d, struct scst_local_sess, dev)
 
+/* Returns the SCST session that serves the hardware queue of @scmd */
+static inline struct scst_session *scst_local_cmd_sess(
+	struct scst_local_sess *sess, struct scsi_cmnd *scmd)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)
+	if (sess->hwq_sess)
+		return sess->hwq_sess[blk_mq_unique_tag_to_hwq(
+				blk_mq_unique_tag(scsi_cmd_to_rq(scmd)))];
+#endif
+	return sess->scst_sess;
+}
+
 static int __scst_local_add_adapter(struct scst_local_tgt *tgt,
 	const char *initiator_name, bool locked);
 static int scst_local_add_adapter(struct scst_local_tgt *tgt,
@@ -714,7 +766,8 @@ static int scst_local_abort(struct scsi_cmnd *scmd)
 
 	sess = to_scst_lcl_sess(scsi_get_device(scmd->device->host));
 
-	ret = scst_rx_mgmt_fn_tag(sess->scst_sess, SCST_ABORT_TASK,
+	ret = scst_rx_mgmt_fn_tag(scst_local_cmd_sess(sess, scmd),
+				  SCST_ABORT_TASK,
 				  blk_mq_unique_tag(scsi_cmd_to_rq(scmd)),
 				  false, &dev_reset_completion);
 
@@ -872,8 +925,8 @@ static int scst_local_queuecommand(struct Scsi_Host *host,
 	 * our devices.
 	 */
 	int_to_scsilun(scmd->device->lun, &lun);
-	scst_cmd = scst_rx_cmd(sess->scst_sess, lun.scsi_lun, sizeof(lun),
-			       scmd->cmnd, scmd->cmd_len, true);
+	scst_cmd = scst_rx_cmd(scst_local_cmd_sess(sess, scmd), lun.scsi_lun,
+			       sizeof(lun), scmd->cmnd, scmd->cmd_len, true);
 	if (!scst_cmd) {
 		PRINT_ERROR("%s", "scst_rx_cmd() failed");
 		return SCSI_MLQUEUE_HOST_BUSY;
@@ -1248,6 +1301,88 @@ static int scst_local_close_session(struct scst_session *scst_sess)
 	return 0;
 }
 
+#ifdef SCST_LOCAL_MQ_POLL
+
+static inline bool scst_local_cmd_polled(struct scsi_cmnd *scmd)
+{
+	return scsi_cmd_to_rq(scmd)->mq_hctx->type == HCTX_TYPE_POLL;
+}
+
+/* Defers completion of a command on a poll queue to scst_local_mq_poll() */
+static void scst_local_poll_done(struct scsi_cmnd *scmd)
+{
+	struct scst_local_sess *sess =
+		to_scst_lcl_sess(scsi_get_device(scmd->device->host));
+	struct scst_local_cmd_priv *priv = scsi_cmd_priv(scmd);
+
+	priv->scmd = scmd;
+	llist_add(&priv->poll_entry,
+		  &sess->poll_done[scsi_cmd_to_rq(scmd)->mq_hctx->queue_num]);
+}
+
+static int scst_local_mq_poll(struct Scsi_Host *shost, unsigned int queue_num)
+{
+	struct scst_local_sess *sess = to_scst_lcl_sess(scsi_get_device(shost));
+	struct scst_local_cmd_priv *priv, *tmp;
+	struct llist_node *list;
+	int res = 0;
+
+	list = llist_del_all(&sess->poll_done[queue_num]);
+	if (list == NULL)
+		goto out;
+
+	list = llist_reverse_order(list);
+	llist_for_each_entry_safe(priv, tmp, list, poll_entry) {
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 16, 0)
+		priv->scmd->scsi_done(priv->scmd);
+#else
+		scsi_done(priv->scmd);
+#endif
+		res++;
+	}
+
+out:
+	return res;
+}
+
+/* See also commit a2b32bc1d9d5 ("blk-mq: Make blk_mq_ops::map_queues return void") # v6.2 */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 2, 0)
+#define MAP_QUEUES_RET int
+#else
+#define MAP_QUEUES_RET void
+#endif
+
+static MAP_QUEUES_RET scst_local_map_queues(struct Scsi_Host *shost)
+{
+	struct scst_local_sess *sess = to_scst_lcl_sess(scsi_get_device(shost));
+	int i, qoff = 0;
+
+	for (i = 0; i < shost->nr_maps; i++) {
+		struct blk_mq_queue_map *map = &shost->tag_set.map[i];
+
+		if (i == HCTX_TYPE_DEFAULT)
+			map->nr_queues = sess->nr_hw_queues -
+					 sess->nr_poll_queues;
+		else if (i == HCTX_TYPE_POLL)
+			map->nr_queues = sess->nr_poll_queues;
+		else
+			map->nr_queues = 0;
+
+		if (map->nr_queues == 0)
+			continue;
+
+		map->queue_offset = qoff;
+		blk_mq_map_queues(map);
+		qoff += map->nr_queues;
+	}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 2, 0)
+	return 0;
+#endif
+}
+
+#endif /* SCST_LOCAL_MQ_POLL */
+
 static int scst_local_targ_xmit_response(struct scst_cmd *scst_cmd)
 {
 	struct scsi_cmnd *scmd = NULL;
@@ -1271,6 +1406,10 @@ static int scst_local_targ_xmit_response(struct scst_cmd *scst_cmd)
 #else
 	done = scsi_done;
 #endif
+#ifdef SCST_LOCAL_MQ_POLL
+	if (scst_local_cmd_polled(scmd))
+		done = scst_local_poll_done;
+#endif
 
 	/*
 	 * This might have to change to use the two status flags
@@ -1406,6 +1545,11 @@ static struct scsi_host_template scst_lcl_ini_driver_template = {
 	.max_segment_size		= PAGE_SIZE,
 #endif
 	.skip_settle_delay		= 1,
+#ifdef SCST_LOCAL_MQ_POLL
+	.map_queues			= scst_local_map_queues,
+	.mq_poll			= scst_local_mq_poll,
+	.cmd_size			= sizeof(struct scst_local_cmd_priv),
+#endif
 	.module				= THIS_MODULE,
 };
 
@@ -1433,7 +1577,11 @@ static int scst_local_driver_probe(struct device *dev)
 	}
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)
-	hpnt->nr_hw_queues = num_possible_cpus();
+	hpnt->nr_hw_queues = sess->nr_hw_queues;
+#endif
+#ifdef SCST_LOCAL_MQ_POLL
+	if (sess->nr_poll_queues)
+		hpnt->nr_maps = HCTX_MAX_TYPES;
 #endif
 
 	sess->shost = hpnt;
@@ -1512,14 +1660,37 @@ static struct device_driver scst_local_driver = {
 
 static struct device *scst_local_root;
 
+static void scst_local_free_sess_mem(struct scst_local_sess *sess)
+{
+#ifdef SCST_LOCAL_MQ_POLL
+	kfree(sess->poll_done);
+#endif
+	kfree(sess->hwq_sess);
+	kfree(sess);
+}
+
 static void scst_local_free_sess(struct scst_session *scst_sess)
 {
 	struct scst_local_sess *sess = scst_sess_get_tgt_priv(scst_sess);
 
-	kfree(sess);
+	scst_local_free_sess_mem(sess);
 	return;
 }
 
+/* Unregisters the per hardware queue sessions except scst_sess */
+static void scst_local_unregister_hwq_sessions(struct scst_local_sess *sess)
+{
+	int i;
+
+	if (sess->hwq_sess == NULL)
+		return;
+
+	for (i = sess->nr_hw_queues - 1; i > 0; i--) {
+		if (sess->hwq_sess[i] != NULL)
+			scst_unregister_session(sess->hwq_sess[i], true, NULL);
+	}
+}
+
 static void scst_local_release_adapter(struct device *dev)
 {
 	struct scst_local_sess *sess;
@@ -1549,6 +1720,7 @@ static void scst_local_release_adapter(struct device *dev)
 	scst_process_aens(sess, true);
 	spin_unlock(&sess->aen_lock);
 
+	scst_local_unregister_hwq_sessions(sess);
 	scst_unregister_session(sess->scst_sess, false, scst_local_free_sess);
 
 	TRACE_EXIT();
@@ -1558,7 +1730,7 @@ static void scst_local_release_adapter(struct device *dev)
 static int __scst_local_add_adapter(struct scst_local_tgt *tgt,
 	const char *initiator_name, bool locked)
 {
-	int res;
+	int res, i;
 	struct scst_local_sess *sess;
 
 	TRACE_ENTRY();
@@ -1584,14 +1756,63 @@ static int __scst_local_add_adapter(struct scst_local_tgt *tgt,
 	spin_lock_init(&sess->aen_lock);
 	INIT_LIST_HEAD(&sess->aen_work_list);
 
-	sess->scst_sess = scst_register_session(tgt->scst_tgt, 0,
-				initiator_name, sess, NULL, NULL);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)
+	sess->nr_hw_queues = num_possible_cpus();
+#else
+	sess->nr_hw_queues = 1;
+#endif
+#ifdef SCST_LOCAL_MQ_POLL
+	sess->nr_poll_queues = scst_local_poll_queues;
+	sess->nr_hw_queues += sess->nr_poll_queues;
+	if (sess->nr_poll_queues) {
+		sess->poll_done = kcalloc(sess->nr_hw_queues,
+					  sizeof(*sess->poll_done), GFP_KERNEL);
+		if (sess->poll_done == NULL) {
+			res = -ENOMEM;
+			goto out_free;
+		}
+	}
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)
+	if (scst_local_mq_sessions) {
+		sess->hwq_sess = kcalloc(sess->nr_hw_queues,
+					 sizeof(*sess->hwq_sess), GFP_KERNEL);
+		if (sess->hwq_sess == NULL) {
+			res = -ENOMEM;
+			goto out_free;
+		}
+	}
+#endif
+
+	if (sess->hwq_sess)
+		sess->scst_sess = scst_register_session_mq(tgt->scst_tgt, 0,
+					initiator_name, sess, NULL, NULL);
+	else
+		sess->scst_sess = scst_register_session(tgt->scst_tgt, 0,
+					initiator_name, sess, NULL, NULL);
 	if (sess->scst_sess == NULL) {
 		PRINT_ERROR("%s", "scst_register_session failed");
 		res = -EFAULT;
 		goto out_free;
 	}
 
+	if (sess->hwq_sess) {
+		sess->hwq_sess[0] = sess->scst_sess;
+		for (i = 1; i < sess->nr_hw_queues; i++) {
+			sess->hwq_sess[i] = scst_register_session_mq(
+						tgt->scst_tgt, 0,
+						initiator_name, sess,
+						NULL, NULL);
+			if (sess->hwq_sess[i] == NULL) {
+				PRINT_ERROR("scst_register_session_mq() failed "
+					"for hardware queue %d", i);
+				res = -EFAULT;
+				goto unregister_session;
+			}
+		}
+	}
+
 	sess->dev.bus     = &scst_local_lld_bus;
 	sess->dev.parent = scst_local_root;
 	sess->dev.release = &scst_local_release_adapter;
@@ -1628,10 +1849,11 @@ unregister_dev:
 	goto out;
 
 unregister_session:
+	scst_local_unregister_hwq_sessions(sess);
 	scst_unregister_session(sess->scst_sess, true, NULL);
 
 out_free:
-	kfree(sess);
+	scst_local_free_sess_mem(sess);
 	goto out;
 }
 
@@ -23,6 +23,7 @@ TRUE             => 1,
 FALSE            => 0,
 
 SCST_ROOT        => '/sys/kernel/scst_tgt',
+SCST_MGMT_DEV    => '/dev/scst_mgmt',
 
 # Root-level
 SCST_SGV         => 'sgv',
@@ -162,6 +163,8 @@ SCST_C_TGRP_TGT_EXISTS       => 163,
 SCST_C_TGRP_TGT_BAD_ATTR     => 170,
 SCST_C_TGRP_TGT_ATTR_STATIC  => 171,
 SCST_C_TGRP_TGT_SETATTR_FAIL => 172,
+
+SCST_C_BATCH_FAIL            => 180,
 };
 
 my %VERBOSE_ERROR = (
@@ -272,6 +275,8 @@ my %VERBOSE_ERROR = (
 (SCST_C_TGRP_TGT_BAD_ATTR)     => 'Bad attributes for target group target.',
 (SCST_C_TGRP_TGT_ATTR_STATIC)  => 'Target group target attribute specified is static.',
 (SCST_C_TGRP_TGT_SETATTR_FAIL) => 'Failed to set target group target attribute. See "dmesg" for more information.',
+
+(SCST_C_BATCH_FAIL)            => 'Failed to apply management batch. See "dmesg" for more information.',
 );
 
 use vars qw(@ISA @EXPORT $VERSION);
@@ -1866,6 +1871,8 @@ sub addInitiator {
 			  $group, SCST_INITIATORS, SCST_MGMT_IO);
 	$cmd .= "add $initiator";
 
+	return FALSE if ($self->_queueBatch($path, $cmd));
+
 	my $bytes = - ENOENT;
 	my $io = new IO::File $path, O_WRONLY;
 	if ($io) {
@@ -2069,6 +2076,8 @@ sub addLun {
 
 	$cmd .= "add $device $lun $o_string";
 
+	return FALSE if ($self->_queueBatch($path, $cmd));
+
 	my $bytes = - ENOENT;
 	my $io = new IO::File $path, O_WRONLY;
 	if ($io) {
@@ -4574,6 +4583,93 @@ sub errorString {
 	return defined($rc) ? $VERBOSE_ERROR{$rc} : undef;
 }
 
+# Start collecting LUN and initiator additions such that they can be applied
+# with a single write into /dev/scst_mgmt by commitBatch() instead of one
+# sysfs write per command. Returns TRUE if the kernel supports this.
+sub beginBatch {
+	my $self = shift;
+
+	return FALSE if (! -c SCST_MGMT_DEV);
+
+	$self->{'batch'} = [];
+
+	return TRUE;
+}
+
+# Queue "$path $cmd" if a batch is being collected. Returns TRUE if queued.
+sub _queueBatch {
+	my $self = shift;
+	my $path = shift;
+	my $cmd = shift;
+
+	return FALSE if (!defined($self->{'batch'}));
+
+	push @{$self->{'batch'}}, "$path $cmd";
+
+	return TRUE;
+}
+
+# Apply all commands queued since beginBatch(). Processing stops at the first
+# failing command, which is then returned by batchError().
+sub commitBatch {
+	my $self = shift;
+	my $batch = $self->{'batch'};
+
+	delete $self->{'batch'};
+	delete $self->{'batch_error'};
+
+	return FALSE if (!defined($batch) || !@{$batch});
+
+	if ($self->{'debug'}) {
+		foreach my $line (@{$batch}) {
+			print "DBG($$): ".SCST_MGMT_DEV." -> $line\n";
+		}
+		return FALSE;
+	}
+
+	my $data = join("\n", @{$batch})."\n";
+
+	my $io = new IO::File SCST_MGMT_DEV, O_RDWR;
+	if (!$io) {
+		$self->{'batch_error'} = "Unable to open ".SCST_MGMT_DEV.": $!";
+		return SCST_C_BATCH_FAIL;
+	}
+
+	my $bytes = syswrite($io, $data, length($data));
+	my $err = $!;
+	my $status;
+
+	if (!defined($bytes) || $bytes != length($data)) {
+		sysread($io, $status, 256);
+		close $io;
+
+		my $line = ($status =~ /failed_line=(\d+)/) ? $1 : 0;
+		if ($line > 0 && $line <= @{$batch}) {
+			$self->{'batch_error'} = "'".$$batch[$line - 1]."': $err";
+		} else {
+			$self->{'batch_error'} = $err;
+		}
+
+		return SCST_C_BATCH_FAIL;
+	}
+
+	close $io;
+
+	return FALSE;
+}
+
+sub inBatch {
+	my $self = shift;
+
+	return defined($self->{'batch'});
+}
+
+sub batchError {
+	my $self = shift;
+
+	return $self->{'batch_error'};
+}
+
 # Read from the SCST sysfs file $1. Return either the data read or undef if
 # reading failed.
 sub _sysread {
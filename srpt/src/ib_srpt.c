@@ -738,9 +738,11 @@ register_tgt:
 		snprintf(tgt_name, sizeof(tgt_name), "%pI6", &sport->gid);
 		sport->scst_tgt = scst_register_target(&srpt_template,
 						       tgt_name);
-		if (sport->scst_tgt)
+		if (sport->scst_tgt) {
 			scst_tgt_set_tgt_priv(sport->scst_tgt, sport);
-		else
+			scst_tgt_set_numa_node(sport->scst_tgt,
+				dev_to_node(sport->sdev->device->dma_device));
+		} else
 			pr_err("Registration of target %s failed.\n", tgt_name);
 	}
 
@@ -27,6 +27,9 @@ char *app_name;
 
 #define DEFAULT_TRANSITION_TIME 17
 
+/* Max events fetched by one SCST_EVENT_REPLY_AND_GET_MULTI */
+#define MAX_EVENTS_PER_CALL 256
+
 #if defined(DEBUG) || defined(TRACING)
 
 #ifdef DEBUG
@@ -87,7 +90,7 @@ static void usage(int status)
 	}
 }
 
-static void stpg_handle_tm_received(struct scst_event_user *event_user)
+static void stpg_handle_tm_received(const struct scst_event *event)
 {
 	/*
 	 * Put code to abort state transition here, if this STPG cmd,
@@ -196,7 +199,7 @@ static int wait_until_finished(pid_t pid, unsigned long deadline, int *status, i
 			}
 			break;
 		}
-		usleep(100*1000);
+		usleep(10*1000);
 		time(&end);
 		elapsed = difftime(end, start);
 	} while (elapsed < deadline);
@@ -205,9 +208,9 @@ static int wait_until_finished(pid_t pid, unsigned long deadline, int *status, i
 	return res;
 }
 
-static int handle_stpg_received(struct scst_event_user *event_user)
+static int handle_stpg_received(const struct scst_event *event)
 {
-	const struct scst_event_stpg_payload *p = (struct scst_event_stpg_payload *)event_user->out_event.payload;
+	const struct scst_event_stpg_payload *p = (const struct scst_event_stpg_payload *)event->payload;
 	int num, k;
 	int res = 0;
 	pid_t pids[p->stpg_descriptors_cnt];
@@ -273,17 +276,65 @@ static int handle_stpg_received(struct scst_event_user *event_user)
 	return res;
 }
 
+/*
+ * Each STPG event is handled by its own child, so that STPG commands for
+ * several devices are processed concurrently.
+ */
+static void stpg_handle_event(int event_fd, const struct scst_event *event)
+{
+	int res, status;
+	pid_t c_pid;
+
+#ifdef DEBUG
+	PRINT_INFO("event_code %d, issuer_name %s", event->event_code,
+		event->issuer_name);
+#endif
+	if (event->payload_len != 0)
+		TRACE_BUFFER("payload", event->payload, event->payload_len);
+
+	if (event->event_code == SCST_EVENT_STPG_USER_INVOKE) {
+		c_pid = fork();
+		if (c_pid == -1)
+			PRINT_ERROR("Failed to fork: %d", c_pid);
+		else if (c_pid == 0) {
+			struct scst_event_notify_done d;
+
+			signal(SIGCHLD, SIG_DFL);
+
+			status = handle_stpg_received(event);
+
+			memset(&d, 0, sizeof(d));
+			d.event_id = event->event_id;
+			d.status = status;
+			res = ioctl(event_fd, SCST_EVENT_NOTIFY_DONE, &d);
+			if (res != 0) {
+				res = -errno;
+				PRINT_ERROR("SCST_EVENT_NOTIFY_DONE "
+					"failed: %s (res %d)",
+					strerror(-res), res);
+			} else
+				PRINT_INFO("STPG event completed with status %d", status);
+			exit(res);
+		}
+	} else if (event->event_code == SCST_EVENT_TM_FN_RECEIVED)
+		stpg_handle_tm_received(event);
+	else
+		PRINT_ERROR("Unknown event %d received", event->event_code);
+}
+
 static int stpg_event_loop(void)
 {
-	int res = 0, status;
+	int res = 0, i, pos;
 	int event_fd;
 	uint8_t event_user_buf[1024*1024];
-	pid_t c_pid = 0;
 	struct pollfd pl;
 	struct scst_event_user *event_user =
 		(struct scst_event_user *)event_user_buf;
+	struct scst_event_get_multi *multi =
+		(struct scst_event_get_multi *)event_user_buf;
 	struct scst_event e1;
 	bool first_error = true;
+	bool use_multi = true, multi_works = false;
 
 	event_fd = open(SCST_EVENT_DEV, O_RDWR);
 	if (event_fd < 0) {
@@ -335,26 +386,39 @@ static int stpg_event_loop(void)
 	}
 
 	while (1) {
-		memset(event_user_buf, 0, sizeof(event_user_buf));
-		event_user->max_event_size = sizeof(event_user_buf);
-		res = ioctl(event_fd, SCST_EVENT_GET_NEXT_EVENT, event_user);
+		if (use_multi) {
+			memset(multi, 0, sizeof(*multi));
+			multi->buf_size = sizeof(event_user_buf) - sizeof(*multi);
+			multi->events_cnt = MAX_EVENTS_PER_CALL;
+			res = ioctl(event_fd, SCST_EVENT_REPLY_AND_GET_MULTI, multi);
+			if ((res != 0) && (errno == EINVAL) && !multi_works) {
+				PRINT_INFO("%s", "SCST_EVENT_REPLY_AND_GET_MULTI "
+					"not supported, getting events one by one");
+				use_multi = false;
+				continue;
+			}
+		} else {
+			memset(event_user_buf, 0, sizeof(event_user_buf));
+			event_user->max_event_size = sizeof(event_user_buf);
+			res = ioctl(event_fd, SCST_EVENT_GET_NEXT_EVENT, event_user);
+		}
 		if (res != 0) {
 			res = -errno;
 			switch (-res) {
 			case ESRCH:
 			case EBUSY:
-				TRACE_MGMT_DBG("SCST_EVENT_GET_NEXT_EVENT "
-					"returned %d (%s)", res, strerror(res));
+				TRACE_MGMT_DBG("Getting events returned %d (%s)",
+					res, strerror(-res));
 				/* fall through */
 			case EINTR:
 				continue;
 			case EAGAIN:
-				TRACE_DBG("SCST_EVENT_GET_NEXT_EVENT, "
-					"returned EAGAIN (%d)", -res);
+				TRACE_DBG("Getting events returned EAGAIN (%d)",
+					-res);
 				continue;
 			default:
-				PRINT_ERROR("SCST_EVENT_GET_NEXT_EVENT "
-					"failed: %d (%s)", res, strerror(-res));
+				PRINT_ERROR("Getting events failed: %d (%s)",
+					res, strerror(-res));
 				if (!first_error)
 					goto out;
 				first_error = false;
@@ -362,7 +426,7 @@ static int stpg_event_loop(void)
 			}
 			first_error = true;
 again_poll:
-			res = poll(&pl, 1, c_pid > 0 ? 1 : 0);
+			res = poll(&pl, 1, 0);
 			if (res > 0)
 				continue;
 			else if (res == 0)
@@ -385,43 +449,21 @@ again_poll:
 			}
 		}
 		first_error = true;
-#ifdef DEBUG
-		PRINT_INFO("event_code %d, issuer_name %s",
-			event_user->out_event.event_code,
-			event_user->out_event.issuer_name);
-#endif
-		if (event_user->out_event.payload_len != 0)
-			TRACE_BUFFER("payload", event_user->out_event.payload,
-				event_user->out_event.payload_len);
-
-		if (event_user->out_event.event_code == SCST_EVENT_STPG_USER_INVOKE) {
-			c_pid = fork();
-			if (c_pid == -1)
-				PRINT_ERROR("Failed to fork: %d", c_pid);
-			else if (c_pid == 0) {
-				struct scst_event_notify_done d;
-
-				signal(SIGCHLD, SIG_DFL);
-
-				status = handle_stpg_received(event_user);
-
-				memset(&d, 0, sizeof(d));
-				d.event_id = event_user->out_event.event_id;
-				d.status = status;
-				res = ioctl(event_fd, SCST_EVENT_NOTIFY_DONE, &d);
-				if (res != 0) {
-					res = -errno;
-					PRINT_ERROR("SCST_EVENT_NOTIFY_DONE "
-						"failed: %s (res %d)",
-						strerror(-res), res);
-				} else
-					PRINT_INFO("STPG event completed with status %d", status);
-				exit(res);
-			}
-		} else if (event_user->out_event.event_code == SCST_EVENT_TM_FN_RECEIVED)
-			stpg_handle_tm_received(event_user);
-		else
-			PRINT_ERROR("Unknown event %d received", event_user->out_event.event_code);
+
+		if (!use_multi) {
+			stpg_handle_event(event_fd, &event_user->out_event);
+			continue;
+		}
+
+		multi_works = true;
+		TRACE_DBG("%d events received", multi->events_cnt);
+		for (i = 0, pos = 0; i < multi->events_cnt; i++) {
+			const struct scst_event *event =
+				(const struct scst_event *)&multi->buf[pos];
+
+			stpg_handle_event(event_fd, event);
+			pos += SCST_EVENT_MULTI_SIZE(event);
+		}
 	}
 out:
 	return res;